@@ -282,6 +282,13 @@ void LogMessage(LedBadgeLib.ResponseCodes code, byte[] response)
                     byte cookie;
                     LedBadgeLib.ResponseAckSource source;
                     LedBadgeLib.BadgeResponses.DecodeAck(response, 0, out source, out cookie);
+                    if(source == LedBadgeLib.ResponseAckSource.CommandList)
+                    {
+                        ushort failedCommands;
+                        LedBadgeLib.BadgeResponses.DecodeCommandListAck(response, 0, out cookie, out failedCommands);
+                        LogMessage("{0} [{1}, {2}, failed: {3:X4}]", code, source, cookie, failedCommands);
+                        break;
+                    }
                     LogMessage("{0} [{1}, {2}]", code, source, cookie);
                     break;
                 }
@@ -293,6 +300,14 @@ void LogMessage(LedBadgeLib.ResponseCodes code, byte[] response)
                     LogMessage("{0} [{1}, {2}]", code, error, cookie);
                     break;
                 }
+                case LedBadgeLib.ResponseCodes.PageWritten:
+                {
+                    byte page;
+                    LedBadgeLib.PageWriteStatus status;
+                    LedBadgeLib.BadgeResponses.DecodePageWritten(response, 0, out status, out page);
+                    LogMessage("{0} [{1}, {2:X4}]", code, status, page * 64);
+                    break;
+                }
                 case LedBadgeLib.ResponseCodes.Setting:
                 {
                     LedBadgeLib.SettingValue setting = (LedBadgeLib.SettingValue)(response[0] & 0xF);
@@ -375,6 +390,15 @@ void LogMessage(LedBadgeLib.ResponseCodes code, byte[] response)
                             LogMessage("{0} [{1}, {2}, {3}, {4}, {5}, {6}]", code, setting, version, width, height, bitDepth, capBits);
                             break;
                         }
+                        case LedBadgeLib.SettingValue.Stats:
+                        {
+                            LedBadgeLib.ProfilePoint point;
+                            ushort count, minCycles, maxCycles;
+                            uint totalCycles;
+                            LedBadgeLib.BadgeResponses.DecodeStatsSetting(response, 0, out point, out count, out minCycles, out maxCycles, out totalCycles);
+                            LogMessage("{0} [{1}, {2}, {3}, {4}, {5}, {6}]", code, setting, point, count, minCycles, maxCycles, count > 0 ? totalCycles / count : 0);
+                            break;
+                        }
                         default:
                         {
                             LogMessage("{0} [{1}]", code, setting);
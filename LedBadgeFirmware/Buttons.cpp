@@ -1,7 +1,12 @@
 #include "Buttons.h"
+#include "Display.h"
 
 #include <avr/io.h>
 
+static unsigned char s_ButtonsDown;			// debounced state
+static unsigned char s_ButtonsSampled;		// raw state at the last sample
+static unsigned int s_ButtonSampleFrame;	// refresh frame of the last sample
+
 // Sets up button input
 // Called once at program start
 void ConfigurePushButtons()
@@ -42,3 +47,22 @@ bool CheckButton1()
 	return (PIND & (1 << PIND2)) == 0;
 #endif
 }
+
+unsigned char PollButtonPresses()
+{
+	unsigned int frame = GetFrameCount();
+	if(frame == s_ButtonSampleFrame)
+	{
+		return 0;
+	}
+	s_ButtonSampleFrame = frame;
+
+	unsigned char sampled = (CheckButton1() << 1) | CheckButton0();
+	unsigned char steady = ~(sampled ^ s_ButtonsSampled);
+	s_ButtonsSampled = sampled;
+
+	unsigned char down = (s_ButtonsDown & ~steady) | (sampled & steady);
+	unsigned char pressed = down & ~s_ButtonsDown;
+	s_ButtonsDown = down;
+	return pressed;
+}
@@ -5,6 +5,10 @@
 bool CheckButton0();
 bool CheckButton1();
 
+// Gets the buttons (bit 0 for button 0, bit 1 for button 1) that went down since the last call
+// Sampled once a refresh frame, and a button has to read the same twice running to count, which rides out contact bounce
+unsigned char PollButtonPresses();
+
 // Sets up button input
 // Called once at program start
 void ConfigurePushButtons();
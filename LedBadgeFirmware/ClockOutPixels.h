@@ -37,6 +37,38 @@
 		}
 	}*/
 
+#if defined(LEDBADGE_SIM)
+
+// the host simulator can't run the assembly, so it models the same port traffic and charges the register-only instructions by hand
+{
+	const unsigned char *b = g_DisplayReg.BufferP;
+	unsigned char data = 0;
+	
+	for(unsigned char p = 0; p < 24; ++p)
+	{
+		if((p & 7) == 0)
+		{
+			data = *--b;
+			SimAdvance(2); // ld
+		}
+		
+		portB = (portB & ~(1 << PORTB1)) | (((data >> (p & 7)) & 1) << PORTB1);
+		SimAdvance(2); // bst + bld
+		PORTB = portB;
+		if(p == SELECT_ROW)
+		{
+			PORTD = portD_selectRow;
+		}
+		PORTB |= (1 << PORTB0);
+		if(p == SELECT_ROW)
+		{
+			PORTD = portD_default;
+		}
+	}
+}
+
+#else
+
 #define NextWord() asm volatile ( \
 		"ld		 __tmp_reg__, -%a[buffer]"		"\n\t"	/* load next 8 pixels and move pointer to previous byte */ \
 		:   [buffer] "+e" (b)							\
@@ -209,6 +241,9 @@
 #undef NextWord
 #undef OutputPix
 #undef OutputPixAndRow
+
+#endif
+
 #undef SELECT_ROW
 
 #elif defined(__AVR_ATmega8A__)
@@ -4,19 +4,182 @@
 #include "Eeprom.h"
 #include "Display.h"
 #include "Buttons.h"
-
-#if defined(__AVR_ATmega88PA__)
-#define F_CPU 12000000UL
-#elif defined(__AVR_ATmega8A__)
-#define F_CPU 8000000UL
-#endif
-#include <util/delay.h>
+#include "Profile.h"
 
 // Command/Animation state machine values
 CommandState g_CommandReg = {};
 
 typedef bool (*CommandHandler)(unsigned char header, FetchByte fetch);
 
+// Resolves a BufferTarget to its buffer
+static unsigned char *GetTargetBuffer(unsigned char target)
+{
+	if(target == BufferTarget::BackBuffer)
+	{
+		return g_DisplayReg.BackBuffer;
+	}
+	return g_DisplayReg.FrontBuffer;
+}
+
+// Moves an anim read position along, wrapping within the memory it's in
+static unsigned int OffsetAnimPosition(unsigned int position, unsigned int offset)
+{
+	unsigned int type = position & RomTarget::TypeMask;
+	return type | ((position + offset) & (type == RomTarget::TypeInternal ? RomTarget::InternalMask : RomTarget::ExternalMask));
+}
+
+// Reads a byte at an anim read position, without moving the anim along
+static unsigned char ReadAnimByte(unsigned int position)
+{
+	if((position & RomTarget::TypeMask) == RomTarget::TypeInternal)
+	{
+		return ReadInternalEEPROM(position & RomTarget::InternalMask);
+	}
+#ifdef ENABLE_EXTERNAL_EEPROM
+	unsigned char data;
+	ReadExternalEEPROM(position & RomTarget::ExternalMask, 1, &data);
+	return data;
+#else
+	return 0;
+#endif
+}
+
+// Reads a 2 byte value at an anim read position, msb first
+static unsigned int ReadAnimWord(unsigned int position)
+{
+	unsigned int value = ReadAnimByte(position);
+	return (value << 8) | ReadAnimByte(OffsetAnimPosition(position, 1));
+}
+
+enum
+{
+	AnimContainerHeaderSize = 6,	// Container op, frame count, keyframe interval, size
+	NoAnimEnd = 0xFFFF,				// neither memory's addresses reach it
+};
+
+void RestartAnimAt(unsigned int position)
+{
+	g_CommandReg.AnimReadPosition = position;
+	g_CommandReg.AnimSwapWaiting = false; // whatever swap it was waiting on isn't next anymore
+	g_CommandReg.AnimStackDepth = 0;
+	g_CommandReg.AnimFrameCount = 0; // only a Container op starts one
+	g_CommandReg.AnimSkipFrames = 0;
+	g_CommandReg.AnimFrameUnshown = false;
+}
+
+// Points the container anim at a frame, through the keyframe before it
+// The frames from the keyframe up to the one asked for are drawn over each other without being shown
+static bool SeekAnimFrame(unsigned int frame)
+{
+	unsigned int frameCount = g_CommandReg.AnimFrameCount;
+	if(frame >= frameCount)
+	{
+		return false;
+	}
+
+	unsigned int keyframe = frame / g_CommandReg.AnimKeyframeInterval;
+	unsigned int entry = OffsetAnimPosition(g_CommandReg.AnimContainer, AnimContainerHeaderSize + keyframe * 2);
+	unsigned int offset = ReadAnimWord(entry);
+
+	RestartAnimAt(OffsetAnimPosition(g_CommandReg.AnimContainer, offset));
+	g_CommandReg.AnimFrameCount = frameCount; // still inside the container
+	g_CommandReg.AnimFrame = keyframe * g_CommandReg.AnimKeyframeInterval;
+	g_CommandReg.AnimSkipFrames = frame - g_CommandReg.AnimFrame;
+	return true;
+}
+
+// Gets the position of one of the fields (AnimDirectory offsets) of a slot's directory entry
+static unsigned int GetAnimSlotField(unsigned char slot, unsigned char field)
+{
+	return OffsetAnimPosition(g_CommandReg.AnimDirectory, AnimDirectory::HeaderSize + slot * AnimDirectory::SlotSize + field);
+}
+
+// Starts a slot from the directory playing, with its loop mode and brightness
+static bool PlayAnimSlot(unsigned char slot)
+{
+	if(slot >= g_CommandReg.AnimSlotCount)
+	{
+		return false;
+	}
+
+	unsigned int start = ReadAnimWord(GetAnimSlotField(slot, AnimDirectory::StartOffset));
+	unsigned int length = ReadAnimWord(GetAnimSlotField(slot, AnimDirectory::LengthOffset));
+	unsigned char loopMode = ReadAnimByte(GetAnimSlotField(slot, AnimDirectory::LoopModeOffset));
+	unsigned char brightness = ReadAnimByte(GetAnimSlotField(slot, AnimDirectory::BrightnessOffset));
+	if(loopMode >= AnimLoopMode::Count)
+	{
+		return false;
+	}
+
+	g_CommandReg.AnimSlot = slot;
+	g_CommandReg.AnimStart = 
+	g_CommandReg.AnimBookmark = start;
+	RestartAnimAt(start);
+	g_CommandReg.AnimEnd = length ? OffsetAnimPosition(start, length) : (unsigned int)NoAnimEnd;
+	g_CommandReg.AnimLoopMode = loopMode;
+	g_CommandReg.AnimButtons = 0;
+	g_CommandReg.AnimPlaying = AnimState::Playing;
+	if(brightness)
+	{
+		SetBrightness(brightness);
+	}
+	return true;
+}
+
+// The host moved the anim somewhere else, so the slot it was in doesn't apply anymore
+static void LeaveAnimSlot()
+{
+	g_CommandReg.AnimSlot = AnimDirectory::NoSlot;
+	g_CommandReg.AnimEnd = NoAnimEnd;
+	g_CommandReg.AnimLoopMode = AnimLoopMode::Loop;
+	g_CommandReg.AnimButtons = 0;
+	g_CommandReg.AnimStackDepth = 0;
+}
+
+// Carries out the loop mode at the end of a slot or container, and returns whether the anim plays on
+static bool EndAnimLoop()
+{
+	switch(g_CommandReg.AnimLoopMode)
+	{
+		case AnimLoopMode::Loop:
+		{
+			if(g_CommandReg.AnimFrameCount)
+			{
+				return SeekAnimFrame(0);
+			}
+			RestartAnimAt(g_CommandReg.AnimStart);
+			return true;
+		}
+		case AnimLoopMode::Next:
+		{
+			if(PlayAnimSlot((g_CommandReg.AnimSlot + 1) % g_CommandReg.AnimSlotCount))
+			{
+				return true;
+			}
+			break;
+		}
+	}
+	g_CommandReg.AnimPlaying = AnimState::Stopped;
+	return false;
+}
+
+void CycleAnimSlot(signed char step)
+{
+	unsigned char count = g_CommandReg.AnimSlotCount;
+	if(!count)
+	{
+		return;
+	}
+
+	unsigned char slot = 0;
+	if(g_CommandReg.AnimSlot != AnimDirectory::NoSlot)
+	{
+		slot = (g_CommandReg.AnimSlot + count + step) % count;
+	}
+	CancelFrameHold(); // the new slot doesn't have to sit out the old one's hold
+	PlayAnimSlot(slot);
+}
+
 bool PingCommandHandler(unsigned char header, FetchByte fetch)
 {
 	unsigned char cookie = fetch(false);
@@ -97,13 +260,91 @@ bool QuerySettingCommandHandler(unsigned char header, FetchByte fetch)
 			WriteSerialData((BufferHeight << 4) | 2 /* bit depth */);
 			WriteSerialData(
 			#if defined(__AVR_ATmega88PA__)
-				SupportedFeatures::HardwareBrightness
-			#else
-				0
+				SupportedFeatures::HardwareBrightness |
+			#endif
+			#ifdef ENABLE_PROFILING
+				SupportedFeatures::Profiling |
+			#endif
+			#ifdef ENABLE_EXTERNAL_EEPROM
+				SupportedFeatures::PageWrites |
 			#endif
+				SupportedFeatures::CreditAcks |
+				SupportedFeatures::CommandLists |
+				SupportedFeatures::AnimContainers |
+				SupportedFeatures::AnimSlots
 			);
 			break;
 		}
+		case Settings::Stats:
+		{
+			// the argument byte selects the counter, instead of being a dummy
+			unsigned char point = fetch(false);
+			ProfileCounter counter = {};
+#ifdef ENABLE_PROFILING
+			if(point < ProfilePoints::Count)
+			{
+				ReadProfileCounter(point, counter);
+			}
+#endif
+			WriteSerialData(point);
+			WriteSerialData((counter.Count >> 8) & 0xFF);
+			WriteSerialData(counter.Count & 0xFF);
+			WriteSerialData((counter.Min >> 8) & 0xFF);
+			WriteSerialData(counter.Min & 0xFF);
+			WriteSerialData((counter.Max >> 8) & 0xFF);
+			WriteSerialData(counter.Max & 0xFF);
+			WriteSerialData((counter.Total >> 24) & 0xFF);
+			WriteSerialData((counter.Total >> 16) & 0xFF);
+			WriteSerialData((counter.Total >> 8) & 0xFF);
+			WriteSerialData(counter.Total & 0xFF);
+			return true;
+		}
+		case Settings::FrameClock:
+		{
+			unsigned int frame = GetFrameCount();
+			WriteSerialData((frame >> 8) & 0xFF);
+			WriteSerialData(frame & 0xFF);
+			WriteSerialData(g_DisplayReg.HoldCount);
+			break;
+		}
+		case Settings::BaudRate:
+		{
+			unsigned char u2x_ubrrH, ubrrL;
+			GetBaudRate(u2x_ubrrH, ubrrL);
+			WriteSerialData(u2x_ubrrH);
+			WriteSerialData(ubrrL);
+			break;
+		}
+		case Settings::FlowControl:
+		{
+			WriteSerialData(CreditAcksEnabled());
+			WriteSerialData(GetFreeSerialSpace());
+			break;
+		}
+		case Settings::AnimFrame:
+		{
+			WriteSerialData((g_CommandReg.AnimFrame >> 8) & 0xFF);
+			WriteSerialData(g_CommandReg.AnimFrame & 0xFF);
+			WriteSerialData((g_CommandReg.AnimFrameCount >> 8) & 0xFF);
+			WriteSerialData(g_CommandReg.AnimFrameCount & 0xFF);
+			break;
+		}
+		case Settings::AnimSlot:
+		{
+			// the argument byte picks the slot, instead of being a dummy
+			unsigned char slot = fetch(false);
+			if(slot == AnimDirectory::NoSlot)
+			{
+				slot = g_CommandReg.AnimSlot;
+			}
+			WriteSerialData(slot);
+			WriteSerialData(g_CommandReg.AnimSlotCount);
+			for(unsigned char i = 0; i < AnimDirectory::InfoSize; ++i)
+			{
+				WriteSerialData(slot < g_CommandReg.AnimSlotCount ? ReadAnimByte(GetAnimSlotField(slot, i)) : 0);
+			}
+			return true;
+		}
 	}
 	return fetch(false) == 0; // discard dummy byte
 }
@@ -157,6 +398,11 @@ bool UpdateSettingCommandHandler(unsigned char header, FetchByte fetch)
 			unsigned short pos = fetch(true);
 			pos = (pos << 8) | fetch(false);
 			g_CommandReg.AnimReadPosition = pos;
+			g_CommandReg.AnimFrameCount = 0; // wherever it landed, it's the Container op that says it's a container
+			if(!g_CommandReg.AnimPlaying)
+			{
+				LeaveAnimSlot(); // the host moved it, rather than the anim jumping around inside its slot
+			}
 			break;
 		}
 		case Settings::AnimPlayState:
@@ -164,6 +410,40 @@ bool UpdateSettingCommandHandler(unsigned char header, FetchByte fetch)
 			g_CommandReg.AnimPlaying = static_cast<AnimState::Enum>(fetch(false) & 0x3);
 			break;
 		}
+		case Settings::Stats:
+		{
+			fetch(false); // discard dummy byte
+#ifdef ENABLE_PROFILING
+			ResetProfileCounters();
+#endif
+			break;
+		}
+		case Settings::BaudRate:
+		{
+			unsigned char u2x_ubrrH = fetch(true);
+			unsigned char ubrrL = fetch(false);
+			if((u2x_ubrrH & 0x70) || g_CommandReg.AnimPlaying)
+			{
+				return false; // UBRR is only 12 bits, and only the host can move the link
+			}
+			ChangeBaudRate(u2x_ubrrH, ubrrL);
+			break;
+		}
+		case Settings::FlowControl:
+		{
+			EnableCreditAcks(fetch(false) & 0x1);
+			break;
+		}
+		case Settings::AnimFrame:
+		{
+			unsigned int frame = fetch(true);
+			frame = (frame << 8) | fetch(false);
+			return SeekAnimFrame(frame);
+		}
+		case Settings::AnimSlot:
+		{
+			return PlayAnimSlot(fetch(false));
+		}
 	}
 	return true;
 }
@@ -171,7 +451,22 @@ bool UpdateSettingCommandHandler(unsigned char header, FetchByte fetch)
 bool SwapCommandHandler(unsigned char header, FetchByte fetch)
 {
 	unsigned char holdFrames = fetch(false);
-	SwapBuffers();
+	if(g_CommandReg.AnimPlaying && g_CommandReg.AnimFrameCount)
+	{
+		if(++g_CommandReg.AnimFrame == g_CommandReg.AnimFrameCount)
+		{
+			g_CommandReg.AnimFrame = 0; // the end of the container loops back around to it
+		}
+		if(g_CommandReg.AnimSkipFrames)
+		{
+			--g_CommandReg.AnimSkipFrames;
+			g_CommandReg.AnimFrameUnshown = true;
+			return true; // the next frame is drawn on top, as though this one had been shown
+		}
+	}
+	
+	g_CommandReg.AnimFrameUnshown = false;
+	SwapBuffers(holdFrames);
 
 	if(g_CommandReg.AnimPlaying)
 	{
@@ -186,17 +481,6 @@ bool SwapCommandHandler(unsigned char header, FetchByte fetch)
 		}
 	}
 
-	while(holdFrames--)
-	{
-		PumpAck();
-		_delay_ms(16.6);
-
-		if(GetPendingSerialDataSize())
-		{
-			break;
-		}
-	}
-
 	return true;
 }
 
@@ -206,10 +490,14 @@ bool ReadRectCommandHandler(unsigned char header, FetchByte fetch)
 	unsigned char width_height = fetch(false);
 	unsigned char target = (header >> 2) & 0x3;
 	PixelFormat::Enum format = static_cast<PixelFormat::Enum>(header & 0x3);
+	if(format > PixelFormat::TwoBits)
+	{
+		return false; // compressed formats only go one way
+	}
 	WriteSerialData((ResponseCodes::Pixels << 4) | (format & 0x3));
 	WriteSerialData(width_height);
 	ReadRect((srcX_srcY >> 4) & 0xF, srcX_srcY & 0xF, (width_height >> 4) & 0xF, width_height & 0xF, format, 
-		target == BufferTarget::BackBuffer ? g_DisplayReg.BackBuffer : g_DisplayReg.FrontBuffer);
+		GetTargetBuffer(target));
 	return true;
 }
 
@@ -220,28 +508,38 @@ bool WriteRectCommandHandler(unsigned char header, FetchByte fetch)
 	unsigned char target = (header >> 2) & 0x3;
 	PixelFormat::Enum format = static_cast<PixelFormat::Enum>(header & 0x3);
 	Fill((dstX_dstY >> 4) & 0xF, dstX_dstY & 0xF, (width_height >> 4) & 0xF, width_height & 0xF, format, fetch,
-		target == BufferTarget::BackBuffer ? g_DisplayReg.BackBuffer : g_DisplayReg.FrontBuffer);
+		GetTargetBuffer(target));
 	return true;
 }
 
+bool WriteDirtyRectCommandHandler(unsigned char header, FetchByte fetch)
+{
+	unsigned char dstX_dstY = fetch(true);
+	unsigned char width_height = fetch(true);
+	unsigned int count = fetch(true) + 1; // put in 1-256 range, an empty update just isn't sent
+	unsigned char target = (header >> 2) & 0x3;
+	PixelFormat::Enum format = static_cast<PixelFormat::Enum>(header & 0x3);
+	if(format > PixelFormat::TwoBits)
+	{
+		return false; // the bitmap already does the compression
+	}
+	return FillDirty((dstX_dstY >> 4) & 0xF, dstX_dstY & 0xF, (width_height >> 4) & 0xF, width_height & 0xF, count, format, fetch,
+		GetTargetBuffer(target));
+}
+
 bool CopyRectCommandHandler(unsigned char header, FetchByte fetch)
 {
 	unsigned char srcX_srcY = fetch(true);
 	unsigned char dstX_dstY = fetch(true);
 	unsigned char width_height = fetch(false);
 
-	unsigned char *srcBuffer = ((header >> 2) & 0x3) == BufferTarget::BackBuffer ? g_DisplayReg.BackBuffer : g_DisplayReg.FrontBuffer;
-	unsigned char *dstBuffer = (header & 0x3) == BufferTarget::BackBuffer ? g_DisplayReg.BackBuffer : g_DisplayReg.FrontBuffer;
-	/*if(srcX_srcY == 0 && dstX_dstY == 0 && ((width_height >> 4) & 0xF) == BufferBitPlaneStride && (width_height & 0xF) == BufferHeight)
-	{
-		CopyWholeBuffer(srcBuffer, dstBuffer);
-	}
-	else*/
-	{
-		Copy((srcX_srcY >> 4) & 0xF, srcX_srcY & 0xF, 
-			(dstX_dstY >> 4) & 0xF, dstX_dstY & 0xF, 
-			(width_height >> 4) & 0xF, width_height & 0xF, srcBuffer, dstBuffer);
-	}
+	unsigned char *srcBuffer = GetTargetBuffer((header >> 2) & 0x3);
+	unsigned char *dstBuffer = GetTargetBuffer(header & 0x3);
+	
+	// full rows and whole buffers take the bulk paths in Copy
+	Copy((srcX_srcY >> 4) & 0xF, srcX_srcY & 0xF, 
+		(dstX_dstY >> 4) & 0xF, dstX_dstY & 0xF, 
+		(width_height >> 4) & 0xF, width_height & 0xF, srcBuffer, dstBuffer);
 	return true;
 }
 
@@ -252,14 +550,142 @@ bool FillRectCommandHandler(unsigned char header, FetchByte fetch)
 	Pix2x8 color = fetch(true);
 	color = (color << 8) | fetch(false);
 
-	unsigned char *buffer = ((header >> 2) & 0x3) == BufferTarget::BackBuffer ? g_DisplayReg.BackBuffer : g_DisplayReg.FrontBuffer;
-	/*if(color == 0 && dstX_dstY == 0 && ((width_height >> 4) & 0xF) == BufferBitPlaneStride && (width_height & 0xF) == BufferHeight)
+	unsigned char *buffer = GetTargetBuffer((header >> 2) & 0x3);
+	
+	// full rows (clears included) take the bulk path in SolidFill
+	SolidFill((dstX_dstY >> 4) & 0xF, dstX_dstY & 0xF, (width_height >> 4) & 0xF, width_height & 0xF, color, buffer);
+	return true;
+}
+
+bool PixelRectCommandHandler(unsigned char header, FetchByte fetch)
+{
+	// the top 2 bits of the x byte are the format for writes, and the source buffer for copies
+	unsigned char extra_dstX = fetch(true);
+	unsigned char dstY_height = fetch(true);
+	unsigned char width = (fetch(true) & 0x3F) + 1;
+	unsigned char dstX = extra_dstX & 0x3F;
+	unsigned char dstY = (dstY_height >> 4) & 0xF;
+	unsigned char height = (dstY_height & 0xF) + 1;
+	unsigned char extra = (extra_dstX >> 6) & 0x3;
+
+	unsigned char *buffer = GetTargetBuffer((header >> 2) & 0x3);
+	switch(header & 0x3)
+	{
+	case PixelRectOps::Write:
+		{
+			PixelFormat::Enum format = static_cast<PixelFormat::Enum>(extra);
+			if(format > PixelFormat::TwoBits)
+			{
+				return false;
+			}
+			FillPixels(dstX, dstY, width, height, format, fetch, buffer);
+			break;
+		}
+	case PixelRectOps::Copy:
+		{
+			unsigned char srcX = fetch(true) & 0x3F;
+			unsigned char srcY = fetch(false) & 0xF;
+			unsigned char *srcBuffer = GetTargetBuffer(extra);
+			CopyPixels(srcX, srcY, dstX, dstY, width, height, srcBuffer, buffer);
+			break;
+		}
+	case PixelRectOps::Fill:
+		{
+			Pix2x8 color = fetch(true);
+			color = (color << 8) | fetch(false);
+			SolidFillPixels(dstX, dstY, width, height, color, buffer);
+			break;
+		}
+	default:
+		return false;
+	}
+	return true;
+}
+
+// Where Scroll pulls its edge pixels from, when they aren't in the command stream itself
+static unsigned int s_EdgeReadPosition;
+static FetchByte s_EdgeFetch;
+
+static unsigned char FetchInternalEdge(bool /*moreBytes*/)
+{
+	return ReadInternalEEPROM(s_EdgeReadPosition++ & (EepromInternalSize - 1));
+}
+
+static unsigned char FetchExternalEdge(bool /*moreBytes*/)
+{
+#ifdef ENABLE_EXTERNAL_EEPROM
+	// each read carries on from the last one without seeking, unless something else had the bus in between
+	unsigned char data;
+	ReadExternalEEPROM(s_EdgeReadPosition++ & (EepromExternalSize - 1), 1, &data);
+	return data;
+#else
+	return 0;
+#endif
+}
+
+// Keeps the stream open at the end of the column edge when the rows edge follows it
+static unsigned char FetchEdgeContinued(bool /*moreBytes*/)
+{
+	return s_EdgeFetch(true);
+}
+
+bool ScrollCommandHandler(unsigned char header, FetchByte fetch)
+{
+	unsigned char x_y = fetch(true);
+	unsigned char width_height = fetch(true);
+	ScrollEdge::Enum edge = static_cast<ScrollEdge::Enum>(header & 0x3);
+	unsigned char dx_dy = fetch(edge != ScrollEdge::Black);
+	if(edge >= ScrollEdge::Count)
+	{
+		return false;
+	}
+
+	unsigned char x = (x_y >> 4) & 0xF;
+	unsigned char y = x_y & 0xF;
+	unsigned char width = (width_height >> 4) & 0xF;
+	unsigned char height = width_height & 0xF;
+	signed char dx = (signed char)(dx_dy & 0xF0) >> 4;
+	signed char dy = (signed char)(dx_dy << 4) >> 4;
+	unsigned char columns = dx < 0 ? -dx : dx;
+	unsigned char rows = dy < 0 ? -dy : dy;
+	if(columns > 7 || (edge != ScrollEdge::Black && (width == 0 || height == 0 || rows > height || (columns == 0 && rows == 0))))
+	{
+		return false; // an edge has to have something in it, otherwise the stream couldn't end on it
+	}
+
+	if(edge == ScrollEdge::Rom)
 	{
-		ClearBuffer(buffer);
+		unsigned int address = fetch(true);
+		address = (address << 8) | fetch(false);
+		s_EdgeReadPosition = address & RomTarget::AddressMask;
+		fetch = (address & RomTarget::TypeMask) == RomTarget::TypeInternal ? FetchInternalEdge : FetchExternalEdge;
 	}
-	else*/
+
+	// the scroll and the edges it uncovers go on the part of the rect inside the buffer
+	// the edge data still covers the rect as sent, and FillPixels reads past the part that hangs off
+	unsigned char visibleWidth = width;
+	unsigned char visibleHeight = height;
+	Clamp<BufferBitPlaneStride>(x, visibleWidth);
+	Clamp<BufferHeight>(y, visibleHeight);
+	if(visibleWidth == 0 || visibleHeight == 0)
 	{
-		SolidFill((dstX_dstY >> 4) & 0xF, dstX_dstY & 0xF, (width_height >> 4) & 0xF, width_height & 0xF, color, buffer);
+		y = BufferHeight; // nothing shows, so the edges are only read
+	}
+
+	unsigned char *buffer = GetTargetBuffer((header >> 2) & 0x3);
+	Scroll(x, y, visibleWidth, visibleHeight, dx, dy, buffer);
+
+	if(edge != ScrollEdge::Black)
+	{
+		if(columns)
+		{
+			s_EdgeFetch = fetch;
+			FillPixels(dx > 0 ? x * 8 : (x + visibleWidth) * 8 - columns, y, columns, height, PixelFormat::TwoBits, rows ? FetchEdgeContinued : fetch, buffer);
+		}
+		if(rows)
+		{
+			FillPixels(x * 8, dy > 0 || rows > visibleHeight ? y : y + visibleHeight - rows, width * 8, rows, PixelFormat::TwoBits, fetch, buffer);
+		}
 	}
 	return true;
 }
@@ -280,13 +706,16 @@ bool ReadMemoryCommandHandler(unsigned char header, FetchByte fetch)
 	if(external)
 	{
 #ifdef ENABLE_EXTERNAL_EEPROM
-		BeginReadExternalEEPROM(address & RomTarget::ExternalMask);
+		address &= RomTarget::ExternalMask;
 		while(dwordCount--)
 		{
-			WriteSerialData(ReadNextByteFromExternalEEPROM(true));
-			WriteSerialData(ReadNextByteFromExternalEEPROM(true));
-			WriteSerialData(ReadNextByteFromExternalEEPROM(true));
-			WriteSerialData(ReadNextByteFromExternalEEPROM(dwordCount > 0));
+			unsigned char dword[4];
+			ReadExternalEEPROM(address, sizeof(dword), dword);
+			address += sizeof(dword);
+			WriteSerialData(dword[0]);
+			WriteSerialData(dword[1]);
+			WriteSerialData(dword[2]);
+			WriteSerialData(dword[3]);
 		}
 #else
 		while(dwordCount--)
@@ -324,13 +753,14 @@ bool WriteMemoryCommandHandler_SerialOnly(unsigned char header, FetchByte fetch)
 	if(external)
 	{
 #ifdef ENABLE_EXTERNAL_EEPROM
-		BeginWriteExternalEEPROM(address & RomTarget::ExternalMask);
+		// pages go out in the background as they fill up, a write that carries on in the next command adds to the same page
+		address &= RomTarget::ExternalMask;
 		while(dwordCount--)
 		{
-			WriteNextByteToExternalEEPROM(fetch(true), true);
-			WriteNextByteToExternalEEPROM(fetch(true), true);
-			WriteNextByteToExternalEEPROM(fetch(true), true);
-			WriteNextByteToExternalEEPROM(fetch(dwordCount > 0), dwordCount > 0);
+			WriteExternalEEPROM(address++, fetch(true));
+			WriteExternalEEPROM(address++, fetch(true));
+			WriteExternalEEPROM(address++, fetch(true));
+			WriteExternalEEPROM(address++, fetch(dwordCount > 0));
 		}
 #else
 		while(dwordCount--)
@@ -365,28 +795,156 @@ bool PlayFromBookmarkCommandHandler(unsigned char header, FetchByte fetch)
 	{
 		g_CommandReg.AnimBookmark = address;
 	}
-	g_CommandReg.AnimReadPosition = g_CommandReg.AnimBookmark;
+	if(!g_CommandReg.AnimPlaying)
+	{
+		LeaveAnimSlot(); // same as the host moving the read position
+	}
+	RestartAnimAt(g_CommandReg.AnimBookmark);
 	g_CommandReg.AnimPlaying = static_cast<AnimState::Enum>(header & 0x3);
 	return true; 
 }
 
-unsigned char FetchSerial(bool moreBytes)
+// Pushes a Loop or Call, failing once they're nested too deep
+static bool PushAnimStack(unsigned int position, unsigned char remaining, bool call)
+{
+	if(g_CommandReg.AnimStackDepth >= AnimOps::StackSize)
+	{
+		return false;
+	}
+
+	unsigned char bit = 1 << g_CommandReg.AnimStackDepth;
+	g_CommandReg.AnimStackCalls = call ? g_CommandReg.AnimStackCalls | bit : g_CommandReg.AnimStackCalls & ~bit;
+
+	AnimStackEntry &entry = g_CommandReg.AnimStack[g_CommandReg.AnimStackDepth++];
+	entry.Position = position;
+	entry.Remaining = remaining;
+	return true;
+}
+
+bool AnimOpCommandHandler_AnimOnly(unsigned char header, FetchByte fetch)
+{
+	if(!g_CommandReg.AnimPlaying)
+	{
+		return false; // serial commands stop the anim before they run, so this came from the host
+	}
+
+	unsigned int op = OffsetAnimPosition(g_CommandReg.AnimReadPosition, -1); // offsets count from the op's header
+	AnimStackEntry *top = g_CommandReg.AnimStackDepth ? &g_CommandReg.AnimStack[g_CommandReg.AnimStackDepth - 1] : 0;
+	bool topCall = top && ((g_CommandReg.AnimStackCalls >> (g_CommandReg.AnimStackDepth - 1)) & 1);
+	switch(header & 0xF)
+	{
+		case AnimOps::Container:
+		{
+			g_CommandReg.AnimContainer = op;
+			unsigned int frameCount = fetch(true);
+			frameCount = (frameCount << 8) | fetch(true);
+			unsigned char interval = fetch(true);
+			unsigned int size = fetch(true);
+			size = (size << 8) | fetch(false);
+			if(!frameCount || !interval)
+			{
+				return false;
+			}
+			
+			g_CommandReg.AnimContainerEnd = OffsetAnimPosition(g_CommandReg.AnimContainer, size);
+			g_CommandReg.AnimFrameCount = frameCount;
+			g_CommandReg.AnimKeyframeInterval = interval;
+			return SeekAnimFrame(0); // hops over the index
+		}
+		case AnimOps::Keyframe:
+		{
+			Fill(0, 0, BufferBitPlaneStride, BufferHeight, PixelFormat::RunLength, fetch, g_DisplayReg.BackBuffer);
+			return true;
+		}
+		case AnimOps::Delta:
+		{
+			// while catching up to a seek the back buffer already holds the frame before, it just wasn't shown
+			if(!g_CommandReg.AnimFrameUnshown)
+			{
+				Copy(0, 0, 0, 0, BufferBitPlaneStride, BufferHeight, GetTargetBuffer(BufferTarget::FrontBuffer), g_DisplayReg.BackBuffer);
+			}
+			Fill(0, 0, BufferBitPlaneStride, BufferHeight, PixelFormat::XorDelta, fetch, g_DisplayReg.BackBuffer);
+			return true;
+		}
+		case AnimOps::Loop:
+		{
+			unsigned char count = fetch(false);
+			return PushAnimStack(g_CommandReg.AnimReadPosition, count, false);
+		}
+		case AnimOps::EndLoop:
+		{
+			if(!top || topCall)
+			{
+				return false;
+			}
+			if(!top->Remaining || --top->Remaining)
+			{
+				g_CommandReg.AnimReadPosition = top->Position;
+			}
+			else
+			{
+				--g_CommandReg.AnimStackDepth;
+			}
+			return true;
+		}
+		case AnimOps::Jump:
+		case AnimOps::Call:
+		{
+			unsigned int offset = fetch(true);
+			offset = (offset << 8) | fetch(false);
+			if((header & 0xF) == AnimOps::Call && !PushAnimStack(g_CommandReg.AnimReadPosition, 0, true))
+			{
+				return false;
+			}
+			g_CommandReg.AnimReadPosition = OffsetAnimPosition(op, offset);
+			return true;
+		}
+		case AnimOps::Return:
+		{
+			if(!top || !topCall)
+			{
+				return false;
+			}
+			g_CommandReg.AnimReadPosition = top->Position;
+			--g_CommandReg.AnimStackDepth;
+			return true;
+		}
+		case AnimOps::BranchButton:
+		{
+			unsigned char button = fetch(true);
+			unsigned int offset = fetch(true);
+			offset = (offset << 8) | fetch(false);
+
+			// the slot reacts to the button itself now, so it stops flipping through the slots
+			g_CommandReg.AnimButtons |= 1 << (button & 0x1);
+			bool down = (button & 0x1) ? CheckButton1() : CheckButton0();
+			if(down != ((button & AnimOps::BranchReleased) != 0))
+			{
+				g_CommandReg.AnimReadPosition = OffsetAnimPosition(op, offset);
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+unsigned char FetchSerial(bool /*moreBytes*/)
 {
 	return ReadSerialData();
 }
 
-unsigned char FetchInternalEEPROM(bool moreBytes)
+unsigned char FetchInternalEEPROM(bool /*moreBytes*/)
 {
 	int readAddr = g_CommandReg.AnimReadPosition;
 	g_CommandReg.AnimReadPosition = ((g_CommandReg.AnimReadPosition + 1) & (EepromInternalSize - 1)) | RomTarget::TypeInternal;
 	return ReadInternalEEPROM(readAddr);
 }
 
-unsigned char FetchExternalEEPROM(bool moreBytes)
+unsigned char FetchExternalEEPROM(bool /*moreBytes*/)
 {
 #ifdef ENABLE_EXTERNAL_EEPROM
 	g_CommandReg.AnimReadPosition = ((g_CommandReg.AnimReadPosition + 1) & (EepromExternalSize - 1)) | RomTarget::TypeExternal;
-	return ReadNextByteFromExternalEEPROM(moreBytes);
+	return ReadExternalEEPROMStream(); // the stream stays open for the next command
 #else
 	return 0;
 #endif
@@ -410,7 +968,9 @@ void BadAnimPanic()
 	g_CommandReg.AnimPlaying = AnimState::Stopped;
 }
 
-static const CommandHandler s_SerialHandlers[SerialCommands::Count] = 
+bool CommandListCommandHandler_SerialOnly(unsigned char header, FetchByte fetch);
+
+static const CommandHandler s_SerialHandlers[SerialCommands::Count] PROGMEM = 
 {
 	PingCommandHandler,
 	QuerySettingCommandHandler,
@@ -422,51 +982,223 @@ static const CommandHandler s_SerialHandlers[SerialCommands::Count] =
 	FillRectCommandHandler,
 	ReadMemoryCommandHandler,
 	WriteMemoryCommandHandler_SerialOnly,
-	PlayFromBookmarkCommandHandler
+	PlayFromBookmarkCommandHandler,
+	WriteDirtyRectCommandHandler,
+	PixelRectCommandHandler,
+	ScrollCommandHandler,
+	CommandListCommandHandler_SerialOnly,
+	AnimOpCommandHandler_AnimOnly
 };
 
-void DispatchSerialCommand()
+// The handler tables live in flash, there isn't the ram to spare for them
+static CommandHandler GetSerialHandler(unsigned char command)
 {
-	unsigned char commandHeader = ReadSerialData();
-	unsigned char command = (commandHeader >> 4) & 0xF;
+	return reinterpret_cast<CommandHandler>(pgm_read_ptr(&s_SerialHandlers[command]));
+}
+
+// Bytes left in the CommandList entry being run
+static unsigned char s_ListRemaining;
+static bool s_ListOverrun;
+
+// Reads a CommandList entry, which can't run on into the next one
+static unsigned char FetchListEntry(bool /*moreBytes*/)
+{
+	if(s_ListRemaining == 0)
+	{
+		s_ListOverrun = true;
+		return 0;
+	}
+	--s_ListRemaining;
+	return ReadSerialData();
+}
+
+// Waits for the rest of a CommandList to pass its crc checks
+// Gives up once a plain packet is thrown away (it could have held part of the list), or nothing new has come in for a second
+static bool WaitForCommandList(unsigned char length)
+{
+	unsigned char lost = GetLostPacketCount();
+	unsigned char pending = GetPendingSerialDataSize();
+	unsigned int since = GetFrameCount();
+	while(pending < length)
+	{
+		PumpAck();
+		if(GetLostPacketCount() != lost || (unsigned int)(GetFrameCount() - since) > RefreshRate)
+		{
+			return false;
+		}
+
+		unsigned char now = GetPendingSerialDataSize();
+		if(now != pending)
+		{
+			pending = now;
+			since = GetFrameCount();
+		}
+	}
+	return true;
+}
+
+// The header is followed by a cookie, the length of the rest of the list, then each command with its length in front
+// Commands are run in order, and one that fails (or doesn't use up exactly its length) is skipped over and flagged without stopping the rest
+// Sends back a single Ack with the list flag, and a 16 bit bitmap (lsb for the first command) if anything failed
+// Nothing is sent for a zero cookie unless something failed
+bool CommandListCommandHandler_SerialOnly(unsigned char header, FetchByte fetch)
+{
+	if(fetch != FetchSerial)
+	{
+		return false; // entries are always read from the serial port
+	}
+	
+	unsigned char count = (header & 0xF) + 1;
+	unsigned char cookie = fetch(true);
+	unsigned char length = fetch(true);
+	
+	// nothing runs until the whole list has passed its crc checks, so one that is split over packets is never half applied
+	// if the rest of it is lost, none of it runs, what did come in is thrown away and every command is flagged
+	unsigned int failed = 0;
+	if(!WaitForCommandList(length))
+	{
+		unsigned char pending = GetPendingSerialDataSize();
+		for(length = pending < length ? pending : length; length; --length)
+		{
+			ReadSerialData();
+		}
+		failed = 0xFFFF >> (16 - count);
+		count = 0;
+	}
+	FlushAcks(); // the acks for the rest of it go out ahead of anything its commands send back
+	
+	for(unsigned int bit = 1; count; --count, bit <<= 1)
+	{
+		unsigned char size = 0;
+		if(length)
+		{
+			size = ReadSerialData();
+			--length;
+		}
+		bool ok = size && size <= length;
+		if(size > length)
+		{
+			size = length; // ran off the end of the list
+		}
+		length -= size;
+		s_ListRemaining = size;
+		s_ListOverrun = false;
+		
+		if(ok)
+		{
+			unsigned char commandHeader = FetchListEntry(true);
+			unsigned char command = (commandHeader >> 4) & 0xF;
+			ok = (command < SerialCommands::Count) && (command != SerialCommands::CommandList) && GetSerialHandler(command)(commandHeader, FetchListEntry);
+		}
+		
+		// skip whatever the command left behind
+		for(; s_ListRemaining; --s_ListRemaining)
+		{
+			ReadSerialData();
+			ok = false;
+		}
+		if(!ok || s_ListOverrun)
+		{
+			failed |= bit;
+		}
+	}
+	
+	// bytes past the last command
+	for(; length; --length)
+	{
+		ReadSerialData();
+	}
+	
+	if(cookie || failed)
+	{
+		WriteSerialData((ResponseCodes::Ack << 4) | (1 << 1) | (failed ? (1 << 0) : 0));
+		WriteSerialData(cookie);
+		if(failed)
+		{
+			WriteSerialData((failed >> 8) & 0xFF);
+			WriteSerialData(failed & 0xFF);
+		}
+	}
+	return true;
+}
 
+void DispatchSerialCommand()
+{
+	g_CommandReg.Tethered = TetherTicks;
 	if(g_CommandReg.AnimPlaying)
 	{
+		// the host takes over, so it doesn't have to sit out the rest of the anim's hold
+		// (its Loops and Calls stay put for AnimPlayState to carry on from, anything that starts it over goes through RestartAnimAt)
 		g_CommandReg.AnimPlaying = AnimState::Stopped;
+		g_CommandReg.AnimSwapWaiting = false; // a resume peeks the swap again
+		CancelFrameHold();
 	}
+
+	// a swap that can't latch yet is left unread, so the main loop keeps servicing the serial port during the hold
+	// (the same as an anim swap, see DispatchAnimCommand)
+	const unsigned char *data;
+	PeekSerialData(data);
+	if(((data[0] >> 4) & 0xF) == SerialCommands::Swap && !IsSwapReady())
+	{
+		return;
+	}
+
+	FlushAcks();
+	unsigned char commandHeader = ReadSerialData();
+	unsigned char command = (commandHeader >> 4) & 0xF;
 	
-	if((command >= SerialCommands::Count) || !s_SerialHandlers[command](commandHeader, FetchSerial))
+	PROFILE_BEGIN();
+	if((command >= SerialCommands::Count) || !GetSerialHandler(command)(commandHeader, FetchSerial))
 	{
 		BadCommandPanic();
 	}
+	PROFILE_END(ProfilePoints::FirstCommand + command);
 }
 
-static const CommandHandler s_AnimHandlers[AnimCommands::Count] =
-{
-	PingCommandHandler,
-	UpdateSettingCommandHandler,
-	SwapCommandHandler,
-	WriteRectCommandHandler,
-	CopyRectCommandHandler,
-	FillRectCommandHandler,
-	PlayFromBookmarkCommandHandler
-};
-
 void DispatchAnimCommand()
 {
-	bool external = (g_CommandReg.AnimReadPosition & RomTarget::TypeMask) != RomTarget::TypeInternal;
+	// a swap that can't latch yet is left unread, so the main loop keeps servicing the serial port during the hold
+	// (swaps skipped over to catch up to a seek don't latch, so they never wait)
+	if(g_CommandReg.AnimSwapWaiting)
+	{
+		if(!IsSwapReady())
+		{
+			return;
+		}
+		g_CommandReg.AnimSwapWaiting = false;
+	}
+
+	if(g_CommandReg.AnimReadPosition == g_CommandReg.AnimEnd ||
+		(g_CommandReg.AnimFrameCount && g_CommandReg.AnimReadPosition == g_CommandReg.AnimContainerEnd))
+	{
+		if(!EndAnimLoop())
+		{
+			return;
+		}
+	}
+
+	unsigned int commandStart = g_CommandReg.AnimReadPosition;
+	bool external = (commandStart & RomTarget::TypeMask) != RomTarget::TypeInternal;
 
 	if(external)
 	{
 #ifdef ENABLE_EXTERNAL_EEPROM
-		BeginReadExternalEEPROM(g_CommandReg.AnimReadPosition);
-		unsigned char commandHeader = FetchExternalEEPROM(true);
+		// only seeks after a jump, otherwise the stream is already sitting on the command
+		SeekExternalEEPROMStream(commandStart);
+		unsigned char commandHeader = PeekExternalEEPROMStream();
 		unsigned char command = (commandHeader >> 4) & 0xF;
 		
-		if((command >= SerialCommands::Count) || !s_SerialHandlers[command](commandHeader, FetchExternalEEPROM))
+		if(command == SerialCommands::Swap && !IsSwapReady() && !g_CommandReg.AnimSkipFrames)
 		{
-			ReadNextByteFromExternalEEPROM(false); // discard junk byte and close connection, but don't call FetchExternalEEPROM/update the read pointer
-			BadAnimPanic();
+			g_CommandReg.AnimSwapWaiting = true; // the header stays in the stream, and the main loop reads ahead during the hold
+		}
+		else
+		{
+			FetchExternalEEPROM(true); // move past the header
+			if((command >= SerialCommands::Count) || !GetSerialHandler(command)(commandHeader, FetchExternalEEPROM))
+			{
+				BadAnimPanic();
+			}
 		}
 #else
 		BadAnimPanic();
@@ -477,49 +1209,66 @@ void DispatchAnimCommand()
 		unsigned char commandHeader = FetchInternalEEPROM(false);
 		unsigned char command = (commandHeader >> 4) & 0xF;
 		
-		if((command >= SerialCommands::Count) || !s_SerialHandlers[command](commandHeader, FetchInternalEEPROM))
+		if(command == SerialCommands::Swap && !IsSwapReady() && !g_CommandReg.AnimSkipFrames)
+		{
+			g_CommandReg.AnimReadPosition = commandStart;
+			g_CommandReg.AnimSwapWaiting = true;
+		}
+		else if((command >= SerialCommands::Count) || !GetSerialHandler(command)(commandHeader, FetchInternalEEPROM))
 		{
 			BadAnimPanic();
 		}
 	}
 }
 
-void InitAnim()
+// Looks for a slot directory or a single anim at the start of a memory, and starts it playing
+static bool FindAnim(unsigned int memory)
 {
-	ClearBuffer(g_DisplayReg.FrontBuffer);
-	g_CommandReg.AnimStart = 
-	g_CommandReg.AnimBookmark =
-	g_CommandReg.AnimReadPosition = 0;
-	g_CommandReg.AnimPlaying = AnimState::Stopped;
+	static const unsigned char Magic[] PROGMEM = { '\0', 'H', '\0', 'i' };
+	static const unsigned char DirectoryMagic[] PROGMEM = { '\0', 'H', '\0', 'D' };
 
-	static const unsigned char Magic[] = { '\0', 'H', '\0', 'i' };
+	bool anim = true;
+	bool directory = true;
+	for(unsigned char i = 0; i < sizeof(Magic); ++i)
+	{
+		unsigned char data = ReadAnimByte(memory | i);
+		anim &= data == pgm_read_byte(&Magic[i]);
+		directory &= data == pgm_read_byte(&DirectoryMagic[i]);
+	}
 
-	bool internal = ReadInternalEEPROM(0) == Magic[0];
-	internal &= ReadInternalEEPROM(1) == Magic[1];
-	internal &= ReadInternalEEPROM(2) == Magic[2];
-	internal &= ReadInternalEEPROM(3) == Magic[3];
-	if(internal)
+	if(directory)
+	{
+		unsigned char count = ReadAnimByte(memory | sizeof(DirectoryMagic));
+		g_CommandReg.AnimDirectory = memory;
+		g_CommandReg.AnimSlotCount = count < AnimDirectory::MaxSlots ? count : (unsigned char)AnimDirectory::MaxSlots;
+		PlayAnimSlot(0);
+	}
+	else if(anim)
 	{
+		// the magic is a pair of pings, so the anim starts right on it
 		g_CommandReg.AnimStart = 
 		g_CommandReg.AnimBookmark =
-		g_CommandReg.AnimReadPosition = RomTarget::TypeInternal;
+		g_CommandReg.AnimReadPosition = memory;
 		g_CommandReg.AnimPlaying = AnimState::Playing;
 	}
-	else
+	return directory || anim;
+}
+
+void InitAnim()
+{
+	ClearBuffer(g_DisplayReg.FrontBuffer);
+	g_CommandReg.AnimStart = 
+	g_CommandReg.AnimBookmark =
+	g_CommandReg.AnimReadPosition = 0;
+	g_CommandReg.AnimPlaying = AnimState::Stopped;
+	g_CommandReg.AnimFrameCount = 0;
+	g_CommandReg.AnimSlotCount = 0;
+	LeaveAnimSlot();
+
+	if(!FindAnim(RomTarget::TypeInternal))
 	{
 #ifdef ENABLE_EXTERNAL_EEPROM
-		BeginReadExternalEEPROM(0);
-		bool external = ReadNextByteFromExternalEEPROM(true) == Magic[0];
-		external &= ReadNextByteFromExternalEEPROM(true) == Magic[1];
-		external &= ReadNextByteFromExternalEEPROM(true) == Magic[2];
-		external &= ReadNextByteFromExternalEEPROM(false) == Magic[3];
-		if(external)
-		{
-			g_CommandReg.AnimStart = 
-			g_CommandReg.AnimBookmark =
-			g_CommandReg.AnimReadPosition = RomTarget::TypeExternal;
-			g_CommandReg.AnimPlaying = AnimState::Playing;
-		}
+		FindAnim(RomTarget::TypeExternal);
 #endif // ENABLE_EXTERNAL_EEPROM
 	}
 }
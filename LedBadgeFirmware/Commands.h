@@ -20,23 +20,62 @@ struct SerialCommands
 		ReadMemory,			// 
 		WriteMemory,		// 
 		PlayFromBookmark,	// 
+		WriteDirtyRect,		// Like WriteRect, but only the blocks flagged in an interleaved bitmap are sent
+		PixelRect,			// WriteRect/CopyRect/FillRect in pixels instead of blocks, the low bits of the header pick the PixelRectOps entry
+		Scroll,				// Shift a block of pixels by -7 to 7 pixels across and -8 to 7 rows down, the low bits of the header pick the ScrollEdge entry
+		CommandList,		// Run 1-16 commands (the low bits of the header are the count - 1) once all of them are in, see CommandListCommandHandler_SerialOnly
+		AnimOp,				// Only runs from anims, the low bits of the header pick the AnimOps entry
 		
 		Count
 	};
 };
 
-struct AnimCommands
+struct PixelRectOps
 {
 	enum Enum
 	{
-		Ping,				// 
-		UpdateSetting,		// 
-		Swap,				// 
-		WriteRect,			// 
-		CopyRect,			// 
-		FillRect,			// 
-		PlayFromBookmark,	// 
+		Write,				// format/dstX, dstY/height-1, width-1, then (width + 7) / 8 blocks per row
+		Copy,				// srcTarget/dstX, dstY/height-1, width-1, srcX, srcY
+		Fill,				// dstX, dstY/height-1, width-1, then the 2 byte color
+		
+		Count
+	};
+};
+
+// A container anim starts with a Container op, and then every frame is a Keyframe or Delta op followed by a regular Swap
+// Other commands can go in between (a Ping to report the frame, say), and playback loops back to the first frame at the end of the container
+// Every KeyframeInterval-th frame is a keyframe, so any frame can be reached by seeking to the keyframe before it and drawing the deltas after it without showing them
+struct AnimOps
+{
+	enum Enum
+	{
+		Container,			// frame count (2 bytes), keyframe interval, size (2 bytes), then the keyframe index - a 2 byte offset from the Container op for each keyframe
+		Keyframe,			// the whole back buffer as RunLength blocks
+		Delta,				// the whole back buffer as XorDelta blocks against the frame before it, which is copied in first
+		Loop,				// repeat count (zero for no end), runs the commands up to the matching EndLoop that many times
+		EndLoop,			// back to the command after the innermost Loop, until its count runs out
+		Jump,				// 2 byte signed offset from the Jump op
+		Call,				// 2 byte signed offset from the Call op, Return comes back to the command after it
+		Return,				// back to the command after the innermost Call
+		BranchButton,		// button (bit 0 picks button 1, bit 7 branches while it's up rather than down), then a 2 byte signed offset from the op
+		
+		Count,
+
+		StackSize = 4,		// Loop and Call nesting depth, between them
+		BranchReleased = 0x80,
+	};
+};
 
+// Edge pixels are 2bpp and laid out like a PixelRect write: first the column uncovered by the horizontal shift (|dx| pixels wide),
+// then the rows uncovered by the vertical shift (the full width of the block)
+struct ScrollEdge
+{
+	enum Enum
+	{
+		Black,				// pixels scrolled in are left black
+		Stream,				// pixels scrolled in follow in the command
+		Rom,				// pixels scrolled in are read from the 2 byte eeprom address that follows (RomTarget type in the top bits)
+		
 		Count
 	};
 };
@@ -55,6 +94,12 @@ struct Settings
 		ButtonState,		// 
 		BufferFullness,		// 
 		Caps,				// 
+		Stats,				// Profiling counters, the query's argument byte picks the ProfilePoints entry, updating it clears them all
+		FrameClock,			// (Read only) Refresh frames output so far and the hold counts left on the current frame
+		BaudRate,			// UBRR high nibble with U2X in the top bit, then UBRR low, updating it answers with a Setting response at the old rate before switching
+		FlowControl,		// Credit acks on/off, then (read only) the free space in the input buffer - while on, packet acks carry the free space in a third byte
+		AnimFrame,			// The container anim frame the next swap shows, then (read only) the frame count - updating it seeks there through the keyframe index
+		AnimSlot,			// The anim slot playing - the query's argument byte picks the slot to describe (AnimDirectory::NoSlot for the one playing), updating it plays a slot
 		
 		Count
 	};
@@ -69,16 +114,33 @@ struct ResponseCodes
 		Pixels,				// 
 		Memory,				// 
 		Error,				// 
+		PageWritten,		// An external eeprom page write finished, the low bits are the outcome (PageWriteStatus), then the page number
 		
 		Count
 	};
 };
 
+struct PageWriteStatus
+{
+	enum Enum
+	{
+		Ok,					// written
+		NoAnswer,			// the memory never answered, even after its write cycle should have been long over
+		BusError,			// the bus did something unexpected
+	};
+};
+
 struct SupportedFeatures
 {
 	enum Enum
 	{
 		HardwareBrightness = 0x01,	// Supports fine grained PWM brightness
+		Profiling = 0x02,			// Built with ENABLE_PROFILING, Settings::Stats returns live counters
+		CreditAcks = 0x08,			// Settings::FlowControl is there, so the host can keep a window of packets in flight
+		CommandLists = 0x10,		// SerialCommands::CommandList is there
+		PageWrites = 0x20,			// external WriteMemory data is written a page at a time, and each page answers with ResponseCodes::PageWritten
+		AnimContainers = 0x40,		// anims can be keyframe/delta containers (see AnimOps), with Settings::AnimFrame to seek them
+		AnimSlots = 0x80,			// an AnimDirectory picks between several stored anims, with Settings::AnimSlot and the buttons
 	};
 };
 
@@ -93,6 +155,7 @@ struct ErrorCodes
 		EepromWriteOutOfBounds,
 		BadSerialCommand,
 		BadAnimCommand,
+		SequenceGap,		// Sequenced packets went missing, the cookie byte is the sequence number to resend from
 
 		Count
 	};
@@ -130,6 +193,40 @@ struct RomTarget
 	};
 };
 
+// A directory of anim slots can sit at the start of either eeprom in place of a single anim
+// 'DirectoryMagic' and a slot count, then SlotSize bytes for each slot
+struct AnimDirectory
+{
+	enum Enum
+	{
+		HeaderSize = 5,
+		SlotSize = 16,
+		MaxSlots = 16,
+		NoSlot = 0xFF,
+
+		NameOffset = 0,			// zero padded
+		NameSize = 8,
+		StartOffset = 8,		// 2 bytes, the anim's read position (with the RomTarget type in the top bits)
+		LengthOffset = 10,		// 2 bytes, zero for an anim that never ends (it loops itself with PlayFromBookmark)
+		LoopModeOffset = 12,	// AnimLoopMode
+		BrightnessOffset = 13,	// zero leaves the brightness alone
+		InfoSize = 14,			// what Settings::AnimSlot answers with, the rest is padding
+	};
+};
+
+// What happens when the anim reaches the end of its slot or container
+struct AnimLoopMode
+{
+	enum Enum
+	{
+		Once,				// stops, leaving the last frame up
+		Loop,				// starts over
+		Next,				// plays the next slot
+		
+		Count
+	};
+};
+
 struct AnimState
 {
 	enum Enum
@@ -140,12 +237,37 @@ struct AnimState
 	};
 };
 
+// A Loop or Call the anim is in the middle of
+struct AnimStackEntry
+{
+	unsigned int Position;				// where EndLoop or Return goes back to
+	unsigned char Remaining;			// loop passes left, zero for a loop with no end
+};
+
 struct CommandState
 {
 	unsigned int AnimStart;				//
 	unsigned int AnimReadPosition;		//
 	unsigned int AnimBookmark;			//
 	AnimState::Enum AnimPlaying;		// 
+	bool AnimSwapWaiting;				// the next anim command is a swap that has to wait for the current hold
+	unsigned int AnimContainer;			// where the container anim being played starts (its Container op)
+	unsigned int AnimContainerEnd;		// where it ends, and loops back to its first frame
+	unsigned int AnimFrameCount;		// frames in the container, zero if the anim isn't one
+	unsigned int AnimFrame;				// container frame the next swap shows
+	unsigned char AnimKeyframeInterval;	// frames from one keyframe to the next
+	unsigned char AnimSkipFrames;		// frames left to draw without showing them, after a seek that landed between keyframes
+	bool AnimFrameUnshown;				// the back buffer holds the last frame, drawn by a seek without being shown
+	unsigned int AnimDirectory;			// where the slot directory is, if there is one
+	unsigned char AnimSlotCount;		// slots in the directory, zero without one
+	unsigned char AnimSlot;				// slot being played, or AnimDirectory::NoSlot
+	unsigned int AnimEnd;				// where the slot ends, or 0xFFFF (never a read position) for no end
+	unsigned char AnimLoopMode;			// what happens at the end of the slot or container
+	unsigned char Tethered;				// TetherTicks left since the host's last command, the buttons leave the slots alone until it runs out
+	unsigned char AnimButtons;			// buttons (PollButtonPresses bits) the slot branches on, so they don't cycle the slots
+	AnimStackEntry AnimStack[AnimOps::StackSize];
+	unsigned char AnimStackDepth;		// Loops and Calls the anim is inside
+	unsigned char AnimStackCalls;		// a bit per AnimStack entry, set for one pushed by a Call rather than a Loop
 	unsigned char LastCookie;			//
 };
 
@@ -153,8 +275,18 @@ extern CommandState g_CommandReg;
 
 void InitAnim();
 
+// Points the anim at position, outside of any Loop, Call or container and with no swap pending
+void RestartAnimAt(unsigned int position);
+
+// Plays the slot step slots on from the current one, wrapping around the directory
+void CycleAnimSlot(signed char step);
+
 void DispatchSerialCommand();
 
+// FetchByte for commands coming in over the serial port
+// Handlers can check for it and read runs of bytes straight out of the input buffer instead (see PeekSerialData)
+unsigned char FetchSerial(bool moreBytes);
+
 void DispatchAnimCommand();
 
 #endif /* COMMANDS_H_ */
\ No newline at end of file
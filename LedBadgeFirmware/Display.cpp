@@ -2,6 +2,7 @@
 #include "Serial.h"
 #include "Eeprom.h"
 #include "Commands.h"
+#include "Profile.h"
 #include <util/atomic.h>
 
 template<bool pred> struct CT_Assert { typedef char arr[pred ? 0 : -1]; };
@@ -27,7 +28,7 @@ CT_Assert<sizeof(Pix2x8) == 2> AssertSizeOfPix2x8;
 };*/
 
 // Scrambles the output row selection to reduce the perceived flicker on the display
-const unsigned char g_RowDitherTable[BufferHeight] = 
+const unsigned char g_RowDitherTable[BufferHeight] PROGMEM = 
 {
 	 7,
 	 2,
@@ -89,29 +90,6 @@ static unsigned char g_Buffer1[BufferLength] __attribute__ ((section (".buffer1"
 // Display state machine values
 DisplayState g_DisplayReg = {};
 
-// Clamps a span along an axis to the bounds [0, Extent)
-template<unsigned char Extent> void Clamp(unsigned char &pos, unsigned char &size)
-{
-	if(pos >= Extent)
-	{
-		size = 0;
-		pos = Extent - 1;
-	}
-	
-	if(pos + size > Extent)
-	{
-		unsigned char delta = (pos + size) - Extent;
-		if(delta > size)
-		{
-			size = 0;
-		}
-		else
-		{
-			size -= delta;
-		}
-	}
-}
-
 // Sets a block of 8 pixel values in a buffer
 void SetPixBlockUnsafe(unsigned char *buffer, Pix2x8 val)
 {
@@ -158,7 +136,7 @@ Pix2x8 GetPixBlock(unsigned char x, unsigned char y, unsigned char *buffer)
 {
 	if(x < BufferBitPlaneStride && y < BufferHeight)
 	{
-		return GetPixBlockUnsafe(buffer);
+		return GetPixBlockUnsafe(buffer + y * BufferBitPlaneStride + x);
 	}
 	else
 	{
@@ -166,6 +144,48 @@ Pix2x8 GetPixBlock(unsigned char x, unsigned char y, unsigned char *buffer)
 	}
 }
 
+// Sets a run of bytes, unrolled 4 to a loop
+static void SetBytes(unsigned char *dst, unsigned char val, unsigned char count)
+{
+	if(count & 1)
+	{
+		*dst++ = val;
+	}
+	if(count & 2)
+	{
+		*dst++ = val;
+		*dst++ = val;
+	}
+	for(count >>= 2; count; --count)
+	{
+		*dst++ = val;
+		*dst++ = val;
+		*dst++ = val;
+		*dst++ = val;
+	}
+}
+
+// Copies a run of bytes front to back (so overlapping runs smear the same way a block by block copy does), unrolled 4 to a loop
+static void CopyBytes(const unsigned char *src, unsigned char *dst, unsigned char count)
+{
+	if(count & 1)
+	{
+		*dst++ = *src++;
+	}
+	if(count & 2)
+	{
+		*dst++ = *src++;
+		*dst++ = *src++;
+	}
+	for(count >>= 2; count; --count)
+	{
+		*dst++ = *src++;
+		*dst++ = *src++;
+		*dst++ = *src++;
+		*dst++ = *src++;
+	}
+}
+
 // Set a block of pixels in a buffer to a particular value
 // The x and width parameters are in blocks, not pixels
 void SolidFill(unsigned char x, unsigned char y, unsigned char width, unsigned char height, Pix2x8 val, unsigned char *buffer)
@@ -173,6 +193,30 @@ void SolidFill(unsigned char x, unsigned char y, unsigned char width, unsigned c
 	Clamp<BufferBitPlaneStride>(x, width);
 	Clamp<BufferHeight>(y, height);
 	
+	if(width == BufferBitPlaneStride)
+	{
+		// full rows are back to back in each bit-plane, so each plane is one run of its expanded value
+		const unsigned char low = val & 0xFF;
+		const unsigned char high = (val >> 8) & 0xFF;
+		const unsigned char count = height * BufferBitPlaneStride;
+		buffer += y * BufferBitPlaneStride;
+		SetBytes(buffer, low | high, count);
+		SetBytes(buffer + BufferBitPlaneLength, high, count);
+		SetBytes(buffer + BufferBitPlaneLength * 2, low & high, count);
+	}
+	else
+	{
+		SolidFillBlocks(x, y, width, height, val, buffer);
+	}
+}
+
+// Set a block of pixels in a buffer to a particular value, a block at a time
+// The x and width parameters are in blocks, not pixels
+void SolidFillBlocks(unsigned char x, unsigned char y, unsigned char width, unsigned char height, Pix2x8 val, unsigned char *buffer)
+{
+	Clamp<BufferBitPlaneStride>(x, width);
+	Clamp<BufferHeight>(y, height);
+	
 	unsigned char *b0 = buffer + y * BufferBitPlaneStride + x;
 	for(unsigned char iy = height; iy; --iy, b0 += BufferBitPlaneStride)
 	{
@@ -184,30 +228,216 @@ void SolidFill(unsigned char x, unsigned char y, unsigned char width, unsigned c
 	}
 }
 
+// Decoder state for a Fill stream
+struct FillStream
+{
+	FetchByte Fetch;
+	PixelFormat::Enum Format;
+	unsigned char Count;		// blocks left in the stream
+	unsigned char Control;		// control byte of the current run (RunLength and XorDelta)
+	unsigned char Run;			// blocks left in the current run
+	Pix2x8 Data;				// last block decoded
+};
+
+// Pulls the next block out of a Fill stream into stream.Data
+// Returns false for XorDelta blocks that are skipped over
+static bool FetchFillBlock(FillStream &stream)
+{
+	const unsigned char count = --stream.Count;
+	if(stream.Format == PixelFormat::OneBit)
+	{
+		const unsigned char data = stream.Fetch(count > 0);
+		stream.Data = (data << 8) | data;
+		return true;
+	}
+	
+	if(stream.Format != PixelFormat::TwoBits)
+	{
+		if(stream.Run == 0)
+		{
+			stream.Control = stream.Fetch(true);
+			stream.Run = (stream.Control & 0x7F) + 1;
+			if(stream.Control & 0x80)
+			{
+				if(stream.Format == PixelFormat::RunLength)
+				{
+					// the repeated block ends the stream if the run covers the rest of the rect
+					stream.Data = stream.Fetch(true);
+					stream.Data = (stream.Data << 8) | stream.Fetch(stream.Run <= count);
+				}
+			}
+		}
+		--stream.Run;
+		
+		if(stream.Control & 0x80)
+		{
+			if(stream.Format == PixelFormat::RunLength)
+			{
+				return true;
+			}
+			
+			if(count == 0)
+			{
+				stream.Fetch(false); // discard padding byte
+			}
+			return false;
+		}
+	}
+	
+	stream.Data = stream.Fetch(true);
+	stream.Data = (stream.Data << 8) | stream.Fetch(count > 0);
+	return true;
+}
+
+// Decodes length blocks of a Fill stream into a row of a buffer, storing only the first visible of them
+static void FillSpan(FillStream &stream, unsigned char *plane0, unsigned char visible, unsigned char length)
+{
+	unsigned char *plane1 = plane0 + BufferBitPlaneLength;
+	unsigned char *plane2 = plane1 + BufferBitPlaneLength;
+	length -= visible;
+	
+	if(stream.Format == PixelFormat::TwoBits)
+	{
+		// raw blocks go straight into the bit-planes
+		if(stream.Fetch != FetchSerial)
+		{
+			for(; visible; --visible)
+			{
+				const unsigned char high = stream.Fetch(true);
+				const unsigned char low = stream.Fetch(--stream.Count > 0);
+				*plane0++ = low | high;
+				*plane1++ = high;
+				*plane2++ = low & high;
+			}
+		}
+		while(visible)
+		{
+			// serial data is read in place a run at a time, instead of going through a fetch call per byte
+			const unsigned char *data;
+			unsigned char blocks = PeekSerialData(data) / 2;
+			if(blocks == 0)
+			{
+				// a block split across the end of the ring
+				const unsigned char high = stream.Fetch(true);
+				const unsigned char low = stream.Fetch(--stream.Count > 0);
+				*plane0++ = low | high;
+				*plane1++ = high;
+				*plane2++ = low & high;
+				--visible;
+				continue;
+			}
+			
+			if(blocks > visible)
+			{
+				blocks = visible;
+			}
+			visible -= blocks;
+			stream.Count -= blocks;
+			for(unsigned char i = blocks; i; --i, data += 2)
+			{
+				const unsigned char high = data[0];
+				const unsigned char low = data[1];
+				*plane0++ = low | high;
+				*plane1++ = high;
+				*plane2++ = low & high;
+			}
+			ReleaseSerialData(blocks * 2);
+		}
+	}
+	else
+	{
+		for(; visible; --visible, ++plane0, ++plane1, ++plane2)
+		{
+			if(FetchFillBlock(stream))
+			{
+				if(stream.Format == PixelFormat::XorDelta)
+				{
+					const unsigned char high = *plane1;
+					const unsigned char low = (*plane0 ^ high) | *plane2;
+					stream.Data ^= (high << 8) | low;
+				}
+				
+				const unsigned char low = stream.Data & 0xFF;
+				const unsigned char high = (stream.Data >> 8) & 0xFF;
+				*plane0 = low | high;
+				*plane1 = high;
+				*plane2 = low & high;
+			}
+		}
+	}
+	
+	// blocks hanging off the edge of the buffer still have to come out of the stream
+	for(; length; --length)
+	{
+		FetchFillBlock(stream);
+	}
+}
+
 // Set a block of pixels in a buffer to the given data (read from the serial port)
 // The x and width parameters are in blocks, not pixels
 void Fill(unsigned char x, unsigned char y, unsigned char width, unsigned char height, PixelFormat::Enum format, FetchByte fetch, unsigned char *buffer)
 {
-	unsigned char count = width * height;
-	for(unsigned char iy = y, sy = y + height; iy < sy; ++iy)
+	FillStream stream = { fetch, format, (unsigned char)(width * height), 0, 0, 0 };
+	
+	unsigned char visibleWidth = width;
+	unsigned char visibleHeight = height;
+	Clamp<BufferBitPlaneStride>(x, visibleWidth);
+	Clamp<BufferHeight>(y, visibleHeight);
+	unsigned char *row = buffer + y * BufferBitPlaneStride + x;
+	
+	if(visibleWidth == BufferBitPlaneStride && width == BufferBitPlaneStride)
 	{
-		for(unsigned char ix = x, sx = x + width; ix < sx; ++ix)
+		// full width rows are back to back in each plane, so they go in as a single span
+		FillSpan(stream, row, visibleHeight * BufferBitPlaneStride, visibleHeight * BufferBitPlaneStride);
+	}
+	else
+	{
+		for(unsigned char iy = visibleHeight; iy; --iy, row += BufferBitPlaneStride)
 		{
-			Pix2x8 data;
-			if(format == PixelFormat::OneBit)
+			FillSpan(stream, row, visibleWidth, width);
+		}
+	}
+	
+	// rows hanging off the bottom
+	FillSpan(stream, row, 0, stream.Count);
+}
+
+// Set only the flagged blocks of a rect to the given data (read from the serial port), leaving the rest alone
+// The x and width parameters are in blocks, not pixels
+bool FillDirty(unsigned char x, unsigned char y, unsigned char width, unsigned char height, unsigned int count, PixelFormat::Enum format, FetchByte fetch, unsigned char *buffer)
+{
+	unsigned char mask = 0;
+	unsigned char bit = 0;
+	for(unsigned char iy = y, sy = y + height; iy < sy && count; ++iy)
+	{
+		for(unsigned char ix = x, sx = x + width; ix < sx && count; ++ix)
+		{
+			if(bit == 0)
 			{
-				data = fetch((--count) > 0);
-				data = (data << 8) | data;
+				mask = fetch(true);
+				bit = 0x80;
 			}
-			else
+			
+			if(mask & bit)
 			{
-				data = fetch(true);
-				data = (data << 8) | fetch((--count) > 0);
+				Pix2x8 data;
+				if(format == PixelFormat::OneBit)
+				{
+					data = fetch((--count) > 0);
+					data = (data << 8) | data;
+				}
+				else
+				{
+					data = fetch(true);
+					data = (data << 8) | fetch((--count) > 0);
+				}
+				
+				SetPixBlock(ix, iy, data, buffer);
 			}
-			
-			SetPixBlock(ix, iy, data, buffer);
+			bit >>= 1;
 		}
 	}
+	return count == 0;
 }
 
 // Copy a block of pixels in a buffer to somewhere else
@@ -219,6 +449,42 @@ void Copy(unsigned char srcX, unsigned char srcY, unsigned char dstX, unsigned c
 	Clamp<BufferBitPlaneStride>(dstX, width);
 	Clamp<BufferHeight>(dstY, height);
 	
+	if(width == BufferBitPlaneStride)
+	{
+		// full rows are back to back in each bit-plane, so each plane is one run
+		if(srcBuffer == dstBuffer && srcY == dstY)
+		{
+			return;
+		}
+		if(height == BufferHeight)
+		{
+			CopyWholeBuffer(srcBuffer, dstBuffer);
+			return;
+		}
+		
+		const unsigned char count = height * BufferBitPlaneStride;
+		srcBuffer += srcY * BufferBitPlaneStride;
+		dstBuffer += dstY * BufferBitPlaneStride;
+		for(unsigned char i = BufferBitPlanes; i; --i, srcBuffer += BufferBitPlaneLength, dstBuffer += BufferBitPlaneLength)
+		{
+			CopyBytes(srcBuffer, dstBuffer, count);
+		}
+	}
+	else
+	{
+		CopyBlocks(srcX, srcY, dstX, dstY, width, height, srcBuffer, dstBuffer);
+	}
+}
+
+// Copy a block of pixels in a buffer to somewhere else, a block at a time
+// The x and width parameters are in blocks, not pixels
+void CopyBlocks(unsigned char srcX, unsigned char srcY, unsigned char dstX, unsigned char dstY, unsigned char width, unsigned char height, unsigned char *srcBuffer, unsigned char *dstBuffer)
+{
+	Clamp<BufferBitPlaneStride>(srcX, width);
+	Clamp<BufferHeight>(srcY, height);
+	Clamp<BufferBitPlaneStride>(dstX, width);
+	Clamp<BufferHeight>(dstY, height);
+	
 	unsigned char *bs = srcBuffer + srcY * BufferBitPlaneStride + srcX;
 	unsigned char *bd = dstBuffer + dstY * BufferBitPlaneStride + dstX;
 	for(unsigned char iy = height; iy; --iy, bs += BufferBitPlaneStride, bd += BufferBitPlaneStride)
@@ -232,6 +498,255 @@ void Copy(unsigned char srcX, unsigned char srcY, unsigned char dstX, unsigned c
 	}
 }
 
+// Splits a block of pixel values into its bit-plane bytes
+static void ExpandPixBlock(Pix2x8 val, unsigned char planes[BufferBitPlanes])
+{
+	const unsigned char low = val & 0xFF;
+	const unsigned char high = (val >> 8) & 0xFF;
+	
+	planes[0] = low | high;
+	planes[1] = high;
+	planes[2] = low & high;
+}
+
+// Merges the masked bits of 8 pixels (msb first, one byte per bit-plane) into a buffer row starting at pixel x
+// When x isn't block aligned the pixels spill over into the next block, and anything past the end of the row is dropped
+static void StorePixels(unsigned char *row, unsigned char x, const unsigned char planes[BufferBitPlanes], unsigned char mask)
+{
+	const unsigned char block = x >> 3;
+	if(block >= BufferBitPlaneStride)
+	{
+		return;
+	}
+	
+	const unsigned char shift = x & 7;
+	const unsigned char leftMask = mask >> shift;
+	const unsigned char rightMask = block + 1 < BufferBitPlaneStride ? (unsigned char)(mask << (8 - shift)) : 0;
+	row += block;
+	for(unsigned char i = 0; i < BufferBitPlanes; ++i, row += BufferBitPlaneLength)
+	{
+		row[0] = (row[0] & ~leftMask) | ((planes[i] >> shift) & leftMask);
+		if(rightMask)
+		{
+			row[1] = (row[1] & ~rightMask) | ((unsigned char)(planes[i] << (8 - shift)) & rightMask);
+		}
+	}
+}
+
+// Mask for the first count pixels of a block
+static unsigned char LeadingPixelMask(unsigned char count)
+{
+	return count < 8 ? (unsigned char)(0xFF << (8 - count)) : 0xFF;
+}
+
+// Set a rect of pixels in a buffer to the given data (read from the serial port)
+// The x and width parameters are in pixels
+void FillPixels(unsigned char x, unsigned char y, unsigned char width, unsigned char height, PixelFormat::Enum format, FetchByte fetch, unsigned char *buffer)
+{
+	unsigned char count = ((width + 7) >> 3) * height;
+	unsigned char *row = buffer + y * BufferBitPlaneStride;
+	for(unsigned char iy = y, sy = y + height; iy < sy; ++iy, row += BufferBitPlaneStride)
+	{
+		for(unsigned char ix = 0; ix < width; ix += 8)
+		{
+			--count;
+			Pix2x8 data;
+			if(format == PixelFormat::OneBit)
+			{
+				data = fetch(count > 0);
+				data = (data << 8) | data;
+			}
+			else
+			{
+				data = fetch(true);
+				data = (data << 8) | fetch(count > 0);
+			}
+			
+			if(iy < BufferHeight)
+			{
+				unsigned char planes[BufferBitPlanes];
+				ExpandPixBlock(data, planes);
+				StorePixels(row, x + ix, planes, LeadingPixelMask(width - ix));
+			}
+		}
+	}
+}
+
+// Set a rect of pixels in a buffer to a particular value
+// The x and width parameters are in pixels
+void SolidFillPixels(unsigned char x, unsigned char y, unsigned char width, unsigned char height, Pix2x8 val, unsigned char *buffer)
+{
+	Clamp<BufferStrideWidth>(x, width);
+	Clamp<BufferHeight>(y, height);
+	if(width == 0)
+	{
+		return;
+	}
+	
+	unsigned char planes[BufferBitPlanes];
+	ExpandPixBlock(val, planes);
+	
+	const unsigned char first = x >> 3;
+	const unsigned char last = (x + width - 1) >> 3;
+	const unsigned char leftMask = 0xFF >> (x & 7);
+	const unsigned char rightMask = 0xFF << (7 - ((x + width - 1) & 7));
+	
+	unsigned char *b0 = buffer + y * BufferBitPlaneStride + first;
+	for(unsigned char iy = height; iy; --iy, b0 += BufferBitPlaneStride)
+	{
+		buffer = b0;
+		for(unsigned char ib = first; ib <= last; ++ib, ++buffer)
+		{
+			unsigned char mask = 0xFF;
+			if(ib == first)
+			{
+				mask &= leftMask;
+			}
+			if(ib == last)
+			{
+				mask &= rightMask;
+			}
+			
+			unsigned char *plane = buffer;
+			for(unsigned char i = 0; i < BufferBitPlanes; ++i, plane += BufferBitPlaneLength)
+			{
+				*plane = (*plane & ~mask) | (planes[i] & mask);
+			}
+		}
+	}
+}
+
+// Copy a rect of pixels in a buffer to somewhere else
+// The x and width parameters are in pixels
+void CopyPixels(unsigned char srcX, unsigned char srcY, unsigned char dstX, unsigned char dstY, unsigned char width, unsigned char height, unsigned char *srcBuffer, unsigned char *dstBuffer)
+{
+	Clamp<BufferStrideWidth>(srcX, width);
+	Clamp<BufferHeight>(srcY, height);
+	Clamp<BufferStrideWidth>(dstX, width);
+	Clamp<BufferHeight>(dstY, height);
+	if(width == 0 || height == 0)
+	{
+		return;
+	}
+	
+	// each row is staged before it's written, and moving down within a buffer goes bottom up, so overlapping rects work out
+	signed char step = BufferBitPlaneStride;
+	if(srcBuffer == dstBuffer && dstY > srcY)
+	{
+		srcY += height - 1;
+		dstY += height - 1;
+		step = -step;
+	}
+	
+	unsigned char *bs = srcBuffer + srcY * BufferBitPlaneStride;
+	unsigned char *bd = dstBuffer + dstY * BufferBitPlaneStride;
+	for(unsigned char iy = height; iy; --iy, bs += step, bd += step)
+	{
+		unsigned char staged[BufferBitPlaneStride][BufferBitPlanes];
+		for(unsigned char ix = 0, ib = 0; ix < width; ix += 8, ++ib)
+		{
+			// funnel shift the source pixels so the row starts at the msb
+			const unsigned char block = (srcX + ix) >> 3;
+			const unsigned char shift = (srcX + ix) & 7;
+			const unsigned char *plane = bs + block;
+			for(unsigned char i = 0; i < BufferBitPlanes; ++i, plane += BufferBitPlaneLength)
+			{
+				unsigned char bits = plane[0] << shift;
+				if(shift && block + 1 < BufferBitPlaneStride)
+				{
+					bits |= plane[1] >> (8 - shift);
+				}
+				staged[ib][i] = bits;
+			}
+		}
+		
+		for(unsigned char ix = 0, ib = 0; ix < width; ix += 8, ++ib)
+		{
+			StorePixels(bd, dstX + ix, staged[ib], LeadingPixelMask(width - ix));
+		}
+	}
+}
+
+// Shifts a block of pixels in a buffer over by dx pixels (-7 to 7, positive is right) and down by dy rows (negative is up)
+// The x and width parameters are in blocks, not pixels
+void Scroll(unsigned char x, unsigned char y, unsigned char width, unsigned char height, signed char dx, signed char dy, unsigned char *buffer)
+{
+	Clamp<BufferBitPlaneStride>(x, width);
+	Clamp<BufferHeight>(y, height);
+	if(width == 0 || height == 0)
+	{
+		return;
+	}
+	
+	unsigned char *b0 = buffer + y * BufferBitPlaneStride + x;
+	
+	// whole rows move first, walking away from the direction of travel so nothing is overwritten before it moves
+	unsigned char rows = dy < 0 ? -dy : dy;
+	if(rows > height)
+	{
+		rows = height;
+	}
+	if(rows)
+	{
+		const unsigned char kept = height - rows;
+		const signed char step = dy < 0 ? BufferBitPlaneStride : -BufferBitPlaneStride;
+		unsigned char *dst = dy < 0 ? b0 : b0 + (height - 1) * BufferBitPlaneStride;
+		for(unsigned char iy = kept; iy; --iy, dst += step)
+		{
+			const unsigned char *src = dst + (dy < 0 ? rows * BufferBitPlaneStride : -(rows * BufferBitPlaneStride));
+			for(unsigned char i = 0; i < BufferBitPlanes; ++i)
+			{
+				CopyBytes(src + i * BufferBitPlaneLength, dst + i * BufferBitPlaneLength, width);
+			}
+		}
+		
+		// then the rows left behind are cleared
+		for(unsigned char iy = rows; iy; --iy, dst += step)
+		{
+			for(unsigned char i = 0; i < BufferBitPlanes; ++i)
+			{
+				SetBytes(dst + i * BufferBitPlaneLength, 0, width);
+			}
+		}
+	}
+	
+	// pixels shift along each bit-plane row, carrying the bits that fall off one byte into the next
+	unsigned char shift = dx < 0 ? -dx : dx;
+	if(shift == 0 || shift > 7)
+	{
+		return;
+	}
+	const unsigned char back = 8 - shift;
+	for(unsigned char i = BufferBitPlanes; i; --i, b0 += BufferBitPlaneLength)
+	{
+		unsigned char *row = b0;
+		for(unsigned char iy = height; iy; --iy, row += BufferBitPlaneStride)
+		{
+			unsigned char carry = 0;
+			if(dx > 0)
+			{
+				buffer = row;
+				for(unsigned char ix = width; ix; --ix, ++buffer)
+				{
+					const unsigned char val = *buffer;
+					*buffer = (val >> shift) | carry;
+					carry = val << back;
+				}
+			}
+			else
+			{
+				buffer = row + width - 1;
+				for(unsigned char ix = width; ix; --ix, --buffer)
+				{
+					const unsigned char val = *buffer;
+					*buffer = (val << shift) | carry;
+					carry = val >> back;
+				}
+			}
+		}
+	}
+}
+
 // Return a block of pixels from a buffer (sending it out to the serial port, 2bpp packed)
 void ReadRect(unsigned char x, unsigned char y, unsigned char width, unsigned char height, PixelFormat::Enum format, unsigned char *buffer)
 {
@@ -252,24 +767,19 @@ void ReadRect(unsigned char x, unsigned char y, unsigned char width, unsigned ch
 // Clears a buffer to black (faster than solid fill)
 void ClearBuffer(unsigned char *buffer)
 {
-	for(unsigned char i = 0; i < BufferLength; ++i)
-	{
-		*buffer++ = 0;
-	}
+	SetBytes(buffer, 0, BufferLength);
 }
 
 // Fast copy of a buffer
 void CopyWholeBuffer(unsigned char *srcBuffer, unsigned char *dstBuffer)
 {
-	for(unsigned char i = 0; i < BufferLength; ++i)
-	{
-		*dstBuffer++ = *srcBuffer++;
-	}
+	CopyBytes(srcBuffer, dstBuffer, BufferLength);
 }
 
 // Flips the front and back buffers (latches over at the end of the frame)
-void SwapBuffers()
+void SwapBuffers(unsigned char holdFrames)
 {
+	g_DisplayReg.SwapHold = holdFrames;
 	g_DisplayReg.SwapRequest = true;
 	while(g_DisplayReg.SwapRequest)
 	{
@@ -277,12 +787,45 @@ void SwapBuffers()
 	}
 }
 
-// Commits the requested buffer swap at the end of the frame
+// True if a swap would latch at the end of this frame, without waiting out a hold or an earlier swap
+bool IsSwapReady()
+{
+	return !g_DisplayReg.SwapRequest && !g_DisplayReg.HoldCount;
+}
+
+// Lets the next swap latch at the end of the frame, cutting the current hold short
+void CancelFrameHold()
+{
+	g_DisplayReg.HoldCount = 0;
+}
+
+// Number of refresh frames output so far (wraps)
+unsigned int GetFrameCount()
+{
+	unsigned int count;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		count = g_DisplayReg.FrameCount;
+	}
+	return count;
+}
+
+// Counts down the current hold, or commits the requested buffer swap at the end of the frame
 void LatchInFrameSwap()
 {
-	if(g_DisplayReg.SwapRequest)
+	if(g_DisplayReg.HoldCount)
+	{
+		if(--g_DisplayReg.HoldPhase == 0)
+		{
+			g_DisplayReg.HoldPhase = RefreshFramesPerHold;
+			--g_DisplayReg.HoldCount;
+		}
+	}
+	else if(g_DisplayReg.SwapRequest)
 	{
 		g_DisplayReg.SwapRequest = false;
+		g_DisplayReg.HoldCount = g_DisplayReg.SwapHold;
+		g_DisplayReg.HoldPhase = RefreshFramesPerHold;
 		
 		g_DisplayReg.BufferSelect = !g_DisplayReg.BufferSelect;
 		g_DisplayReg.FrontBuffer = g_DisplayReg.BufferSelect == 0 ? g_Buffer0 : g_Buffer1;
@@ -348,13 +891,13 @@ void RunEndOfFadeAction()
 	{
 		case EndOfFadeAction::ResumeAnim:
 		{
-			g_CommandReg.AnimReadPosition = g_CommandReg.AnimBookmark;
+			RestartAnimAt(g_CommandReg.AnimBookmark);
 			g_CommandReg.AnimPlaying = AnimState::Playing;
 			break;
 		}
 		case EndOfFadeAction::RestartAnim:
 		{
-			g_CommandReg.AnimReadPosition = g_CommandReg.AnimStart;
+			RestartAnimAt(g_CommandReg.AnimStart);
 			g_CommandReg.AnimPlaying = AnimState::Playing;
 			break;
 		}
@@ -500,13 +1043,23 @@ void EnableDisplay(bool enable)
 }
 
 // Updates one segment of the display (one half a a row)
+// Runs with interrupts back on so a serial byte never waits out a whole segment, it masks itself off instead so it can't nest
 #if defined(__AVR_ATmega88PA__)
 ISR(TIMER2_COMPA_vect, ISR_BLOCK)
 #elif defined(__AVR_ATmega8A__)
 ISR(TIMER2_COMP_vect, ISR_BLOCK)
 #endif
 {
-	unsigned char y = g_RowDitherTable[g_DisplayReg.Y];
+	PROFILE_ISR_NESTING_BEGIN();
+
+#if defined(__AVR_ATmega88PA__)
+	TIMSK2 &= ~(1 << OCIE2A);
+#elif defined(__AVR_ATmega8A__)
+	TIMSK &= ~(1 << OCIE2);
+#endif
+	sei();
+
+	unsigned char y = pgm_read_byte(&g_RowDitherTable[g_DisplayReg.Y]);
 	g_DisplayReg.BufferP = g_DisplayReg.FrontBuffer + 
 		(g_DisplayReg.BitPlane * BufferBitPlaneLength) + 
 		(y * BufferBitPlaneStride) + 
@@ -799,6 +1352,11 @@ ISR(TIMER2_COMP_vect, ISR_BLOCK)
 					PumpFade();
 				
 					g_DisplayReg.FrameChanged = true;
+					++g_DisplayReg.FrameCount;
+					if(!(unsigned char)g_DisplayReg.FrameCount && g_CommandReg.Tethered)
+					{
+						--g_CommandReg.Tethered; // a host that has gone quiet gives the buttons back
+					}
 				}
 				
 				g_DisplayReg.BitPlaneHold = g_DisplayReg.GammaTable[g_DisplayReg.BitPlane];
@@ -806,7 +1364,15 @@ ISR(TIMER2_COMP_vect, ISR_BLOCK)
 		}
 	}
 
+	// back to blocking for the way out, the profile counters and the unmask can't be interrupted
+	cli();
+
+	PROFILE_ISR_NESTING_END(ProfilePoints::Scanout);
+
 #if defined(__AVR_ATmega88PA__)
 	TCNT2 = 0;
+	TIMSK2 |= (1 << OCIE2A);
+#elif defined(__AVR_ATmega8A__)
+	TIMSK |= (1 << OCIE2);
 #endif
 }
@@ -8,7 +8,7 @@
 #include <avr/pgmspace.h>
 
 // a packed block of 8 2bpp pixels broken up into 2 bit planes
-typedef unsigned int Pix2x8;
+typedef unsigned short Pix2x8;
 
 struct PixelFormat
 {
@@ -16,6 +16,8 @@ struct PixelFormat
 	{
 		OneBit,
 		TwoBits,
+		RunLength,	// 2bpp blocks in runs, see Fill
+		XorDelta,	// 2bpp blocks xor'd into the buffer, with runs of unchanged blocks skipped, see Fill
 	};
 };
 
@@ -46,15 +48,20 @@ enum
 {
 #if defined(__AVR_ATmega88PA__)
 	BufferWidth = 48,											// pixels across
+	RefreshRate = 186,											// refresh frames a second with the default gamma timings (see notes_88pa.md)
 #elif defined(__AVR_ATmega8A__)
 	BufferWidth = 36,											// pixels across
+	RefreshRate = 236,											// refresh frames a second with the default gamma timings (see notes_8a.md)
 #endif
 	BufferHeight = 12,											// pixels tall
 	BufferBitPlanes = 3,										// unpacked bit-planes, 2 bits -> black + 3 gray levels
 	BufferBitPlaneStride = (BufferWidth + 7) / 8,				// bit-planes are 1bbp
+	BufferStrideWidth = BufferBitPlaneStride * 8,				// pixels across a bit-plane row, including the padding past BufferWidth
 	BufferBitPlaneLength = BufferBitPlaneStride * BufferHeight,	// full bit-plane size
 	BufferLength = BufferBitPlaneLength * BufferBitPlanes,		// full unpacked frame buffer size
-	BufferCount = 2,											// buffers in the swap chain (front/back)
+	HoldRate = 62,												// Swap hold counts a second
+	RefreshFramesPerHold = (RefreshRate + HoldRate / 2) / HoldRate,	// refresh frames per Swap hold count (3 on the 88PA, 4 on the 8A)
+	TetherTicks = RefreshRate * 10 / 256,						// 256 refresh frame ticks (~10 s) the buttons leave the slots alone for after a host command
 	
 	BrightnessLevels = 256										// brightness look up table size
 };
@@ -67,10 +74,16 @@ struct DisplayState
 	unsigned char Half;											// current side of the output row (scan lines are split in half)
 	unsigned char BitPlane;										// currently displaying bit-plane index
 	unsigned char BitPlaneHold;									// remaining count on current bit-plane
+#if defined(__AVR_ATmega8A__)
 	unsigned char SoftwarePWMHold;								// remaining count for brightness control timing this cycle
-	unsigned char SoftwarePWMPeriod;							// the count per cycle for brightness control timing
+	unsigned char SoftwarePWMPeriod;							// the count per cycle for brightness control timing (the 88PA has OC0B for it)
+#endif
 	const unsigned char *BufferP;								// points at the next 8 pixels to go out
 	volatile bool FrameChanged;									// true if frame just changed
+	volatile unsigned int FrameCount;							// refresh frames output so far (wraps)
+	volatile unsigned char HoldCount;							// hold counts left before the next swap can latch
+	unsigned char HoldPhase;									// refresh frames left in the current hold count
+	unsigned char SwapHold;										// hold count that goes with the requested swap
 	volatile bool TimeoutAllowUpdate;							// true if timeout counter can change
 	unsigned char TimeoutTrigger;								// idle frame count threshold
 	unsigned char TimeoutCounter;								// idle frames so far...
@@ -88,18 +101,82 @@ struct DisplayState
 extern DisplayState g_DisplayReg;
 extern const unsigned char g_RowDitherTable[BufferHeight];
 
+// Clamps a span along an axis to the bounds [0, Extent)
+template<unsigned char Extent> void Clamp(unsigned char &pos, unsigned char &size)
+{
+	if(pos >= Extent)
+	{
+		size = 0;
+		pos = Extent - 1;
+	}
+	
+	if(pos + size > Extent)
+	{
+		unsigned char delta = (pos + size) - Extent;
+		if(delta > size)
+		{
+			size = 0;
+		}
+		else
+		{
+			size -= delta;
+		}
+	}
+}
+
 // Set a block of pixels in a buffer to a particular value
 // The x and width parameters are in blocks, not pixels
 void SolidFill(unsigned char x, unsigned char y, unsigned char width, unsigned char height, Pix2x8 val, unsigned char *buffer = g_DisplayReg.BackBuffer);
 
+// Set a block of pixels in a buffer to a particular value, a block at a time
+// SolidFill uses this for partial rows, and the full row path has to match it bit for bit
+// The x and width parameters are in blocks, not pixels
+void SolidFillBlocks(unsigned char x, unsigned char y, unsigned char width, unsigned char height, Pix2x8 val, unsigned char *buffer);
+
 // Set a block of pixels in a buffer to the given data (read from the serial port)
+// RunLength and XorDelta data is a series of runs, each starting with a control byte whose low 7 bits are the block count - 1
+//   RunLength: high bit set repeats the single 2bpp block that follows, clear is followed by that many 2bpp blocks
+//   XorDelta: high bit set skips over unchanged blocks, clear is followed by that many 2bpp blocks to xor into the buffer
+//     a stream that ends on a skip gets one padding byte after it, so the last byte fetched is never a control byte
 // The x and width parameters are in blocks, not pixels
 void Fill(unsigned char x, unsigned char y, unsigned char width, unsigned char height, PixelFormat::Enum format, FetchByte fetch, unsigned char *buffer = g_DisplayReg.BackBuffer);
 
+// Set only the flagged blocks of a rect to the given data (read from the serial port), leaving the rest alone
+// Each run of 8 blocks (row-major across the rect) starts with a mask byte, msb first, followed by the data for the flagged blocks
+// The stream ends with the last flagged block, so trailing mask bytes are never sent
+// The x and width parameters are in blocks, not pixels
+// Returns false if the rect ran out before count blocks were read
+bool FillDirty(unsigned char x, unsigned char y, unsigned char width, unsigned char height, unsigned int count, PixelFormat::Enum format, FetchByte fetch, unsigned char *buffer = g_DisplayReg.BackBuffer);
+
 // Copy a block of pixels in a buffer to somewhere else
 // The x and width parameters are in blocks, not pixels
 void Copy(unsigned char srcX, unsigned char srcY, unsigned char dstX, unsigned char dstY, unsigned char width, unsigned char height, unsigned char *srcBuffer, unsigned char *dstBuffer);
 
+// Copy a block of pixels in a buffer to somewhere else, a block at a time
+// Copy uses this for partial rows, and the full row path has to match it bit for bit
+// The x and width parameters are in blocks, not pixels
+void CopyBlocks(unsigned char srcX, unsigned char srcY, unsigned char dstX, unsigned char dstY, unsigned char width, unsigned char height, unsigned char *srcBuffer, unsigned char *dstBuffer);
+
+// Set a rect of pixels in a buffer to the given data (read from the serial port)
+// Each row is (width + 7) / 8 OneBit or TwoBits blocks, starting from the msb of the first one, and the unused bits of the last block are ignored
+// Pixels off the edge of the buffer are read and dropped
+// The x and width parameters are in pixels
+void FillPixels(unsigned char x, unsigned char y, unsigned char width, unsigned char height, PixelFormat::Enum format, FetchByte fetch, unsigned char *buffer = g_DisplayReg.BackBuffer);
+
+// Set a rect of pixels in a buffer to a particular value
+// The value is a pattern lined up with the buffer's blocks, not with the rect
+// The x and width parameters are in pixels
+void SolidFillPixels(unsigned char x, unsigned char y, unsigned char width, unsigned char height, Pix2x8 val, unsigned char *buffer = g_DisplayReg.BackBuffer);
+
+// Copy a rect of pixels in a buffer to somewhere else (overlapping rects within a buffer are fine)
+// The x and width parameters are in pixels
+void CopyPixels(unsigned char srcX, unsigned char srcY, unsigned char dstX, unsigned char dstY, unsigned char width, unsigned char height, unsigned char *srcBuffer, unsigned char *dstBuffer);
+
+// Shifts a block of pixels in a buffer over by dx pixels (-7 to 7, positive is right) and down by dy rows (negative is up)
+// The pixels scrolled in are black, and the ones scrolled out of the block are lost
+// The x and width parameters are in blocks, not pixels
+void Scroll(unsigned char x, unsigned char y, unsigned char width, unsigned char height, signed char dx, signed char dy, unsigned char *buffer = g_DisplayReg.BackBuffer);
+
 // Return a block of pixels from a buffer (sending it out to the serial port, 2bpp packed)
 void ReadRect(unsigned char x, unsigned char y, unsigned char width, unsigned char height, PixelFormat::Enum format, unsigned char *buffer = g_DisplayReg.BackBuffer);
 
@@ -110,7 +187,19 @@ void ClearBuffer(unsigned char *buffer = g_DisplayReg.BackBuffer);
 void CopyWholeBuffer(unsigned char *srcBuffer, unsigned char *dstBuffer);
 
 // Flips the front and back buffers (latches over at the end of the frame)
-void SwapBuffers();
+// The swap waits for the last one's hold to run out, then stays up for at least 1 + holdFrames * RefreshFramesPerHold refresh frames
+// Returns once the back buffer is free to draw to, so the hold overlaps with drawing the next frame
+// Swaps from the serial port and anims check IsSwapReady first and wait in the main loop, so only a Swap inside a CommandList waits in here
+void SwapBuffers(unsigned char holdFrames = 0);
+
+// True if a swap would latch at the end of this frame, without waiting out a hold or an earlier swap
+bool IsSwapReady();
+
+// Lets the next swap latch at the end of the frame, cutting the current hold short
+void CancelFrameHold();
+
+// Number of refresh frames output so far (wraps)
+unsigned int GetFrameCount();
 
 // Sets the overall image brightness (latches over at the end of the frame)
 void SetBrightness(unsigned char brightness);
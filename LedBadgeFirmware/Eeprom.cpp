@@ -1,6 +1,9 @@
 #include "Eeprom.h"
 
 #include "I2C.h"
+#include "Serial.h"
+#include "Commands.h"
+#include "Profile.h"
 #include <avr/sfr_defs.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
@@ -18,32 +21,170 @@
 
 #define EEPROM_I2C_ADDR		0xA0
 
-// Writes a byte to the on chip persistent memory
+enum
+{
+	StreamFifoSize = 4,		// bytes the anim stream reads ahead (power of 2)
+	WriteBufferSize = 32,	// bytes staged at a time (power of 2), so an off chip page goes out in two halves
+	InternalSkipsPerInterrupt = 4,	// unchanged bytes the write queue compares before it lets other interrupts in
+};
+
+// Staging for whichever memory is being written, there isn't the ram for one each
+// The internal queue owns it while it holds bytes, and the external writer while it has bytes staged or a page going out
+static unsigned char s_WriteBuffer[WriteBufferSize];
+
+// Anim read that fills a fifo from the TWI interrupt
+struct ExternalStream
+{
+	I2CTransaction Read;					// the read filling the fifo, when it isn't busy the fifo is either full or stalled on an error
+											// it's the only transaction for the off chip memory, ReadExternalEEPROM and the page writes borrow it
+	unsigned int Address;					// address of the next byte handed out
+	unsigned char Reading;					// bytes asked for by the read
+	unsigned char ReadPos;					// oldest byte in the fifo
+	volatile unsigned char Count;			// bytes in the fifo
+	unsigned char Fifo[StreamFifoSize];
+};
+
+static ExternalStream s_ExternalStream;
+
+// Page write staged for the off chip memory
+struct ExternalWrite
+{
+	unsigned int Address;					// address of the first staged byte, or of the last bytes to go out
+	unsigned char Staged;					// bytes staged in s_WriteBuffer, there is only room up to the end of the half page
+	volatile bool HalfPending;				// the first half of the page went out on its own, and gets reported along with the rest
+	volatile unsigned char HalfStatus;		// how that half went (PageWriteStatus)
+};
+
+static ExternalWrite s_ExternalWrite;
+
+// Run of bytes in a row waiting to be written to the on chip memory, drained by the EE_READY interrupt
+struct InternalWrite
+{
+	unsigned int Address;					// address of the oldest queued byte
+	unsigned char ReadPos;					// oldest queued byte in s_WriteBuffer
+	volatile unsigned char Count;			// bytes queued
+};
+
+static InternalWrite s_InternalWrite;
+
+static void WaitForExternalEEPROM(const I2CTransaction *t);
+
+// Queues a byte to be written to the on chip persistent memory
+// Only blocks if the queue is full, or the byte doesn't follow on from the ones already queued
 void WriteInternalEEPROM(unsigned int addr, unsigned char data)
 {
-	// wait until the memory has finished it's previous operation
-	while(EECR & (1 << EE_PENDING_BUSY)) { }
+	addr &= EepromInternalSize - 1;
+	
+	bool follows;
+	ATOMIC_BLOCK(ATOMIC_FORCEON)
+	{
+		follows = s_InternalWrite.Count && addr == ((s_InternalWrite.Address + s_InternalWrite.Count) & (EepromInternalSize - 1));
+	}
+
+	if(!follows)
+	{
+		while(s_InternalWrite.Count)
+		{
+			PumpAck();
+		}
+
+		// take the buffer back from the external writer
+		FlushExternalEEPROM();
+		WaitForExternalEEPROM(&s_ExternalStream.Read);
 		
-	EEAR = addr;
-	EEDR = data;
+		s_InternalWrite.Address = addr;
+		s_InternalWrite.ReadPos = 0;
+	}
+
+	while(s_InternalWrite.Count == WriteBufferSize)
+	{
+		PumpAck();
+	}
 	
 	ATOMIC_BLOCK(ATOMIC_FORCEON)
 	{
-		EECR |= (1 << EE_FLUSH_DATA);
-		EECR |= (1 << EE_PENDING_BUSY);
+		s_WriteBuffer[(s_InternalWrite.ReadPos + s_InternalWrite.Count) & (WriteBufferSize - 1)] = data;
+		++s_InternalWrite.Count;
+		EECR |= (1 << EERIE);
+	}
+}
+
+// Starts writing the next queued byte that differs from what the memory already holds
+// Unchanged bytes are skipped, so rewriting mostly the same data is quicker and wears the cells less
+static void WriteNextInternalByte()
+{
+	for(unsigned char i = 0; i < InternalSkipsPerInterrupt; ++i)
+	{
+		if(!s_InternalWrite.Count)
+		{
+			EECR &= ~(1 << EERIE);
+			return;
+		}
+		
+		unsigned char data = s_WriteBuffer[s_InternalWrite.ReadPos];
+		EEAR = s_InternalWrite.Address;
+		s_InternalWrite.ReadPos = (s_InternalWrite.ReadPos + 1) & (WriteBufferSize - 1);
+		s_InternalWrite.Address = (s_InternalWrite.Address + 1) & (EepromInternalSize - 1);
+		--s_InternalWrite.Count;
+		
+		EECR |= (1 << EERE);
+		unsigned char current = EEDR;
+		if(current != data)
+		{
+			EEDR = data;
+#if defined(__AVR_ATmega88PA__)
+			// erasing or only clearing bits takes half the time of a full erase and write
+			unsigned char mode = data == 0xFF ? (1 << EEPM0) : (current & data) == data ? (1 << EEPM1) : 0;
+			EECR = (1 << EERIE) | mode;
+#endif
+			EECR |= (1 << EE_FLUSH_DATA);
+			EECR |= (1 << EE_PENDING_BUSY);
+			return;
+		}
 	}
+	
+	// still more to compare, the interrupt comes straight back after anything else pending has had a turn
+}
+
+ISR(EE_READY_vect)
+{
+	PROFILE_NESTED_BEGIN();
+	WriteNextInternalByte();
+	PROFILE_NESTED_END();
 }
 
 // Reads a byte from the on chip persistent memory
+// Bytes still queued come straight from the queue, anything else only waits for the byte being written (not the whole queue)
 unsigned char ReadInternalEEPROM(unsigned int addr)
 {
-	// wait until the memory has finished it's previous operation
-	while(EECR & (1 << EE_PENDING_BUSY)) { }
-	
-	EEAR = addr;
-	
-	EECR |= (1 << EERE);
-	return EEDR;
+	addr &= EepromInternalSize - 1;
+	for(;;)
+	{
+		ATOMIC_BLOCK(ATOMIC_FORCEON)
+		{
+			// queued bytes are newer than what the memory holds
+			unsigned int offset = (addr - s_InternalWrite.Address) & (EepromInternalSize - 1);
+			if(offset < s_InternalWrite.Count)
+			{
+				return s_WriteBuffer[(s_InternalWrite.ReadPos + offset) & (WriteBufferSize - 1)];
+			}
+
+			if(!(EECR & (1 << EE_PENDING_BUSY)))
+			{
+				EEAR = addr;
+				EECR |= (1 << EERE);
+				unsigned char data = EEDR;
+				if(s_InternalWrite.Count)
+				{
+					EECR |= (1 << EERIE);
+				}
+				return data;
+			}
+
+			// the queue holds off until the read is done, otherwise it starts on the next byte the moment this one finishes
+			EECR &= ~(1 << EERIE);
+		}
+	}
 }
 
 // Initial setup for the off chip memory
@@ -72,81 +213,236 @@ void ResetExternalEEPROM()
 	StopI2C();*/
 }
 
-// Begins writing a sequence of bytes to the off chip memory
-// This will block while the off chip memory is busy in an internal write state
-void BeginWriteExternalEEPROM(unsigned int addr)
+// Blocks until a transaction has gone out
+static void WaitForExternalEEPROM(const I2CTransaction *t)
+{
+	while(IsI2CBusy(t))
+	{
+		PumpAck();
+	}
+}
+
+// The same, for the middle of a response - packets coming in are still checked, but their acks wait
+static void WaitForExternalRead(const I2CTransaction *t)
 {
-	for(;;) // need to keep polling this if it doesn't respond; it may be in an internal write cycle
+	while(IsI2CBusy(t))
 	{
-		StartI2C();
-		WriteI2C(EEPROM_I2C_ADDR | TW_WRITE);
-		if(TW_STATUS != TW_MT_SLA_NACK)
+		PumpPacketCheck();
+	}
+}
+
+static void StartPageWrite(bool firstHalf);
+static void ReportHalfPage();
+
+// Stages a byte to be written to the off chip memory
+// Bytes in a row go out half a page at a time, in the background, once they reach the end of a half (or the next byte goes elsewhere)
+// The bus is held after a first half, so the rest of the page carries on in the same page write
+// This only blocks while the last half is still going out, and each page answers with a ResponseCodes::PageWritten when it's done
+void WriteExternalEEPROM(unsigned int addr, unsigned char data)
+{
+	addr &= EepromExternalSize - 1;
+	if(s_ExternalWrite.Staged && addr != s_ExternalWrite.Address + s_ExternalWrite.Staged)
+	{
+		FlushExternalEEPROM();
+	}
+
+	if(!s_ExternalWrite.Staged)
+	{
+		// the internal write queue has to let go of the buffer
+		while(s_InternalWrite.Count)
+		{
+			PumpAck();
+		}
+
+		// the last half has to be out, and whatever the stream read ahead could be about to change, so it stops reading until this is out too
+		WaitForExternalEEPROM(&s_ExternalStream.Read);
+		s_ExternalStream.Count = 0;
+
+		if(addr != ((s_ExternalWrite.Address | (WriteBufferSize - 1)) + 1))
+		{
+			ReportHalfPage(); // the rest of its page isn't coming
+		}
+		s_ExternalWrite.Address = addr;
+	}
+
+	s_WriteBuffer[s_ExternalWrite.Staged++] = data;
+	if(!((addr + 1) & (WriteBufferSize - 1)))
+	{
+		StartPageWrite((addr + 1) & (EepromExternalPageSize - 1));
+	}
+}
+
+static PageWriteStatus::Enum GetPageWriteStatus(const I2CTransaction *t)
+{
+	return t->Status == I2CStatus::Done ? PageWriteStatus::Ok :
+		t->Status == I2CStatus::Nack ? PageWriteStatus::NoAnswer : PageWriteStatus::BusError;
+}
+
+// Tells the host how the page went, a failed first half wins over how the rest of it went
+static void PageWriteDone(I2CTransaction *t)
+{
+	unsigned char status = GetPageWriteStatus(t);
+	if(s_ExternalWrite.HalfPending)
+	{
+		if(s_ExternalWrite.HalfStatus != PageWriteStatus::Ok)
 		{
-			WriteI2C((addr >> 8) & 0xFF);
-			WriteI2C(addr & 0xFF);
-			break;
+			status = s_ExternalWrite.HalfStatus;
 		}
-		StopI2C();
+		s_ExternalWrite.HalfPending = false;
 	}
+	QueueResponse((ResponseCodes::PageWritten << 4) | status, s_ExternalWrite.Address / EepromExternalPageSize);
+}
+
+// Holds on to how the first half of a page went, until the rest of it is out
+static void HalfPageWriteDone(I2CTransaction *t)
+{
+	s_ExternalWrite.HalfStatus = GetPageWriteStatus(t);
 }
 
-// Stuff a byte
-void WriteNextByteToExternalEEPROM(unsigned char data, bool moreBytes)
+// Writes a first half that the rest of its page didn't follow, and tells the host about it, once it's out
+static void ReportHalfPage()
 {
-	WriteI2C(data);
-	if(!moreBytes)
+	if(s_ExternalWrite.HalfPending && !IsI2CBusy(&s_ExternalStream.Read))
 	{
-		StopI2C();
+		ReleaseI2C();
+		s_ExternalWrite.HalfPending = false;
+		QueueResponse((ResponseCodes::PageWritten << 4) | s_ExternalWrite.HalfStatus, s_ExternalWrite.Address / EepromExternalPageSize);
 	}
 }
 
-// Do a burst write to the off chip memory
-// A maximum of 64 bytes can be written at a time (to a window aligned to a multiple of 64 bytes)
-unsigned char WriteExternalEEPROMPage(unsigned int addr, unsigned char count, unsigned char *data)
+// Sends the staged bytes off on the shared transaction, which has to be free
+// Anything queued after it waits for the memory to finish its internal write cycle
+static void StartPageWrite(bool firstHalf)
 {
-	unsigned char maxWrite = 64 - (count & 63);
-	if (count > maxWrite)
+	I2CTransaction &t = s_ExternalStream.Read;
+	t.Data = s_WriteBuffer;
+	t.Address = s_ExternalWrite.Address;
+	t.Count = s_ExternalWrite.Staged;
+	t.Device = EEPROM_I2C_ADDR;
+	t.Flags = firstHalf ? I2CFlags::Hold : 0;
+	t.Done = firstHalf ? HalfPageWriteDone : PageWriteDone;
+	if(firstHalf)
 	{
-		count = maxWrite;
+		s_ExternalWrite.HalfPending = true;
 	}
-	unsigned char written = count;
+	s_ExternalWrite.Staged = 0;
+	QueueI2C(&t);
+}
 
-	BeginWriteExternalEEPROM(addr);
-	while(count--)
+// Writes out a partly staged page, reads do this for themselves
+void FlushExternalEEPROM()
+{
+	if(!s_ExternalWrite.Staged)
 	{
-		WriteNextByteToExternalEEPROM(*data++, count > 0);
+		ReportHalfPage();
+		return;
 	}
 
-	return written;
+	StartPageWrite(false);
 }
 
 // Do a burst read from the off chip memory
+// The read is left open, so reading on from the next address later doesn't have to seek
+// Nothing else goes out over the serial port while this waits, so it can be used in the middle of a response
 void ReadExternalEEPROM(unsigned int addr, unsigned char count, unsigned char *data)
 {
-	BeginReadExternalEEPROM(addr);
-	while(count--)
+	FlushExternalEEPROM();
+
+	// borrows the stream's transaction, the fifo keeps what it has and reads on again the next time the stream is read from
+	I2CTransaction &t = s_ExternalStream.Read;
+	WaitForExternalRead(&t);
+	t.Data = data;
+	t.Address = addr;
+	t.Count = count;
+	t.Device = EEPROM_I2C_ADDR;
+	t.Flags = I2CFlags::Read | I2CFlags::Hold;
+	t.Done = 0;
+	QueueI2C(&t);
+	WaitForExternalRead(&t);
+}
+
+static void StreamReadDone(I2CTransaction *t);
+
+// Reads into the free space in the fifo (up to where it wraps), if the read isn't already busy
+// Called from both the main thread and the interrupt
+static void FillExternalEEPROMStream()
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		unsigned char count = s_ExternalStream.Count;
+		if(IsI2CBusy(&s_ExternalStream.Read) || count == StreamFifoSize || s_ExternalWrite.Staged)
+		{
+			return;
+		}
+
+		unsigned char writePos = (s_ExternalStream.ReadPos + count) & (StreamFifoSize - 1);
+		unsigned char space = StreamFifoSize - writePos;
+		if(space > StreamFifoSize - count)
+		{
+			space = StreamFifoSize - count;
+		}
+
+		s_ExternalStream.Read.Data = &s_ExternalStream.Fifo[writePos];
+		s_ExternalStream.Read.Address = (s_ExternalStream.Address + count) & (EepromExternalSize - 1);
+		s_ExternalStream.Read.Count = space;
+		s_ExternalStream.Read.Device = EEPROM_I2C_ADDR;
+		s_ExternalStream.Read.Flags = I2CFlags::Read | I2CFlags::Hold;
+		s_ExternalStream.Read.Done = StreamReadDone;
+		s_ExternalStream.Reading = space;
+		QueueI2C(&s_ExternalStream.Read);
+	}
+}
+
+// Hands the bytes that came in to the fifo, and keeps reading if there is room
+static void StreamReadDone(I2CTransaction *t)
+{
+	s_ExternalStream.Count += s_ExternalStream.Reading - t->Count;
+	if(t->Status == I2CStatus::Done)
 	{
-		*data++ = ReadNextByteFromExternalEEPROM(count != 0);
+		FillExternalEEPROMStream();
 	}
 }
 
-// Begins a read sequence from the off chip memory
-// This may block if the memory is currently in an internal write state
-void BeginReadExternalEEPROM(unsigned int addr)
+// Streams bytes from the off chip memory starting at addr, for reading anims
+// The stream reads ahead in the background, so this only seeks if addr isn't the next byte of the stream
+void SeekExternalEEPROMStream(unsigned int addr)
 {
-	BeginWriteExternalEEPROM(addr); // dummy write is required to seek the read cursor
-	StartI2C();
-	WriteI2C(EEPROM_I2C_ADDR | TW_READ);
+	addr &= EepromExternalSize - 1;
+	if(addr == s_ExternalStream.Address && (s_ExternalStream.Count || IsI2CBusy(&s_ExternalStream.Read)))
+	{
+		return;
+	}
+
+	FlushExternalEEPROM();
+	WaitForExternalEEPROM(&s_ExternalStream.Read);
+	s_ExternalStream.Address = addr;
+	s_ExternalStream.ReadPos = 0;
+	s_ExternalStream.Count = 0;
+	FillExternalEEPROMStream();
+}
+
+// Gets the next byte of the stream, without moving past it
+unsigned char PeekExternalEEPROMStream()
+{
+	while(!s_ExternalStream.Count)
+	{
+		FlushExternalEEPROM();
+		FillExternalEEPROMStream(); // only does anything if the last read failed, or a write emptied the fifo
+		PumpAck();
+	}
+	return s_ExternalStream.Fifo[s_ExternalStream.ReadPos];
 }
 
-// Grab a byte
-unsigned char ReadNextByteFromExternalEEPROM(bool moreBytes)
+// Gets the next byte of the stream, and reads ahead to replace it
+unsigned char ReadExternalEEPROMStream()
 {
-	BeginReadI2C(moreBytes);
-	unsigned char c = EndReadI2C();
-	if(!moreBytes)
+	unsigned char data = PeekExternalEEPROMStream();
+	s_ExternalStream.ReadPos = (s_ExternalStream.ReadPos + 1) & (StreamFifoSize - 1);
+	s_ExternalStream.Address = (s_ExternalStream.Address + 1) & (EepromExternalSize - 1);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		StopI2C();
+		--s_ExternalStream.Count;
 	}
-	return c;
+	FillExternalEEPROMStream();
+	return data;
 }
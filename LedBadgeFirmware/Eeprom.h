@@ -6,13 +6,16 @@
 enum
 {
 	EepromInternalSize = 0x0200,
-	EepromExternalSize = 0x4000
+	EepromExternalSize = 0x4000,
+	EepromExternalPageSize = 64		// most bytes one write can take (to a window aligned to a multiple of 64 bytes)
 };
 
-// Writes a byte to the on chip persistent memory
+// Queues a byte to be written to the on chip persistent memory, from the EE_READY interrupt
+// Bytes that already hold the value aren't rewritten, and this only blocks once 32 bytes are queued, or the byte doesn't follow on from the queued ones
 void WriteInternalEEPROM(unsigned int addr, unsigned char data);
 
 // Reads a byte from the on chip persistent memory
+// Queued writes are read back from the queue, so this waits at most one byte's write, and never sends anything over the serial port (so it can be used in the middle of a response)
 unsigned char ReadInternalEEPROM(unsigned int addr);
 
 // Initial setup for the off chip memory
@@ -21,25 +24,27 @@ void ConfigureExternalEEPROM();
 // Soft reset the off chip memory
 void ResetExternalEEPROM();
 
-// Begins writing a sequence of bytes to the off chip memory
-// This will block while the off chip memory is busy in an internal write state
-void BeginWriteExternalEEPROM(unsigned int addr);
+// Stages a byte to be written to the off chip memory
+// Bytes in a row are written half a page at a time, in the background, once they reach the end of a half (or the next byte goes elsewhere)
+// This only blocks while the last half is still going out, and each page answers with a ResponseCodes::PageWritten when it's done
+void WriteExternalEEPROM(unsigned int addr, unsigned char data);
 
-// Stuff a byte
-void WriteNextByteToExternalEEPROM(unsigned char data, bool moreBytes);
-
-// Do a burst write to the off chip memory
-// A maximum of 64 bytes can be written at a time (to a window aligned to a multiple of 64 bytes)
-unsigned char WriteExternalEEPROMPage(unsigned int addr, unsigned char count, unsigned char *data);
+// Writes out a partly staged page, reads do this for themselves
+void FlushExternalEEPROM();
 
 // Do a burst read from the off chip memory
+// The read is left open, so reading on from the next address later doesn't have to seek
+// Nothing else goes out over the serial port while this waits, so it can be used in the middle of a response
 void ReadExternalEEPROM(unsigned int addr, unsigned char count, unsigned char *data);
 
-// Begins a read sequence from the off chip memory
-// This may block if the memory is currently in an internal write state
-void BeginReadExternalEEPROM(unsigned int addr);
+// Streams bytes from the off chip memory starting at addr, for reading anims
+// The stream reads ahead in the background, so this only seeks if addr isn't the next byte of the stream
+void SeekExternalEEPROMStream(unsigned int addr);
+
+// Gets the next byte of the stream, without moving past it
+unsigned char PeekExternalEEPROMStream();
 
-// Grab a byte
-unsigned char ReadNextByteFromExternalEEPROM(bool moreBytes);
+// Gets the next byte of the stream, and reads ahead to replace it
+unsigned char ReadExternalEEPROMStream();
 
 #endif /* EEPROM_H_ */
\ No newline at end of file
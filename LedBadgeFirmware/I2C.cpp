@@ -1,6 +1,36 @@
 #include "I2C.h"
+#include "Profile.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
 #include <util/twi.h>
-#include <util/delay_basic.h>
+
+enum
+{
+	TwiGo = (1 << TWINT) | (1 << TWEN) | (1 << TWIE),	// clears the interrupt flag, which starts the next step
+};
+
+struct I2CPhase
+{
+	enum Enum
+	{
+		Idle,				// stopped, nothing queued
+		Parked,				// stopped in the middle of a held read or write, nothing queued
+		Addressing,			// writing the slave and memory addresses, then the data for a write
+		Reading,			// reading the data
+		Releasing,			// nacking the byte after a held read, so the slave lets go of the bus
+		Finishing,			// running a Done callback
+	};
+};
+
+static I2CTransaction *volatile s_I2CQueue;		// the transaction on the bus, followed by the ones waiting
+static I2CTransaction *s_I2CQueueTail;
+static volatile unsigned char s_I2CPhase = I2CPhase::Idle;
+static unsigned char s_I2CAddressBytes;			// memory address bytes sent so far
+static unsigned char s_I2CPolls;				// times the slave didn't answer, it doesn't while busy with a write cycle
+static bool s_I2CHeld;							// the last transaction was held, so the slave is waiting to send or take more
+static unsigned char s_I2CHeldDevice;			// with TW_READ or TW_WRITE for the held direction
+static unsigned int s_I2CHeldAddress;			// where the held transaction carries on from
 
 // Sets up I2C IO
 // Called once at program start
@@ -17,68 +47,232 @@ void ConfigureI2C()
 	TWCR = (1 << TWEN);
 }
 
-// Blocks until ACK/NACK from slave
-void WaitForI2C()
+// Acks the byte coming in unless it's the last one, so the slave knows to stop
+static unsigned char AckIfMore(const I2CTransaction *t)
 {
-	while (!(TWCR & (1 << TWINT))) {}
+	return (t->Count > 1 || (t->Flags & I2CFlags::Hold)) ? (1 << TWEA) : 0;
 }
 
-// Sends start signal
-void StartI2C()
+// Starts whatever is at the head of the queue
+// stop is (1 << TWSTO) if the last transaction still has the bus, and 0 if it's already stopped (or held)
+static void StartNextI2C(unsigned char stop)
 {
-	TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWSTA);
-	WaitForI2C();
-}
+	I2CTransaction *t = s_I2CQueue;
+	if(s_I2CHeld)
+	{
+		if(!t)
+		{
+			// turn off the interrupt, but leave its flag set to keep the clock stretched until something is queued
+			s_I2CPhase = I2CPhase::Parked;
+			TWCR = (1 << TWEN);
+			return;
+		}
 
-// Sends stop signal
-void StopI2C()
-{
-	TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWSTO);
-#if defined(__AVR_ATmega88PA__)
-	_delay_loop_1(20); // ~60us @ 12MHz
-#elif defined(__AVR_ATmega8A__)
-	_delay_loop_1(13); // ~60us @ 8MHz
-#endif
-}
+		s_I2CHeld = false;
+		unsigned char direction = (t->Flags & I2CFlags::Read) ? TW_READ : TW_WRITE;
+		if(t->Count && (t->Device | direction) == s_I2CHeldDevice && t->Address == s_I2CHeldAddress)
+		{
+			t->Status = I2CStatus::Busy;
+			if(direction == TW_READ)
+			{
+				s_I2CPhase = I2CPhase::Reading;
+				TWCR = TwiGo | AckIfMore(t);
+			}
+			else
+			{
+				s_I2CPhase = I2CPhase::Addressing;
+				s_I2CAddressBytes = 2;
+				TWDR = *t->Data++;
+				++t->Address;
+				--t->Count;
+				TWCR = TwiGo;
+			}
+			return;
+		}
 
-// Begin writing an asynchronous byte, without blocking
-void BeginWriteI2C(unsigned char data)
-{
-	TWDR = data;
-	TWCR = (1 << TWINT) | (1 << TWEN);
+		if(s_I2CHeldDevice & TW_READ)
+		{
+			t->Status = I2CStatus::Busy;
+			s_I2CPhase = I2CPhase::Releasing;
+			TWCR = TwiGo;
+			return;
+		}
+
+		// a held write only needs its stop
+		stop = (1 << TWSTO);
+	}
+
+	if(!t)
+	{
+		s_I2CPhase = I2CPhase::Idle;
+		TWCR = stop ? (1 << TWINT) | (1 << TWEN) | stop : (1 << TWEN);
+		return;
+	}
+
+	t->Status = I2CStatus::Busy;
+	s_I2CPhase = I2CPhase::Addressing;
+	s_I2CAddressBytes = 0;
+	s_I2CPolls = 0;
+	TWCR = TwiGo | stop | (1 << TWSTA); // with a stop, the start goes out as soon as it's done
 }
 
-// Finish writing an asynchronous byte, blocking if needed
-void EndWriteI2C()
+// Retires the transaction at the head of the queue and moves on
+static void FinishI2C(I2CStatus::Enum status)
 {
-	WaitForI2C();
+	I2CTransaction *t = s_I2CQueue;
+	s_I2CQueue = t->Next;
+	s_I2CPhase = I2CPhase::Finishing;
+	t->Status = status;
+	if(t->Done)
+	{
+		t->Done(t);
+	}
+	StartNextI2C(s_I2CHeld ? 0 : (1 << TWSTO));
 }
 
-// Synchronously write a byte
-void WriteI2C(unsigned char data)
+// Adds a transaction to the end of the queue, without blocking
+// It runs from the TWI interrupt, so nothing finishes while interrupts are off
+void QueueI2C(I2CTransaction *t)
 {
-	BeginWriteI2C(data);
-	EndWriteI2C();
+	t->Next = 0;
+	t->Status = I2CStatus::Queued;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(s_I2CQueue)
+		{
+			s_I2CQueueTail->Next = t;
+		}
+		else
+		{
+			s_I2CQueue = t;
+		}
+		s_I2CQueueTail = t;
+
+		if(s_I2CPhase == I2CPhase::Idle || s_I2CPhase == I2CPhase::Parked)
+		{
+			while(TWCR & (1 << TWSTO)) {} // the last stop has to be out before the next start
+			StartNextI2C(0);
+		}
+	}
 }
 
-// Begin reading an asynchronous byte, without blocking
-// Set the ack flag to true to continue reading more bytes after this one
-void BeginReadI2C(bool ack)
+// Checks if a transaction is still queued or on the bus
+bool IsI2CBusy(const I2CTransaction *t)
 {
-	TWCR = (1 << TWINT) | (1 << TWEN) | (ack << TWEA);
+	return t->Status >= I2CStatus::Queued;
 }
 
-// Finish reading an asynchronous byte, blocking if needed
-unsigned char EndReadI2C()
+// Sends the stop for a held write if nothing is queued behind it, so the slave starts its write cycle
+void ReleaseI2C()
 {
-	WaitForI2C();
-	return TWDR;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(s_I2CPhase == I2CPhase::Parked && !(s_I2CHeldDevice & TW_READ))
+		{
+			s_I2CHeld = false;
+			s_I2CPhase = I2CPhase::Idle;
+			TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWSTO);
+		}
+	}
 }
 
-// Synchronously read a byte
-// Set the ack flag to true to continue reading more bytes after this one
-unsigned char ReadI2C(bool ack)
+ISR(TWI_vect)
 {
-	BeginReadI2C(ack);
-	return EndReadI2C();
+	PROFILE_NESTED_BEGIN();
+	I2CTransaction *t = s_I2CQueue;
+	unsigned char status = TW_STATUS;
+	switch(status)
+	{
+	case TW_START:
+	case TW_REP_START:
+		TWDR = t->Device | (s_I2CPhase == I2CPhase::Reading ? TW_READ : TW_WRITE);
+		TWCR = TwiGo;
+		break;
+
+	case TW_MT_SLA_ACK:
+	case TW_MT_DATA_ACK:
+		if(s_I2CAddressBytes < 2)
+		{
+			TWDR = s_I2CAddressBytes++ ? t->Address & 0xFF : (t->Address >> 8) & 0xFF;
+			TWCR = TwiGo;
+		}
+		else if(!t->Count)
+		{
+			if((t->Flags & (I2CFlags::Read | I2CFlags::Hold)) == I2CFlags::Hold)
+			{
+				// no stop, the slave holds on to what it has been sent so far
+				s_I2CHeld = true;
+				s_I2CHeldDevice = t->Device | TW_WRITE;
+				s_I2CHeldAddress = t->Address;
+			}
+			FinishI2C(I2CStatus::Done);
+		}
+		else if(t->Flags & I2CFlags::Read)
+		{
+			// the address write only seeks, the read needs a repeated start
+			s_I2CPhase = I2CPhase::Reading;
+			TWCR = TwiGo | (1 << TWSTA);
+		}
+		else
+		{
+			TWDR = *t->Data++;
+			++t->Address;
+			--t->Count;
+			TWCR = TwiGo;
+		}
+		break;
+
+	case TW_MT_SLA_NACK:
+		// the eeprom doesn't answer while it's in a write cycle, so keep asking until it does (ack polling)
+		if(++s_I2CPolls)
+		{
+			TWCR = TwiGo | (1 << TWSTO) | (1 << TWSTA);
+		}
+		else
+		{
+			FinishI2C(I2CStatus::Nack);
+		}
+		break;
+
+	case TW_MR_SLA_ACK:
+		TWCR = TwiGo | AckIfMore(t);
+		break;
+
+	case TW_MR_DATA_ACK:
+	case TW_MR_DATA_NACK:
+		if(s_I2CPhase == I2CPhase::Releasing)
+		{
+			// the slave let go, the transaction at the head still has to be started
+			StartNextI2C(1 << TWSTO);
+			break;
+		}
+
+		*t->Data++ = TWDR;
+		++t->Address;
+		if(--t->Count)
+		{
+			TWCR = TwiGo | AckIfMore(t);
+		}
+		else
+		{
+			if(status == TW_MR_DATA_ACK)
+			{
+				s_I2CHeld = true;
+				s_I2CHeldDevice = t->Device | TW_READ;
+				s_I2CHeldAddress = t->Address;
+			}
+			FinishI2C(I2CStatus::Done);
+		}
+		break;
+
+	case TW_MT_DATA_NACK:
+	case TW_MR_SLA_NACK:
+		FinishI2C(I2CStatus::Nack);
+		break;
+
+	default:
+		FinishI2C(I2CStatus::BusError);
+		break;
+	}
+	PROFILE_NESTED_END();
 }
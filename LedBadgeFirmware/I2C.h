@@ -1,37 +1,54 @@
 #ifndef I2C_H_
 #define I2C_H_
 
+struct I2CStatus
+{
+	enum Enum
+	{
+		Done,				// everything was moved
+		Nack,				// the slave stopped answering (or never did, after all of the ack polls)
+		BusError,			// the bus did something unexpected
+		Queued,				// waiting for the transactions ahead of it
+		Busy,				// on the bus now
+	};
+};
+
+struct I2CFlags
+{
+	enum Enum
+	{
+		Read = 0x01,		// reads Count bytes after writing the address, instead of writing them
+		Hold = 0x02,		// keeps the bus after the last byte, so a read or write that picks up at the next address carries on without seeking
+							// a held write doesn't start the slave's write cycle until the bus is let go of (see ReleaseI2C)
+	};
+};
+
+// A transfer to or from an address on a slave (so far the external eeprom is the only one)
+// The caller owns it, and must leave it alone while it's queued or busy
+struct I2CTransaction
+{
+	I2CTransaction *Next;					// transaction queued behind this one
+	void (*Done)(I2CTransaction *t);		// called from the interrupt once finished (can be null), it's free to queue more
+	unsigned char *Data;					// bytes to write, or where the read bytes go, moves along as they do
+	unsigned int Address;					// 2 byte address written ahead of the data, moves along with the data
+	unsigned char Count;					// bytes left to move
+	unsigned char Device;					// slave address, TW_READ or TW_WRITE gets added
+	unsigned char Flags;					// I2CFlags
+	volatile unsigned char Status;			// I2CStatus
+};
+
 // Sets up I2C IO
 // Called once at program start
 void ConfigureI2C();
 
-// Blocks until ACK/NACK from slave
-void WaitForI2C();
-
-// Sends start signal
-void StartI2C();
-
-// Sends stop signal
-void StopI2C();
-
-// Begin writing an asynchronous byte, without blocking
-void BeginWriteI2C(unsigned char data);
-
-// Finish writing an asynchronous byte, blocking if needed
-void EndWriteI2C();
-
-// Synchronously write a byte
-void WriteI2C(unsigned char data);
-
-// Begin reading an asynchronous byte, without blocking
-// Set the ack flag to true to continue reading more bytes after this one
-void BeginReadI2C(bool ack);
+// Adds a transaction to the end of the queue, without blocking
+// It runs from the TWI interrupt, so nothing finishes while interrupts are off
+void QueueI2C(I2CTransaction *t);
 
-// Finish reading an asynchronous byte, blocking if needed
-unsigned char EndReadI2C();
+// Checks if a transaction is still queued or on the bus
+bool IsI2CBusy(const I2CTransaction *t);
 
-// Synchronously read a byte
-// Set the ack flag to true to continue reading more bytes after this one
-unsigned char ReadI2C(bool ack);
+// Sends the stop for a held write if nothing is queued behind it, so the slave starts its write cycle
+void ReleaseI2C();
 
-#endif /* I2C_H_ */
\ No newline at end of file
+#endif /* I2C_H_ */
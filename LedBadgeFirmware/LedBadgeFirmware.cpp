@@ -5,6 +5,7 @@
 #include "Serial.h"
 #include "I2C.h"
 #include "Eeprom.h"
+#include "Profile.h"
 
 int main(void)
 {
@@ -14,9 +15,12 @@ int main(void)
 	ConfigureUART();
 	ConfigureI2C();
 	ConfigureExternalEEPROM();
-	InitAnim();
+#ifdef ENABLE_PROFILING
+	ConfigureProfiling();
+#endif
 	
 	sei();
+	InitAnim(); // the external eeprom is read from the TWI interrupt
 	
 	for(;;)
     {
@@ -31,6 +35,23 @@ int main(void)
 			ResetIdleTime();
 		}
 
+		if(!g_CommandReg.Tethered)
+		{
+			// running on its own, so the buttons flip through the anim slots (apart from any the slot branches on)
+			unsigned char pressed = PollButtonPresses() & ~g_CommandReg.AnimButtons;
+			if(pressed)
+			{
+				CycleAnimSlot(pressed & 0x1 ? 1 : -1);
+				ResetIdleTime();
+			}
+		}
+
 		PumpAck();
+#ifdef ENABLE_EXTERNAL_EEPROM
+		if(!GetPendingSerialDataSize())
+		{
+			FlushExternalEEPROM(); // the last page of an upload that stopped coming in
+		}
+#endif
 	}
 }
@@ -0,0 +1,127 @@
+#include "Profile.h"
+
+#ifdef ENABLE_PROFILING
+
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#if defined(__AVR_ATmega88PA__)
+	#define PR_TIMER_MASK_REG	TIMSK1
+	#define PR_TIMER_FLAG_REG	TIFR1
+#elif defined(__AVR_ATmega8A__)
+	#define PR_TIMER_MASK_REG	TIMSK
+	#define PR_TIMER_FLAG_REG	TIFR
+#endif
+
+static ProfileCounter g_ProfileCounters[ProfilePoints::Count];
+static volatile unsigned int g_ProfileOverflows = 0;
+static unsigned short g_ProfileNestedCycles = 0; // only touched with interrupts off
+
+// Sets up the profiling timer and clears the counters
+// Called once at program start
+void ConfigureProfiling()
+{
+	ResetProfileCounters();
+
+	// free running at the cpu clock, overflow extends the count to 32 bits
+	TCCR1A = 0;
+	TCCR1B = (1 << CS10);
+	PR_TIMER_MASK_REG |= (1 << TOIE1);
+}
+
+// Clears all of the counters
+void ResetProfileCounters()
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for(unsigned char i = 0; i < ProfilePoints::Count; ++i)
+		{
+			g_ProfileCounters[i].Count = 0;
+			g_ProfileCounters[i].Min = 0xFFFF;
+			g_ProfileCounters[i].Max = 0;
+			g_ProfileCounters[i].Total = 0;
+		}
+	}
+}
+
+// Takes a consistent copy of a counter
+void ReadProfileCounter(unsigned char point, ProfileCounter &counter)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		counter = g_ProfileCounters[point];
+	}
+
+	if(counter.Count == 0)
+	{
+		counter.Min = 0;
+	}
+}
+
+// Adds a sample to a counter (out of range points are ignored)
+void RecordProfileSample(unsigned char point, unsigned long cycles)
+{
+	if(point >= ProfilePoints::Count)
+	{
+		return;
+	}
+
+	ProfileCounter &counter = g_ProfileCounters[point];
+	unsigned int clamped = cycles > 0xFFFF ? 0xFFFF : cycles;
+	if(clamped < counter.Min)
+	{
+		counter.Min = clamped;
+	}
+	if(clamped > counter.Max)
+	{
+		counter.Max = clamped;
+	}
+
+	// freeze the average rather than letting either half of it wrap
+	if(counter.Count != 0xFFFF && counter.Total + cycles >= counter.Total)
+	{
+		++counter.Count;
+		counter.Total += cycles;
+	}
+}
+
+// 32 bit cycle count, extended by the Timer1 overflow interrupt
+unsigned long GetProfileTimestamp()
+{
+	unsigned int low;
+	unsigned int high;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		low = TCNT1;
+		high = g_ProfileOverflows;
+
+		// an overflow that hasn't been serviced yet belongs to this reading if the count has already wrapped
+		if((PR_TIMER_FLAG_REG & (1 << TOV1)) && low < 0x8000)
+		{
+			++high;
+		}
+	}
+	return ((unsigned long)high << 16) | low;
+}
+
+// Adds up the time spent in blocking interrupt handlers (it wraps), so one that lets them in can leave them out of its own
+// Hands back the cycles it was given
+unsigned short AddNestedProfileCycles(unsigned short cycles)
+{
+	g_ProfileNestedCycles += cycles;
+	return cycles;
+}
+
+unsigned short GetNestedProfileCycles()
+{
+	return g_ProfileNestedCycles;
+}
+
+ISR(TIMER1_OVF_vect, ISR_BLOCK)
+{
+	PROFILE_NESTED_BEGIN();
+	g_ProfileOverflows = g_ProfileOverflows + 1;
+	PROFILE_NESTED_END();
+}
+
+#endif // ENABLE_PROFILING
@@ -0,0 +1,87 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include "Commands.h"
+
+#include <avr/io.h>
+
+// Samples the cost of the interrupt handlers and serial commands with Timer1 (running at the cpu clock)
+// Takes over Timer1 and its overflow interrupt, and eats ~180 bytes of ram for the counters, so it is off by default
+//#define ENABLE_PROFILING
+
+// Indices for the counters in the stats block
+struct ProfilePoints
+{
+	enum Enum
+	{
+		Scanout,			// display refresh interrupt
+		SerialRx,			// serial receive interrupt
+		FirstCommand,		// one counter per SerialCommands entry from here on
+
+		Count = FirstCommand + SerialCommands::Count
+	};
+};
+
+// Stats for one profile point, in cpu cycles
+struct ProfileCounter
+{
+	unsigned int Count;		// number of samples in Total (stops accumulating before either one would overflow)
+	unsigned int Min;		// shortest sample
+	unsigned int Max;		// longest sample (saturates at 0xFFFF)
+	unsigned long Total;	// sum of the samples
+};
+
+#ifdef ENABLE_PROFILING
+
+// Sets up the profiling timer and clears the counters
+// Called once at program start
+void ConfigureProfiling();
+
+// Clears all of the counters
+void ResetProfileCounters();
+
+// Takes a consistent copy of a counter
+void ReadProfileCounter(unsigned char point, ProfileCounter &counter);
+
+// Adds a sample to a counter (out of range points are ignored)
+void RecordProfileSample(unsigned char point, unsigned long cycles);
+
+// 32 bit cycle count, extended by the Timer1 overflow interrupt
+unsigned long GetProfileTimestamp();
+
+// Adds up the time spent in blocking interrupt handlers (it wraps), so one that lets them in can leave them out of its own
+// Hands back the cycles it was given
+unsigned short AddNestedProfileCycles(unsigned short cycles);
+unsigned short GetNestedProfileCycles();
+
+// Bracket the body of a blocking interrupt handler (Timer1 can't wrap more than once in there)
+#define PROFILE_ISR_BEGIN() unsigned short profileStart = TCNT1
+#define PROFILE_ISR_END(point) RecordProfileSample((point), AddNestedProfileCycles(TCNT1 - profileStart))
+
+// Bracket a blocking interrupt handler without a counter of its own, so it can still be left out of one it lands in
+#define PROFILE_NESTED_BEGIN() unsigned short profileStart = TCNT1
+#define PROFILE_NESTED_END() AddNestedProfileCycles(TCNT1 - profileStart)
+
+// Bracket the body of an interrupt handler that turns interrupts back on, anything that comes in on top of it is left out
+// (their entry and exit still count, they happen before and after the cycles they add up)
+#define PROFILE_ISR_NESTING_BEGIN() unsigned short profileStart = TCNT1; unsigned short profileNested = GetNestedProfileCycles()
+#define PROFILE_ISR_NESTING_END(point) RecordProfileSample((point), (unsigned short)(TCNT1 - profileStart - (unsigned short)(GetNestedProfileCycles() - profileNested)))
+
+// Bracket main thread work that can be interrupted and run long
+#define PROFILE_BEGIN() unsigned long profileStart = GetProfileTimestamp()
+#define PROFILE_END(point) RecordProfileSample((point), GetProfileTimestamp() - profileStart)
+
+#else
+
+#define PROFILE_ISR_BEGIN()
+#define PROFILE_ISR_END(point)
+#define PROFILE_NESTED_BEGIN()
+#define PROFILE_NESTED_END()
+#define PROFILE_ISR_NESTING_BEGIN()
+#define PROFILE_ISR_NESTING_END(point)
+#define PROFILE_BEGIN()
+#define PROFILE_END(point)
+
+#endif // ENABLE_PROFILING
+
+#endif /* PROFILE_H_ */
@@ -1,13 +1,25 @@
 #include "Serial.h"
 #include "Commands.h"
 #include "Display.h"
+#include "Profile.h"
 #include <util/atomic.h>
 #include <util/crc16.h>
 
 enum
 {
-	AckBufferSize = 16,
-	AckPacketFlag = (0)
+	AckBufferSize = 8,			// a packet only commits while there is room for its ack
+	AckPacketFlag = (0),
+	AckCreditFlag = (1 << 2),	// a byte with GetFreeSerialSpace follows the cookie
+	TxBufferSize = 16,		// most responses fit, only ReadRect/ReadMemory dumps wait on the port
+	BaudConfirmFrames = RefreshRate,	// 1 second of refresh frames for the host to get a packet through at a new rate
+	BaudDoubleSpeedFlag = 0x80,	// U2X bit in the top byte of a rate
+	CheckQueueSize = 2,			// received packets waiting on their data crc
+	CheckPosMask = CheckQueueSize * 2 - 1,	// check queue positions count to twice the size, so every slot can be used and a full queue still differs from an empty one
+	CheckBytesPerPump = 32,		// bounds how long a PumpAck spends on the crc, it gets called from wait loops
+	PacketSentinel = 0xA5,		// plain packet
+	SequencedSentinel = 0xA6,	// packet with a sequence number, has to come in order
+	RestartSentinel = 0xA7,		// sequenced packet that starts the count over at its own number
+	SequenceWindow = 128,		// sequence numbers up to this far behind the next one expected are repeats
 };
 
 struct SerialState 
@@ -16,7 +28,8 @@ struct SerialState
 	{
 		Waiting,
 		Header,
-		Body
+		Body,
+		Skip				// throwing away the body of a packet that is out of sequence
 	};
 };
 
@@ -24,7 +37,8 @@ struct PacketHeader
 {
 	unsigned char Cookie;
 	unsigned char Length;
-	unsigned int PacketCRC;
+	unsigned short PacketCRC;
+	unsigned char Sequence;	// only there for the sequenced sentinels
 };
 
 struct PendingAck
@@ -33,42 +47,108 @@ struct PendingAck
 	unsigned char Cookie;
 };
 
+struct PendingPacket
+{
+	unsigned char End;
+	unsigned char Cookie;
+	unsigned short PacketCRC;
+	unsigned char Sequence;
+	bool Sequenced;
+};
+
 // Circular read buffer that the input interrupt can fill out while pixels are being pushed out
-// Transactioned with a pending write-position/size
+// Transactioned with a pending write-position, the main thread moves the committed write-position up once a packet's crc checks out
 static unsigned char g_SerialBuffer[256] __attribute__ ((section (".serialBuffer")));
 static volatile unsigned char g_SerialReadPos = 0;
 static volatile unsigned char g_SerialWritePos = 0;
-static volatile unsigned char g_SerialPendingWritePos = 0;
-static volatile unsigned char g_SerialCount = 0;
-static volatile unsigned char g_SerialPendingCount = 0;
+static unsigned char g_SerialPendingWritePos = 0;	// only touched by the interrupt, or with it held off
+static unsigned char g_SerialPacketStart = 0;		// where the packet being received began, an overrun rewinds to it
+
+// Circular buffer of received packets - pushed from the serial interrupt, checked and committed from the main thread
+// Slots are the positions masked with CheckQueueSize - 1
+static PendingPacket g_SerialCheckQueue[CheckQueueSize];
+static volatile unsigned char g_SerialCheckReadPos = 0;
+static volatile unsigned char g_SerialCheckWritePos = 0;
+
+// Low nibble remainders for the header's crc8 (ccitt, 0x07 polynomial), two lookups a byte instead of the 8 step loop
+static const unsigned char g_Crc8NibbleTable[16] PROGMEM =
+{
+	0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15, 0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D
+};
 
 // Circular buffer for responses - pushed from the serial interrupt, sent from the main thread
 static PendingAck g_SerialAckQueue[AckBufferSize];
 static volatile unsigned char g_SerialAckReadPos = 0;
 static volatile unsigned char g_SerialAckWritePos = 0;
+static bool g_SerialCreditAcks = false;
+
+// Circular buffer for outgoing data - pushed from the main thread, sent from the data register empty interrupt
+static unsigned char g_SerialTxBuffer[TxBufferSize];
+static volatile unsigned char g_SerialTxReadPos = 0;
+static volatile unsigned char g_SerialTxWritePos = 0;
 
-static volatile SerialState::Enum g_SerialState = SerialState::Waiting;
-static volatile union
+// Rate negotiation - UBRR high nibble with the U2X flag, then UBRR low, for the current and the last confirmed rate
+static unsigned char g_SerialRate[2];
+static unsigned char g_SerialFallbackRate[2];
+static volatile bool g_SerialRateProbation = false;
+static unsigned int g_SerialRateChangedAt;
+
+// Packet framing state, only touched by the interrupt (or with it held off) so it doesn't need to be volatile
+static SerialState::Enum g_SerialState = SerialState::Waiting;
+static union
 {
 	PacketHeader Header;
-	unsigned char Buffer[4];
+	unsigned char Buffer[5];
 } g_SerialPacketHeader;
-static volatile unsigned char g_SerialPacketHeaderBufferPos = 0;
-static volatile unsigned char g_SerialHeaderRunningCRC = 0;
-static volatile unsigned int g_SerialRunningCRC = 0;
+static unsigned char g_SerialPacketSentinel = 0;
+static unsigned char g_SerialPacketHeaderLength = 0;
+static unsigned char g_SerialPacketHeaderBufferPos = 0;
+static unsigned char g_SerialHeaderRunningCRC = 0;
+
+// Sequenced packets - the next number expected, and whether the host has already been told to resend from it
+static unsigned char g_SerialNextSequence = 0;
+static bool g_SerialSequenceReported = false;
+
+// Plain packets thrown away, see GetLostPacketCount
+static volatile unsigned char g_SerialLostPackets = 0;
+
+// Data crc of the oldest packet in the check queue, run a few bytes at a time from the main thread
+static unsigned char g_SerialCheckPos = 0;
+static unsigned short g_SerialCheckCRC = 0xFFFF;
 
 #if defined(__AVR_ATmega88PA__)
 	#define UR_CTRL_REG_A	UCSR0A
+	#define UR_CTRL_REG_B	UCSR0B
+	#define UR_BAUD_HIGH	UBRR0H
+	#define UR_BAUD_LOW		UBRR0L
 	#define UR_RX_COMPLETE	RXC0
+	#define UR_TX_COMPLETE	TXC0
+	#define UR_DOUBLE_SPEED	U2X0
 	#define UR_DATA_BUFFER	UDR0
 	#define UR_DATA_EMPTY	UDRE0
+	#define UR_DATA_EMPTY_IE	UDRIE0
 	#define UR_RX_vect		USART_RX_vect
+	#define UR_UDRE_vect	USART_UDRE_vect
 #elif defined(__AVR_ATmega8A__)
 	#define UR_CTRL_REG_A	UCSRA
+	#define UR_CTRL_REG_B	UCSRB
+	#define UR_BAUD_HIGH	UBRRH
+	#define UR_BAUD_LOW		UBRRL
 	#define UR_RX_COMPLETE	RXC
+	#define UR_TX_COMPLETE	TXC
+	#define UR_DOUBLE_SPEED	U2X
 	#define UR_DATA_BUFFER	UDR
 	#define UR_DATA_EMPTY	UDRE
+	#define UR_DATA_EMPTY_IE	UDRIE
 	#define UR_RX_vect		USART_RXC_vect
+	#define UR_UDRE_vect	USART_UDRE_vect
+#endif
+
+#if defined(LEDBADGE_SIM)
+	// the host simulator only charges register accesses, so the ram-only wait loops charge their polling by hand
+	#define CHARGE_WAIT_LOOP(cycles) SimAdvance(cycles)
+#else
+	#define CHARGE_WAIT_LOOP(cycles)
 #endif
 
 // Sets up serial IO
@@ -90,6 +170,68 @@ void ConfigureUART()
 	UCSRB = (1 << RXEN) | (1 << TXEN) | (1 << RXCIE);
 	UCSRC = (1 << URSEL) | (1 << UCSZ0) | (1 << UCSZ1); // 8 bits, 1 stop bits 
 #endif
+
+	g_SerialRate[0] = 0;
+	g_SerialRate[1] = 12;
+}
+
+// Loads a rate into the baud rate generator, between bytes in both directions
+static void ApplyBaudRate(const unsigned char *rate)
+{
+	UR_BAUD_HIGH = rate[0] & 0xF;
+	UR_BAUD_LOW = rate[1]; // the low byte write is what reloads the prescaler
+	UR_CTRL_REG_A = (rate[0] & BaudDoubleSpeedFlag) ? (1 << UR_DOUBLE_SPEED) : 0;
+}
+
+// Switches the port over to a new rate (UBRR high nibble with U2X in the top bit, then UBRR low)
+// Sends a Setting response with the new rate, and waits for it and anything else already queued up to go out at the old rate
+// Falls back to the old rate if an intact packet header doesn't show up at the new rate within BaudConfirmFrames
+void ChangeBaudRate(unsigned char u2x_ubrrH, unsigned char ubrrL)
+{
+	// the answer is the last thing the host hears at the old rate, any acks after it wait for the new one
+	FlushAcks();
+	WriteSerialData((ResponseCodes::Setting << 4) | Settings::BaudRate);
+	WriteSerialData(u2x_ubrrH);
+	WriteSerialData(ubrrL);
+
+	// TXC is cleared with every byte sent, so it only comes up once the last one is out of the shift register
+	while(g_SerialTxReadPos != g_SerialTxWritePos || !(UR_CTRL_REG_A & (1 << UR_TX_COMPLETE)))
+	{
+		CHARGE_WAIT_LOOP(4);
+	}
+
+	ATOMIC_BLOCK(ATOMIC_FORCEON)
+	{
+		g_SerialFallbackRate[0] = g_SerialRate[0];
+		g_SerialFallbackRate[1] = g_SerialRate[1];
+		g_SerialRate[0] = u2x_ubrrH;
+		g_SerialRate[1] = ubrrL;
+		ApplyBaudRate(g_SerialRate);
+		g_SerialRateChangedAt = g_DisplayReg.FrameCount;
+		g_SerialRateProbation = true;
+	}
+}
+
+// Gets the current rate, in the same layout as ChangeBaudRate
+void GetBaudRate(unsigned char &u2x_ubrrH, unsigned char &ubrrL)
+{
+	u2x_ubrrH = g_SerialRate[0];
+	ubrrL = g_SerialRate[1];
+}
+
+// Goes back to the last confirmed rate if the host never showed up at the new one
+static void PumpBaudRateProbation()
+{
+	if(g_SerialRateProbation && (unsigned int)(GetFrameCount() - g_SerialRateChangedAt) > BaudConfirmFrames)
+	{
+		ATOMIC_BLOCK(ATOMIC_FORCEON)
+		{
+			g_SerialRate[0] = g_SerialFallbackRate[0];
+			g_SerialRate[1] = g_SerialFallbackRate[1];
+			ApplyBaudRate(g_SerialRate);
+			g_SerialRateProbation = false;
+		}
+	}
 }
 
 // Read a byte from the serial port
@@ -102,62 +244,364 @@ unsigned char ReadSerialData()
 		PumpAck();
 	}
 	
-	unsigned char data;	
-	ATOMIC_BLOCK(ATOMIC_FORCEON)
+	// the interrupt only compares against the read position, so it can move up as soon as the byte is out
+	unsigned char readPos = g_SerialReadPos;
+	unsigned char data = g_SerialBuffer[readPos];
+	_MemoryBarrier();
+	g_SerialReadPos = readPos + 1;
+	
+	return data;
+}
+
+// Gets the run of received bytes that can be read in place, up to the end of the ring buffer
+// Will block until at least one byte is in, and the bytes stay in the buffer until they are released
+unsigned char PeekSerialData(const unsigned char *&data)
+{
+	while(g_SerialReadPos == g_SerialWritePos)
 	{
-		--g_SerialCount;
-		--g_SerialPendingCount;
-		data = g_SerialBuffer[g_SerialReadPos++];
+		PumpAck();
 	}
 	
-	return data;
+	// only committed bytes, the rest of a packet may still fail its crc check
+	unsigned char readPos = g_SerialReadPos;
+	unsigned char count = g_SerialWritePos - readPos;
+	if(readPos + count > sizeof(g_SerialBuffer))
+	{
+		count = sizeof(g_SerialBuffer) - readPos; // the rest comes from the next peek
+	}
+	data = g_SerialBuffer + readPos;
+	return count;
+}
+
+// Consumes the first count bytes of the run from PeekSerialData
+void ReleaseSerialData(unsigned char count)
+{
+	// a single byte store, so the interrupt sees the whole run freed up at once
+	unsigned char readPos = g_SerialReadPos + count;
+	_MemoryBarrier();
+	g_SerialReadPos = readPos;
+}
+
+// Space left in the outgoing ring buffer
+static unsigned char GetFreeTxSpace()
+{
+	return (g_SerialTxReadPos - g_SerialTxWritePos - 1) & (TxBufferSize - 1);
 }
 
 // Write a byte to the serial port
 // Will block if the output buffer is full
 void WriteSerialData(unsigned char data)
 {
-	// Wait for the output buffer to free up
-	while(!(UR_CTRL_REG_A & (1 << UR_DATA_EMPTY))) { }
-	UR_DATA_BUFFER = data;
+	// back pressure - a full ring waits on the interrupt to make room, responses are never dropped
+	unsigned char next = (g_SerialTxWritePos + 1) & (TxBufferSize - 1);
+	while(next == g_SerialTxReadPos)
+	{
+		PumpPacketCheck(); // keeps packets coming in behind a long response from backing up the check queue (their acks wait for FlushAcks)
+	}
+
+	g_SerialTxBuffer[g_SerialTxWritePos] = data;
+	g_SerialTxWritePos = next;
+
+	// the interrupt turns itself off once the ring drains
+	UR_CTRL_REG_B |= (1 << UR_DATA_EMPTY_IE);
 }
 
 // Gets the total number of bytes that can be read without blocking
 unsigned char GetPendingSerialDataSize()
 {
-	return g_SerialCount;
+	return g_SerialWritePos - g_SerialReadPos;
+}
+
+// Gets the number of bytes that can still come in before the input buffer overruns, counting packets that are only partly in
+unsigned char GetFreeSerialSpace()
+{
+	unsigned char used;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		used = g_SerialPendingWritePos - g_SerialReadPos;
+	}
+	return 255 - used; // one slot always stays open
+}
+
+// Counts plain packets thrown away after they started coming in (it wraps), so anything waiting on their bytes can tell they aren't coming
+// Sequenced packets don't count, the host resends them
+unsigned char GetLostPacketCount()
+{
+	return g_SerialLostPackets;
+}
+
+// Turns the trailing free space byte on packet acks on or off (see Settings::FlowControl)
+void EnableCreditAcks(bool enable)
+{
+	g_SerialCreditAcks = enable;
+}
+
+bool CreditAcksEnabled()
+{
+	return g_SerialCreditAcks;
+}
+
+// Queues up a response to a packet
+// Called from the serial interrupt, or with it held off
+static inline void QueueAck(unsigned char header, unsigned char cookie)
+{
+	unsigned char writePos = g_SerialAckWritePos;
+	unsigned char nextPos = (writePos + 1) & (AckBufferSize - 1);
+	if(nextPos == g_SerialAckReadPos)
+	{
+		return; // full, the host times out on it rather than losing everything queued
+	}
+	g_SerialAckQueue[writePos].Header = header;
+	g_SerialAckQueue[writePos].Cookie = cookie;
+	g_SerialAckWritePos = nextPos;
+}
+
+// Queues up a 2 byte response to go out with the acks, for things that finish in the background
+// Can be called from any interrupt
+void QueueResponse(unsigned char header, unsigned char data)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		QueueAck(header, data);
+	}
+}
+
+// Drops back to a sequenced packet that didn't make it in, the host resends everything from it on
+// Called from the serial interrupt, or with it held off
+static inline void RewindSequence(unsigned char sequence)
+{
+	g_SerialNextSequence = sequence;
+	QueueAck((ResponseCodes::Error << 4) | ErrorCodes::SequenceGap, sequence);
+	g_SerialSequenceReported = true;
+}
+
+// Cuts the oldest packet in the check queue out of the ring, after a plain packet failed its crc
+// Everything received after it moves back over the hole, so the packets behind it still get through
+// The bulk of that is done with the interrupt running (it only ever adds bytes past the pending write position), only what comes in meanwhile moves with it held off
+static void CutCheckedPacket(unsigned char readPos, const PendingPacket &packet)
+{
+	unsigned char start = g_SerialWritePos;
+	unsigned char end = packet.End;
+	unsigned char moved;
+	ATOMIC_BLOCK(ATOMIC_FORCEON)
+	{
+		moved = g_SerialPendingWritePos - end;
+	}
+	for(unsigned char i = 0; i < moved; ++i)
+	{
+		g_SerialBuffer[(unsigned char)(start + i)] = g_SerialBuffer[(unsigned char)(end + i)];
+	}
+
+	ATOMIC_BLOCK(ATOMIC_FORCEON)
+	{
+		// a packet dropped meanwhile rewinds to its start, and whatever came in after that could have written over what was already moved
+		unsigned char received = g_SerialPendingWritePos - end;
+		unsigned char stable = g_SerialPacketStart - end;
+		for(unsigned char i = stable < moved ? stable : moved; i < received; ++i)
+		{
+			g_SerialBuffer[(unsigned char)(start + i)] = g_SerialBuffer[(unsigned char)(end + i)];
+		}
+
+		unsigned char hole = end - start;
+		g_SerialPendingWritePos = start + received;
+		g_SerialPacketStart -= hole;
+		for(readPos = (readPos + 1) & CheckPosMask; readPos != g_SerialCheckWritePos; readPos = (readPos + 1) & CheckPosMask)
+		{
+			g_SerialCheckQueue[readPos & (CheckQueueSize - 1)].End -= hole;
+		}
+
+		QueueAck((ResponseCodes::Error << 4) | ErrorCodes::CorruptPacketData, packet.Cookie);
+		++g_SerialLostPackets;
+		g_SerialCheckReadPos = (g_SerialCheckReadPos + 1) & CheckPosMask;
+		g_SerialCheckPos = start;
+		g_SerialCheckCRC = 0xFFFF;
+	}
+}
+
+// Checks the data crc of the oldest received packet, and commits it for reading if it matches
+// A bad plain packet is cut out of the ring on its own, a bad sequenced one throws out everything received after it (the host resends all of it anyway)
+// Only runs while there's room to queue its ack, FlushAcks gets that out ahead of anything its commands send back
+void PumpPacketCheck()
+{
+	CHARGE_WAIT_LOOP(3);
+	unsigned char readPos = g_SerialCheckReadPos;
+	if(readPos == g_SerialCheckWritePos || ((g_SerialAckWritePos + 1) & (AckBufferSize - 1)) == g_SerialAckReadPos)
+	{
+		return;
+	}
+
+	PendingPacket &packet = g_SerialCheckQueue[readPos & (CheckQueueSize - 1)];
+	if(packet.PacketCRC != 0)
+	{
+		unsigned char checkPos = g_SerialCheckPos;
+		unsigned short crc = g_SerialCheckCRC;
+		for(unsigned char i = 0; i < CheckBytesPerPump && checkPos != packet.End; ++i)
+		{
+			// avr-libc's version is already a byte at a time (a handful of shifts and xors, no bit loop), a 16 entry table would take more cycles and a 256 entry one 512 bytes of flash
+			crc = _crc_ccitt_update(crc, g_SerialBuffer[checkPos++]);
+		}
+		g_SerialCheckPos = checkPos;
+		g_SerialCheckCRC = crc;
+
+		if(checkPos != packet.End)
+		{
+			return;
+		}
+
+		if(crc != packet.PacketCRC && !packet.Sequenced)
+		{
+			CutCheckedPacket(readPos, packet);
+			return;
+		}
+	}
+
+	ATOMIC_BLOCK(ATOMIC_FORCEON)
+	{
+		if(packet.PacketCRC == 0 || g_SerialCheckCRC == packet.PacketCRC)
+		{
+			g_SerialWritePos = packet.End;
+			g_SerialCheckReadPos = (readPos + 1) & CheckPosMask;
+
+			// notify of success
+			if(packet.Cookie)
+			{
+				QueueAck((ResponseCodes::Ack << 4) | AckPacketFlag, packet.Cookie);
+			}
+		}
+		else
+		{
+			// failure! the packet is sequenced, the single resend request covers everything dropped behind it as well
+			RewindSequence(packet.Sequence);
+
+			// everything behind it gets dropped, including a packet that is still coming in (and any plain ones mixed in)
+			for(readPos = (readPos + 1) & CheckPosMask; readPos != g_SerialCheckWritePos; readPos = (readPos + 1) & CheckPosMask)
+			{
+				if(!g_SerialCheckQueue[readPos & (CheckQueueSize - 1)].Sequenced)
+				{
+					QueueAck((ResponseCodes::Error << 4) | ErrorCodes::ReceiveBufferOverrun, g_SerialCheckQueue[readPos & (CheckQueueSize - 1)].Cookie);
+					++g_SerialLostPackets;
+				}
+			}
+			g_SerialCheckReadPos = readPos;
+
+			if(g_SerialState == SerialState::Body)
+			{
+				if(g_SerialPacketSentinel == PacketSentinel)
+				{
+					QueueAck((ResponseCodes::Error << 4) | ErrorCodes::ReceiveBufferOverrun, g_SerialPacketHeader.Header.Cookie);
+					++g_SerialLostPackets;
+				}
+				g_SerialState = SerialState::Waiting;
+			}
+			g_SerialPendingWritePos = g_SerialWritePos;
+		}
+
+		g_SerialCheckPos = g_SerialWritePos;
+		g_SerialCheckCRC = 0xFFFF;
+	}
 }
 
 // Call periodically from the main thread to send along queued up responses
 void PumpAck()
 {
-	if(g_SerialAckReadPos != g_SerialAckWritePos)
+	CHARGE_WAIT_LOOP(4);
+	PumpBaudRateProbation();
+	PumpPacketCheck();
+
+	// only queue up an ack when all of it fits, so this never stalls behind a response that is still going out
+	if(g_SerialAckReadPos != g_SerialAckWritePos && GetFreeTxSpace() >= 3)
 	{
-		WriteSerialData(g_SerialAckQueue[g_SerialAckReadPos].Header);
+		// the credit is taken as the ack goes out rather than when it was queued, so the host gets the freshest count
+		unsigned char header = g_SerialAckQueue[g_SerialAckReadPos].Header;
+		bool credit = g_SerialCreditAcks && header == ((ResponseCodes::Ack << 4) | AckPacketFlag);
+		WriteSerialData(credit ? (header | AckCreditFlag) : header);
 		WriteSerialData(g_SerialAckQueue[g_SerialAckReadPos].Cookie);
+		if(credit)
+		{
+			WriteSerialData(GetFreeSerialSpace());
+		}
 		g_SerialAckReadPos = (g_SerialAckReadPos + 1) & (AckBufferSize - 1);
 	}
 }
 
+// Waits for every ack queued up so far to go out
+void FlushAcks()
+{
+	while(g_SerialAckReadPos != g_SerialAckWritePos)
+	{
+		PumpAck();
+	}
+}
+
+// Interrupt handler for outgoing IO
+// Feeds the next byte of the ring buffer to the transmitter, and shuts itself off when there is nothing left
+ISR(UR_UDRE_vect, ISR_BLOCK)
+{
+	PROFILE_NESTED_BEGIN();
+	unsigned char readPos = g_SerialTxReadPos;
+	if(readPos != g_SerialTxWritePos)
+	{
+		UR_CTRL_REG_A = (UR_CTRL_REG_A & (1 << UR_DOUBLE_SPEED)) | (1 << UR_TX_COMPLETE); // lets ChangeBaudRate tell when the line goes quiet
+		UR_DATA_BUFFER = g_SerialTxBuffer[readPos];
+		g_SerialTxReadPos = (readPos + 1) & (TxBufferSize - 1);
+	}
+	else
+	{
+		UR_CTRL_REG_B &= ~(1 << UR_DATA_EMPTY_IE);
+	}
+	PROFILE_NESTED_END();
+}
+
+// Steps the header crc (ccitt crc8, 0x07 polynomial) a nibble at a time through a table
+static inline unsigned char UpdateHeaderCRC(unsigned char crc, unsigned char data)
+{
+	crc ^= data;
+	crc = (crc << 4) ^ pgm_read_byte(&g_Crc8NibbleTable[crc >> 4]);
+	crc = (crc << 4) ^ pgm_read_byte(&g_Crc8NibbleTable[crc >> 4]);
+	return crc;
+}
+
+// Drops the rest of the packet being received, after the input buffer or check queue ran out of room
+// Sequenced packets rewind to resend from this one, plain packets get an overrun error
+static inline void DropPacket()
+{
+	if(g_SerialPacketSentinel == PacketSentinel)
+	{
+		QueueAck((ResponseCodes::Error << 4) | ErrorCodes::ReceiveBufferOverrun, g_SerialPacketHeader.Header.Cookie);
+		++g_SerialLostPackets;
+	}
+	else
+	{
+		RewindSequence(g_SerialPacketHeader.Header.Sequence);
+	}
+	g_SerialPendingWritePos = g_SerialPacketStart;
+}
+
 // Interrupt handler for incoming IO
-// Shovels data into the circular read buffer, once an entire packet is verified, it gets committed and is visible to the main thread
+// Shovels data into the circular read buffer, once an entire packet is in it gets queued up for the main thread to check its crc and commit
 // Packet format:
-//   Sentinel:    u8 (0xA5)
+//   Sentinel:    u8 (0xA5, or 0xA6/0xA7 for sequenced packets)
 //   Cookie:      u8
 //   Data Length: u8
 //   Data CRC:    u16
+//   Sequence:    u8 (only for 0xA6/0xA7)
 //   Header CRC:  u8
-static unsigned char s_bufferData;
+// Sequenced packets have to come in order - a repeat is acked again without being committed, a gap is reported once with
+// the number to resend from (ErrorCodes::SequenceGap) and everything up to it is thrown away. 0xA7 starts the count over.
 ISR(UR_RX_vect, ISR_BLOCK)
 {
-	s_bufferData = UR_DATA_BUFFER;
+	PROFILE_ISR_BEGIN();
+
+	unsigned char data = UR_DATA_BUFFER;
 	switch(g_SerialState)
 	{
 		case SerialState::Waiting:
 		{
-			if(s_bufferData == 0xA5)
+			if(data == PacketSentinel || data == SequencedSentinel || data == RestartSentinel)
 			{
-				g_SerialHeaderRunningCRC = s_bufferData;
+				g_SerialPacketSentinel = data;
+				g_SerialPacketHeaderLength = data == PacketSentinel ? 4 : 5;
+				g_SerialHeaderRunningCRC = data;
 				g_SerialPacketHeaderBufferPos = 0;
 				g_SerialState = SerialState::Header;
 			}
@@ -165,16 +609,51 @@ ISR(UR_RX_vect, ISR_BLOCK)
 		}
 		case SerialState::Header:
 		{
-			if(g_SerialPacketHeaderBufferPos == 4)
+			unsigned char headerPos = g_SerialPacketHeaderBufferPos;
+			if(headerPos == g_SerialPacketHeaderLength)
 			{
-				if(s_bufferData == g_SerialHeaderRunningCRC)
+				if(data == g_SerialHeaderRunningCRC)
 				{
+					g_SerialRateProbation = false; // made it through intact, so the host is on the current rate
+
+					unsigned char sentinel = g_SerialPacketSentinel;
+					if(sentinel != PacketSentinel)
+					{
+						unsigned char sequence = g_SerialPacketHeader.Header.Sequence;
+						if(sentinel == RestartSentinel)
+						{
+							g_SerialNextSequence = sequence;
+						}
+
+						unsigned char ahead = sequence - g_SerialNextSequence;
+						if(ahead == 0)
+						{
+							g_SerialNextSequence = sequence + 1;
+							g_SerialSequenceReported = false;
+						}
+						else
+						{
+							if(ahead >= SequenceWindow)
+							{
+								// a resend of something already taken in, the ack must have been lost
+								if(g_SerialPacketHeader.Header.Cookie)
+								{
+									QueueAck((ResponseCodes::Ack << 4) | AckPacketFlag, g_SerialPacketHeader.Header.Cookie);
+								}
+							}
+							else if(!g_SerialSequenceReported)
+							{
+								RewindSequence(g_SerialNextSequence);
+							}
+							g_SerialState = g_SerialPacketHeader.Header.Length ? SerialState::Skip : SerialState::Waiting;
+							break;
+						}
+					}
+					
 					if(g_SerialPacketHeader.Header.Length)
 					{
 						// get ready for data
-						g_SerialRunningCRC = 0xFFFF;
-						g_SerialPendingWritePos = g_SerialWritePos;
-						g_SerialPendingCount = g_SerialCount;
+						g_SerialPacketStart = g_SerialPendingWritePos;
 						g_SerialState = SerialState::Body;
 					}
 					else
@@ -182,9 +661,7 @@ ISR(UR_RX_vect, ISR_BLOCK)
 						// handle the case of an empty packet
 						if(g_SerialPacketHeader.Header.Cookie)
 						{
-							g_SerialAckQueue[g_SerialAckWritePos].Header = (ResponseCodes::Ack << 4) | AckPacketFlag;
-							g_SerialAckQueue[g_SerialAckWritePos].Cookie = g_SerialPacketHeader.Header.Cookie;
-							g_SerialAckWritePos = (g_SerialAckWritePos + 1) & (AckBufferSize - 1);
+							QueueAck((ResponseCodes::Ack << 4) | AckPacketFlag, g_SerialPacketHeader.Header.Cookie);
 						}
 						g_SerialState = SerialState::Waiting;
 					}
@@ -192,62 +669,67 @@ ISR(UR_RX_vect, ISR_BLOCK)
 				else
 				{
 					// failure - send notification and reset
-					g_SerialAckQueue[g_SerialAckWritePos].Header = (ResponseCodes::Error << 4) | ErrorCodes::CorruptPacketHeader;
-					g_SerialAckQueue[g_SerialAckWritePos].Cookie = 0;
-					g_SerialAckWritePos = (g_SerialAckWritePos + 1) & (AckBufferSize - 1);
+					QueueAck((ResponseCodes::Error << 4) | ErrorCodes::CorruptPacketHeader, 0);
 					g_SerialState = SerialState::Waiting;
 				}
 			}
 			else
 			{
-				g_SerialPacketHeader.Buffer[g_SerialPacketHeaderBufferPos++] = s_bufferData;
-				g_SerialHeaderRunningCRC = _crc8_ccitt_update(g_SerialHeaderRunningCRC, s_bufferData);
+				g_SerialPacketHeader.Buffer[headerPos] = data;
+				g_SerialPacketHeaderBufferPos = headerPos + 1;
+				g_SerialHeaderRunningCRC = UpdateHeaderCRC(g_SerialHeaderRunningCRC, data);
 			}
 			break;
 		}
 		case SerialState::Body:
 		{
-			if(g_SerialPendingCount != 0xFF)
+			// one slot always stays open so a full ring doesn't look empty
+			unsigned char writePos = g_SerialPendingWritePos;
+			unsigned char nextPos = writePos + 1;
+			if(nextPos != g_SerialReadPos)
 			{
-				g_SerialBuffer[g_SerialPendingWritePos++] = s_bufferData;
-				g_SerialRunningCRC = _crc_ccitt_update(g_SerialRunningCRC, s_bufferData);
-				++g_SerialPendingCount;
+				g_SerialBuffer[writePos] = data;
+				g_SerialPendingWritePos = nextPos;
 
-				// commit, if we have completed the data transfer
+				// hand it over to the main thread, if we have completed the data transfer
 				if(--g_SerialPacketHeader.Header.Length == 0)
 				{
-					if(g_SerialPacketHeader.Header.PacketCRC == 0 || g_SerialRunningCRC == g_SerialPacketHeader.Header.PacketCRC)
+					unsigned char checkPos = g_SerialCheckWritePos;
+					if(((checkPos - g_SerialCheckReadPos) & CheckPosMask) != CheckQueueSize)
 					{
-						g_SerialWritePos = g_SerialPendingWritePos;
-						g_SerialCount = g_SerialPendingCount;
-
-						// notify of success
-						if(g_SerialPacketHeader.Header.Cookie)
-						{
-							g_SerialAckQueue[g_SerialAckWritePos].Header = (ResponseCodes::Ack << 4) | AckPacketFlag;
-							g_SerialAckQueue[g_SerialAckWritePos].Cookie = g_SerialPacketHeader.Header.Cookie;
-							g_SerialAckWritePos = (g_SerialAckWritePos + 1) & (AckBufferSize - 1);
-						}
+						PendingPacket &packet = g_SerialCheckQueue[checkPos & (CheckQueueSize - 1)];
+						packet.End = nextPos;
+						packet.Cookie = g_SerialPacketHeader.Header.Cookie;
+						packet.PacketCRC = g_SerialPacketHeader.Header.PacketCRC;
+						packet.Sequence = g_SerialPacketHeader.Header.Sequence;
+						packet.Sequenced = g_SerialPacketSentinel != PacketSentinel;
+						g_SerialCheckWritePos = (checkPos + 1) & CheckPosMask;
 					}
 					else
 					{
-						// failure!
-						g_SerialAckQueue[g_SerialAckWritePos].Header = (ResponseCodes::Error << 4) | ErrorCodes::CorruptPacketData;
-						g_SerialAckQueue[g_SerialAckWritePos].Cookie = g_SerialPacketHeader.Header.Cookie;
-						g_SerialAckWritePos = (g_SerialAckWritePos + 1) & (AckBufferSize - 1);
+						// too many packets waiting on a check
+						DropPacket();
 					}
 					g_SerialState = SerialState::Waiting;
 				}
 			}
 			else
 			{
-				// this would have overflowed
-				g_SerialAckQueue[g_SerialAckWritePos].Header = (ResponseCodes::Error << 4) | ErrorCodes::ReceiveBufferOverrun;
-				g_SerialAckQueue[g_SerialAckWritePos].Cookie = g_SerialPacketHeader.Header.Cookie;
-				g_SerialAckWritePos = (g_SerialAckWritePos + 1) & (AckBufferSize - 1);
+				// this would have overflowed, the rest of it gets skipped rather than searched for a sentinel
+				DropPacket();
+				g_SerialState = --g_SerialPacketHeader.Header.Length ? SerialState::Skip : SerialState::Waiting;
+			}
+			break;
+		}
+		case SerialState::Skip:
+		{
+			if(--g_SerialPacketHeader.Header.Length == 0)
+			{
 				g_SerialState = SerialState::Waiting;
 			}
 			break;
 		}
 	}
+
+	PROFILE_ISR_END(ProfilePoints::SerialRx);
 }
@@ -14,14 +14,51 @@ void ConfigureUART();
 // Will block if the input buffer is empty
 unsigned char ReadSerialData();
 
+// Gets the run of received bytes that can be read in place, up to the end of the ring buffer
+// Will block until at least one byte is in, and the bytes stay in the buffer until they are released
+unsigned char PeekSerialData(const unsigned char *&data);
+
+// Consumes the first count bytes of the run from PeekSerialData
+void ReleaseSerialData(unsigned char count);
+
 // Write a byte to the serial port
-// Will block if the output buffer is full
+// Queued up and sent from an interrupt, will only block if the output buffer is full
 void WriteSerialData(unsigned char data);
 
 // Gets the total number of bytes that can be read without blocking
 unsigned char GetPendingSerialDataSize();
 
+// Gets the number of bytes that can still come in before the input buffer overruns, counting packets that are only partly in
+unsigned char GetFreeSerialSpace();
+
+// Counts plain packets thrown away after they started coming in (it wraps), so anything waiting on their bytes can tell they aren't coming
+// Sequenced packets don't count, the host resends them
+unsigned char GetLostPacketCount();
+
+// Turns the trailing free space byte on packet acks on or off (see Settings::FlowControl)
+void EnableCreditAcks(bool enable);
+bool CreditAcksEnabled();
+
 // Call periodically from the main thread to send along queued up responses
 void PumpAck();
 
+// Sends every queued up ack, so a command's response can't get ahead of the ack for the packet it came in
+void FlushAcks();
+
+// Runs the crc checks on packets that have come in, queueing up their acks without sending anything
+// Safe to call in the middle of a response, so a long one doesn't leave packets behind it to overflow the check queue
+void PumpPacketCheck();
+
+// Queues up a 2 byte response to go out with the acks, for things that finish in the background
+// Can be called from any interrupt
+void QueueResponse(unsigned char header, unsigned char data);
+
+// Switches the port over to a new rate (UBRR high nibble with U2X in the top bit, then UBRR low)
+// Sends a Setting response with the new rate, and waits for it and anything else already queued up to go out at the old rate
+// Falls back to the old rate if an intact packet header doesn't show up at the new rate within ~1 second
+void ChangeBaudRate(unsigned char u2x_ubrrH, unsigned char ubrrL);
+
+// Gets the current rate, in the same layout as ChangeBaudRate
+void GetBaudRate(unsigned char &u2x_ubrrH, unsigned char &ubrrL);
+
 #endif /* SERIAL_H_ */
\ No newline at end of file
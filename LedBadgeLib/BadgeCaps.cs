@@ -12,7 +12,7 @@ namespace LedBadgeLib
     /// </summary>
     public class BadgeCaps
     {
-        public BadgeCaps(int version, int width, int height, int bitDepth, SupportedFeatures caps, int baud)
+        public BadgeCaps(int version, int width, int height, int bitDepth, SupportedFeatures caps, int baud, int cpuFrequency = 0)
         {
             Version = version;
             Width = width;
@@ -27,6 +27,7 @@ public BadgeCaps(int version, int width, int height, int bitDepth, SupportedFeat
             IntermediateFrameSize = IntermediateFrameStride * Height;
             SupportedFeatures = caps;
             Baud = baud;
+            CpuFrequency = cpuFrequency;
         }
 
         /// <summary>Number of pixels packed into one block.</summary>
@@ -60,6 +61,8 @@ public BadgeCaps(int version, int width, int height, int bitDepth, SupportedFeat
         public SupportedFeatures SupportedFeatures { get; private set; }
         /// <summary>Communication rate of the connected badge.</summary>
         public int Baud { get; private set; }
+        /// <summary>Clock the badge's microcontroller runs at, which the serial rates are divided down from (0 if unknown).</summary>
+        public int CpuFrequency { get; private set; }
 
         public override bool Equals(object obj)
         {
@@ -94,8 +97,8 @@ public static class Badges
     {
         static Badges()
         {
-            B1236 = new BadgeCaps(BadgeConnection.Version, 36, 12, 2, 0, 38400);
-            B1248 = new BadgeCaps(BadgeConnection.Version, 48, 12, 2, SupportedFeatures.HardwareBrightness, 57600);
+            B1236 = new BadgeCaps(BadgeConnection.Version, 36, 12, 2, 0, 38400, 8000000);
+            B1248 = new BadgeCaps(BadgeConnection.Version, 48, 12, 2, SupportedFeatures.HardwareBrightness, 57600, 12000000);
         }
 
         public static BadgeCaps B1236 { get; private set; }
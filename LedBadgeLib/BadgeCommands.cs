@@ -24,6 +24,17 @@ public static void CreateQuerySetting(Stream stream, SettingValue setting)
             stream.WriteByte(0);
         }
 
+        public static void CreateQueryStats(Stream stream, ProfilePoint point)
+        {
+            stream.WriteByte((byte)(((byte)CommandCodes.QuerySetting << 4) | ((byte)SettingValue.Stats)));
+            stream.WriteByte((byte)point);
+        }
+
+        public static void CreateQueryStats(Stream stream, CommandCodes command)
+        {
+            CreateQueryStats(stream, (ProfilePoint)((byte)ProfilePoint.FirstCommand + (byte)command));
+        }
+
         public static void CreateUpdateBrightnessSetting(Stream stream, byte brightness)
         {
             stream.WriteByte((byte)(((byte)CommandCodes.UpdateSetting << 4) | ((byte)SettingValue.Brightness)));
@@ -71,6 +82,95 @@ public static void CreateUpdateAnimPlayStateSetting(Stream stream, AnimState pla
             stream.WriteByte((byte)((byte)playState & 0x3));
         }
 
+        /// <summary>
+        /// Seeks the container anim to a frame (see CreateAnimContainer).
+        /// </summary>
+        public static void CreateUpdateAnimFrameSetting(Stream stream, ushort frame)
+        {
+            stream.WriteByte((byte)(((byte)CommandCodes.UpdateSetting << 4) | ((byte)SettingValue.AnimFrame)));
+            stream.WriteByte((byte)(frame >> 8));
+            stream.WriteByte((byte)(frame & 0xFF));
+        }
+
+        /// <summary>
+        /// Asks for a slot from the anim directory, or with the default the slot that's playing.
+        /// </summary>
+        public static void CreateQueryAnimSlot(Stream stream, byte slot = NoAnimSlot)
+        {
+            stream.WriteByte((byte)(((byte)CommandCodes.QuerySetting << 4) | ((byte)SettingValue.AnimSlot)));
+            stream.WriteByte(slot);
+        }
+
+        /// <summary>
+        /// Plays a slot from the anim directory, switching to its brightness if it has one.
+        /// </summary>
+        public static void CreateUpdateAnimSlotSetting(Stream stream, byte slot)
+        {
+            stream.WriteByte((byte)(((byte)CommandCodes.UpdateSetting << 4) | ((byte)SettingValue.AnimSlot)));
+            stream.WriteByte(slot);
+        }
+
+        public static void CreateResetStats(Stream stream)
+        {
+            stream.WriteByte((byte)(((byte)CommandCodes.UpdateSetting << 4) | ((byte)SettingValue.Stats)));
+            stream.WriteByte(0);
+        }
+
+        /// <summary>
+        /// Switches the badge's serial link rate (see GetBaudRateDivisor). Should be the last command sent at the old rate.
+        /// </summary>
+        public static void CreateUpdateBaudRateSetting(Stream stream, ushort divisor, bool doubleSpeed)
+        {
+            stream.WriteByte((byte)(((byte)CommandCodes.UpdateSetting << 4) | ((byte)SettingValue.BaudRate)));
+            stream.WriteByte((byte)((doubleSpeed ? 0x80 : 0) | ((divisor >> 8) & 0xF)));
+            stream.WriteByte((byte)(divisor & 0xFF));
+        }
+
+        /// <summary>
+        /// Turns the free space byte on packet acks on or off. Query SettingValue.FlowControl in the same packet to get the starting credit.
+        /// </summary>
+        public static void CreateUpdateFlowControlSetting(Stream stream, bool creditAcks)
+        {
+            stream.WriteByte((byte)(((byte)CommandCodes.UpdateSetting << 4) | ((byte)SettingValue.FlowControl)));
+            stream.WriteByte((byte)(creditAcks ? 1 : 0));
+        }
+
+        /// <summary>
+        /// Picks the UBRR divisor and U2X flag that come closest to a baud rate on a badge running at the given clock.
+        /// Returns how far off the closest rate is, as a fraction of the requested one (anything over ~0.02 won't hold a link).
+        /// </summary>
+        public static double GetBaudRateDivisor(int cpuFrequency, int baud, out ushort divisor, out bool doubleSpeed)
+        {
+            double bestError = double.MaxValue;
+            divisor = 0;
+            doubleSpeed = false;
+
+            // normal speed first, since it samples each bit more times and wins a tie
+            for(int speed = 0; speed < 2; ++speed)
+            {
+                int samplesPerBit = speed == 0 ? 16 : 8;
+                int d = (int)Math.Round((double)cpuFrequency / (samplesPerBit * baud)) - 1;
+                if(d < 0 || d > 0xFFF)
+                {
+                    continue;
+                }
+
+                double actual = (double)cpuFrequency / (samplesPerBit * (d + 1));
+                double error = Math.Abs(actual - baud) / baud;
+                if(error < bestError)
+                {
+                    bestError = error;
+                    divisor = (ushort)d;
+                    doubleSpeed = speed != 0;
+                }
+            }
+            return bestError;
+        }
+
+        /// <summary>
+        /// Shows the back buffer at the end of a refresh frame, once the last swap's hold has run out.
+        /// It then stays up for about holdFrames / 62 seconds (3 refresh frames a hold count on the B1248, 4 on the B1236).
+        /// </summary>
         public static void CreateSwap(Stream stream, bool bookmark, byte holdFrames)
         {
             stream.WriteByte((byte)(((byte)CommandCodes.Swap << 4) | (bookmark ? 0x08 : 0)));
@@ -85,11 +185,168 @@ public static void CreateReadRect(Stream stream, Target targetBuffer, PixelForma
         }
 
         public static void CreateWriteRect(Stream stream, Target targetBuffer, PixelFormat format, byte x, byte y, byte width, byte height, out int bufferSize)
+        {
+            WriteRectHeader(stream, targetBuffer, format, x, y, width, height);
+            bufferSize = width * height * ((int)format + 1);
+        }
+
+        /// <summary>
+        /// Writes a TwoBits packed rect, collapsing repeated blocks into runs.
+        /// Each run starts with a control byte holding the block count - 1 in the low 7 bits.
+        /// The high bit means the single block that follows is repeated, otherwise that many blocks follow.
+        /// </summary>
+        public static void CreateWriteRectRunLength(Stream stream, Target targetBuffer, byte x, byte y, byte width, byte height, byte[] packedBuffer)
+        {
+            WriteRectHeader(stream, targetBuffer, PixelFormat.RunLength, x, y, width, height);
+            WriteRunLength(stream, width * height, packedBuffer);
+        }
+
+        static void WriteRunLength(Stream stream, int blocks, byte[] packedBuffer)
+        {
+            for(int i = 0; i < blocks; )
+            {
+                int repeat = 1;
+                while(i + repeat < blocks && repeat < MaxPixelRun && SameBlock(packedBuffer, i + repeat, packedBuffer, i))
+                {
+                    ++repeat;
+                }
+                if(repeat > 1)
+                {
+                    stream.WriteByte((byte)(0x80 | (repeat - 1)));
+                    stream.Write(packedBuffer, i * 2, 2);
+                    i += repeat;
+                    continue;
+                }
+
+                // literal run up to the start of the next repeat
+                int literal = 1;
+                while(i + literal < blocks && literal < MaxPixelRun && (i + literal + 1 >= blocks || !SameBlock(packedBuffer, i + literal + 1, packedBuffer, i + literal)))
+                {
+                    ++literal;
+                }
+                stream.WriteByte((byte)(literal - 1));
+                stream.Write(packedBuffer, i * 2, literal * 2);
+                i += literal;
+            }
+        }
+
+        /// <summary>
+        /// Writes the difference between a TwoBits packed rect and what the target buffer already holds.
+        /// Each run starts with a control byte holding the block count - 1 in the low 7 bits.
+        /// The high bit means the blocks are unchanged and skipped, otherwise that many blocks to xor into the buffer follow.
+        /// If the last run is a skip, a padding byte follows it so the badge never finishes on a control byte.
+        /// </summary>
+        public static void CreateWriteRectXorDelta(Stream stream, Target targetBuffer, byte x, byte y, byte width, byte height, byte[] packedBuffer, byte[] previousPackedBuffer)
+        {
+            WriteRectHeader(stream, targetBuffer, PixelFormat.XorDelta, x, y, width, height);
+            WriteXorDelta(stream, width * height, packedBuffer, previousPackedBuffer);
+        }
+
+        static void WriteXorDelta(Stream stream, int blocks, byte[] packedBuffer, byte[] previousPackedBuffer)
+        {
+            bool endsOnSkip = false;
+            for(int i = 0; i < blocks; )
+            {
+                bool skip = SameBlock(packedBuffer, i, previousPackedBuffer, i);
+                int length = 1;
+                while(i + length < blocks && length < MaxPixelRun && SameBlock(packedBuffer, i + length, previousPackedBuffer, i + length) == skip)
+                {
+                    ++length;
+                }
+
+                stream.WriteByte((byte)((skip ? 0x80 : 0) | (length - 1)));
+                for(int j = i * 2, end = (i + length) * 2; !skip && j < end; ++j)
+                {
+                    stream.WriteByte((byte)(packedBuffer[j] ^ previousPackedBuffer[j]));
+                }
+                i += length;
+                endsOnSkip = skip;
+            }
+
+            if(endsOnSkip)
+            {
+                stream.WriteByte(0);
+            }
+        }
+
+        const int MaxPixelRun = 128;
+
+        static void WriteRectHeader(Stream stream, Target targetBuffer, PixelFormat format, byte x, byte y, byte width, byte height)
         {
             stream.WriteByte((byte)(((byte)CommandCodes.WriteRect << 4) | (((byte)targetBuffer & 0x3) << 2) | ((byte)format & 0x3)));
             stream.WriteByte((byte)((x << 4) | (y & 0xF)));
             stream.WriteByte((byte)((width << 4) | (height & 0xF)));
-            bufferSize = width * height * ((int)format + 1);
+        }
+
+        static bool SameBlock(byte[] a, int blockA, byte[] b, int blockB)
+        {
+            return a[blockA * 2] == b[blockB * 2] && a[blockA * 2 + 1] == b[blockB * 2 + 1];
+        }
+
+        /// <summary>
+        /// Writes only the blocks of a packed rect that differ from what the target buffer already holds.
+        /// Each run of 8 blocks starts with a mask byte (msb first) followed by the data for its flagged blocks, and trailing masks are left off.
+        /// Returns the number of blocks sent. Nothing is written to the stream when none of them changed.
+        /// </summary>
+        public static int CreateWriteDirtyRect(Stream stream, Target targetBuffer, PixelFormat format, byte x, byte y, byte width, byte height, byte[] packedBuffer, byte[] previousPackedBuffer)
+        {
+            int bytesPerBlock = (int)format + 1;
+            int blocks = width * height;
+
+            int count = 0;
+            int last = -1;
+            for(int i = 0; i < blocks; ++i)
+            {
+                if(BlockChanged(packedBuffer, previousPackedBuffer, i, bytesPerBlock))
+                {
+                    ++count;
+                    last = i;
+                }
+            }
+            if(count == 0)
+            {
+                return 0;
+            }
+
+            stream.WriteByte((byte)(((byte)CommandCodes.WriteDirtyRect << 4) | (((byte)targetBuffer & 0x3) << 2) | ((byte)format & 0x3)));
+            stream.WriteByte((byte)((x << 4) | (y & 0xF)));
+            stream.WriteByte((byte)((width << 4) | (height & 0xF)));
+            stream.WriteByte((byte)(count - 1));
+            for(int group = 0; group <= last; group += 8)
+            {
+                int end = Math.Min(group + 8, blocks);
+
+                byte mask = 0;
+                for(int i = group; i < end; ++i)
+                {
+                    if(BlockChanged(packedBuffer, previousPackedBuffer, i, bytesPerBlock))
+                    {
+                        mask |= (byte)(0x80 >> (i - group));
+                    }
+                }
+                stream.WriteByte(mask);
+
+                for(int i = group; i < end; ++i)
+                {
+                    if(BlockChanged(packedBuffer, previousPackedBuffer, i, bytesPerBlock))
+                    {
+                        stream.Write(packedBuffer, i * bytesPerBlock, bytesPerBlock);
+                    }
+                }
+            }
+            return count;
+        }
+
+        static bool BlockChanged(byte[] packedBuffer, byte[] previousPackedBuffer, int block, int bytesPerBlock)
+        {
+            for(int i = block * bytesPerBlock, end = i + bytesPerBlock; i < end; ++i)
+            {
+                if(packedBuffer[i] != previousPackedBuffer[i])
+                {
+                    return true;
+                }
+            }
+            return false;
         }
 
         public static void CreateCopyRect(Stream stream, Target sourceBuffer, Target targetBuffer, byte srcX, byte srcY, byte dstX, byte dstY, byte width, byte height)
@@ -109,6 +366,94 @@ public static void CreateFillRect(Stream stream, Target targetBuffer, byte x, by
             stream.WriteByte((byte)(value.Value & 0xFF));
         }
 
+        /// <summary>
+        /// Starts a pixel granular WriteRect (x and width are in pixels, width is 1-64 and height is 1-16).
+        /// Each row of pixels follows as (width + 7) / 8 blocks in the given format, starting from the msb of the first one.
+        /// </summary>
+        public static void CreateWritePixelRect(Stream stream, Target targetBuffer, PixelFormat format, byte x, byte y, byte width, byte height, out int bufferSize)
+        {
+            WritePixelRectHeader(stream, PixelRectOp.Write, targetBuffer, (byte)format, x, y, width, height);
+            bufferSize = ((width + 7) / 8) * height * ((int)format + 1);
+        }
+
+        /// <summary>
+        /// Pixel granular CopyRect (x and width are in pixels, width is 1-64 and height is 1-16).
+        /// </summary>
+        public static void CreateCopyPixelRect(Stream stream, Target sourceBuffer, Target targetBuffer, byte srcX, byte srcY, byte dstX, byte dstY, byte width, byte height)
+        {
+            WritePixelRectHeader(stream, PixelRectOp.Copy, targetBuffer, (byte)sourceBuffer, dstX, dstY, width, height);
+            stream.WriteByte((byte)(srcX & 0x3F));
+            stream.WriteByte((byte)(srcY & 0xF));
+        }
+
+        /// <summary>
+        /// Pixel granular FillRect (x and width are in pixels, width is 1-64 and height is 1-16).
+        /// The value is a pattern lined up with the buffer's blocks, not with the rect.
+        /// </summary>
+        public static void CreateFillPixelRect(Stream stream, Target targetBuffer, byte x, byte y, byte width, byte height, Pix2x8 value)
+        {
+            WritePixelRectHeader(stream, PixelRectOp.Fill, targetBuffer, 0, x, y, width, height);
+            stream.WriteByte((byte)(value.Value >> 8));
+            stream.WriteByte((byte)(value.Value & 0xFF));
+        }
+
+        /// <summary>
+        /// Shifts a rect (in blocks) by dx pixels (-7 to 7, positive is right) and dy rows (-8 to 7, positive is down), scrolling in black.
+        /// </summary>
+        public static void CreateScroll(Stream stream, Target targetBuffer, byte x, byte y, byte width, byte height, int dx, int dy)
+        {
+            WriteScrollHeader(stream, targetBuffer, ScrollEdge.Black, x, y, width, height, dx, dy);
+        }
+
+        /// <summary>
+        /// Shifts a rect and fills in the uncovered edge from packed TwoBits data (see GetScrollEdgeLength for the size).
+        /// </summary>
+        public static void CreateScroll(Stream stream, Target targetBuffer, byte x, byte y, byte width, byte height, int dx, int dy, byte[] packedEdge)
+        {
+            System.Diagnostics.Debug.Assert(packedEdge.Length == GetScrollEdgeLength(width, height, dx, dy) && packedEdge.Length > 0);
+
+            WriteScrollHeader(stream, targetBuffer, ScrollEdge.Stream, x, y, width, height, dx, dy);
+            stream.Write(packedEdge, 0, packedEdge.Length);
+        }
+
+        /// <summary>
+        /// Shifts a rect and reads the uncovered edge out of eeprom (the address has the RomTarget type in the top bits).
+        /// </summary>
+        public static void CreateScrollFromRom(Stream stream, Target targetBuffer, byte x, byte y, byte width, byte height, int dx, int dy, short romAddress)
+        {
+            WriteScrollHeader(stream, targetBuffer, ScrollEdge.Rom, x, y, width, height, dx, dy);
+            stream.WriteByte((byte)(romAddress >> 8));
+            stream.WriteByte((byte)(romAddress & 0xFF));
+        }
+
+        /// <summary>
+        /// Bytes of edge data a Scroll uncovers: a block per row for the column, plus a block per column for each uncovered row.
+        /// </summary>
+        public static int GetScrollEdgeLength(byte width, byte height, int dx, int dy)
+        {
+            return ((dx != 0 ? height : 0) + width * Math.Abs(dy)) * 2;
+        }
+
+        static void WriteScrollHeader(Stream stream, Target targetBuffer, ScrollEdge edge, byte x, byte y, byte width, byte height, int dx, int dy)
+        {
+            System.Diagnostics.Debug.Assert(dx >= -7 && dx <= 7 && dy >= -8 && dy <= 7);
+
+            stream.WriteByte((byte)(((byte)CommandCodes.Scroll << 4) | (((byte)targetBuffer & 0x3) << 2) | ((byte)edge & 0x3)));
+            stream.WriteByte((byte)((x << 4) | (y & 0xF)));
+            stream.WriteByte((byte)((width << 4) | (height & 0xF)));
+            stream.WriteByte((byte)(((dx & 0xF) << 4) | (dy & 0xF)));
+        }
+
+        static void WritePixelRectHeader(Stream stream, PixelRectOp op, Target targetBuffer, byte extra, byte x, byte y, byte width, byte height)
+        {
+            System.Diagnostics.Debug.Assert(width >= 1 && width <= 64 && height >= 1 && height <= 16);
+
+            stream.WriteByte((byte)(((byte)CommandCodes.PixelRect << 4) | (((byte)targetBuffer & 0x3) << 2) | ((byte)op & 0x3)));
+            stream.WriteByte((byte)((extra << 6) | (x & 0x3F)));
+            stream.WriteByte((byte)((y << 4) | ((height - 1) & 0xF)));
+            stream.WriteByte((byte)((width - 1) & 0x3F));
+        }
+
         public static void CreateReadMemory(Stream stream, short address, int numDWords)
         {
             if(numDWords < 1) { numDWords = 1; }
@@ -136,10 +481,28 @@ public static void CreateWriteMemory(Stream stream, short address, byte[] data)
             CreateWriteMemory(stream, address, data.Length / 4, out bufferSize);
             for(int i = 0; i < bufferSize; ++i)
             {
-                stream.WriteByte(data[i++]);
+                stream.WriteByte(data[i]);
             }
         }
 
+        /// <summary>
+        /// Writes the WriteMemory for the next part of an upload to the external eeprom, up to the end of the 64 byte page it starts in.
+        /// Sending each one in a packet of its own lets the badge write a page as soon as its packet is in (see SupportedFeatures.PageWrites).
+        /// Returns how many bytes of the data it took, the address and the length have to be multiples of 4.
+        /// </summary>
+        public static int CreateUploadPage(Stream stream, int address, byte[] data, int offset)
+        {
+            System.Diagnostics.Debug.Assert((address & 3) == 0 && (data.Length & 3) == 0 && offset < data.Length);
+
+            int pageAddress = (address + offset) & (ExternalMemorySize - 1);
+            int length = Math.Min(64 - (pageAddress & 63), data.Length - offset);
+
+            int bufferSize;
+            CreateWriteMemory(stream, (short)(ExternalMemoryFlag | pageAddress), length / 4, out bufferSize);
+            stream.Write(data, offset, bufferSize);
+            return bufferSize;
+        }
+
         public static void CreatePlayFromBookmark(Stream stream, AnimState playState, short? bookmark = null)
         {
             stream.WriteByte((byte)(((byte)CommandCodes.PlayFromBookmark << 4) | (bookmark.HasValue ? 0x08 : 0) | ((byte)playState & 0x3)));
@@ -147,6 +510,177 @@ public static void CreatePlayFromBookmark(Stream stream, AnimState playState, sh
             stream.WriteByte((byte)(bookmark.HasValue ? bookmark.Value & 0xFF : 0));
         }
 
+        /// <summary>
+        /// Packs 1 to 16 commands into a list that the badge only starts on once all of it has come in, so it can be split over packets without ever being half applied.
+        /// A command that fails is skipped without stopping the rest, and the ack for the list flags it (see BadgeResponses.DecodeCommandListAck).
+        /// If a plain packet with part of the list is lost, or the rest doesn't come within a second, none of it runs and every command is flagged.
+        /// With a zero cookie the list is only answered if something failed.
+        /// </summary>
+        public static void CreateCommandList(Stream stream, byte cookie, IList<byte[]> commands)
+        {
+            int length = commands.Sum(c => c.Length + 1);
+            System.Diagnostics.Debug.Assert(commands.Count >= 1 && commands.Count <= 16);
+            System.Diagnostics.Debug.Assert(length <= 255 && commands.All(c => c.Length > 0));
+
+            stream.WriteByte((byte)(((byte)CommandCodes.CommandList << 4) | (commands.Count - 1)));
+            stream.WriteByte(cookie);
+            stream.WriteByte((byte)length);
+            foreach(byte[] command in commands)
+            {
+                stream.WriteByte((byte)command.Length);
+                stream.Write(command, 0, command.Length);
+            }
+        }
+
+        /// <summary>
+        /// Lays out an anim as a keyframe/delta container, to be stored in eeprom and played from where it starts (see SupportedFeatures.AnimContainers).
+        /// Frames are TwoBits packed full buffers. Every keyframeInterval-th one is stored whole as RunLength blocks, and the rest as XorDelta blocks against the frame before.
+        /// Each frame is followed by a Swap with the given hold, the badge loops back to the first frame at the end, and SettingValue.AnimFrame seeks through the keyframe index.
+        /// </summary>
+        public static void CreateAnimContainer(Stream stream, IList<byte[]> packedFrames, int keyframeInterval, byte holdFrames)
+        {
+            System.Diagnostics.Debug.Assert(packedFrames.Count >= 1 && packedFrames.Count <= ushort.MaxValue);
+            System.Diagnostics.Debug.Assert(keyframeInterval >= 1 && keyframeInterval <= 255);
+
+            int blocks = packedFrames[0].Length / 2;
+            int keyframes = (packedFrames.Count + keyframeInterval - 1) / keyframeInterval;
+            int headerLength = AnimContainerHeaderLength + keyframes * 2;
+
+            var frames = new MemoryStream();
+            var index = new List<int>();
+            for(int i = 0; i < packedFrames.Count; ++i)
+            {
+                bool keyframe = i % keyframeInterval == 0;
+                if(keyframe)
+                {
+                    index.Add(headerLength + (int)frames.Length);
+                    frames.WriteByte((byte)(((byte)CommandCodes.AnimOp << 4) | (byte)AnimOp.Keyframe));
+                    WriteRunLength(frames, blocks, packedFrames[i]);
+                }
+                else
+                {
+                    frames.WriteByte((byte)(((byte)CommandCodes.AnimOp << 4) | (byte)AnimOp.Delta));
+                    WriteXorDelta(frames, blocks, packedFrames[i], packedFrames[i - 1]);
+                }
+                CreateSwap(frames, false, holdFrames);
+            }
+
+            int size = headerLength + (int)frames.Length;
+            System.Diagnostics.Debug.Assert(size <= ExternalMemorySize);
+
+            stream.WriteByte((byte)(((byte)CommandCodes.AnimOp << 4) | (byte)AnimOp.Container));
+            stream.WriteByte((byte)(packedFrames.Count >> 8));
+            stream.WriteByte((byte)(packedFrames.Count & 0xFF));
+            stream.WriteByte((byte)keyframeInterval);
+            stream.WriteByte((byte)(size >> 8));
+            stream.WriteByte((byte)(size & 0xFF));
+            foreach(int offset in index)
+            {
+                stream.WriteByte((byte)(offset >> 8));
+                stream.WriteByte((byte)(offset & 0xFF));
+            }
+            frames.WriteTo(stream);
+        }
+
+        const int AnimContainerHeaderLength = 6;
+
+        /// <summary>
+        /// (Anims only) Runs the commands up to the matching CreateAnimEndLoop count times, or with zero until something jumps out.
+        /// Loops and calls nest up to 4 deep between them.
+        /// </summary>
+        public static void CreateAnimLoop(Stream stream, byte count)
+        {
+            stream.WriteByte((byte)(((byte)CommandCodes.AnimOp << 4) | (byte)AnimOp.Loop));
+            stream.WriteByte(count);
+        }
+
+        public static void CreateAnimEndLoop(Stream stream)
+        {
+            stream.WriteByte((byte)(((byte)CommandCodes.AnimOp << 4) | (byte)AnimOp.EndLoop));
+        }
+
+        /// <summary>
+        /// (Anims only) Moves the anim by an offset from the start of this command.
+        /// </summary>
+        public static void CreateAnimJump(Stream stream, short offset)
+        {
+            stream.WriteByte((byte)(((byte)CommandCodes.AnimOp << 4) | (byte)AnimOp.Jump));
+            stream.WriteByte((byte)(offset >> 8));
+            stream.WriteByte((byte)(offset & 0xFF));
+        }
+
+        /// <summary>
+        /// (Anims only) Moves the anim by an offset from the start of this command, and CreateAnimReturn comes back to the command after it.
+        /// </summary>
+        public static void CreateAnimCall(Stream stream, short offset)
+        {
+            stream.WriteByte((byte)(((byte)CommandCodes.AnimOp << 4) | (byte)AnimOp.Call));
+            stream.WriteByte((byte)(offset >> 8));
+            stream.WriteByte((byte)(offset & 0xFF));
+        }
+
+        public static void CreateAnimReturn(Stream stream)
+        {
+            stream.WriteByte((byte)(((byte)CommandCodes.AnimOp << 4) | (byte)AnimOp.Return));
+        }
+
+        /// <summary>
+        /// (Anims only) Moves the anim by an offset from the start of this command if the button is down (or up, with whenReleased).
+        /// Once an anim slot branches on a button, that button stops flipping through the slots until another slot plays.
+        /// </summary>
+        public static void CreateAnimBranchButton(Stream stream, int button, bool whenReleased, short offset)
+        {
+            stream.WriteByte((byte)(((byte)CommandCodes.AnimOp << 4) | (byte)AnimOp.BranchButton));
+            stream.WriteByte((byte)((whenReleased ? 0x80 : 0) | (button & 0x1)));
+            stream.WriteByte((byte)(offset >> 8));
+            stream.WriteByte((byte)(offset & 0xFF));
+        }
+
+        /// <summary>
+        /// Lays out a directory of anim slots, to be stored at the start of either eeprom in place of a single anim (see SupportedFeatures.AnimSlots).
+        /// The badge plays the first slot at power up, and its buttons flip through the rest whenever the host hasn't sent anything for ~10 seconds.
+        /// </summary>
+        public static void CreateAnimDirectory(Stream stream, IList<AnimSlotInfo> slots)
+        {
+            System.Diagnostics.Debug.Assert(slots.Count >= 1 && slots.Count <= AnimDirectoryMaxSlots);
+
+            stream.Write(AnimDirectoryMagic, 0, AnimDirectoryMagic.Length);
+            stream.WriteByte((byte)slots.Count);
+            foreach(AnimSlotInfo slot in slots)
+            {
+                byte[] name = Encoding.ASCII.GetBytes(slot.Name ?? "");
+                for(int i = 0; i < AnimSlotNameLength; ++i)
+                {
+                    stream.WriteByte(i < name.Length ? name[i] : (byte)0);
+                }
+                stream.WriteByte((byte)(slot.Start >> 8));
+                stream.WriteByte((byte)(slot.Start & 0xFF));
+                stream.WriteByte((byte)(slot.Length >> 8));
+                stream.WriteByte((byte)(slot.Length & 0xFF));
+                stream.WriteByte((byte)slot.LoopMode);
+                stream.WriteByte(slot.Brightness);
+                stream.WriteByte(0);
+                stream.WriteByte(0);
+            }
+        }
+
+        /// <summary>Bytes a directory of the given number of slots takes up, which is where the first anim can go.</summary>
+        public static int GetAnimDirectoryLength(int slotCount)
+        {
+            return AnimDirectoryMagic.Length + 1 + slotCount * AnimSlotLength;
+        }
+
+        /// <summary>Slot byte for CreateQueryAnimSlot that asks for the one playing, and what comes back when none is.</summary>
+        public const byte NoAnimSlot = 0xFF;
+        public const int AnimDirectoryMaxSlots = 16;
+        internal const int AnimSlotNameLength = 8;
+        const int AnimSlotLength = 16;
+        static readonly byte[] AnimDirectoryMagic = { 0, (byte)'H', 0, (byte)'D' };
+
+        /// <summary>Top bits of a memory address that pick the external eeprom over the internal one.</summary>
+        const int ExternalMemoryFlag = 0x4000;
+        const int ExternalMemorySize = 0x4000;
+
         public static CommandCodes GetCode(byte b)
         {
             return (CommandCodes)(b >> 4);
@@ -167,6 +701,11 @@ public static int GetMinCommandLength(CommandCodes command)
                 case CommandCodes.ReadMemory:       return 3;
                 case CommandCodes.WriteMemory:      return 3;
                 case CommandCodes.PlayFromBookmark: return 3;
+                case CommandCodes.WriteDirtyRect:   return 6;
+                case CommandCodes.PixelRect:        return 4;
+                case CommandCodes.Scroll:           return 4;
+                case CommandCodes.CommandList:      return 3;
+                case CommandCodes.AnimOp:           return 1;
             }
             throw new NotImplementedException("Unimplemented CommandCode length! (" + command + ")");
         }
@@ -182,6 +721,11 @@ public static int GetSettingUpdateLength(SettingValue setting)
                 case SettingValue.AnimBookmarkPos:  return 3;
                 case SettingValue.AnimReadPos:      return 3;
                 case SettingValue.AnimPlayState:    return 2;
+                case SettingValue.Stats:            return 2;
+                case SettingValue.BaudRate:         return 3;
+                case SettingValue.FlowControl:      return 2;
+                case SettingValue.AnimFrame:        return 3;
+                case SettingValue.AnimSlot:         return 2;
             }
             throw new NotImplementedException("Unimplemented SettingValue length! (" + setting + ")");
         }
@@ -213,6 +757,76 @@ public static int GetFullCommandLength(CommandCodes command, byte[] buffer, int
                     int headerLen = BadgeCommands.DecodeWriteMemory(buffer, offset, out address, out numDWords, out bufferLength);
                     return headerLen + bufferLength;
                 }
+                case CommandCodes.WriteDirtyRect:
+                {
+                    Target targetBuffer;
+                    PixelFormat format;
+                    byte x, y;
+                    byte width, height;
+                    int count;
+                    int bufferLength;
+                    int headerLen = BadgeCommands.DecodeWriteDirtyRect(buffer, offset, out targetBuffer, out format, out x, out y, out width, out height, out count, out bufferLength);
+                    return headerLen + bufferLength;
+                }
+                case CommandCodes.PixelRect:
+                {
+                    PixelRectOp op;
+                    Target targetBuffer;
+                    byte extra;
+                    byte x, y;
+                    byte width, height;
+                    int headerLen = BadgeCommands.DecodePixelRect(buffer, offset, out op, out targetBuffer, out extra, out x, out y, out width, out height);
+                    switch(op)
+                    {
+                        case PixelRectOp.Write: return headerLen + ((width + 7) / 8) * height * (extra + 1);
+                        default:                return headerLen + 2;
+                    }
+                }
+                case CommandCodes.Scroll:
+                {
+                    Target targetBuffer;
+                    ScrollEdge edge;
+                    byte x, y;
+                    byte width, height;
+                    int dx, dy;
+                    int headerLen = BadgeCommands.DecodeScroll(buffer, offset, out targetBuffer, out edge, out x, out y, out width, out height, out dx, out dy);
+                    switch(edge)
+                    {
+                        case ScrollEdge.Stream: return headerLen + GetScrollEdgeLength(width, height, dx, dy);
+                        case ScrollEdge.Rom:    return headerLen + 2;
+                        default:                return headerLen;
+                    }
+                }
+                case CommandCodes.CommandList:
+                {
+                    int count;
+                    byte cookie;
+                    byte bufferLength;
+                    int headerLen = BadgeCommands.DecodeCommandList(buffer, offset, out count, out cookie, out bufferLength);
+                    return headerLen + bufferLength;
+                }
+                case CommandCodes.AnimOp:
+                {
+                    AnimOp op = (AnimOp)(buffer[offset] & 0xF);
+                    switch(op)
+                    {
+                        case AnimOp.Container:
+                        {
+                            ushort frameCount;
+                            byte keyframeInterval;
+                            ushort size;
+                            return BadgeCommands.DecodeAnimContainer(buffer, offset, out frameCount, out keyframeInterval, out size);
+                        }
+                        case AnimOp.Loop:           return 2;
+                        case AnimOp.EndLoop:        return 1;
+                        case AnimOp.Jump:           return 3;
+                        case AnimOp.Call:           return 3;
+                        case AnimOp.Return:         return 1;
+                        case AnimOp.BranchButton:   return 4;
+                    }
+                    // the frame ops cover the whole buffer, so their length depends on the badge
+                    throw new NotImplementedException("AnimOp frame lengths depend on the badge's buffer size! (" + op + ")");
+                }
                 default: return GetMinCommandLength(command);
             }
         }
@@ -334,10 +948,73 @@ public static int DecodeWriteRect(byte[] buffer, int offset, out Target targetBu
             y = (byte)(buffer[offset + 1] & 0xF);
             width = (byte)(buffer[offset + 2] >> 4);
             height = (byte)(buffer[offset + 2] & 0xF);
-            bufferLength = (byte)(width * height * ((int)format + 1));
+            bufferLength = (byte)GetPixelDataLength(buffer, offset + 3, format, width * height);
             return 3;
         }
 
+        /// <summary>
+        /// Size of the pixel data for a WriteRect, the compressed formats have to be walked to find the end.
+        /// </summary>
+        public static int GetPixelDataLength(byte[] buffer, int offset, PixelFormat format, int blocks)
+        {
+            switch(format)
+            {
+                case PixelFormat.OneBit:    return blocks;
+                case PixelFormat.TwoBits:   return blocks * 2;
+            }
+
+            int length = 0;
+            bool endsOnSkip = false;
+            while(blocks > 0)
+            {
+                byte control = buffer[offset + length];
+                int run = (control & 0x7F) + 1;
+                bool repeatOrSkip = (control & 0x80) != 0;
+                if(format == PixelFormat.RunLength)
+                {
+                    length += 1 + (repeatOrSkip ? 2 : run * 2);
+                }
+                else
+                {
+                    length += 1 + (repeatOrSkip ? 0 : run * 2);
+                }
+                blocks -= run;
+                endsOnSkip = format == PixelFormat.XorDelta && repeatOrSkip;
+            }
+            return endsOnSkip ? length + 1 : length;
+        }
+
+        public static int DecodeWriteDirtyRect(byte[] buffer, int offset, out Target targetBuffer, out PixelFormat format, out byte x, out byte y, out byte width, out byte height, out int count, out int bufferLength)
+        {
+            System.Diagnostics.Debug.Assert((CommandCodes)(buffer[offset] >> 4) == CommandCodes.WriteDirtyRect);
+
+            targetBuffer = (Target)((buffer[offset] >> 2) & 0x3);
+            format = (PixelFormat)(buffer[offset] & 0x3);
+            x = (byte)(buffer[offset + 1] >> 4);
+            y = (byte)(buffer[offset + 1] & 0xF);
+            width = (byte)(buffer[offset + 2] >> 4);
+            height = (byte)(buffer[offset + 2] & 0xF);
+            count = buffer[offset + 3] + 1;
+
+            // walk the masks to find where the data ends
+            int bytesPerBlock = (int)format + 1;
+            int remaining = count;
+            bufferLength = 0;
+            while(remaining > 0)
+            {
+                byte mask = buffer[offset + 4 + bufferLength];
+                int flagged = 0;
+                for(; mask != 0; mask &= (byte)(mask - 1))
+                {
+                    ++flagged;
+                }
+                flagged = Math.Min(flagged, remaining);
+                bufferLength += 1 + flagged * bytesPerBlock;
+                remaining -= flagged;
+            }
+            return 4;
+        }
+
         public static int DecodeCopyRect(byte[] buffer, int offset, out Target sourceBuffer, out Target targetBuffer, out byte srcX, out byte srcY, out byte dstX, out byte dstY, out byte width, out byte height)
         {
             System.Diagnostics.Debug.Assert((CommandCodes)(buffer[offset] >> 4) == CommandCodes.CopyRect);
@@ -366,6 +1043,40 @@ public static int DecodeFillRect(byte[] buffer, int offset, out Target targetBuf
             return 5;
         }
 
+        /// <summary>
+        /// Decodes the part of a PixelRect that all of the ops share.
+        /// Extra is the PixelFormat for writes and the source Target for copies.
+        /// Copies are followed by srcX and srcY bytes, fills by the 2 byte color, and writes by the pixel data.
+        /// </summary>
+        public static int DecodePixelRect(byte[] buffer, int offset, out PixelRectOp op, out Target targetBuffer, out byte extra, out byte x, out byte y, out byte width, out byte height)
+        {
+            System.Diagnostics.Debug.Assert((CommandCodes)(buffer[offset] >> 4) == CommandCodes.PixelRect);
+
+            op = (PixelRectOp)(buffer[offset] & 0x3);
+            targetBuffer = (Target)((buffer[offset] >> 2) & 0x3);
+            extra = (byte)(buffer[offset + 1] >> 6);
+            x = (byte)(buffer[offset + 1] & 0x3F);
+            y = (byte)(buffer[offset + 2] >> 4);
+            height = (byte)((buffer[offset + 2] & 0xF) + 1);
+            width = (byte)((buffer[offset + 3] & 0x3F) + 1);
+            return 4;
+        }
+
+        public static int DecodeScroll(byte[] buffer, int offset, out Target targetBuffer, out ScrollEdge edge, out byte x, out byte y, out byte width, out byte height, out int dx, out int dy)
+        {
+            System.Diagnostics.Debug.Assert((CommandCodes)(buffer[offset] >> 4) == CommandCodes.Scroll);
+
+            targetBuffer = (Target)((buffer[offset] >> 2) & 0x3);
+            edge = (ScrollEdge)(buffer[offset] & 0x3);
+            x = (byte)(buffer[offset + 1] >> 4);
+            y = (byte)(buffer[offset + 1] & 0xF);
+            width = (byte)(buffer[offset + 2] >> 4);
+            height = (byte)(buffer[offset + 2] & 0xF);
+            dx = (sbyte)(buffer[offset + 3] & 0xF0) >> 4;
+            dy = (sbyte)(buffer[offset + 3] << 4) >> 4;
+            return 4;
+        }
+
         public static int DecodeReadMemory(byte[] buffer, int offset, out short address, out byte numDWords)
         {
             System.Diagnostics.Debug.Assert((CommandCodes)(buffer[offset] >> 4) == CommandCodes.ReadMemory);
@@ -393,5 +1104,33 @@ public static int DecodePlayFromBookmark(byte[] buffer, int offset, out AnimStat
             bookmark = ((buffer[offset] & 0x08) != 0) ? (short)((buffer[offset + 1] << 8) | buffer[offset + 2]) : (short?)null;
             return 3;
         }
+
+        /// <summary>
+        /// BufferLength covers the entries, each of which is a length byte followed by the command.
+        /// </summary>
+        public static int DecodeCommandList(byte[] buffer, int offset, out int count, out byte cookie, out byte bufferLength)
+        {
+            System.Diagnostics.Debug.Assert((CommandCodes)(buffer[offset] >> 4) == CommandCodes.CommandList);
+
+            count = (buffer[offset] & 0xF) + 1;
+            cookie = buffer[offset + 1];
+            bufferLength = buffer[offset + 2];
+            return 3;
+        }
+
+        /// <summary>
+        /// Size runs from the Container op to the end of the last frame. The returned length covers the keyframe index.
+        /// </summary>
+        public static int DecodeAnimContainer(byte[] buffer, int offset, out ushort frameCount, out byte keyframeInterval, out ushort size)
+        {
+            System.Diagnostics.Debug.Assert((CommandCodes)(buffer[offset] >> 4) == CommandCodes.AnimOp);
+            System.Diagnostics.Debug.Assert((AnimOp)(buffer[offset] & 0xF) == AnimOp.Container);
+
+            frameCount = (ushort)((buffer[offset + 1] << 8) | buffer[offset + 2]);
+            keyframeInterval = buffer[offset + 3];
+            size = (ushort)((buffer[offset + 4] << 8) | buffer[offset + 5]);
+            int keyframes = keyframeInterval > 0 ? (frameCount + keyframeInterval - 1) / keyframeInterval : 0;
+            return AnimContainerHeaderLength + keyframes * 2;
+        }
     }
 }
@@ -76,6 +76,88 @@ public void Send(byte[] buffer, int offset, byte length, bool ensureDelivery, bo
             Send(buffer, offset, length, ensureDelivery, flush, 1, true);
         }
 
+        /// <summary>
+        /// Moves the link to a new rate. The badge answers at the old rate, both sides switch, and a ping echo at the new rate confirms it.
+        /// Returns false and stays at the old rate if the badge can't get close enough to the rate or the echo never shows up.
+        /// Nothing else should be in flight while this runs.
+        /// </summary>
+        public bool NegotiateBaudRate(int baud, int cpuFrequency, int timeout = 250)
+        {
+            ushort divisor;
+            bool doubleSpeed;
+            if(BadgeCommands.GetBaudRateDivisor(cpuFrequency, baud, out divisor, out doubleSpeed) > MaxBaudRateError)
+            {
+                return false;
+            }
+
+            lock(m_lockObj)
+            {
+                // not a reliable packet, since its ack would go out after the switch
+                m_baudRateAnswered.Reset();
+                MemoryStream m = new MemoryStream();
+                BadgeCommands.CreateUpdateBaudRateSetting(m, divisor, doubleSpeed);
+                WritePacket(m.GetBuffer(), 0, (byte)m.Length, 0, -1, false, true);
+                if(!m_baudRateAnswered.WaitOne(timeout))
+                {
+                    return false;
+                }
+
+                Stream.BaudRate = baud;
+
+                m_baudRateConfirmed.Reset();
+                m = new MemoryStream();
+                BadgeCommands.CreatePing(m, true, BaudRateProbeCookie);
+                WritePacket(m.GetBuffer(), 0, (byte)m.Length, 0, -1, false, true);
+                if(m_baudRateConfirmed.WaitOne(timeout))
+                {
+                    Baud = baud;
+                    return true;
+                }
+
+                // wait out the badge's own fallback before talking at the old rate again
+                Stream.BaudRate = Baud;
+                System.Threading.Thread.Sleep(BadgeBaudRateFallbackTime);
+                return false;
+            }
+        }
+
+        /// <summary>
+        /// Switches to keeping a window of packets in flight, sized by the free input buffer space the badge reports with each ack.
+        /// Every packet gets a cookie so its ack comes back, and sends wait for room in the window instead of overrunning the badge.
+        /// Packets are numbered too, so when one goes missing the badge asks for it by number and only it and the ones after it get sent again.
+        /// Returns false if the badge doesn't have credit acks or never answers. Nothing else should be in flight while this runs.
+        /// </summary>
+        public bool EnableSlidingWindow(int timeout = 250)
+        {
+            var device = Device;
+            if(device == null || (device.SupportedFeatures & SupportedFeatures.CreditAcks) == 0)
+            {
+                return false;
+            }
+
+            lock(m_lockObj)
+            {
+                // the query's answer is the starting credit
+                m_flowControlAnswered.Reset();
+                MemoryStream m = new MemoryStream();
+                BadgeCommands.CreateUpdateFlowControlSetting(m, true);
+                BadgeCommands.CreateQuerySetting(m, SettingValue.FlowControl);
+                WritePacket(m.GetBuffer(), 0, (byte)m.Length, 0, -1, false, true);
+                if(!m_flowControlAnswered.WaitOne(timeout))
+                {
+                    return false;
+                }
+
+                lock(m_windowPackets)
+                {
+                    m_windowPackets.Clear();
+                    m_restartSequence = true;
+                    SlidingWindow = true;
+                }
+                return true;
+            }
+        }
+
         void PumpResend()
         {
             PendingPacket[] resend;
@@ -116,6 +198,13 @@ void Send(byte[] buffer, int offset, byte length, bool ensureDelivery, bool flus
 
             lock(m_lockObj)
             {
+                // the window takes care of resending on its own
+                if(SlidingWindow)
+                {
+                    SendPacket(buffer, offset, length, ensureDelivery, flush);
+                    return;
+                }
+
                 //
                 byte packetID = 0;
                 if(ensureDelivery)
@@ -142,6 +231,26 @@ void Send(byte[] buffer, int offset, byte length, bool ensureDelivery, bool flus
         }
 
         void SendPacket(byte[] buffer, int offset, byte length, bool ensureDelivery, bool flush)
+        {
+            lock(m_lockObj)
+            {
+                if(SlidingWindow)
+                {
+                    PumpWindowResend();
+                    WindowPacket packet = EnterWindow(buffer, offset, length, ensureDelivery);
+                    WritePacket(buffer, offset, length, packet.Cookie, packet.Sequence, packet.Restart, flush);
+                }
+                else
+                {
+                    WritePacket(buffer, offset, length, ensureDelivery ? AcquirePacketId() : (byte)0, -1, false, flush);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Frames a packet and puts it on the wire. A sequence number switches to the sequenced sentinels (see ErrorCodes.SequenceGap).
+        /// </summary>
+        void WritePacket(byte[] buffer, int offset, byte length, byte cookie, int sequence, bool restart, bool flush)
         {
             lock(m_lockObj)
             {
@@ -153,19 +262,21 @@ void SendPacket(byte[] buffer, int offset, byte length, bool ensureDelivery, boo
                 }
 
                 //
-                m_tempHeader[5] =
-                m_tempHeader[0] = 0xA5;
-                m_tempHeader[1] = ensureDelivery ? AcquirePacketId() : (byte)0;
+                int headerLength = sequence < 0 ? 6 : 7;
+                m_tempHeader[0] = sequence < 0 ? PacketSentinel : (restart ? RestartSentinel : SequencedSentinel);
+                m_tempHeader[1] = cookie;
                 m_tempHeader[2] = length;
                 m_tempHeader[3] = (byte)(dataCrc & 0xFF);
                 m_tempHeader[4] = (byte)(dataCrc >> 8);
-                for(int i = 1; i < 5; ++i)
+                m_tempHeader[5] = (byte)sequence;
+                m_tempHeader[headerLength - 1] = m_tempHeader[0];
+                for(int i = 1; i < headerLength - 1; ++i)
                 {
-                    m_tempHeader[5] = crc8_ccitt_update(m_tempHeader[5], m_tempHeader[i]);
+                    m_tempHeader[headerLength - 1] = crc8_ccitt_update(m_tempHeader[headerLength - 1], m_tempHeader[i]);
                 }
 
                 //
-                Stream.Write(m_tempHeader, 0, m_tempHeader.Length);
+                Stream.Write(m_tempHeader, 0, headerLength);
                 Stream.Write(buffer, offset, length);
                 if(flush)
                 {
@@ -174,6 +285,155 @@ void SendPacket(byte[] buffer, int offset, byte length, bool ensureDelivery, boo
             }
         }
 
+        /// <summary>
+        /// Waits for room in the window and for a free cookie, then takes both and the next sequence number for a packet that is about to go out.
+        /// Called with the send lock held, and puts out any resends that come up while it waits.
+        /// </summary>
+        WindowPacket EnterWindow(byte[] buffer, int offset, byte length, bool reliable)
+        {
+            lock(m_windowPackets)
+            {
+                while(m_windowPackets.Count >= MaxWindowPackets || m_windowCredit < length || !AvailiblePacketIds())
+                {
+                    if(!System.Threading.Monitor.Wait(m_windowPackets, m_timerInterval))
+                    {
+                        ExpireWindowPackets(Environment.TickCount);
+                        if(m_windowPackets.Count == 0 && m_windowCredit < length)
+                        {
+                            // nothing left to bring back a fresh credit, and the badge has had plenty of time to drain its buffer
+                            m_windowCredit = MaxWindowCredit;
+                        }
+                    }
+                    PumpWindowResend();
+                }
+
+                // only reliable packets keep their contents, the others are resent empty just to fill in the sequence
+                byte[] bufferCopy = null;
+                if(reliable)
+                {
+                    bufferCopy = new byte[length];
+                    Array.Copy(buffer, offset, bufferCopy, 0, length);
+                }
+
+                var packet = new WindowPacket
+                {
+                    TimeStamp = Environment.TickCount,
+                    Attempt = 1,
+                    Cookie = AcquirePacketId(),
+                    Sequence = m_nextSequence++,
+                    Restart = m_restartSequence,
+                    Length = length,
+                    Packet = bufferCopy
+                };
+                m_restartSequence = false;
+                m_windowPackets.Add(packet);
+                m_windowCredit -= length;
+                return packet;
+            }
+        }
+
+        /// <summary>
+        /// Takes a packet out of the window once the badge acks it, credit is the free space from the ack (or -1 if it didn't carry one).
+        /// A repeat of an ack that was already handled is ignored.
+        /// </summary>
+        void RetireWindowPacket(byte cookie, int credit)
+        {
+            lock(m_windowPackets)
+            {
+                int index = m_windowPackets.FindIndex(p => p.Cookie == cookie);
+                if(index < 0)
+                {
+                    return;
+                }
+
+                m_windowPackets.RemoveAt(index);
+                if(credit >= 0)
+                {
+                    // the badge answers in order, so everything still in the window went out after this one and may not be in its buffer yet
+                    m_windowCredit = credit - m_windowPackets.Where(p => !p.Resend).Sum(p => p.Length);
+                }
+                lock(m_availableIds)
+                {
+                    m_availableIds.Enqueue(cookie);
+                }
+                System.Threading.Monitor.PulseAll(m_windowPackets);
+            }
+        }
+
+        /// <summary>
+        /// Flags every packet from the given sequence number on to go out again, in order.
+        /// Dropped is set when the badge threw them away, so their space in its buffer is free again.
+        /// </summary>
+        void MarkWindowResend(byte sequence, bool dropped)
+        {
+            lock(m_windowPackets)
+            {
+                bool first = true;
+                byte pending = (byte)(m_nextSequence - sequence);
+                foreach(var packet in m_windowPackets)
+                {
+                    if((byte)(packet.Sequence - sequence) < pending && !packet.Resend)
+                    {
+                        // the count has to pick up from here if the one it asked for is gone
+                        packet.Restart |= first && packet.Sequence != sequence;
+                        packet.Resend = true;
+                        if(dropped)
+                        {
+                            m_windowCredit = Math.Min(m_windowCredit + packet.Length, MaxWindowCredit);
+                        }
+                        first = false;
+                    }
+                }
+                System.Threading.Monitor.PulseAll(m_windowPackets);
+            }
+        }
+
+        /// <summary>
+        /// Puts the flagged packets back on the wire, in sequence order. Called with the send lock held.
+        /// A reliable packet that runs out of attempts is reported as failed and goes out empty from then on, the sequence can't skip it.
+        /// </summary>
+        void PumpWindowResend()
+        {
+            lock(m_windowPackets)
+            {
+                foreach(var packet in m_windowPackets)
+                {
+                    if(!packet.Resend)
+                    {
+                        continue;
+                    }
+
+                    if(packet.Packet != null && packet.Attempt >= m_retryMax)
+                    {
+                        m_dispatcher.NotifySendFailure(this, packet.Packet);
+                        packet.Packet = null;
+                    }
+                    byte[] body = packet.Packet ?? new byte[0];
+                    packet.Length = body.Length;
+                    packet.TimeStamp = Environment.TickCount;
+                    ++packet.Attempt;
+                    packet.Resend = false;
+                    m_windowCredit -= packet.Length;
+                    WritePacket(body, 0, (byte)body.Length, packet.Cookie, packet.Sequence, packet.Restart, false);
+                }
+                Stream.BaseStream.Flush();
+            }
+        }
+
+        /// <summary>
+        /// Goes back to the oldest packet that never got an answer and sends everything from it on again.
+        /// </summary>
+        void ExpireWindowPackets(int time)
+        {
+            lock(m_windowPackets)
+            {
+                if(m_windowPackets.Count > 0 && !m_windowPackets[0].Resend && (time - m_windowPackets[0].TimeStamp) > m_timerInterval)
+                {
+                    MarkWindowResend(m_windowPackets[0].Sequence, false);
+                }
+            }
+        }
+
         void TimeoutEvent(object state)
         {
             while(true)
@@ -199,6 +459,20 @@ void TimeoutEvent(object state)
                 }
             }
 
+            // a sender waiting on the window already holds the lock, and handles this itself
+            if(SlidingWindow && System.Threading.Monitor.TryEnter(m_lockObj))
+            {
+                try
+                {
+                    ExpireWindowPackets(Environment.TickCount);
+                    PumpWindowResend();
+                }
+                finally
+                {
+                    System.Threading.Monitor.Exit(m_lockObj);
+                }
+            }
+
             PumpResend();
         }
 
@@ -233,11 +507,20 @@ void DataReceived(object sender, SerialDataReceivedEventArgs data)
                     // handle a couple of special responses before forwarding them along
                     if(code == ResponseCodes.Ack)
                     {
-                        bool fromSerialPacket = ((fullResponse[0] & 0x08) == 0);
-                        if(fromSerialPacket)
+                        ResponseAckSource source;
+                        byte cookie;
+                        int credit;
+                        BadgeResponses.DecodeAck(fullResponse, 0, out source, out cookie, out credit);
+                        if(source == ResponseAckSource.PacketReceived)
                         {
+                            RetireWindowPacket(cookie, credit);
+
                             // reliable packet success!
-                            RetirePendingPacket(fullResponse[1]);
+                            RetirePendingPacket(cookie);
+                        }
+                        else if(source == ResponseAckSource.Ping && cookie == BaudRateProbeCookie)
+                        {
+                            m_baudRateConfirmed.Set();
                         }
                     }
                     else if(code == ResponseCodes.Error)
@@ -262,6 +545,22 @@ void DataReceived(object sender, SerialDataReceivedEventArgs data)
                                 }
                             }
                         }
+                        else if(error == ErrorCodes.SequenceGap)
+                        {
+                            // only what went missing goes out again, starting from the number the badge asked for
+                            MarkWindowResend(fullResponse[1], true);
+                            if(System.Threading.Monitor.TryEnter(m_lockObj))
+                            {
+                                try
+                                {
+                                    PumpWindowResend();
+                                }
+                                finally
+                                {
+                                    System.Threading.Monitor.Exit(m_lockObj);
+                                }
+                            }
+                        }
                     }
                     else if(code == ResponseCodes.Setting)
                     {
@@ -271,7 +570,24 @@ void DataReceived(object sender, SerialDataReceivedEventArgs data)
                             byte version, width, height, bitDepth;
                             SupportedFeatures features;
                             BadgeResponses.DecodeCapsSetting(fullResponse, 0, out version, out width, out height, out bitDepth, out features);
-                            Device = new BadgeCaps(version, width, height, bitDepth, features, Baud);
+                            // the clock isn't reported, but each known screen size only ever came with one chip
+                            int cpuFrequency = width == Badges.B1236.Width ? Badges.B1236.CpuFrequency : Badges.B1248.CpuFrequency;
+                            Device = new BadgeCaps(version, width, height, bitDepth, features, Baud, cpuFrequency);
+                        }
+                        else if(valueType == SettingValue.BaudRate)
+                        {
+                            m_baudRateAnswered.Set();
+                        }
+                        else if(valueType == SettingValue.FlowControl)
+                        {
+                            bool creditAcks;
+                            byte freeSpace;
+                            BadgeResponses.DecodeFlowControlSetting(fullResponse, 0, out creditAcks, out freeSpace);
+                            lock(m_windowPackets)
+                            {
+                                m_windowCredit = freeSpace;
+                            }
+                            m_flowControlAnswered.Set();
                         }
                     }
                 }
@@ -398,10 +714,24 @@ struct PendingPacket
             public byte[] Packet;
         }
 
+        class WindowPacket
+        {
+            public int TimeStamp;
+            public int Attempt;
+            public byte Cookie;
+            public byte Sequence;
+            public bool Restart;
+            public bool Resend;
+            public int Length;
+            public byte[] Packet;
+        }
+
         public string Port { get; private set; }
         public int Baud { get; private set; }
         public SerialPort Stream { get; private set; }
         public BadgeCaps Device { get; private set; }
+        /// <summary>Packets are sent against the badge's reported input buffer space (see EnableSlidingWindow).</summary>
+        public bool SlidingWindow { get; private set; }
 
         int m_timeSinceLastSend = Environment.TickCount;
         object m_lockObj = new object();
@@ -414,7 +744,23 @@ struct PendingPacket
         int m_retryMax = 5;
         IBadgeResponseDispatcher m_dispatcher;
         byte[] m_inputBuffer = new byte[8192];
-        byte[] m_tempHeader = new byte[6];
+        byte[] m_tempHeader = new byte[7];
         int m_inputBufferLength;
+        System.Threading.ManualResetEvent m_baudRateAnswered = new System.Threading.ManualResetEvent(false);
+        System.Threading.ManualResetEvent m_baudRateConfirmed = new System.Threading.ManualResetEvent(false);
+        System.Threading.ManualResetEvent m_flowControlAnswered = new System.Threading.ManualResetEvent(false);
+        List<WindowPacket> m_windowPackets = new List<WindowPacket>();
+        int m_windowCredit;
+        byte m_nextSequence;
+        bool m_restartSequence;
+
+        const double MaxBaudRateError = 0.02;
+        const byte BaudRateProbeCookie = 0xBD;
+        const int BadgeBaudRateFallbackTime = 1500;
+        const int MaxWindowCredit = 255;    // the badge's input ring, less the slot that always stays open
+        const int MaxWindowPackets = 4;     // the badge only queues up this many packets waiting on their crc check
+        const byte PacketSentinel = 0xA5;
+        const byte SequencedSentinel = 0xA6;
+        const byte RestartSentinel = 0xA7;  // sequenced, and the badge picks up the count from this packet
     }
 }
@@ -26,7 +26,69 @@ public enum CommandCodes: byte
         FillRect,
         ReadMemory,
         WriteMemory,
-        PlayFromBookmark
+        PlayFromBookmark,
+        /// <summary>Writes only the changed blocks of a rect, flagged by an interleaved bitmap.</summary>
+        WriteDirtyRect,
+        /// <summary>Writes, copies, or fills a rect with pixel (rather than block) coordinates, see PixelRectOp.</summary>
+        PixelRect,
+        /// <summary>Shifts a rect by -7 to 7 pixels across and -8 to 7 rows down, see ScrollEdge for what gets scrolled in.</summary>
+        Scroll,
+        /// <summary>Runs up to 16 commands once all of them are in, and answers with a single ack (see BadgeCommands.CreateCommandList).</summary>
+        CommandList,
+        /// <summary>(Anims only) Keyframe/delta container pieces and control flow (loops, jumps, calls, button branches), see AnimOp.</summary>
+        AnimOp
+    }
+
+    /// <summary>
+    /// Anim only operations, in the low bits of a CommandCodes.AnimOp header.
+    /// </summary>
+    public enum AnimOp: byte
+    {
+        /// <summary>Starts a container: frame count, keyframe interval, size, then an offset for each keyframe.</summary>
+        Container,
+        /// <summary>The whole back buffer as RunLength blocks.</summary>
+        Keyframe,
+        /// <summary>The whole back buffer as XorDelta blocks against the frame before it.</summary>
+        Delta,
+        /// <summary>Runs the commands up to the matching EndLoop a number of times (zero for no end).</summary>
+        Loop,
+        /// <summary>Back to the command after the innermost Loop, until its count runs out.</summary>
+        EndLoop,
+        /// <summary>Moves the anim by a signed offset from the op.</summary>
+        Jump,
+        /// <summary>Jumps like Jump, and the next Return comes back to the command after it.</summary>
+        Call,
+        /// <summary>Back to the command after the innermost Call.</summary>
+        Return,
+        /// <summary>Jumps if a button is down (or up), and stops that button flipping through the anim slots.</summary>
+        BranchButton
+    }
+
+    /// <summary>
+    /// Where a Scroll gets the pixels it uncovers.
+    /// Edge pixels are TwoBits blocks laid out like a PixelRect write: first the column uncovered by the horizontal shift, then the rows uncovered by the vertical shift.
+    /// </summary>
+    public enum ScrollEdge: byte
+    {
+        /// <summary>Uncovered pixels are black.</summary>
+        Black,
+        /// <summary>Uncovered pixels follow in the command.</summary>
+        Stream,
+        /// <summary>Uncovered pixels are read from an eeprom address (with the RomTarget type in the top bits).</summary>
+        Rom
+    }
+
+    /// <summary>
+    /// Operations for the PixelRect command.
+    /// </summary>
+    public enum PixelRectOp: byte
+    {
+        /// <summary>Writes pixel data, each row is (width + 7) / 8 blocks starting from the msb of the first one.</summary>
+        Write,
+        /// <summary>Copies pixels from one location to another (overlapping rects are fine).</summary>
+        Copy,
+        /// <summary>Fills with a color pattern that is lined up with the buffer's blocks.</summary>
+        Fill
     }
 
     public enum ResponseCodes: byte
@@ -35,7 +97,20 @@ public enum ResponseCodes: byte
         Setting,
         Pixels,
         Memory,
-        Error
+        Error,
+        /// <summary>An external eeprom page write finished, see BadgeResponses.DecodePageWritten.</summary>
+        PageWritten
+    }
+
+    /// <summary>
+    /// How an external eeprom page write went (see SupportedFeatures.PageWrites).
+    /// </summary>
+    public enum PageWriteStatus: byte
+    {
+        Ok,
+        /// <summary>The eeprom never answered, even after its write cycle should have been long over.</summary>
+        NoAnswer,
+        BusError
     }
 
     public enum ErrorCodes: byte
@@ -46,7 +121,9 @@ public enum ErrorCodes: byte
         ReceiveBufferOverrun,
         EepromWriteOutOfBounds,
         BadSerialCommand,
-        BadAnimCommand
+        BadAnimCommand,
+        /// <summary>Sequenced packets went missing. The cookie byte holds the sequence number to resend from.</summary>
+        SequenceGap
     }
 
     /// <summary>
@@ -70,13 +147,82 @@ public enum SettingValue: byte
         /// <summary>(ReadOnly) Queries the state of the input buffer.</summary>
         BufferFullness,
         /// <summary>(ReadOnly) Queries number physical device capabilities and version info.</summary>
-        Caps
+        Caps,
+        /// <summary>Queries a profiling counter (see ProfilePoint). Updating it clears all of the counters.</summary>
+        Stats,
+        /// <summary>(ReadOnly) Queries the number of refresh frames output so far and the hold counts left on the current frame.</summary>
+        FrameClock,
+        /// <summary>
+        /// Controls the serial link rate, as a UBRR divisor and U2X flag (see BadgeConnection.NegotiateBaudRate).
+        /// Updating it answers with the new rate at the old one, and the badge falls back if no packet makes it through at the new rate within ~1 second.
+        /// </summary>
+        BaudRate,
+        /// <summary>
+        /// Turns credit acks on or off, and queries the free space in the input buffer (see BadgeConnection.EnableSlidingWindow).
+        /// While on, every packet ack carries the input buffer's free space in a third byte.
+        /// </summary>
+        FlowControl,
+        /// <summary>
+        /// The frame of a container anim that the next swap shows, and (read only) its frame count.
+        /// Updating it seeks there through the keyframe index, drawing any frames between the keyframe and it without showing them.
+        /// </summary>
+        AnimFrame,
+        /// <summary>
+        /// The anim slot playing out of the stored directory (see BadgeCommands.CreateAnimDirectory).
+        /// Querying it describes the slot in the argument byte (see BadgeCommands.CreateQueryAnimSlot), updating it plays a slot.
+        /// </summary>
+        AnimSlot
+    }
+
+    /// <summary>
+    /// What an anim slot does once it gets to its end.
+    /// </summary>
+    public enum AnimLoopMode: byte
+    {
+        /// <summary>Stops, leaving the last frame up.</summary>
+        Once,
+        /// <summary>Starts over (from the first frame, for a container).</summary>
+        Loop,
+        /// <summary>Plays the next slot in the directory.</summary>
+        Next
+    }
+
+    /// <summary>
+    /// One entry of an anim slot directory.
+    /// </summary>
+    public struct AnimSlotInfo
+    {
+        /// <summary>Up to 8 ASCII characters.</summary>
+        public string Name { get; set; }
+        /// <summary>Where the anim starts, with the external memory flag (0x4000) for the external eeprom.</summary>
+        public short Start { get; set; }
+        /// <summary>Bytes the anim takes up, zero for one that never ends (it loops itself with PlayFromBookmark).</summary>
+        public ushort Length { get; set; }
+        public AnimLoopMode LoopMode { get; set; }
+        /// <summary>Brightness to switch to when the slot starts, zero leaves it alone.</summary>
+        public byte Brightness { get; set; }
+    }
+
+    /// <summary>
+    /// Profiling counters that can be queried with SettingValue.Stats.
+    /// Only live on firmware built with profiling enabled (see SupportedFeatures.Profiling).
+    /// </summary>
+    public enum ProfilePoint: byte
+    {
+        /// <summary>Display refresh interrupt.</summary>
+        Scanout,
+        /// <summary>Serial receive interrupt.</summary>
+        SerialRx,
+        /// <summary>First of the per command counters, add a CommandCodes value to get the rest.</summary>
+        FirstCommand
     }
 
     public enum ResponseAckSource: byte
     {
         PacketReceived,
-        Ping
+        Ping,
+        /// <summary>A command list finished, see BadgeResponses.DecodeCommandListAck.</summary>
+        CommandList
     }
 
     public enum FadingAction: byte
@@ -97,7 +243,11 @@ public enum EndofFadeAction: byte
     public enum PixelFormat: byte
     {
         OneBit,
-        TwoBits
+        TwoBits,
+        /// <summary>(WriteRect only) TwoBits blocks with repeated blocks collapsed into runs.</summary>
+        RunLength,
+        /// <summary>(WriteRect only) TwoBits blocks xor'd into the target buffer, with unchanged blocks skipped in runs.</summary>
+        XorDelta
     }
 
     public struct Pix2x8
@@ -113,7 +263,19 @@ public struct Pix2x8
     public enum SupportedFeatures: byte
     {
         /// <summary>Supports fine grained PWM brightness.</summary>
-        HardwareBrightness = 1
+        HardwareBrightness = 1,
+        /// <summary>Firmware keeps cycle counters that can be read with SettingValue.Stats.</summary>
+        Profiling = 2,
+        /// <summary>Packet acks can carry the free space in the input buffer (see SettingValue.FlowControl).</summary>
+        CreditAcks = 8,
+        /// <summary>Supports CommandCodes.CommandList.</summary>
+        CommandLists = 16,
+        /// <summary>External eeprom writes go out a page at a time, each answering with ResponseCodes.PageWritten (see BadgeCommands.CreateUploadPage).</summary>
+        PageWrites = 32,
+        /// <summary>Anims can be keyframe/delta containers that seek with SettingValue.AnimFrame (see BadgeCommands.CreateAnimContainer).</summary>
+        AnimContainers = 64,
+        /// <summary>An anim slot directory picks between several stored anims, with SettingValue.AnimSlot or (while the host is quiet) the buttons.</summary>
+        AnimSlots = 128
     }
 
     /// <summary>
@@ -23,6 +23,7 @@ public static int GetMinResponseLength(ResponseCodes response)
                 case ResponseCodes.Pixels:  return 2;
                 case ResponseCodes.Memory:  return 3;
                 case ResponseCodes.Error:   return 2;
+                case ResponseCodes.PageWritten: return 2;
             }
             //throw new NotImplementedException("Unimplemented ResponseCode length! (" + response + ")");
             return 1;
@@ -42,6 +43,12 @@ public static int GetSettingResponseLength(SettingValue setting)
                 case SettingValue.ButtonState:      return 2;
                 case SettingValue.BufferFullness:   return 2;
                 case SettingValue.Caps:             return 5;
+                case SettingValue.Stats:            return 12;
+                case SettingValue.FrameClock:       return 4;
+                case SettingValue.BaudRate:         return 3;
+                case SettingValue.FlowControl:      return 3;
+                case SettingValue.AnimFrame:        return 5;
+                case SettingValue.AnimSlot:         return 17;
             }
             //throw new NotImplementedException("Unimplemented SettingValue length! (" + setting + ")");
             return 1;
@@ -51,6 +58,10 @@ public static int GetFullResponseLength(ResponseCodes response, byte[] buffer, i
         {
             switch(response)
             {
+                case ResponseCodes.Ack:
+                {
+                    return 2 + ((buffer[offset] & AckCreditFlag) != 0 ? 1 : 0) + ((buffer[offset] & AckFailedFlag) != 0 ? 2 : 0);
+                }
                 case ResponseCodes.Setting:
                 {
                     SettingValue setting = (SettingValue)(buffer[offset] & 0xF);
@@ -78,11 +89,44 @@ public static int GetFullResponseLength(ResponseCodes response, byte[] buffer, i
         }
 
         public static int DecodeAck(byte[] buffer, int offset, out ResponseAckSource source, out byte cookie)
+        {
+            int credit;
+            return DecodeAck(buffer, offset, out source, out cookie, out credit);
+        }
+
+        /// <summary>
+        /// Credit is the free space left in the badge's input buffer as the ack went out, or -1 if the ack didn't carry it (see SettingValue.FlowControl).
+        /// </summary>
+        public static int DecodeAck(byte[] buffer, int offset, out ResponseAckSource source, out byte cookie, out int credit)
         {
             System.Diagnostics.Debug.Assert((ResponseCodes)(buffer[offset] >> 4) == ResponseCodes.Ack);
 
-            source = (ResponseAckSource)((buffer[offset] >> 3) & 0x1);
+            source = (buffer[offset] & AckListFlag) != 0 ? ResponseAckSource.CommandList : (ResponseAckSource)((buffer[offset] >> 3) & 0x1);
+            cookie = buffer[offset + 1];
+            if((buffer[offset] & AckCreditFlag) != 0)
+            {
+                credit = buffer[offset + 2];
+                return 3;
+            }
+            credit = -1;
+            return 2;
+        }
+
+        /// <summary>
+        /// Decodes the ack for a command list (see BadgeCommands.CreateCommandList).
+        /// Bit i of failedCommands is set if the list's i-th command was bad or didn't match its length.
+        /// </summary>
+        public static int DecodeCommandListAck(byte[] buffer, int offset, out byte cookie, out ushort failedCommands)
+        {
+            System.Diagnostics.Debug.Assert((ResponseCodes)(buffer[offset] >> 4) == ResponseCodes.Ack && (buffer[offset] & AckListFlag) != 0);
+
             cookie = buffer[offset + 1];
+            if((buffer[offset] & AckFailedFlag) != 0)
+            {
+                failedCommands = (ushort)((buffer[offset + 2] << 8) | buffer[offset + 3]);
+                return 4;
+            }
+            failedCommands = 0;
             return 2;
         }
 
@@ -186,6 +230,83 @@ public static int DecodeCapsSetting(byte[] buffer, int offset, out byte version,
             return 5;
         }
 
+        public static int DecodeStatsSetting(byte[] buffer, int offset, out ProfilePoint point, out ushort count, out ushort minCycles, out ushort maxCycles, out uint totalCycles)
+        {
+            System.Diagnostics.Debug.Assert((ResponseCodes)(buffer[offset] >> 4) == ResponseCodes.Setting);
+            System.Diagnostics.Debug.Assert((SettingValue)(buffer[offset] & 0xF) == SettingValue.Stats);
+
+            point = (ProfilePoint)buffer[offset + 1];
+            count = (ushort)((buffer[offset + 2] << 8) | buffer[offset + 3]);
+            minCycles = (ushort)((buffer[offset + 4] << 8) | buffer[offset + 5]);
+            maxCycles = (ushort)((buffer[offset + 6] << 8) | buffer[offset + 7]);
+            totalCycles = (uint)((buffer[offset + 8] << 24) | (buffer[offset + 9] << 16) | (buffer[offset + 10] << 8) | buffer[offset + 11]);
+            return 12;
+        }
+
+        public static int DecodeFrameClockSetting(byte[] buffer, int offset, out ushort frameCount, out byte holdCount)
+        {
+            System.Diagnostics.Debug.Assert((ResponseCodes)(buffer[offset] >> 4) == ResponseCodes.Setting);
+            System.Diagnostics.Debug.Assert((SettingValue)(buffer[offset] & 0xF) == SettingValue.FrameClock);
+
+            frameCount = (ushort)((buffer[offset + 1] << 8) | buffer[offset + 2]);
+            holdCount = buffer[offset + 3];
+            return 4;
+        }
+
+        public static int DecodeBaudRateSetting(byte[] buffer, int offset, out ushort divisor, out bool doubleSpeed)
+        {
+            System.Diagnostics.Debug.Assert((ResponseCodes)(buffer[offset] >> 4) == ResponseCodes.Setting);
+            System.Diagnostics.Debug.Assert((SettingValue)(buffer[offset] & 0xF) == SettingValue.BaudRate);
+
+            divisor = (ushort)(((buffer[offset + 1] & 0xF) << 8) | buffer[offset + 2]);
+            doubleSpeed = (buffer[offset + 1] & 0x80) != 0;
+            return 3;
+        }
+
+        public static int DecodeFlowControlSetting(byte[] buffer, int offset, out bool creditAcks, out byte freeSpace)
+        {
+            System.Diagnostics.Debug.Assert((ResponseCodes)(buffer[offset] >> 4) == ResponseCodes.Setting);
+            System.Diagnostics.Debug.Assert((SettingValue)(buffer[offset] & 0xF) == SettingValue.FlowControl);
+
+            creditAcks = (buffer[offset + 1] & 0x1) != 0;
+            freeSpace = buffer[offset + 2];
+            return 3;
+        }
+
+        public static int DecodeAnimFrameSetting(byte[] buffer, int offset, out ushort frame, out ushort frameCount)
+        {
+            System.Diagnostics.Debug.Assert((ResponseCodes)(buffer[offset] >> 4) == ResponseCodes.Setting);
+            System.Diagnostics.Debug.Assert((SettingValue)(buffer[offset] & 0xF) == SettingValue.AnimFrame);
+
+            frame = (ushort)((buffer[offset + 1] << 8) | buffer[offset + 2]);
+            frameCount = (ushort)((buffer[offset + 3] << 8) | buffer[offset + 4]);
+            return 5;
+        }
+
+        /// <summary>
+        /// Decodes the answer to BadgeCommands.CreateQueryAnimSlot. A slot past the end of the directory (or none playing) comes back zeroed.
+        /// </summary>
+        public static int DecodeAnimSlotSetting(byte[] buffer, int offset, out byte slot, out byte slotCount, out AnimSlotInfo info)
+        {
+            System.Diagnostics.Debug.Assert((ResponseCodes)(buffer[offset] >> 4) == ResponseCodes.Setting);
+            System.Diagnostics.Debug.Assert((SettingValue)(buffer[offset] & 0xF) == SettingValue.AnimSlot);
+
+            slot = buffer[offset + 1];
+            slotCount = buffer[offset + 2];
+            int nameLength = 0;
+            while(nameLength < BadgeCommands.AnimSlotNameLength && buffer[offset + 3 + nameLength] != 0)
+            {
+                ++nameLength;
+            }
+            info = new AnimSlotInfo();
+            info.Name = Encoding.ASCII.GetString(buffer, offset + 3, nameLength);
+            info.Start = (short)((buffer[offset + 11] << 8) | buffer[offset + 12]);
+            info.Length = (ushort)((buffer[offset + 13] << 8) | buffer[offset + 14]);
+            info.LoopMode = (AnimLoopMode)buffer[offset + 15];
+            info.Brightness = buffer[offset + 16];
+            return 17;
+        }
+
         public static int DecodePixels(byte[] buffer, int offset, out PixelFormat format, out byte width, out byte height, out byte bufferLength)
         {
             System.Diagnostics.Debug.Assert((ResponseCodes)(buffer[offset] >> 4) == ResponseCodes.Pixels);
@@ -215,5 +336,24 @@ public static int DecodeError(byte[] buffer, int offset, out ErrorCodes error, o
             cookie = buffer[offset + 1];
             return 2;
         }
+
+        /// <summary>
+        /// Page is the external eeprom address of the page divided by 64.
+        /// </summary>
+        public static int DecodePageWritten(byte[] buffer, int offset, out PageWriteStatus status, out byte page)
+        {
+            System.Diagnostics.Debug.Assert((ResponseCodes)(buffer[offset] >> 4) == ResponseCodes.PageWritten);
+
+            status = (PageWriteStatus)(buffer[offset] & 0xF);
+            page = buffer[offset + 1];
+            return 2;
+        }
+
+        /// <summary>Set in an Ack header when a free space byte follows the cookie.</summary>
+        internal const byte AckCreditFlag = 0x04;
+        /// <summary>Set in an Ack header for the end of a command list.</summary>
+        internal const byte AckListFlag = 0x02;
+        /// <summary>Set in an Ack header when a bitmap of failed commands follows the cookie.</summary>
+        internal const byte AckFailedFlag = 0x01;
     }
 }
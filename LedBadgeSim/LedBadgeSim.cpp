@@ -0,0 +1,2505 @@
+// Host build of the badge firmware running against the simulated peripherals in SimHal
+// Feeds a host->badge byte stream into the USART, lets the firmware chew on it, then reports what came back and what the interrupts cost
+
+#include "SimHal.h"
+#include "Display.h"
+#include "Commands.h"
+#include "Profile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// LedBadgeFirmware.cpp's main(), renamed by the build
+int FirmwareMain();
+
+enum
+{
+	BootCycles = F_CPU / 100,							// give the firmware time to configure itself before the host starts talking
+	FrameCycles = 336 * BufferHeight * 2 * 8,			// scanout interrupt interval * row segments * gray level passes
+	DefaultSettleFrames = 8,
+	AnimFrames = 4,										// distinct frames in the anim scenario's loop
+	AnimRunFrames = 240,								// refresh frames the anim scenario plays for
+	ContainerFrames = 12,								// frames in the container scenario's anim
+	ContainerKeyframeInterval = 4,
+	ContainerRunFrames = 160,							// refresh frames the container plays for before the host seeks it
+	ContainerSeekFrame = 7,								// between keyframes, so the seek has to draw its way there
+	UploadAddress = 0x0020,								// where the upload scenario starts, off a page boundary so its first and last writes are partial
+	UploadBytes = 0x1000,
+	SaveAddress = 0x0080,								// internal eeprom block the save scenario rewrites
+	SaveBytes = 64,
+	SavePasses = 3,
+	SavePassCycles = F_CPU / 4,							// how far apart the save scenario's saves go out, a full save takes ~220 ms at worst
+	SlotCount = 3,										// slots in the slots scenario's directory (see SlotInfos)
+	SlotsAddress = 0x0040,								// where the slots scenario's anims start, after the directory
+	SlotPressFrame = 40,								// refresh frames in that the button flips to the next slot
+	SlotHostFrame = 80,									// the host takes over
+	SlotIgnoredPressFrame = 100,						// a press while the host has the badge, which shouldn't do anything
+	SlotQueryFrame = 120,
+	SlotReleasedPressFrame = SlotQueryFrame + (TetherTicks + 1) * 256 * 3 / 2,	// the host has been quiet long enough for the button to flip the slots again
+																		// (the firmware's frames run ~1.5 FrameCycles, the scanout timer starts over after each handler)
+	SlotLastQueryFrame = SlotReleasedPressFrame + 40,
+	SlotBrightness = 0x40,
+	BranchOuterPasses = 3,								// the branch scenario's outer Loop count, each pass runs the inner one
+	BranchInnerPasses = 2,								// the inner Loop count, each pass calls the subroutine
+	BranchPressFrame = 30,								// refresh frames in that the button the anim waits on goes down
+	RestartIdleFrames = 4,								// idle refresh frames before the restart scenario's anim starts over
+	RestartStops = 5,									// times the host stops it again once it has started over
+	RestartStopFrames = 24,								// refresh frames between the host's commands
+	SmokeBaudRate = 0x800C,								// U2X with UBRR 12, ~115200 baud at 12 MHz
+	SmokeMemoryAddress = 0x0100,						// external eeprom page the smoke scenario writes to (see SmokeMemoryOffsets)
+	SmokeMemoryBytes = 16,
+	SmokeNestedEntryExit = 8,							// cycles the simulator charges getting in and out of an interrupt, which the firmware can't time
+	SmokeAckFillCookie = 19,							// first of the packets that fill up the ack queue during the smoke scenario's frame dump
+	SmokeCookies = SmokeAckFillCookie + 5				// one past the last cookie the smoke scenario uses
+};
+
+// Writes of SmokeMemoryBytes into the external eeprom, the last one straddles two pages
+static const unsigned int SmokeMemoryOffsets[] = { 0x00, 0x40, 0xF8 };
+static const unsigned char SmokeMemoryPages[] = { 4, 5, 7, 8 };
+
+typedef std::vector<unsigned char> Bytes;
+
+struct Options
+{
+	const char *Input;
+	const char *Scenario;
+	const char *InternalEeprom;
+	const char *ExternalEeprom;
+	unsigned int SettleFrames;
+	bool Button0;
+	bool Button1;
+	bool Dump;
+	bool Responses;
+	std::vector<std::pair<std::string, SimCycles> > Budgets;
+};
+
+static unsigned char Crc8Update(unsigned char crc, unsigned char data)
+{
+	crc ^= data;
+	for(int i = 0; i < 8; ++i)
+	{
+		crc = (crc & 0x80) ? (unsigned char)((crc << 1) ^ 0x07) : (unsigned char)(crc << 1);
+	}
+	return crc;
+}
+
+static unsigned short CrcCcittUpdate(unsigned short crc, unsigned char data)
+{
+	data ^= crc & 0xFF;
+	data ^= data << 4;
+	return ((((unsigned short)data << 8) | ((crc >> 8) & 0xFF)) ^ (unsigned char)(data >> 4) ^ ((unsigned short)data << 3));
+}
+
+// Same framing as BadgeConnection.SendPacket, a sequence number switches to the sequenced sentinels
+static void AppendPacket(Bytes &wire, unsigned char cookie, const Bytes &body, int sequence = -1, bool restart = false)
+{
+	unsigned short crc = 0xFFFF;
+	for(size_t i = 0; i < body.size(); ++i)
+	{
+		crc = CrcCcittUpdate(crc, body[i]);
+	}
+
+	unsigned char sentinel = sequence < 0 ? 0xA5 : (restart ? 0xA7 : 0xA6);
+	Bytes header;
+	header.push_back(sentinel);
+	header.push_back(cookie);
+	header.push_back((unsigned char)body.size());
+	header.push_back((unsigned char)(crc & 0xFF));
+	header.push_back((unsigned char)(crc >> 8));
+	if(sequence >= 0)
+	{
+		header.push_back((unsigned char)sequence);
+	}
+	unsigned char headerCrc = sentinel;
+	for(size_t i = 1; i < header.size(); ++i)
+	{
+		headerCrc = Crc8Update(headerCrc, header[i]);
+	}
+	header.push_back(headerCrc);
+
+	wire.insert(wire.end(), header.begin(), header.end());
+	wire.insert(wire.end(), body.begin(), body.end());
+}
+
+static Bytes PingPacket(unsigned char echo)
+{
+	Bytes ping;
+	ping.push_back((SerialCommands::Ping << 4) | 0x08);
+	ping.push_back(echo);
+	return ping;
+}
+
+static unsigned int SettingResponseLength(unsigned char setting)
+{
+	switch(setting)
+	{
+		case Settings::Brightness:		return 2;
+		case Settings::HoldTimings:		return 3;
+		case Settings::IdleTimeout:		return 3;
+		case Settings::FadeValue:		return 3;
+		case Settings::AnimBookmarkPos:	return 3;
+		case Settings::AnimReadPos:		return 3;
+		case Settings::AnimPlayState:	return 2;
+		case Settings::ButtonState:		return 2;
+		case Settings::BufferFullness:	return 2;
+		case Settings::Caps:			return 5;
+		case Settings::Stats:			return 12;
+		case Settings::FrameClock:		return 4;
+		case Settings::BaudRate:		return 3;
+		case Settings::FlowControl:		return 3;
+		case Settings::AnimFrame:		return 5;
+		case Settings::AnimSlot:		return 17;
+	}
+	return 1;
+}
+
+// Chops the badge->host stream back up into responses, mirroring BadgeResponses.GetFullResponseLength
+static void SplitResponses(const Bytes &tx, std::vector<Bytes> &responses)
+{
+	for(size_t i = 0; i < tx.size(); )
+	{
+		unsigned char header = tx[i];
+		unsigned int length = 1;
+		switch(header >> 4)
+		{
+			case ResponseCodes::Ack:		length = 2 + ((header & 0x04) ? 1 : 0) + ((header & 0x01) ? 2 : 0); break;
+			case ResponseCodes::Error:		length = 2; break;
+			case ResponseCodes::PageWritten:	length = 2; break;
+			case ResponseCodes::Setting:	length = SettingResponseLength(header & 0xF); break;
+			case ResponseCodes::Pixels:
+			{
+				length = 2;
+				if(i + 1 < tx.size())
+				{
+					length += ((tx[i + 1] >> 4) & 0xF) * (tx[i + 1] & 0xF) * ((header & 0x3) + 1);
+				}
+				break;
+			}
+			case ResponseCodes::Memory:		length = 3 + ((header & 0xF) + 1) * 4; break;
+		}
+
+		if(i + length > tx.size())
+		{
+			length = tx.size() - i;
+		}
+		responses.push_back(Bytes(tx.begin() + i, tx.begin() + i + length));
+		i += length;
+	}
+}
+
+static Pix2x8 ReadFrontBlock(unsigned char x, unsigned char y)
+{
+	const unsigned char *b = g_DisplayReg.FrontBuffer + y * BufferBitPlaneStride + x;
+	const unsigned char b0 = b[0];
+	const unsigned char b1 = b[BufferBitPlaneLength];
+	const unsigned char b2 = b[BufferBitPlaneLength * 2];
+	return (b1 << 8) | ((b0 ^ b1) | b2);
+}
+
+static void DumpFrontBuffer()
+{
+	static const char Shades[] = " .o#";
+	for(unsigned char y = 0; y < BufferHeight; ++y)
+	{
+		for(unsigned char x = 0; x < BufferBitPlaneStride; ++x)
+		{
+			Pix2x8 block = ReadFrontBlock(x, y);
+			for(int bit = 7; bit >= 0; --bit)
+			{
+				putchar(Shades[(((block >> (8 + bit)) & 1) << 1) | ((block >> bit) & 1)]);
+			}
+		}
+		putchar('\n');
+	}
+}
+
+static bool LoadFile(const char *path, unsigned char *data, size_t capacity, Bytes *grow)
+{
+	FILE *file = fopen(path, "rb");
+	if(!file)
+	{
+		fprintf(stderr, "can't open %s\n", path);
+		return false;
+	}
+
+	unsigned char chunk[256];
+	size_t total = 0;
+	for(size_t read; (read = fread(chunk, 1, sizeof(chunk), file)) != 0; total += read)
+	{
+		if(grow)
+		{
+			grow->insert(grow->end(), chunk, chunk + read);
+		}
+		else
+		{
+			memcpy(data + total, chunk, total + read > capacity ? capacity - total : read);
+			if(total + read >= capacity)
+			{
+				break;
+			}
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+// Pattern the smoke scenario writes, distinct per block and using all four gray levels
+static Pix2x8 SmokePattern(unsigned char x, unsigned char y)
+{
+	unsigned char high = (unsigned char)(x * 37 + y * 11);
+	unsigned char low = (unsigned char)~(high ^ (y << 3) ^ x);
+	return (high << 8) | low;
+}
+
+// Blocks the smoke scenario patches afterwards with a dirty rect update
+static bool SmokeDirty(unsigned char x, unsigned char y)
+{
+	return (x + y * 3) % 7 == 0;
+}
+
+// Blocks the smoke scenario flips some bits of with an xor delta update, the bottom row gets rewritten with run length data after that
+static Pix2x8 SmokeDelta(unsigned char x, unsigned char y)
+{
+	return (x * 5 + y) % 11 == 4 ? 0x0FF0 : 0;
+}
+
+static Pix2x8 SmokeBottomRow(unsigned char x)
+{
+	static const Pix2x8 Row[] = { 0x5AA5, 0x5AA5, 0x5AA5, 0x5AA5, 0x1234, 0x4321, 0x4321, 0x4321 };
+	return Row[x];
+}
+
+static unsigned char SmokeMemoryByte(unsigned char i)
+{
+	return i * 37 + 5;
+}
+
+static Pix2x8 SmokeExpected(unsigned char x, unsigned char y)
+{
+	if(y == BufferHeight - 1)
+	{
+		return SmokeBottomRow(x);
+	}
+	Pix2x8 block = SmokeDirty(x, y) ? (Pix2x8)~SmokePattern(x, y) : SmokePattern(x, y);
+	return block ^ SmokeDelta(x, y);
+}
+
+static void AppendBlock(Bytes &data, Pix2x8 block)
+{
+	data.push_back((block >> 8) & 0xFF);
+	data.push_back(block & 0xFF);
+}
+
+// PixelFormat::RunLength, repeats anything that shows up at least twice in a row
+static void EncodeRunLength(Bytes &data, const std::vector<Pix2x8> &blocks)
+{
+	for(size_t i = 0; i < blocks.size(); )
+	{
+		size_t repeat = 1;
+		while(i + repeat < blocks.size() && repeat < 128 && blocks[i + repeat] == blocks[i])
+		{
+			++repeat;
+		}
+		if(repeat > 1)
+		{
+			data.push_back(0x80 | (repeat - 1));
+			AppendBlock(data, blocks[i]);
+			i += repeat;
+			continue;
+		}
+
+		size_t literal = 1;
+		while(i + literal < blocks.size() && literal < 128 && (i + literal + 1 >= blocks.size() || blocks[i + literal + 1] != blocks[i + literal]))
+		{
+			++literal;
+		}
+		data.push_back(literal - 1);
+		for(size_t j = 0; j < literal; ++j)
+		{
+			AppendBlock(data, blocks[i + j]);
+		}
+		i += literal;
+	}
+}
+
+// PixelFormat::XorDelta, zero blocks become skips
+static void EncodeXorDelta(Bytes &data, const std::vector<Pix2x8> &deltas)
+{
+	bool endsOnSkip = false;
+	for(size_t i = 0; i < deltas.size(); )
+	{
+		bool skip = deltas[i] == 0;
+		size_t length = 1;
+		while(i + length < deltas.size() && length < 128 && (deltas[i + length] == 0) == skip)
+		{
+			++length;
+		}
+		data.push_back((skip ? 0x80 : 0) | (length - 1));
+		for(size_t j = 0; !skip && j < length; ++j)
+		{
+			AppendBlock(data, deltas[i + j]);
+		}
+		i += length;
+		endsOnSkip = skip;
+	}
+	if(endsOnSkip)
+	{
+		data.push_back(0); // padding, so the stream doesn't end on a control byte
+	}
+}
+
+static void BuildSmokeScenario(Bytes &wire)
+{
+	Bytes caps;
+	caps.push_back((SerialCommands::QuerySetting << 4) | Settings::Caps);
+	caps.push_back(0);
+	caps.push_back((SerialCommands::UpdateSetting << 4) | Settings::BaudRate);
+	caps.push_back(SmokeBaudRate >> 8);
+	caps.push_back(SmokeBaudRate & 0xFF);
+	caps.push_back((SerialCommands::UpdateSetting << 4) | Settings::FlowControl);
+	caps.push_back(1);
+	AppendPacket(wire, 1, caps);
+
+	Bytes frame;
+	frame.push_back((SerialCommands::FillRect << 4) | (BufferTarget::BackBuffer << 2));
+	frame.push_back(0);
+	frame.push_back((BufferBitPlaneStride << 4) | BufferHeight);
+	frame.push_back(0);
+	frame.push_back(0);
+	frame.push_back((SerialCommands::WriteRect << 4) | (BufferTarget::BackBuffer << 2) | PixelFormat::TwoBits);
+	frame.push_back(0);
+	frame.push_back((BufferBitPlaneStride << 4) | BufferHeight);
+	for(unsigned char y = 0; y < BufferHeight; ++y)
+	{
+		for(unsigned char x = 0; x < BufferBitPlaneStride; ++x)
+		{
+			Pix2x8 block = SmokePattern(x, y);
+			frame.push_back((block >> 8) & 0xFF);
+			frame.push_back(block & 0xFF);
+		}
+	}
+	// held, so the next swap has to sit out the rest of it
+	frame.push_back(SerialCommands::Swap << 4);
+	frame.push_back(1);
+	frame.push_back((SerialCommands::QuerySetting << 4) | Settings::FrameClock);
+	frame.push_back(0);
+	AppendPacket(wire, 2, frame);
+
+	// bring the back buffer up to date, then only send the blocks that change
+	Bytes dirty;
+	dirty.push_back((SerialCommands::CopyRect << 4) | (BufferTarget::FrontBuffer << 2) | BufferTarget::BackBuffer);
+	dirty.push_back(0);
+	dirty.push_back(0);
+	dirty.push_back((BufferBitPlaneStride << 4) | BufferHeight);
+	dirty.push_back((SerialCommands::WriteDirtyRect << 4) | (BufferTarget::BackBuffer << 2) | PixelFormat::TwoBits);
+	dirty.push_back(0);
+	dirty.push_back((BufferBitPlaneStride << 4) | BufferHeight);
+	size_t countPos = dirty.size();
+	dirty.push_back(0);
+	unsigned int count = 0;
+	size_t maskPos = 0;
+	for(unsigned char i = 0; i < BufferBitPlaneLength; ++i)
+	{
+		unsigned char x = i % BufferBitPlaneStride;
+		unsigned char y = i / BufferBitPlaneStride;
+		if((i & 7) == 0)
+		{
+			maskPos = dirty.size();
+			dirty.push_back(0);
+		}
+		if(SmokeDirty(x, y))
+		{
+			Pix2x8 block = ~SmokePattern(x, y);
+			dirty[maskPos] |= 0x80 >> (i & 7);
+			dirty.push_back((block >> 8) & 0xFF);
+			dirty.push_back(block & 0xFF);
+			++count;
+		}
+	}
+	if(dirty.size() == maskPos + 1)
+	{
+		dirty.pop_back(); // a trailing mask without any data is left off
+	}
+	dirty[countPos] = count - 1;
+	dirty.push_back(SerialCommands::Swap << 4);
+	dirty.push_back(0);
+	dirty.push_back((SerialCommands::QuerySetting << 4) | Settings::FrameClock);
+	dirty.push_back(0);
+	AppendPacket(wire, 3, dirty);
+
+	// compressed writes, the front buffer is still current in the back buffer after the last swap's copy
+	Bytes compressed;
+	compressed.push_back((SerialCommands::CopyRect << 4) | (BufferTarget::FrontBuffer << 2) | BufferTarget::BackBuffer);
+	compressed.push_back(0);
+	compressed.push_back(0);
+	compressed.push_back((BufferBitPlaneStride << 4) | BufferHeight);
+	compressed.push_back((SerialCommands::WriteRect << 4) | (BufferTarget::BackBuffer << 2) | PixelFormat::XorDelta);
+	compressed.push_back(0);
+	compressed.push_back((BufferBitPlaneStride << 4) | BufferHeight);
+	std::vector<Pix2x8> blocks;
+	for(unsigned char i = 0; i < BufferBitPlaneLength; ++i)
+	{
+		blocks.push_back(SmokeDelta(i % BufferBitPlaneStride, i / BufferBitPlaneStride));
+	}
+	EncodeXorDelta(compressed, blocks);
+	compressed.push_back((SerialCommands::WriteRect << 4) | (BufferTarget::BackBuffer << 2) | PixelFormat::RunLength);
+	compressed.push_back(BufferHeight - 1);
+	compressed.push_back((BufferBitPlaneStride << 4) | 1);
+	blocks.clear();
+	for(unsigned char x = 0; x < BufferBitPlaneStride; ++x)
+	{
+		blocks.push_back(SmokeBottomRow(x));
+	}
+	EncodeRunLength(compressed, blocks);
+	compressed.push_back(SerialCommands::Swap << 4);
+	compressed.push_back(0);
+	AppendPacket(wire, 4, compressed);
+
+	// pixel rects into the back buffer (after the last swap, so the front buffer check doesn't see them), a bad parse shows up as an error response
+	Bytes ping;
+	ping.push_back((SerialCommands::PixelRect << 4) | (BufferTarget::BackBuffer << 2) | PixelRectOps::Write);
+	ping.push_back((PixelFormat::TwoBits << 6) | 3);
+	ping.push_back((1 << 4) | (2 - 1));
+	ping.push_back(10 - 1);
+	for(unsigned char i = 0; i < 2 * 2 * 2; ++i)
+	{
+		ping.push_back(0xA5 ^ i);
+	}
+	ping.push_back((SerialCommands::PixelRect << 4) | (BufferTarget::BackBuffer << 2) | PixelRectOps::Copy);
+	ping.push_back((BufferTarget::FrontBuffer << 6) | 5);
+	ping.push_back((4 << 4) | (3 - 1));
+	ping.push_back(13 - 1);
+	ping.push_back(1);
+	ping.push_back(2);
+	ping.push_back((SerialCommands::PixelRect << 4) | (BufferTarget::BackBuffer << 2) | PixelRectOps::Fill);
+	ping.push_back(7);
+	ping.push_back((9 << 4) | (2 - 1));
+	ping.push_back(20 - 1);
+	ping.push_back(0xF0);
+	ping.push_back(0x3C);
+	ping.push_back((SerialCommands::Scroll << 4) | (BufferTarget::BackBuffer << 2) | ScrollEdge::Stream);
+	ping.push_back(0);
+	ping.push_back((BufferBitPlaneStride << 4) | BufferHeight);
+	ping.push_back(((-3 & 0xF) << 4) | 2);
+	for(unsigned char i = 0; i < (BufferHeight + BufferBitPlaneStride * 2) * 2; ++i)
+	{
+		ping.push_back(i);
+	}
+	ping.push_back((SerialCommands::Scroll << 4) | (BufferTarget::BackBuffer << 2) | ScrollEdge::Rom);
+	ping.push_back(0);
+	ping.push_back((BufferBitPlaneStride << 4) | BufferHeight);
+	ping.push_back(1 << 4);
+	ping.push_back(RomTarget::TypeInternal >> 8);
+	ping.push_back(0);
+	ping.push_back((SerialCommands::Ping << 4) | 0x08);
+	ping.push_back(0x5A);
+	ping.push_back((SerialCommands::QuerySetting << 4) | Settings::BaudRate);
+	ping.push_back(0);
+#ifdef ENABLE_PROFILING
+	ping.push_back((SerialCommands::QuerySetting << 4) | Settings::Stats);
+	ping.push_back(ProfilePoints::Scanout);
+	ping.push_back((SerialCommands::QuerySetting << 4) | Settings::Stats);
+	ping.push_back(ProfilePoints::FirstCommand + SerialCommands::WriteRect);
+#endif
+	AppendPacket(wire, 5, ping);
+
+	// data crc is checked after the fact, a bad packet must never reach the command parser, and the next one still has to get through
+	Bytes corrupt;
+	corrupt.push_back((SerialCommands::Ping << 4) | 0x08);
+	corrupt.push_back(0xC3);
+	AppendPacket(wire, 6, corrupt);
+	wire.back() ^= 0x01;
+
+	Bytes recover;
+	recover.push_back((SerialCommands::Ping << 4) | 0x08);
+	recover.push_back(0x3C);
+	AppendPacket(wire, 7, recover);
+
+	// sequenced packets, the one after a bad crc is dropped with it, and only those two get sent again
+	AppendPacket(wire, 8, PingPacket(0x81), 0x10, true);
+	AppendPacket(wire, 9, PingPacket(0x91), 0x11);
+	wire.back() ^= 0x01;
+	AppendPacket(wire, 10, PingPacket(0xA1), 0x12);
+	wire.insert(wire.end(), 64, 0); // idle line while the host hears about the gap
+	AppendPacket(wire, 9, PingPacket(0x91), 0x11);
+	AppendPacket(wire, 10, PingPacket(0xA1), 0x12);
+
+	// a repeat of something already taken in (its ack was lost) is acked again, but not run twice
+	AppendPacket(wire, 9, PingPacket(0x91), 0x11);
+
+	// a command list split over two packets, which only runs once both are in, with a few broken entries that are skipped and flagged
+	Bytes list;
+	list.push_back((SerialCommands::CommandList << 4) | (6 - 1));
+	list.push_back(0x4C);
+	list.push_back(0);
+	const Bytes echo = PingPacket(0x4D);
+	list.push_back(echo.size());
+	list.insert(list.end(), echo.begin(), echo.end());
+	list.push_back(5);
+	list.push_back((SerialCommands::FillRect << 4) | (BufferTarget::BackBuffer << 2));
+	list.push_back(0);
+	list.push_back(0x11);
+	list.push_back(0);
+	list.push_back(0);
+	list.push_back(3); // cut short
+	list.push_back((SerialCommands::FillRect << 4) | (BufferTarget::BackBuffer << 2));
+	list.push_back(0);
+	list.push_back(0x11);
+	list.push_back(2); // can't nest
+	list.push_back(SerialCommands::CommandList << 4);
+	list.push_back(0);
+	list.push_back(3); // a byte too long
+	list.push_back(SerialCommands::Ping << 4);
+	list.push_back(0);
+	list.push_back(0);
+	list.push_back(0); // empty
+	list[2] = list.size() - 3;
+	const size_t split = 8;
+	AppendPacket(wire, 11, Bytes(list.begin(), list.begin() + split));
+	wire.insert(wire.end(), 160, 0); // long enough for the main loop to get to the first half
+	AppendPacket(wire, 12, Bytes(list.begin() + split, list.end()));
+
+	// external eeprom writes go out a page at a time in the background, each one and the reads have to wait out the write cycle before them
+	Bytes memory;
+	const size_t writes = sizeof(SmokeMemoryOffsets) / sizeof(SmokeMemoryOffsets[0]);
+	for(unsigned int w = 0; w < writes; ++w)
+	{
+		unsigned int address = RomTarget::TypeExternal | (SmokeMemoryAddress + SmokeMemoryOffsets[w]);
+		memory.push_back((SerialCommands::WriteMemory << 4) | (SmokeMemoryBytes / 4 - 1));
+		memory.push_back(address >> 8);
+		memory.push_back(address & 0xFF);
+		for(unsigned char i = 0; i < SmokeMemoryBytes; ++i)
+		{
+			memory.push_back(SmokeMemoryByte(w * SmokeMemoryBytes + i));
+		}
+	}
+	for(unsigned int w = 0; w < writes; ++w)
+	{
+		unsigned int address = RomTarget::TypeExternal | (SmokeMemoryAddress + SmokeMemoryOffsets[w]);
+		memory.push_back((SerialCommands::ReadMemory << 4) | (SmokeMemoryBytes / 4 - 1));
+		memory.push_back(address >> 8);
+		memory.push_back(address & 0xFF);
+	}
+	AppendPacket(wire, 13, memory);
+
+	// a bad plain packet that the next one has come in right behind only takes itself out
+	// a frame dump keeps the acks of the packets during it from going out, and once their queue is full the checks wait until both are in
+	wire.insert(wire.end(), 200, 0); // the memory writes and reads are done first
+	Bytes dump;
+	dump.push_back((SerialCommands::ReadRect << 4) | (BufferTarget::FrontBuffer << 2) | PixelFormat::TwoBits);
+	dump.push_back(0);
+	dump.push_back((BufferBitPlaneStride << 4) | BufferHeight);
+	AppendPacket(wire, 18, dump);
+	for(unsigned char cookie = SmokeAckFillCookie; cookie < SmokeCookies; ++cookie)
+	{
+		AppendPacket(wire, cookie, PingPacket(0));
+	}
+	AppendPacket(wire, 16, PingPacket(0xC2));
+	wire.back() ^= 0x01;
+	AppendPacket(wire, 17, PingPacket(0x3D));
+
+	// a list whose second packet is lost while it waits never runs any of it, and comes back with every command flagged
+	Bytes lost;
+	lost.push_back((SerialCommands::CommandList << 4) | (2 - 1));
+	lost.push_back(0x4E);
+	lost.push_back(0);
+	const Bytes lostEcho = PingPacket(0x4F);
+	for(int i = 0; i < 2; ++i)
+	{
+		lost.push_back(lostEcho.size());
+		lost.insert(lost.end(), lostEcho.begin(), lostEcho.end());
+	}
+	lost[2] = lost.size() - 3;
+	wire.insert(wire.end(), 200, 0); // the dump and the acks held up behind it go out first
+	AppendPacket(wire, 14, Bytes(lost.begin(), lost.begin() + 5));
+	wire.insert(wire.end(), 400, 0); // long enough for the memory reads to finish and the list to start waiting
+	AppendPacket(wire, 15, Bytes(lost.begin() + 5, lost.end()));
+	wire.back() ^= 0x01;
+}
+
+static bool CheckSmokeScenario(const std::vector<Bytes> &responses)
+{
+	bool ok = true;
+	bool acked[SmokeCookies] = {};
+	bool caps = false;
+	bool echo = false;
+	bool corruptRejected = false;
+	bool corruptParsed = false;
+	bool recovered = false;
+	bool corruptBehindRejected = false;
+	bool behindEchoed = false;
+	unsigned int sequenceGaps = 0;
+	unsigned int sequencedEchoes[3] = {};
+	unsigned int listEchoes = 0;
+	unsigned int lostListAcks = 0;
+	unsigned int lostListEchoes = 0;
+	bool lostListRejected = false;
+	unsigned int listAcks = 0;
+	bool listEarly = false;
+	std::vector<unsigned int> frameClock;
+	unsigned char firstHold = 0;
+	unsigned int baudRates = 0;
+	unsigned int memoryReads = 0;
+	unsigned int pagesWritten[sizeof(SmokeMemoryPages)] = {};
+	bool pageFailed = false;
+#ifdef ENABLE_PROFILING
+	bool scanoutStats = false;
+	bool writeRectStats = false;
+#endif
+	for(size_t i = 0; i < responses.size(); ++i)
+	{
+		const Bytes &r = responses[i];
+		switch(r[0] >> 4)
+		{
+			case ResponseCodes::Ack:
+			{
+				if(r[0] & 0x02)
+				{
+					// only the entries that were cut short, nested, too long, or empty are flagged
+					listAcks += r.size() == 4 && (r[0] & 0x01) && r[1] == 0x4C && r[2] == 0x00 && r[3] == 0x3C;
+					lostListAcks += r.size() == 4 && (r[0] & 0x01) && r[1] == 0x4E && r[2] == 0x00 && r[3] == 0x03;
+				}
+				else if(r.size() == 2 && (r[0] & 0x08))
+				{
+					echo |= r[1] == 0x5A;
+					listEchoes += r[1] == 0x4D;
+					listEarly |= r[1] == 0x4D && !acked[12];
+					lostListEchoes += r[1] == 0x4F;
+					corruptParsed |= r[1] == 0xC3 || r[1] == 0xC2;
+					recovered |= r[1] == 0x3C;
+					behindEchoed |= r[1] == 0x3D;
+					for(int i = 0; i < 3; ++i)
+					{
+						sequencedEchoes[i] += r[1] == 0x81 + i * 0x10;
+					}
+				}
+				else if(r.size() == 3 && (r[0] & 0x04) && r[1] < SmokeCookies)
+				{
+					// credit acks are on from the first packet, whose own ack can go out either way
+					acked[r[1]] = true;
+				}
+				else if(r.size() == 2 && r[1] == 1)
+				{
+					acked[r[1]] = true;
+				}
+				break;
+			}
+			case ResponseCodes::Setting:
+			{
+				caps |= r.size() == 5 && r[1] == VERSION && r[2] == BufferWidth && r[3] == ((BufferHeight << 4) | 2) && (r[4] & SupportedFeatures::CreditAcks) && (r[4] & SupportedFeatures::CommandLists) && (r[4] & SupportedFeatures::PageWrites) && (r[4] & SupportedFeatures::AnimContainers) && (r[4] & SupportedFeatures::AnimSlots);
+				if(r.size() == 3 && (r[0] & 0xF) == Settings::BaudRate)
+				{
+					// the switch's own answer, then the query at the end that shows it stuck
+					baudRates += ((r[1] << 8) | r[2]) == SmokeBaudRate;
+				}
+				if(r.size() == 4)
+				{
+					if(frameClock.empty())
+					{
+						firstHold = r[3];
+					}
+					frameClock.push_back((r[1] << 8) | r[2]);
+				}
+#ifdef ENABLE_PROFILING
+				caps &= r.size() != 5 || (r[4] & SupportedFeatures::Profiling);
+				if(r.size() == 12)
+				{
+					// the firmware's own numbers leave out interrupt entry/exit, so they can't be worse than what the simulator saw
+					// scanout lets the other handlers in and takes their time back out, only getting in and out of them is left over
+					unsigned int count = (r[2] << 8) | r[3];
+					unsigned int min = (r[4] << 8) | r[5];
+					unsigned int max = (r[6] << 8) | r[7];
+					bool sane = count && min && min <= max;
+					if(r[1] == ProfilePoints::Scanout)
+					{
+						scanoutStats = sane && max <= SimGetIsrStats(SimVectors::Timer2CompA).Max + SmokeNestedEntryExit;
+					}
+					else if(r[1] == ProfilePoints::FirstCommand + SerialCommands::WriteRect)
+					{
+						writeRectStats = sane && count == 3;
+					}
+				}
+#endif
+				break;
+			}
+			case ResponseCodes::Memory:
+			{
+				unsigned int address = r.size() > 3 ? (r[1] << 8) | r[2] : 0;
+				for(unsigned int w = 0; w < sizeof(SmokeMemoryOffsets) / sizeof(SmokeMemoryOffsets[0]); ++w)
+				{
+					bool match = r.size() == 3 + SmokeMemoryBytes && address == (RomTarget::TypeExternal | (SmokeMemoryAddress + SmokeMemoryOffsets[w]));
+					for(unsigned char b = 0; match && b < SmokeMemoryBytes; ++b)
+					{
+						match = r[3 + b] == SmokeMemoryByte(w * SmokeMemoryBytes + b);
+					}
+					memoryReads += match;
+				}
+				break;
+			}
+			case ResponseCodes::PageWritten:
+			{
+				pageFailed |= r.size() != 2 || (r[0] & 0xF) != PageWriteStatus::Ok;
+				for(unsigned int p = 0; r.size() == 2 && p < sizeof(SmokeMemoryPages); ++p)
+				{
+					pagesWritten[p] += r[1] == SmokeMemoryPages[p];
+				}
+				break;
+			}
+			case ResponseCodes::Error:
+			{
+				if(r.size() == 2 && (r[0] & 0xF) == ErrorCodes::CorruptPacketData && r[1] == 6 && !corruptRejected)
+				{
+					corruptRejected = true;
+					break;
+				}
+				if(r.size() == 2 && (r[0] & 0xF) == ErrorCodes::CorruptPacketData && r[1] == 16 && !corruptBehindRejected)
+				{
+					corruptBehindRejected = true;
+					break;
+				}
+				if(r.size() == 2 && (r[0] & 0xF) == ErrorCodes::CorruptPacketData && r[1] == 15 && !lostListRejected)
+				{
+					lostListRejected = true;
+					break;
+				}
+				if(r.size() == 2 && (r[0] & 0xF) == ErrorCodes::SequenceGap && r[1] == 0x11)
+				{
+					++sequenceGaps;
+					break;
+				}
+				fprintf(stderr, "smoke: error response %d (cookie %d)\n", r[0] & 0xF, r.size() > 1 ? r[1] : 0);
+				ok = false;
+				break;
+			}
+		}
+	}
+
+	for(int cookie = 1; cookie < SmokeCookies; ++cookie)
+	{
+		if(cookie == 6 || cookie == 15 || cookie == 16)
+		{
+			continue;
+		}
+		if(!acked[cookie])
+		{
+			fprintf(stderr, "smoke: packet %d was never acked\n", cookie);
+			ok = false;
+		}
+	}
+	if(!caps)
+	{
+		fprintf(stderr, "smoke: missing or bad caps response\n");
+		ok = false;
+	}
+	if(!echo)
+	{
+		fprintf(stderr, "smoke: missing ping echo\n");
+		ok = false;
+	}
+	if(!corruptRejected || corruptParsed || acked[6] || !recovered)
+	{
+		fprintf(stderr, "smoke: corrupt packet wasn't rejected cleanly\n");
+		ok = false;
+	}
+	if(!corruptBehindRejected || acked[16] || !behindEchoed)
+	{
+		fprintf(stderr, "smoke: corrupt packet took the one behind it down with it\n");
+		ok = false;
+	}
+	if(sequenceGaps != 1 || sequencedEchoes[0] != 1 || sequencedEchoes[1] != 1 || sequencedEchoes[2] != 1)
+	{
+		fprintf(stderr, "smoke: sequenced packets weren't resent cleanly (%u gap reports, echoes %u %u %u)\n", sequenceGaps, sequencedEchoes[0], sequencedEchoes[1], sequencedEchoes[2]);
+		ok = false;
+	}
+	if(listAcks != 1 || listEchoes != 1 || listEarly)
+	{
+		fprintf(stderr, "smoke: command list wasn't run or reported cleanly (%u acks, %u echoes)\n", listAcks, listEchoes);
+		ok = false;
+	}
+	if(lostListAcks != 1 || lostListEchoes || !lostListRejected || acked[15])
+	{
+		fprintf(stderr, "smoke: command list with a lost packet wasn't given up on cleanly (%u acks, %u echoes)\n", lostListAcks, lostListEchoes);
+		ok = false;
+	}
+	if(memoryReads != sizeof(SmokeMemoryOffsets) / sizeof(SmokeMemoryOffsets[0]))
+	{
+		fprintf(stderr, "smoke: external eeprom didn't read back what was written\n");
+		ok = false;
+	}
+	for(unsigned int p = 0; p < sizeof(SmokeMemoryPages); ++p)
+	{
+		if(pagesWritten[p] != 1 || pageFailed)
+		{
+			fprintf(stderr, "smoke: page %u write wasn't reported once as ok\n", SmokeMemoryPages[p]);
+			ok = false;
+		}
+	}
+	if(baudRates != 2)
+	{
+		fprintf(stderr, "smoke: baud rate switch wasn't answered or didn't stick\n");
+		ok = false;
+	}
+	if(frameClock.size() != 2 || firstHold != 1 || (unsigned short)(frameClock[1] - frameClock[0]) < 1 + RefreshFramesPerHold)
+	{
+		fprintf(stderr, "smoke: held swap latched early or missing frame clock\n");
+		ok = false;
+	}
+#ifdef ENABLE_PROFILING
+	if(!scanoutStats || !writeRectStats)
+	{
+		fprintf(stderr, "smoke: missing or bad profiling stats\n");
+		ok = false;
+	}
+#endif
+
+	for(unsigned char y = 0; y < BufferHeight; ++y)
+	{
+		for(unsigned char x = 0; x < BufferBitPlaneStride; ++x)
+		{
+			if(ReadFrontBlock(x, y) != SmokeExpected(x, y))
+			{
+				fprintf(stderr, "smoke: front buffer mismatch at block %d,%d\n", x, y);
+				return false;
+			}
+		}
+	}
+	return ok;
+}
+
+// Random rect coordinate, leaning on the edges and on full rows since that's where the bulk paths kick in
+static unsigned char BlitCoord(unsigned char extent)
+{
+	switch(rand() % 4)
+	{
+	case 0:		return 0;
+	case 1:		return extent;
+	default:	return rand() % (extent + 3);
+	}
+}
+
+// Fills a buffer with random blocks (a block at a time through the firmware, so the bit-planes are consistent)
+static void RandomizeBuffer(unsigned char *buffer)
+{
+	for(unsigned char y = 0; y < BufferHeight; ++y)
+	{
+		for(unsigned char x = 0; x < BufferBitPlaneStride; ++x)
+		{
+			SolidFillBlocks(x, y, 1, 1, (Pix2x8)rand(), buffer);
+		}
+	}
+}
+
+// Reference model for the pixel granular ops, one 2 bit pixel at a time
+static unsigned char GetBlitPixel(const unsigned char *buffer, unsigned char x, unsigned char y)
+{
+	const unsigned char *b = buffer + y * BufferBitPlaneStride + (x >> 3);
+	const unsigned char bit = 0x80 >> (x & 7);
+	const unsigned char high = (b[BufferBitPlaneLength] & bit) ? 1 : 0;
+	const unsigned char low = (((b[0] ^ b[BufferBitPlaneLength]) | b[BufferBitPlaneLength * 2]) & bit) ? 1 : 0;
+	return (high << 1) | low;
+}
+
+static void SetBlitPixel(unsigned char *buffer, unsigned char x, unsigned char y, unsigned char val)
+{
+	unsigned char *b = buffer + y * BufferBitPlaneStride + (x >> 3);
+	const unsigned char bit = 0x80 >> (x & 7);
+	const bool high = (val & 2) != 0;
+	const bool low = (val & 1) != 0;
+	b[0] = (low || high) ? (b[0] | bit) : (b[0] & ~bit);
+	b[BufferBitPlaneLength] = high ? (b[BufferBitPlaneLength] | bit) : (b[BufferBitPlaneLength] & ~bit);
+	b[BufferBitPlaneLength * 2] = (low && high) ? (b[BufferBitPlaneLength * 2] | bit) : (b[BufferBitPlaneLength * 2] & ~bit);
+}
+
+static unsigned char BlockPixel(Pix2x8 block, unsigned char i)
+{
+	return (((block >> (15 - i)) & 1) << 1) | ((block >> (7 - i)) & 1);
+}
+
+static unsigned int ClampedSpan(unsigned char pos, unsigned char size, unsigned char extent)
+{
+	return pos >= extent ? 0 : (pos + size > extent ? extent - pos : size);
+}
+
+static Bytes s_BlitStream;
+static size_t s_BlitStreamPos;
+static bool s_BlitStreamClosed;
+
+static unsigned char FetchBlitStream(bool moreBytes)
+{
+	s_BlitStreamClosed = !moreBytes;
+	return s_BlitStreamPos < s_BlitStream.size() ? s_BlitStream[s_BlitStreamPos++] : 0;
+}
+
+// Runs the pixel granular ops against the reference model on random rects
+static bool CheckPixelBlits()
+{
+	enum { Iterations = 20000 };
+	static unsigned char pixels[2][BufferLength];
+	static unsigned char reference[2][BufferLength];
+
+	for(unsigned int i = 0; i < Iterations; ++i)
+	{
+		RandomizeBuffer(pixels[0]);
+		RandomizeBuffer(pixels[1]);
+		memcpy(reference, pixels, sizeof(pixels));
+
+		unsigned char x = BlitCoord(BufferStrideWidth);
+		unsigned char y = BlitCoord(BufferHeight);
+		unsigned char width = 1 + rand() % 64;
+		unsigned char height = 1 + rand() % 16;
+
+		const char *op;
+		switch(i % 4)
+		{
+		case 0:
+			{
+				op = "FillPixels";
+				PixelFormat::Enum format = (i & 4) ? PixelFormat::TwoBits : PixelFormat::OneBit;
+				unsigned int blocks = (width + 7) / 8;
+				s_BlitStream.clear();
+				for(unsigned int b = 0; b < blocks * height * (format + 1); ++b)
+				{
+					s_BlitStream.push_back((unsigned char)rand());
+				}
+				s_BlitStreamPos = 0;
+				s_BlitStreamClosed = false;
+				FillPixels(x, y, width, height, format, FetchBlitStream, pixels[1]);
+				if(s_BlitStreamPos != s_BlitStream.size() || !s_BlitStreamClosed)
+				{
+					fprintf(stderr, "blits: FillPixels read %u of %u bytes\n", (unsigned int)s_BlitStreamPos, (unsigned int)s_BlitStream.size());
+					return false;
+				}
+
+				for(unsigned char iy = 0; iy < ClampedSpan(y, height, BufferHeight); ++iy)
+				{
+					for(unsigned char ix = 0; ix < ClampedSpan(x, width, BufferStrideWidth); ++ix)
+					{
+						unsigned int b = (iy * blocks + ix / 8) * (format + 1);
+						Pix2x8 block = format == PixelFormat::OneBit ? (s_BlitStream[b] << 8) | s_BlitStream[b] : (s_BlitStream[b] << 8) | s_BlitStream[b + 1];
+						SetBlitPixel(reference[1], x + ix, y + iy, BlockPixel(block, ix & 7));
+					}
+				}
+				break;
+			}
+		case 1:
+			{
+				op = "SolidFillPixels";
+				Pix2x8 color = (Pix2x8)rand();
+				SolidFillPixels(x, y, width, height, color, pixels[1]);
+				for(unsigned char iy = 0; iy < ClampedSpan(y, height, BufferHeight); ++iy)
+				{
+					for(unsigned char ix = 0; ix < ClampedSpan(x, width, BufferStrideWidth); ++ix)
+					{
+						SetBlitPixel(reference[1], x + ix, y + iy, BlockPixel(color, (x + ix) & 7));
+					}
+				}
+				break;
+			}
+		case 3:
+			{
+				// blocks for the rect this time, and everything outside of it has to stay put
+				op = "Scroll";
+				x = BlitCoord(BufferBitPlaneStride);
+				width = BlitCoord(BufferBitPlaneStride);
+				signed char dx = rand() % 15 - 7;
+				signed char dy = rand() % 16 - 8;
+				Scroll(x, y, width, height, dx, dy, pixels[1]);
+
+				unsigned char before[BufferLength];
+				memcpy(before, reference[1], BufferLength);
+				unsigned char left = x * 8;
+				unsigned char right = left + ClampedSpan(x, width, BufferBitPlaneStride) * 8;
+				unsigned char top = y;
+				unsigned char bottom = top + ClampedSpan(y, height, BufferHeight);
+				for(unsigned char iy = top; iy < bottom; ++iy)
+				{
+					for(unsigned char ix = left; ix < right; ++ix)
+					{
+						int sx = ix - dx;
+						int sy = iy - dy;
+						bool inside = sx >= left && sx < right && sy >= top && sy < bottom;
+						SetBlitPixel(reference[1], ix, iy, inside ? GetBlitPixel(before, sx, sy) : 0);
+					}
+				}
+				break;
+			}
+		default:
+			{
+				// half of the copies stay within one buffer so overlapping rects get covered too
+				op = "CopyPixels";
+				unsigned char srcX = BlitCoord(BufferStrideWidth);
+				unsigned char srcY = BlitCoord(BufferHeight);
+				unsigned char src = (i & 4) ? 1 : 0;
+				CopyPixels(srcX, srcY, x, y, width, height, pixels[src], pixels[1]);
+
+				unsigned char w = ClampedSpan(x, ClampedSpan(srcX, width, BufferStrideWidth), BufferStrideWidth);
+				unsigned char h = ClampedSpan(y, ClampedSpan(srcY, height, BufferHeight), BufferHeight);
+				unsigned char staged[BufferHeight][BufferStrideWidth];
+				for(unsigned char iy = 0; iy < h; ++iy)
+				{
+					for(unsigned char ix = 0; ix < w; ++ix)
+					{
+						staged[iy][ix] = GetBlitPixel(reference[src], srcX + ix, srcY + iy);
+					}
+				}
+				for(unsigned char iy = 0; iy < h; ++iy)
+				{
+					for(unsigned char ix = 0; ix < w; ++ix)
+					{
+						SetBlitPixel(reference[1], x + ix, y + iy, staged[iy][ix]);
+					}
+				}
+				break;
+			}
+		}
+
+		if(memcmp(pixels, reference, sizeof(pixels)))
+		{
+			fprintf(stderr, "blits: %s mismatch at %d,%d %dx%d (iteration %u)\n", op, x, y, width, height, i);
+			return false;
+		}
+	}
+
+	printf("blits: %u pixel ops matched\n", Iterations);
+	return true;
+}
+
+static Pix2x8 GetBlitBlock(const unsigned char *buffer, unsigned char x, unsigned char y)
+{
+	const unsigned char *b = buffer + y * BufferBitPlaneStride + x;
+	const unsigned char high = b[BufferBitPlaneLength];
+	const unsigned char low = (b[0] ^ high) | b[BufferBitPlaneLength * 2];
+	return (high << 8) | low;
+}
+
+static void SetBlitBlock(unsigned char *buffer, unsigned char x, unsigned char y, Pix2x8 val)
+{
+	if(x < BufferBitPlaneStride && y < BufferHeight)
+	{
+		unsigned char *b = buffer + y * BufferBitPlaneStride + x;
+		const unsigned char low = val & 0xFF;
+		const unsigned char high = (val >> 8) & 0xFF;
+		b[0] = low | high;
+		b[BufferBitPlaneLength] = high;
+		b[BufferBitPlaneLength * 2] = low & high;
+	}
+}
+
+// Reference for Fill, decoding and storing a block at a time with a bounds check on each (how Fill used to work)
+static void FillBlocks(unsigned char x, unsigned char y, unsigned char width, unsigned char height, PixelFormat::Enum format, FetchByte fetch, unsigned char *buffer)
+{
+	unsigned char count = width * height;
+	unsigned char control = 0;
+	unsigned char run = 0;
+	Pix2x8 data = 0;
+	for(unsigned char iy = y, sy = y + height; iy < sy; ++iy)
+	{
+		for(unsigned char ix = x, sx = x + width; ix < sx; ++ix)
+		{
+			--count;
+			if(format == PixelFormat::OneBit)
+			{
+				data = fetch(count > 0);
+				data = (data << 8) | data;
+			}
+			else if(format == PixelFormat::TwoBits)
+			{
+				data = fetch(true);
+				data = (data << 8) | fetch(count > 0);
+			}
+			else
+			{
+				if(run == 0)
+				{
+					control = fetch(true);
+					run = (control & 0x7F) + 1;
+					if(format == PixelFormat::RunLength && (control & 0x80))
+					{
+						data = fetch(true);
+						data = (data << 8) | fetch(run <= count);
+					}
+				}
+				--run;
+
+				if(!(control & 0x80))
+				{
+					data = fetch(true);
+					data = (data << 8) | fetch(count > 0);
+				}
+
+				if(format == PixelFormat::XorDelta)
+				{
+					if(control & 0x80)
+					{
+						if(count == 0)
+						{
+							fetch(false); // discard padding byte
+						}
+						continue;
+					}
+					if(ix < BufferBitPlaneStride && iy < BufferHeight)
+					{
+						data ^= GetBlitBlock(buffer, ix, iy);
+					}
+				}
+			}
+
+			SetBlitBlock(buffer, ix, iy, data);
+		}
+	}
+}
+
+// Runs Fill against the block at a time version on random rects and streams in every format
+static bool CheckFillBlits()
+{
+	enum { Iterations = 20000 };
+	static unsigned char bulk[BufferLength];
+	static unsigned char blocks[BufferLength];
+
+	for(unsigned int i = 0; i < Iterations; ++i)
+	{
+		RandomizeBuffer(bulk);
+		memcpy(blocks, bulk, sizeof(bulk));
+
+		unsigned char x = BlitCoord(BufferBitPlaneStride);
+		unsigned char y = BlitCoord(BufferHeight);
+		unsigned char width = 1 + BlitCoord(BufferBitPlaneStride);
+		unsigned char height = 1 + BlitCoord(BufferHeight);
+		PixelFormat::Enum format = static_cast<PixelFormat::Enum>(i % 4);
+		s_BlitStream.clear();
+		for(unsigned int b = 0; b < width * height * 3u; ++b)
+		{
+			s_BlitStream.push_back((unsigned char)rand());
+		}
+
+		s_BlitStreamPos = 0;
+		Fill(x, y, width, height, format, FetchBlitStream, bulk);
+		size_t bulkRead = s_BlitStreamPos;
+		bool bulkClosed = s_BlitStreamClosed;
+
+		s_BlitStreamPos = 0;
+		FillBlocks(x, y, width, height, format, FetchBlitStream, blocks);
+		if(memcmp(bulk, blocks, sizeof(bulk)) || bulkRead != s_BlitStreamPos || bulkClosed != s_BlitStreamClosed)
+		{
+			fprintf(stderr, "blits: Fill format %d mismatch at %d,%d %dx%d (iteration %u)\n", format, x, y, width, height, i);
+			return false;
+		}
+	}
+
+	printf("blits: %u fills matched\n", Iterations);
+	return true;
+}
+
+// Counts the host instructions a call takes, by single stepping a forked copy of the sim under ptrace
+// The simulated clock only moves on register accesses, so it (and the Stats counters running off it) can't see plain RAM work like the blit loops
+// Returns -1 where that isn't available
+static long CountInstructions(void (*run)())
+{
+#ifdef __linux__
+	pid_t pid = fork();
+	if(pid == 0)
+	{
+		if(ptrace(PTRACE_TRACEME, 0, 0, 0) != 0)
+		{
+			_exit(2);
+		}
+		raise(SIGSTOP);
+		raise(SIGSTOP); // an empty run, to take out what the stops themselves cost
+		raise(SIGSTOP);
+		run();
+		raise(SIGSTOP);
+		_exit(0);
+	}
+
+	long counts[2] = {};
+	int status = 0;
+	waitpid(pid, &status, 0);
+	for(int pass = 0; pass < 2 && WIFSTOPPED(status); ++pass)
+	{
+		for(;;)
+		{
+			ptrace(PTRACE_SINGLESTEP, pid, 0, 0);
+			waitpid(pid, &status, 0);
+			if(!WIFSTOPPED(status) || WSTOPSIG(status) == SIGSTOP)
+			{
+				break;
+			}
+			++counts[pass];
+		}
+		if(pass == 0 && WIFSTOPPED(status))
+		{
+			ptrace(PTRACE_CONT, pid, 0, 0);
+			waitpid(pid, &status, 0);
+		}
+	}
+	if(WIFSTOPPED(status))
+	{
+		ptrace(PTRACE_CONT, pid, 0, 0);
+		waitpid(pid, &status, 0);
+	}
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? counts[1] - counts[0] : -1;
+#else
+	return -1;
+#endif
+}
+
+static unsigned char s_CostBuffer[BufferLength];
+static unsigned char FetchCostStream(bool /*moreBytes*/) { return s_BlitStream[s_BlitStreamPos++]; }
+static FetchByte volatile s_CostFetch = FetchCostStream; // opaque, so the reference can't inline the fetch where Fill can't either
+static void CostFill() { Fill(0, 0, BufferBitPlaneStride, BufferHeight, PixelFormat::TwoBits, s_CostFetch, s_CostBuffer); }
+static void CostFillBlocks() { FillBlocks(0, 0, BufferBitPlaneStride, BufferHeight, PixelFormat::TwoBits, s_CostFetch, s_CostBuffer); }
+static void CostSolidFill() { SolidFill(0, 0, BufferBitPlaneStride, BufferHeight, 0x5AA5, s_CostBuffer); }
+static void CostSolidFillBlocks() { SolidFillBlocks(0, 0, BufferBitPlaneStride, BufferHeight, 0x5AA5, s_CostBuffer); }
+
+bool ScrollCommandHandler(unsigned char header, FetchByte fetch);
+
+// Scrolls a rect hanging off the bottom right corner, the uncovered edges have to land inside the buffer
+static bool CheckScrollEdges()
+{
+	static unsigned char pixels[BufferLength];
+	memset(pixels, 0, sizeof(pixels));
+	unsigned char *backBuffer = g_DisplayReg.BackBuffer;
+	g_DisplayReg.BackBuffer = pixels;
+
+	enum { X = BufferBitPlaneStride - 2, Y = BufferHeight - 4, Width = 4, Height = 6, Columns = 3, Rows = 2 };
+	const unsigned char header[] = { X << 4 | Y, Width << 4 | Height, (-Columns & 0xF) << 4 | (-Rows & 0xF) };
+	s_BlitStream.assign(header, header + sizeof(header));
+	for(unsigned char i = 0; i < Height; ++i)
+	{
+		AppendBlock(s_BlitStream, 0xFFFF); // the column edge is white
+	}
+	for(unsigned char i = 0; i < Width * Rows; ++i)
+	{
+		AppendBlock(s_BlitStream, 0x00FF); // and the rows edge is the darkest gray
+	}
+	s_BlitStreamPos = 0;
+	bool handled = ScrollCommandHandler((SerialCommands::Scroll << 4) | (BufferTarget::BackBuffer << 2) | ScrollEdge::Stream, FetchBlitStream);
+	g_DisplayReg.BackBuffer = backBuffer;
+
+	bool ok = handled && s_BlitStreamPos == s_BlitStream.size() && s_BlitStreamClosed;
+	for(unsigned char iy = Y; iy < BufferHeight; ++iy)
+	{
+		for(unsigned char ix = X * 8; ix < BufferStrideWidth; ++ix)
+		{
+			unsigned char expected = iy >= BufferHeight - Rows ? 1 : (ix >= BufferStrideWidth - Columns ? 3 : 0);
+			ok = ok && GetBlitPixel(pixels, ix, iy) == expected;
+		}
+	}
+	if(!ok)
+	{
+		fprintf(stderr, "blits: Scroll edges off the bottom right went astray (read %u of %u bytes)\n", (unsigned int)s_BlitStreamPos, (unsigned int)s_BlitStream.size());
+	}
+	return ok;
+}
+
+// Reports what a full buffer WriteRect (Fill with TwoBits) and FillRect (SolidFill) take against the block at a time versions
+// Host instruction counts swing with the compiler and its flags and say nothing about AVR cycles, so these are for reading rather than checking
+static void ReportBlitCosts()
+{
+	s_BlitStream.assign(BufferBitPlaneLength * 2, 0);
+	for(size_t b = 0; b < s_BlitStream.size(); ++b)
+	{
+		s_BlitStream[b] = (unsigned char)(b * 37 + 11);
+	}
+	s_BlitStreamPos = 0;
+
+	static const struct { const char *Name; void (*Bulk)(); void (*Blocks)(); } Costs[] =
+	{
+		{ "Fill", CostFill, CostFillBlocks },
+		{ "SolidFill", CostSolidFill, CostSolidFillBlocks },
+	};
+	for(size_t i = 0; i < sizeof(Costs) / sizeof(Costs[0]); ++i)
+	{
+		long bulk = CountInstructions(Costs[i].Bulk);
+		long blocks = CountInstructions(Costs[i].Blocks);
+		if(bulk < 0 || blocks < 0)
+		{
+			printf("blits: can't single step here, skipping the instruction counts\n");
+			return;
+		}
+		printf("blits: full buffer %s takes %ld host instructions, %ld a block at a time\n", Costs[i].Name, bulk, blocks);
+	}
+}
+
+// Runs Copy and SolidFill against the block at a time versions on random rects, the results have to match bit for bit
+static bool CheckBlitScenario()
+{
+	enum { Iterations = 20000 };
+	static unsigned char bulk[2][BufferLength];
+	static unsigned char blocks[2][BufferLength];
+
+	srand(1);
+	unsigned long bulkRows = 0;
+	for(unsigned int i = 0; i < Iterations; ++i)
+	{
+		RandomizeBuffer(bulk[0]);
+		RandomizeBuffer(bulk[1]);
+		memcpy(blocks, bulk, sizeof(bulk));
+
+		unsigned char x = BlitCoord(BufferBitPlaneStride);
+		unsigned char y = BlitCoord(BufferHeight);
+		unsigned char width = BlitCoord(BufferBitPlaneStride);
+		unsigned char height = BlitCoord(BufferHeight);
+		bulkRows += x == 0 && width >= BufferBitPlaneStride;
+
+		const char *op;
+		if(i & 1)
+		{
+			op = "SolidFill";
+			Pix2x8 color = (i & 2) ? 0 : (Pix2x8)rand();
+			SolidFill(x, y, width, height, color, bulk[1]);
+			SolidFillBlocks(x, y, width, height, color, blocks[1]);
+		}
+		else
+		{
+			// half of the copies stay within one buffer so overlapping rects get covered too
+			op = "Copy";
+			unsigned char srcX = BlitCoord(BufferBitPlaneStride);
+			unsigned char srcY = BlitCoord(BufferHeight);
+			if(rand() & 1)
+			{
+				srcX = x;
+			}
+			unsigned char src = (i & 2) ? 1 : 0;
+			Copy(srcX, srcY, x, y, width, height, bulk[src], bulk[1]);
+			CopyBlocks(srcX, srcY, x, y, width, height, blocks[src], blocks[1]);
+		}
+
+		if(memcmp(bulk, blocks, sizeof(bulk)))
+		{
+			fprintf(stderr, "blits: %s mismatch at %d,%d %dx%d (iteration %u)\n", op, x, y, width, height, i);
+			return false;
+		}
+	}
+
+	printf("blits: %u ops matched, %lu on full rows\n", Iterations, bulkRows);
+	if(!CheckFillBlits() || !CheckPixelBlits() || !CheckScrollEdges())
+	{
+		return false;
+	}
+	ReportBlitCosts();
+	return true;
+}
+
+// Pattern for one frame of the anim scenario
+static Pix2x8 AnimPattern(unsigned char frame, unsigned char x, unsigned char y)
+{
+	return SmokePattern(x, y) ^ (Pix2x8)(frame * 0x3C5A + x * 0x0101);
+}
+
+// Stores a looping anim of full frame writes in the external eeprom, each frame followed by a swap and a ping that echoes its number
+static void BuildAnimScenario(unsigned char *eeprom)
+{
+	static const unsigned char Magic[] = { '\0', 'H', '\0', 'i' };
+	Bytes anim(Magic, Magic + sizeof(Magic));
+	for(unsigned char f = 0; f < AnimFrames; ++f)
+	{
+		anim.push_back((SerialCommands::WriteRect << 4) | (BufferTarget::BackBuffer << 2) | PixelFormat::TwoBits);
+		anim.push_back(0);
+		anim.push_back((BufferBitPlaneStride << 4) | BufferHeight);
+		for(unsigned char y = 0; y < BufferHeight; ++y)
+		{
+			for(unsigned char x = 0; x < BufferBitPlaneStride; ++x)
+			{
+				AppendBlock(anim, AnimPattern(f, x, y));
+			}
+		}
+		anim.push_back(SerialCommands::Swap << 4);
+		anim.push_back(0);
+		anim.push_back((SerialCommands::Ping << 4) | 0x08);
+		anim.push_back(f + 1);
+	}
+	// back to the bookmark, which is the start
+	anim.push_back((SerialCommands::PlayFromBookmark << 4) | AnimState::Playing);
+	anim.push_back(0);
+	anim.push_back(0);
+	memcpy(eeprom, anim.data(), anim.size());
+}
+
+static bool CheckAnimScenario(const std::vector<Bytes> &responses)
+{
+	// the frames have to come out in order, and the one on screen has to be whole
+	unsigned int frames = 0;
+	bool ok = true;
+	for(size_t i = 0; i < responses.size(); ++i)
+	{
+		const Bytes &r = responses[i];
+		if(r.size() != 2 || r[0] != ((ResponseCodes::Ack << 4) | 0x08) || r[1] != frames % AnimFrames + 1)
+		{
+			fprintf(stderr, "anim: unexpected response %02X after %u frames\n", r[0], frames);
+			ok = false;
+			break;
+		}
+		++frames;
+	}
+
+	bool whole = false;
+	for(unsigned char f = 0; f < AnimFrames && !whole; ++f)
+	{
+		whole = true;
+		for(unsigned char y = 0; y < BufferHeight; ++y)
+		{
+			for(unsigned char x = 0; x < BufferBitPlaneStride; ++x)
+			{
+				whole &= ReadFrontBlock(x, y) == AnimPattern(f, x, y);
+			}
+		}
+	}
+	if(!whole)
+	{
+		fprintf(stderr, "anim: front buffer isn't one of the frames\n");
+		ok = false;
+	}
+
+	// the read stays open from one command to the next, so only the jump back to the start seeks (a start and a repeated start each)
+	printf("anim: %u frames in %u refresh frames, %lu i2c starts\n", frames, (unsigned int)AnimRunFrames, SimTwiStarts());
+	if(frames < AnimRunFrames * 5 / 8 || SimTwiStarts() > 2 * (2 + frames / AnimFrames))
+	{
+		fprintf(stderr, "anim: fell behind or seeked between commands\n");
+		ok = false;
+	}
+	return ok;
+}
+
+// Pattern for one frame of the container scenario, a bar moves down and the rest stays put
+static Pix2x8 ContainerPattern(unsigned char frame, unsigned char x, unsigned char y)
+{
+	Pix2x8 block = SmokePattern(x, y);
+	return y == frame % BufferHeight ? (Pix2x8)~block : block;
+}
+
+// Stores a looping keyframe/delta container in the external eeprom, each frame followed by a swap and a ping that echoes its number
+// Returns false if it didn't come out well under the size of the same frames as full WriteRects
+static bool BuildContainerScenario(unsigned char *eeprom)
+{
+	static const unsigned char Magic[] = { '\0', 'H', '\0', 'i' };
+	Bytes anim(Magic, Magic + sizeof(Magic));
+	size_t container = anim.size();
+	const unsigned int keyframes = (ContainerFrames + ContainerKeyframeInterval - 1) / ContainerKeyframeInterval;
+	anim.push_back((SerialCommands::AnimOp << 4) | AnimOps::Container);
+	anim.push_back(ContainerFrames >> 8);
+	anim.push_back(ContainerFrames & 0xFF);
+	anim.push_back(ContainerKeyframeInterval);
+	anim.resize(anim.size() + 2 + keyframes * 2); // size is filled in at the end
+
+	unsigned int raw = 0;
+	std::vector<Pix2x8> blocks;
+	for(unsigned char f = 0; f < ContainerFrames; ++f)
+	{
+		bool keyframe = f % ContainerKeyframeInterval == 0;
+		if(keyframe)
+		{
+			unsigned int offset = anim.size() - container;
+			anim[container + 6 + f / ContainerKeyframeInterval * 2] = offset >> 8;
+			anim[container + 7 + f / ContainerKeyframeInterval * 2] = offset & 0xFF;
+		}
+
+		blocks.clear();
+		for(unsigned char y = 0; y < BufferHeight; ++y)
+		{
+			for(unsigned char x = 0; x < BufferBitPlaneStride; ++x)
+			{
+				blocks.push_back(keyframe ? ContainerPattern(f, x, y) : ContainerPattern(f, x, y) ^ ContainerPattern(f - 1, x, y));
+			}
+		}
+		anim.push_back((SerialCommands::AnimOp << 4) | (keyframe ? AnimOps::Keyframe : AnimOps::Delta));
+		if(keyframe)
+		{
+			EncodeRunLength(anim, blocks);
+		}
+		else
+		{
+			EncodeXorDelta(anim, blocks);
+		}
+		anim.push_back(SerialCommands::Swap << 4);
+		anim.push_back(0);
+		anim.push_back((SerialCommands::Ping << 4) | 0x08);
+		anim.push_back(f + 1);
+		raw += 3 + BufferBitPlaneStride * BufferHeight * 2 + 2 + 2;
+	}
+	anim[container + 4] = (anim.size() - container) >> 8;
+	anim[container + 5] = (anim.size() - container) & 0xFF;
+	memcpy(eeprom, anim.data(), anim.size());
+	printf("container: %u frames in %u bytes, %u as full frames\n", (unsigned int)ContainerFrames, (unsigned int)(anim.size() - container), raw);
+	return raw * 2 / 3 > anim.size() - container;
+}
+
+// The host stops the container partway, seeks it to a frame between keyframes and single steps it there, then checks where it ended up
+static void BuildContainerSeek(Bytes &wire)
+{
+	Bytes seek;
+	seek.push_back((SerialCommands::QuerySetting << 4) | Settings::AnimFrame);
+	seek.push_back(0);
+	seek.push_back((SerialCommands::UpdateSetting << 4) | Settings::AnimFrame);
+	seek.push_back(0);
+	seek.push_back(ContainerSeekFrame);
+	seek.push_back((SerialCommands::UpdateSetting << 4) | Settings::AnimPlayState);
+	seek.push_back(AnimState::SingleStepping);
+	AppendPacket(wire, 1, seek);
+	SimQueueRx(wire.data(), wire.size(), BootCycles + (SimCycles)ContainerRunFrames * FrameCycles);
+
+	Bytes query;
+	query.push_back((SerialCommands::QuerySetting << 4) | Settings::AnimFrame);
+	query.push_back(0);
+	wire.clear();
+	AppendPacket(wire, 2, query);
+	SimQueueRx(wire.data(), wire.size(), BootCycles + (SimCycles)(ContainerRunFrames + 20) * FrameCycles);
+	wire.clear();
+}
+
+static bool CheckContainerScenario(const std::vector<Bytes> &responses, bool small)
+{
+	// frames in order until the host steps in, then the pings of the frames the seek drew over, then nothing until the second query
+	bool ok = true;
+	unsigned int frames = 0;
+	unsigned int queries = 0;
+	unsigned int skipped = 0;
+	for(size_t i = 0; i < responses.size() && ok; ++i)
+	{
+		const Bytes &r = responses[i];
+		if(r.size() == 2 && r[0] == ((ResponseCodes::Ack << 4) | 0x08))
+		{
+			if(!queries && r[1] == frames % ContainerFrames + 1)
+			{
+				++frames;
+			}
+			else if(queries == 1 && r[1] == (ContainerSeekFrame / ContainerKeyframeInterval) * ContainerKeyframeInterval + skipped + 1)
+			{
+				++skipped;
+			}
+			else
+			{
+				fprintf(stderr, "container: ping %u out of order after %u frames\n", r[1], frames);
+				ok = false;
+			}
+		}
+		else if(r.size() == 5 && r[0] == ((ResponseCodes::Setting << 4) | Settings::AnimFrame))
+		{
+			unsigned int frame = (r[1] << 8) | r[2];
+			unsigned int count = (r[3] << 8) | r[4];
+			bool expected = queries ? frame == ContainerSeekFrame + 1 : (frame == frames % ContainerFrames || frame == (frames + 1) % ContainerFrames);
+			if(count != ContainerFrames || !expected)
+			{
+				fprintf(stderr, "container: query %u found frame %u of %u\n", queries, frame, count);
+				ok = false;
+			}
+			++queries;
+		}
+		else if((r[0] >> 4) != ResponseCodes::Ack)
+		{
+			fprintf(stderr, "container: unexpected response %02X %02X\n", r[0], r.size() > 1 ? r[1] : 0);
+			ok = false;
+		}
+	}
+	if(queries != 2 || skipped != ContainerSeekFrame % ContainerKeyframeInterval)
+	{
+		fprintf(stderr, "container: %u queries answered, %u frames drawn over by the seek\n", queries, skipped);
+		ok = false;
+	}
+
+	for(unsigned char y = 0; y < BufferHeight; ++y)
+	{
+		for(unsigned char x = 0; x < BufferBitPlaneStride; ++x)
+		{
+			if(ReadFrontBlock(x, y) != ContainerPattern(ContainerSeekFrame, x, y))
+			{
+				fprintf(stderr, "container: front buffer isn't the frame seeked to at %u,%u\n", x, y);
+				ok = false;
+				y = BufferHeight;
+				break;
+			}
+		}
+	}
+
+	printf("container: %u frames in %u refresh frames before the seek\n", frames, (unsigned int)ContainerRunFrames);
+	if(frames < ContainerRunFrames * 5 / 8 || !small)
+	{
+		fprintf(stderr, "container: fell behind or didn't shrink the frames\n");
+		ok = false;
+	}
+	return ok;
+}
+
+static unsigned char UploadByte(unsigned int i)
+{
+	return (unsigned char)(i * 7 + (i >> 8));
+}
+
+// Uploads a block to the external eeprom the way BadgeCommands.CreateUploadPage lays it out, one WriteMemory per page in a packet of its own
+static void BuildUploadScenario(Bytes &wire)
+{
+	for(unsigned int offset = 0; offset < UploadBytes; )
+	{
+		unsigned int address = UploadAddress + offset;
+		unsigned int length = 64 - (address & 63);
+		if(length > UploadBytes - offset)
+		{
+			length = UploadBytes - offset;
+		}
+
+		Bytes write;
+		write.push_back((SerialCommands::WriteMemory << 4) | (length / 4 - 1));
+		write.push_back((RomTarget::TypeExternal | address) >> 8);
+		write.push_back(address & 0xFF);
+		for(unsigned int i = 0; i < length; ++i)
+		{
+			write.push_back(UploadByte(offset + i));
+		}
+		AppendPacket(wire, address / 64 + 1, write);
+		offset += length;
+	}
+}
+
+static bool CheckUploadScenario(const std::vector<Bytes> &responses)
+{
+	bool ok = true;
+	const unsigned int firstPage = UploadAddress / 64;
+	const unsigned int pages = (UploadAddress + UploadBytes + 63) / 64 - firstPage;
+	std::vector<unsigned int> written(pages);
+	for(size_t i = 0; i < responses.size(); ++i)
+	{
+		const Bytes &r = responses[i];
+		if((r[0] >> 4) == ResponseCodes::PageWritten && r.size() == 2 && (r[0] & 0xF) == PageWriteStatus::Ok && r[1] >= firstPage && r[1] < firstPage + pages)
+		{
+			++written[r[1] - firstPage];
+		}
+		else if((r[0] >> 4) != ResponseCodes::Ack)
+		{
+			fprintf(stderr, "upload: unexpected response %02X %02X\n", r[0], r.size() > 1 ? r[1] : 0);
+			ok = false;
+		}
+	}
+	for(unsigned int p = 0; p < pages; ++p)
+	{
+		if(written[p] != 1)
+		{
+			fprintf(stderr, "upload: page %u was reported written %u times\n", firstPage + p, written[p]);
+			ok = false;
+		}
+	}
+
+	const unsigned char *eeprom = SimExternalEeprom();
+	for(unsigned int i = 0; i < UploadBytes; ++i)
+	{
+		if(eeprom[UploadAddress + i] != UploadByte(i))
+		{
+			fprintf(stderr, "upload: byte %u wasn't written\n", i);
+			ok = false;
+			break;
+		}
+	}
+
+	// the eeprom keeps up with the line, so it's done about as soon as the last packet is in
+	SimCycles line = SimRxDrainedAt() - BootCycles;
+	printf("upload: %u bytes in %u pages over %llu ms, %lu i2c starts\n", (unsigned int)UploadBytes, pages, line * 1000 / F_CPU, SimTwiStarts());
+	return ok;
+}
+
+// What save pass writes to byte i: a pattern, the same again, then bytes cleared back to 0xFF, bytes with only bits cleared, and the rest left alone
+static unsigned char SaveByte(unsigned int pass, unsigned int i)
+{
+	unsigned char pattern = (unsigned char)(i * 37 + 11);
+	if(pass < 2 || (i & 3) > 1)
+	{
+		return pattern;
+	}
+	return (i & 3) ? (pattern & 0x0F) : 0xFF;
+}
+
+// Saves a block to the internal eeprom a few times with a full frame right behind each one, then reads it back
+// Each pass is queued up on the line by itself, a save apart
+static void BuildSaveScenario()
+{
+	for(unsigned int pass = 0; pass < SavePasses; ++pass)
+	{
+		Bytes wire;
+		Bytes save;
+		save.push_back((SerialCommands::WriteMemory << 4) | (SaveBytes / 4 - 1));
+		save.push_back((RomTarget::TypeInternal | SaveAddress) >> 8);
+		save.push_back(SaveAddress & 0xFF);
+		for(unsigned int i = 0; i < SaveBytes; ++i)
+		{
+			save.push_back(SaveByte(pass, i));
+		}
+		AppendPacket(wire, pass * 2 + 1, save);
+
+		if(pass == 0)
+		{
+			// the end of the first save is still queued, the read should come from the queue rather than wait it out
+			Bytes peek;
+			peek.push_back((SerialCommands::QuerySetting << 4) | Settings::FrameClock);
+			peek.push_back(0);
+			peek.push_back(SerialCommands::ReadMemory << 4);
+			peek.push_back((RomTarget::TypeInternal | (SaveAddress + SaveBytes - 4)) >> 8);
+			peek.push_back((SaveAddress + SaveBytes - 4) & 0xFF);
+			peek.push_back((SerialCommands::QuerySetting << 4) | Settings::FrameClock);
+			peek.push_back(0);
+			AppendPacket(wire, SavePasses * 2 + 2, peek);
+		}
+
+		// more than the input buffer holds, so it has to be taken in while the save is still going out
+		Bytes frame;
+		frame.push_back((SerialCommands::WriteRect << 4) | (BufferTarget::BackBuffer << 2) | PixelFormat::TwoBits);
+		frame.push_back(0);
+		frame.push_back((BufferBitPlaneStride << 4) | BufferHeight);
+		for(unsigned char y = 0; y < BufferHeight; ++y)
+		{
+			for(unsigned char x = 0; x < BufferBitPlaneStride; ++x)
+			{
+				AppendBlock(frame, SmokePattern(x, y));
+			}
+		}
+		AppendPacket(wire, pass * 2 + 2, frame);
+
+		if(pass == SavePasses - 1)
+		{
+			Bytes read;
+			read.push_back((SerialCommands::ReadMemory << 4) | (SaveBytes / 4 - 1));
+			read.push_back((RomTarget::TypeInternal | SaveAddress) >> 8);
+			read.push_back(SaveAddress & 0xFF);
+			AppendPacket(wire, SavePasses * 2 + 1, read);
+		}
+		SimQueueRx(wire.data(), wire.size(), BootCycles + (SimCycles)pass * SavePassCycles);
+	}
+}
+
+static bool CheckSaveScenario(const std::vector<Bytes> &responses)
+{
+	bool ok = true;
+	unsigned int reads = 0;
+	unsigned int peeks = 0;
+	std::vector<unsigned int> frameClock;
+	for(size_t i = 0; i < responses.size(); ++i)
+	{
+		const Bytes &r = responses[i];
+		if((r[0] >> 4) == ResponseCodes::Memory && r.size() == 3 + 4)
+		{
+			bool match = ((r[1] << 8) | r[2]) == (RomTarget::TypeInternal | (SaveAddress + SaveBytes - 4));
+			for(unsigned int b = 0; match && b < 4; ++b)
+			{
+				match = r[3 + b] == SaveByte(0, SaveBytes - 4 + b);
+			}
+			peeks += match;
+		}
+		else if((r[0] >> 4) == ResponseCodes::Memory)
+		{
+			bool match = r.size() == 3 + SaveBytes && ((r[1] << 8) | r[2]) == (RomTarget::TypeInternal | SaveAddress);
+			for(unsigned int b = 0; match && b < SaveBytes; ++b)
+			{
+				match = r[3 + b] == SaveByte(SavePasses - 1, b);
+			}
+			reads += match;
+		}
+		else if(r.size() == 4 && r[0] == ((ResponseCodes::Setting << 4) | Settings::FrameClock))
+		{
+			frameClock.push_back((r[1] << 8) | r[2]);
+		}
+		else if((r[0] >> 4) != ResponseCodes::Ack)
+		{
+			fprintf(stderr, "save: unexpected response %02X %02X\n", r[0], r.size() > 1 ? r[1] : 0);
+			ok = false;
+		}
+	}
+	if(reads != 1)
+	{
+		fprintf(stderr, "save: read back %u good copies of the block\n", reads);
+		ok = false;
+	}
+	unsigned int peekFrames = frameClock.size() == 2 ? (unsigned short)(frameClock[1] - frameClock[0]) : ~0U;
+	printf("save: reading the end of a queued save took %u refresh frames\n", peekFrames);
+	if(peeks != 1 || peekFrames > 1)
+	{
+		fprintf(stderr, "save: read %u good copies of the end of the queued save\n", peeks);
+		ok = false;
+	}
+
+	// only bytes that change should cost a write cycle, starting from the blank 0xFF the sim powers up with
+	unsigned long changed = 0;
+	for(unsigned int i = 0; i < SaveBytes; ++i)
+	{
+		unsigned char current = 0xFF;
+		for(unsigned int pass = 0; pass < SavePasses; ++pass)
+		{
+			changed += SaveByte(pass, i) != current;
+			current = SaveByte(pass, i);
+		}
+		if(SimInternalEeprom()[SaveAddress + i] != current)
+		{
+			fprintf(stderr, "save: byte %u wasn't written\n", i);
+			ok = false;
+		}
+	}
+	if(SimEepromWrites() != changed)
+	{
+		fprintf(stderr, "save: %lu eeprom write cycles for %lu changed bytes\n", SimEepromWrites(), changed);
+		ok = false;
+	}
+
+	printf("save: %u bytes saved %u times with %lu write cycles\n", (unsigned int)SaveBytes, (unsigned int)SavePasses, SimEepromWrites());
+	return ok;
+}
+
+// The slots scenario's directory, the first slot loops, the second runs on into the third, and the third plays once
+struct SlotInfo
+{
+	const char *Name;
+	unsigned char Frames;
+	AnimLoopMode::Enum LoopMode;
+	unsigned char Brightness;
+};
+
+static const SlotInfo SlotInfos[SlotCount] =
+{
+	{ "alpha", 2, AnimLoopMode::Loop, 0 },
+	{ "beta", 2, AnimLoopMode::Next, 0 },
+	{ "gamma", 1, AnimLoopMode::Once, SlotBrightness },
+};
+
+static unsigned int s_SlotStarts[SlotCount];
+static unsigned int s_SlotLengths[SlotCount];
+
+// Each frame of each slot pings with the slot in the high nibble and the frame in the low one
+static unsigned char SlotPing(unsigned char slot, unsigned char frame)
+{
+	return ((slot + 1) << 4) | (frame + 1);
+}
+
+static Pix2x8 SlotPattern(unsigned char slot, unsigned char frame, unsigned char x, unsigned char y)
+{
+	return AnimPattern(slot * 2 + frame, x, y);
+}
+
+// Stores a directory of anims in the external eeprom, then has the button and the host pick between them
+static void BuildSlotsScenario(unsigned char *eeprom, Bytes &wire)
+{
+	static const unsigned char DirectoryMagic[] = { '\0', 'H', '\0', 'D' };
+	Bytes directory(DirectoryMagic, DirectoryMagic + sizeof(DirectoryMagic));
+	directory.push_back(SlotCount);
+
+	Bytes anims;
+	for(unsigned char s = 0; s < SlotCount; ++s)
+	{
+		s_SlotStarts[s] = RomTarget::TypeExternal | (SlotsAddress + anims.size());
+		for(unsigned char f = 0; f < SlotInfos[s].Frames; ++f)
+		{
+			anims.push_back((SerialCommands::WriteRect << 4) | (BufferTarget::BackBuffer << 2) | PixelFormat::TwoBits);
+			anims.push_back(0);
+			anims.push_back((BufferBitPlaneStride << 4) | BufferHeight);
+			for(unsigned char y = 0; y < BufferHeight; ++y)
+			{
+				for(unsigned char x = 0; x < BufferBitPlaneStride; ++x)
+				{
+					AppendBlock(anims, SlotPattern(s, f, x, y));
+				}
+			}
+			anims.push_back(SerialCommands::Swap << 4);
+			anims.push_back(0);
+			anims.push_back((SerialCommands::Ping << 4) | 0x08);
+			anims.push_back(SlotPing(s, f));
+		}
+		s_SlotLengths[s] = SlotsAddress + anims.size() - (s_SlotStarts[s] & RomTarget::AddressMask);
+
+		Bytes entry(AnimDirectory::SlotSize, 0);
+		memcpy(&entry[AnimDirectory::NameOffset], SlotInfos[s].Name, strlen(SlotInfos[s].Name));
+		entry[AnimDirectory::StartOffset] = s_SlotStarts[s] >> 8;
+		entry[AnimDirectory::StartOffset + 1] = s_SlotStarts[s] & 0xFF;
+		entry[AnimDirectory::LengthOffset] = s_SlotLengths[s] >> 8;
+		entry[AnimDirectory::LengthOffset + 1] = s_SlotLengths[s] & 0xFF;
+		entry[AnimDirectory::LoopModeOffset] = SlotInfos[s].LoopMode;
+		entry[AnimDirectory::BrightnessOffset] = SlotInfos[s].Brightness;
+		directory.insert(directory.end(), entry.begin(), entry.end());
+	}
+	memcpy(eeprom, directory.data(), directory.size());
+	memcpy(eeprom + SlotsAddress, anims.data(), anims.size());
+
+	// button 0 moves on a slot, the second press comes after the host has taken over so it's ignored, and the third once it has gone quiet
+	static const unsigned int Presses[] = { SlotPressFrame, SlotIgnoredPressFrame, SlotReleasedPressFrame };
+	for(unsigned int p = 0; p < sizeof(Presses) / sizeof(Presses[0]); ++p)
+	{
+		SimQueueButton(0, true, BootCycles + (SimCycles)Presses[p] * FrameCycles);
+		SimQueueButton(0, false, BootCycles + (SimCycles)(Presses[p] + 4) * FrameCycles);
+	}
+
+	Bytes host;
+	host.push_back((SerialCommands::QuerySetting << 4) | Settings::AnimSlot);
+	host.push_back(AnimDirectory::NoSlot);
+	host.push_back((SerialCommands::QuerySetting << 4) | Settings::AnimSlot);
+	host.push_back(1);
+	host.push_back((SerialCommands::QuerySetting << 4) | Settings::Brightness);
+	host.push_back(0);
+	host.push_back((SerialCommands::UpdateSetting << 4) | Settings::AnimSlot);
+	host.push_back(0);
+	AppendPacket(wire, 1, host);
+	SimQueueRx(wire.data(), wire.size(), BootCycles + (SimCycles)SlotHostFrame * FrameCycles);
+
+	Bytes query;
+	query.push_back((SerialCommands::QuerySetting << 4) | Settings::AnimSlot);
+	query.push_back(AnimDirectory::NoSlot);
+	wire.clear();
+	AppendPacket(wire, 2, query);
+	SimQueueRx(wire.data(), wire.size(), BootCycles + (SimCycles)SlotQueryFrame * FrameCycles);
+	wire.clear();
+	AppendPacket(wire, 3, query);
+	SimQueueRx(wire.data(), wire.size(), BootCycles + (SimCycles)SlotLastQueryFrame * FrameCycles);
+	wire.clear();
+}
+
+// Checks an AnimSlot setting response against the directory
+static bool CheckSlotInfo(const Bytes &r, unsigned char slot)
+{
+	const SlotInfo &info = SlotInfos[slot];
+	bool ok = r[1] == slot && r[2] == SlotCount;
+	for(unsigned char i = 0; i < AnimDirectory::NameSize; ++i)
+	{
+		ok &= r[3 + AnimDirectory::NameOffset + i] == (i < strlen(info.Name) ? info.Name[i] : 0);
+	}
+	unsigned int start = (r[3 + AnimDirectory::StartOffset] << 8) | r[4 + AnimDirectory::StartOffset];
+	unsigned int length = (r[3 + AnimDirectory::LengthOffset] << 8) | r[4 + AnimDirectory::LengthOffset];
+	ok &= start == s_SlotStarts[slot] && length == s_SlotLengths[slot];
+	ok &= r[3 + AnimDirectory::LoopModeOffset] == info.LoopMode && r[3 + AnimDirectory::BrightnessOffset] == info.Brightness;
+	return ok;
+}
+
+static bool CheckSlotsScenario(const std::vector<Bytes> &responses)
+{
+	// the first slot loops until the press, the next two slots play through once each, then only the host brings the first one back
+	// once the host has been quiet for long enough, a press plays the other two again
+	static const unsigned char Pressed[] = { SlotPing(1, 0), SlotPing(1, 1), SlotPing(2, 0) };
+	bool ok = true;
+	unsigned int looped = 0;
+	unsigned int pressed = 0;
+	unsigned int replayed = 0;
+	unsigned int released = 0;
+	unsigned int queries = 0;
+	for(size_t i = 0; i < responses.size() && ok; ++i)
+	{
+		const Bytes &r = responses[i];
+		if(r.size() == 2 && r[0] == ((ResponseCodes::Ack << 4) | 0x08))
+		{
+			bool expected = false;
+			if(queries && !released && r[1] == SlotPing(0, replayed % 2))
+			{
+				expected = true;
+				++replayed;
+			}
+			else if(queries)
+			{
+				expected = released < sizeof(Pressed) && r[1] == Pressed[released];
+				released += expected;
+			}
+			else if(!pressed && r[1] == SlotPing(0, looped % 2))
+			{
+				expected = true;
+				++looped;
+			}
+			else
+			{
+				expected = pressed < sizeof(Pressed) && r[1] == Pressed[pressed];
+				pressed += expected;
+			}
+			if(!expected)
+			{
+				fprintf(stderr, "slots: ping %02X out of order (%u looped, %u after the press, %u after the host, %u after it went quiet)\n", r[1], looped, pressed, replayed, released);
+				ok = false;
+			}
+		}
+		else if(r.size() == 17 && r[0] == ((ResponseCodes::Setting << 4) | Settings::AnimSlot))
+		{
+			// the one playing after the press, the one that ran on into it, the one the host picked, then the one the last press ran on into
+			static const unsigned char Expected[] = { 2, 1, AnimDirectory::NoSlot, 0, 2 };
+			if(queries >= sizeof(Expected) || Expected[queries] >= SlotCount || !CheckSlotInfo(r, Expected[queries]))
+			{
+				fprintf(stderr, "slots: query %u answered with slot %u of %u\n", queries, r[1], r[2]);
+				ok = false;
+			}
+			++queries;
+		}
+		else if(r.size() == 2 && r[0] == ((ResponseCodes::Setting << 4) | Settings::Brightness))
+		{
+			if(r[1] != SlotBrightness)
+			{
+				fprintf(stderr, "slots: brightness is %02X, the last slot sets %02X\n", r[1], SlotBrightness);
+				ok = false;
+			}
+			++queries;
+		}
+		else if((r[0] >> 4) != ResponseCodes::Ack)
+		{
+			fprintf(stderr, "slots: unexpected response %02X %02X\n", r[0], r.size() > 1 ? r[1] : 0);
+			ok = false;
+		}
+	}
+	if(queries != 5 || pressed != sizeof(Pressed) || looped < 4 || replayed < 4 || released != sizeof(Pressed))
+	{
+		fprintf(stderr, "slots: %u queries answered, %u looped frames, %u after the press, %u after the host, %u after it went quiet\n", queries, looped, pressed, replayed, released);
+		ok = false;
+	}
+
+	// the last slot plays once and stays up
+	bool whole = true;
+	for(unsigned char y = 0; y < BufferHeight; ++y)
+	{
+		for(unsigned char x = 0; x < BufferBitPlaneStride; ++x)
+		{
+			whole &= ReadFrontBlock(x, y) == SlotPattern(SlotCount - 1, SlotInfos[SlotCount - 1].Frames - 1, x, y);
+		}
+	}
+	if(!whole)
+	{
+		fprintf(stderr, "slots: front buffer isn't the last slot's frame\n");
+		ok = false;
+	}
+
+	printf("slots: %u frames looped before the press, %u after the host picked the first slot again\n", looped, replayed);
+	return ok;
+}
+
+// Pings that the branch scenario's anim sends from its different parts
+struct BranchPings
+{
+	enum Enum
+	{
+		Outer = 0x10,
+		Call = 0x11,
+		Waiting = 0x20,
+		Pressed = 0x30
+	};
+};
+
+static size_t AppendAnimOp(Bytes &anim, AnimOps::Enum op)
+{
+	anim.push_back((SerialCommands::AnimOp << 4) | op);
+	return anim.size() - 1;
+}
+
+static void AppendEchoPing(Bytes &anim, unsigned char echo)
+{
+	anim.push_back((SerialCommands::Ping << 4) | 0x08);
+	anim.push_back(echo);
+}
+
+// Points a Jump/Call/BranchButton's offset (the last 2 bytes so far for one still being written) at a target
+static void PatchAnimOffset(Bytes &anim, size_t op, size_t target)
+{
+	size_t at = anim[op] == ((SerialCommands::AnimOp << 4) | AnimOps::BranchButton) ? op + 2 : op + 1;
+	unsigned short offset = (unsigned short)(target - op);
+	anim[at] = offset >> 8;
+	anim[at + 1] = offset & 0xFF;
+}
+
+// Stores an anim in the external eeprom that runs nested Loops around a Call, then waits on a button with BranchButton and a Jump back
+static void BuildBranchScenario(unsigned char *eeprom)
+{
+	static const unsigned char Magic[] = { '\0', 'H', '\0', 'i' };
+	Bytes anim(Magic, Magic + sizeof(Magic));
+
+	AppendAnimOp(anim, AnimOps::Loop);
+	anim.push_back(BranchOuterPasses);
+	AppendEchoPing(anim, BranchPings::Outer);
+	AppendAnimOp(anim, AnimOps::Loop);
+	anim.push_back(BranchInnerPasses);
+	size_t call = AppendAnimOp(anim, AnimOps::Call);
+	anim.push_back(0);
+	anim.push_back(0);
+	AppendAnimOp(anim, AnimOps::EndLoop);
+	AppendAnimOp(anim, AnimOps::EndLoop);
+	AppendEchoPing(anim, BranchPings::Waiting);
+
+	// a frame at a time until the button goes down
+	size_t wait = anim.size();
+	anim.push_back(SerialCommands::Swap << 4);
+	anim.push_back(0);
+	size_t branch = AppendAnimOp(anim, AnimOps::BranchButton);
+	anim.push_back(0);
+	anim.push_back(0);
+	anim.push_back(0);
+	size_t jump = AppendAnimOp(anim, AnimOps::Jump);
+	anim.push_back(0);
+	anim.push_back(0);
+	PatchAnimOffset(anim, jump, wait);
+
+	PatchAnimOffset(anim, branch, anim.size());
+	AppendEchoPing(anim, BranchPings::Pressed);
+	anim.push_back((SerialCommands::UpdateSetting << 4) | Settings::AnimPlayState);
+	anim.push_back(AnimState::Stopped);
+
+	PatchAnimOffset(anim, call, anim.size());
+	AppendEchoPing(anim, BranchPings::Call);
+	AppendAnimOp(anim, AnimOps::Return);
+	memcpy(eeprom, anim.data(), anim.size());
+
+	SimQueueButton(0, true, BootCycles + (SimCycles)BranchPressFrame * FrameCycles);
+	SimQueueButton(0, false, BootCycles + (SimCycles)(BranchPressFrame + 4) * FrameCycles);
+}
+
+static bool CheckBranchScenario(const std::vector<Bytes> &responses)
+{
+	Bytes expected;
+	for(unsigned char outer = 0; outer < BranchOuterPasses; ++outer)
+	{
+		expected.push_back(BranchPings::Outer);
+		expected.insert(expected.end(), BranchInnerPasses, BranchPings::Call);
+	}
+	expected.push_back(BranchPings::Waiting);
+	expected.push_back(BranchPings::Pressed);
+
+	Bytes pings;
+	bool ok = true;
+	for(size_t i = 0; i < responses.size(); ++i)
+	{
+		const Bytes &r = responses[i];
+		if(r.size() != 2 || r[0] != ((ResponseCodes::Ack << 4) | 0x08))
+		{
+			fprintf(stderr, "branch: unexpected response %02X\n", r[0]);
+			ok = false;
+			break;
+		}
+		pings.push_back(r[1]);
+	}
+	if(pings != expected)
+	{
+		fprintf(stderr, "branch: pings came out as");
+		for(size_t i = 0; i < pings.size(); ++i)
+		{
+			fprintf(stderr, " %02X", pings[i]);
+		}
+		fprintf(stderr, "\n");
+		ok = false;
+	}
+
+	// the anim stops itself once it has seen the button, well before the sim does
+	printf("branch: %u pings, anim %s at the end\n", (unsigned int)pings.size(), g_CommandReg.AnimPlaying ? "playing" : "stopped");
+	if(g_CommandReg.AnimPlaying || g_CommandReg.AnimStackDepth)
+	{
+		fprintf(stderr, "branch: anim still playing, or still inside a Loop or Call\n");
+		ok = false;
+	}
+	return ok;
+}
+
+// Pings that the restart scenario's anim and host send
+struct RestartPings
+{
+	enum Enum
+	{
+		Anim = 0x50,
+		Host = 0x60
+	};
+};
+
+// Stores an anim in the external eeprom that sits in a Loop with no end, and has the host stop it in there a few times
+// The idle timeout starts it over each time, with no fade, so every restart happens from inside the Loop
+static void BuildRestartScenario(unsigned char *eeprom)
+{
+	static const unsigned char Magic[] = { '\0', 'H', '\0', 'i' };
+	Bytes anim(Magic, Magic + sizeof(Magic));
+	AppendAnimOp(anim, AnimOps::Loop);
+	anim.push_back(0);
+	anim.push_back(SerialCommands::Swap << 4);
+	anim.push_back(0);
+	AppendEchoPing(anim, RestartPings::Anim);
+	AppendAnimOp(anim, AnimOps::EndLoop);
+	memcpy(eeprom, anim.data(), anim.size());
+
+	// the idle timeout waits out the fade in at power up, which goes up to half brightness a level a frame
+	SimCycles start = BootCycles + (SimCycles)(BrightnessLevels / 2) * FrameCycles;
+	for(unsigned int stop = 0; stop <= RestartStops; ++stop)
+	{
+		Bytes host;
+		if(stop == 0)
+		{
+			host.push_back((SerialCommands::UpdateSetting << 4) | Settings::IdleTimeout);
+			host.push_back(RestartIdleFrames);
+			host.push_back(EndOfFadeAction::RestartAnim << 5);
+		}
+		else
+		{
+			AppendEchoPing(host, RestartPings::Host + stop);
+		}
+		Bytes wire;
+		AppendPacket(wire, stop + 1, host);
+		SimQueueRx(wire.data(), wire.size(), start + (SimCycles)stop * RestartStopFrames * FrameCycles);
+	}
+	SimStopAt(start + (SimCycles)(RestartStops + 1) * RestartStopFrames * FrameCycles);
+}
+
+static bool CheckRestartScenario(const std::vector<Bytes> &responses)
+{
+	bool ok = true;
+	unsigned int stops = 0;
+	unsigned int pings = 0;
+	for(size_t i = 0; i < responses.size(); ++i)
+	{
+		const Bytes &r = responses[i];
+		if(r.size() == 2 && r[0] == ((ResponseCodes::Ack << 4) | 0x08) && r[1] == RestartPings::Anim)
+		{
+			++pings;
+		}
+		else if(r.size() == 2 && r[0] == ((ResponseCodes::Ack << 4) | 0x08) && r[1] == RestartPings::Host + stops + 1)
+		{
+			++stops;
+			pings = 0;
+		}
+		else if((r[0] >> 4) != ResponseCodes::Ack)
+		{
+			fprintf(stderr, "restart: unexpected response %02X %02X\n", r[0], r.size() > 1 ? r[1] : 0);
+			ok = false;
+		}
+	}
+	if(stops != RestartStops)
+	{
+		fprintf(stderr, "restart: %u of the host's %u pings came back\n", stops, (unsigned int)RestartStops);
+		ok = false;
+	}
+
+	// each restart starts over outside the Loop, so it's only ever one deep
+	printf("restart: %u anim pings after the last stop, anim %s at the end\n", pings, g_CommandReg.AnimPlaying ? "playing" : "stopped");
+	if(!pings || !g_CommandReg.AnimPlaying || g_CommandReg.AnimStackDepth != 1)
+	{
+		fprintf(stderr, "restart: anim didn't play on after the last restart, or is %u deep in Loops and Calls\n", g_CommandReg.AnimStackDepth);
+		ok = false;
+	}
+	return ok;
+}
+
+static void Usage()
+{
+	fprintf(stderr,
+		"usage: LedBadgeSim [options]\n"
+		"  --input FILE              raw host->badge stream (packets as BadgeConnection sends them)\n"
+		"  --scenario smoke          built-in self checking stream\n"
+		"  --scenario blits          check the bulk and pixel granular Copy/Fill paths against reference versions\n"
+		"  --scenario anim           play a looping anim out of the external eeprom and check it keeps up\n"
+		"  --scenario container      play a keyframe/delta container anim, then seek it between keyframes and check it lands there\n"
+		"  --scenario upload         write a block to the external eeprom a page at a time and check it all went in\n"
+		"  --scenario save           rewrite a block of the internal eeprom while frames keep coming, and check only changed bytes get written\n"
+		"  --scenario slots          flip through a directory of anims with the button, then check the host can list and pick them\n"
+		"  --scenario branch         run an anim's nested Loops and Calls, then check it waits on the button and branches once it's down\n"
+		"  --scenario restart        stop an anim inside a Loop a few times, and check the idle timeout still starts it over\n"
+		"  --internal-eeprom FILE    initial internal eeprom image\n"
+		"  --external-eeprom FILE    initial external eeprom image\n"
+		"  --settle FRAMES           frames to keep running after the input drains (default %d)\n"
+		"  --button0, --button1      hold a button down for the whole run\n"
+		"  --responses               print everything the badge sent back\n"
+		"  --dump                    print the front buffer at the end\n"
+		"  --budget VECTOR=CYCLES    fail if the worst case for an interrupt handler goes over\n"
+		"                            (RX_WAIT is how long a received byte sat in UDR0 before being read)\n",
+		DefaultSettleFrames);
+}
+
+static bool ParseOptions(int argc, char **argv, Options &options)
+{
+	memset(&options.Input, 0, sizeof(const char *) * 4);
+	options.SettleFrames = DefaultSettleFrames;
+	options.Button0 = options.Button1 = options.Dump = options.Responses = false;
+
+	for(int i = 1; i < argc; ++i)
+	{
+		const char *arg = argv[i];
+		const char *next = i + 1 < argc ? argv[i + 1] : 0;
+		if(!strcmp(arg, "--input") && next) { options.Input = argv[++i]; }
+		else if(!strcmp(arg, "--scenario") && next) { options.Scenario = argv[++i]; }
+		else if(!strcmp(arg, "--internal-eeprom") && next) { options.InternalEeprom = argv[++i]; }
+		else if(!strcmp(arg, "--external-eeprom") && next) { options.ExternalEeprom = argv[++i]; }
+		else if(!strcmp(arg, "--settle") && next) { options.SettleFrames = atoi(argv[++i]); }
+		else if(!strcmp(arg, "--button0")) { options.Button0 = true; }
+		else if(!strcmp(arg, "--button1")) { options.Button1 = true; }
+		else if(!strcmp(arg, "--responses")) { options.Responses = true; }
+		else if(!strcmp(arg, "--dump")) { options.Dump = true; }
+		else if(!strcmp(arg, "--budget") && next && strchr(next, '='))
+		{
+			const char *split = strchr(argv[++i], '=');
+			options.Budgets.push_back(std::make_pair(std::string(argv[i], split - argv[i]), (SimCycles)strtoull(split + 1, 0, 10)));
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	if(options.Scenario && strcmp(options.Scenario, "smoke") && strcmp(options.Scenario, "blits") && strcmp(options.Scenario, "anim") && strcmp(options.Scenario, "container") && strcmp(options.Scenario, "upload") && strcmp(options.Scenario, "save") && strcmp(options.Scenario, "slots") && strcmp(options.Scenario, "branch") && strcmp(options.Scenario, "restart"))
+	{
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	if(!ParseOptions(argc, argv, options))
+	{
+		Usage();
+		return 2;
+	}
+
+	if(options.Scenario && !strcmp(options.Scenario, "blits"))
+	{
+		return CheckBlitScenario() ? 0 : 1;
+	}
+
+	SimReset();
+	SimSetButton(0, options.Button0);
+	SimSetButton(1, options.Button1);
+	if(options.InternalEeprom && !LoadFile(options.InternalEeprom, SimInternalEeprom(), EepromInternalSize, 0))
+	{
+		return 2;
+	}
+	if(options.ExternalEeprom && !LoadFile(options.ExternalEeprom, SimExternalEeprom(), EepromExternalSize, 0))
+	{
+		return 2;
+	}
+
+	Bytes wire;
+	if(options.Input && !LoadFile(options.Input, 0, 0, &wire))
+	{
+		return 2;
+	}
+	bool anim = options.Scenario && !strcmp(options.Scenario, "anim");
+	bool container = options.Scenario && !strcmp(options.Scenario, "container");
+	bool containerSmall = false;
+	bool upload = options.Scenario && !strcmp(options.Scenario, "upload");
+	bool save = options.Scenario && !strcmp(options.Scenario, "save");
+	bool slots = options.Scenario && !strcmp(options.Scenario, "slots");
+	bool branch = options.Scenario && !strcmp(options.Scenario, "branch");
+	bool restart = options.Scenario && !strcmp(options.Scenario, "restart");
+	if(anim)
+	{
+		BuildAnimScenario(SimExternalEeprom());
+		SimStopAt(BootCycles + (SimCycles)AnimRunFrames * FrameCycles);
+	}
+	else if(container)
+	{
+		containerSmall = BuildContainerScenario(SimExternalEeprom());
+		BuildContainerSeek(wire);
+	}
+	else if(upload)
+	{
+		BuildUploadScenario(wire);
+	}
+	else if(save)
+	{
+		BuildSaveScenario();
+	}
+	else if(slots)
+	{
+		BuildSlotsScenario(SimExternalEeprom(), wire);
+	}
+	else if(branch)
+	{
+		BuildBranchScenario(SimExternalEeprom());
+	}
+	else if(restart)
+	{
+		BuildRestartScenario(SimExternalEeprom());
+	}
+	else if(options.Scenario)
+	{
+		BuildSmokeScenario(wire);
+	}
+
+	SimQueueRx(wire.data(), wire.size(), BootCycles);
+	if(!anim && !restart)
+	{
+		SimStopWhenIdle((SimCycles)options.SettleFrames * FrameCycles);
+	}
+	try
+	{
+		FirmwareMain();
+	}
+	catch(const SimStop &)
+	{
+	}
+
+	std::vector<Bytes> responses;
+	SplitResponses(SimTxData(), responses);
+	if(options.Responses)
+	{
+		for(size_t i = 0; i < responses.size(); ++i)
+		{
+			for(size_t j = 0; j < responses[i].size(); ++j)
+			{
+				printf("%02X ", responses[i][j]);
+			}
+			putchar('\n');
+		}
+	}
+	if(options.Dump)
+	{
+		DumpFrontBuffer();
+	}
+
+	printf("cycles: %llu\n", SimClock());
+	printf("rx overruns: %lu\n", SimRxOverruns());
+	printf("rx worst wait: %llu\n", SimRxWorstWait());
+	printf("%-14s %10s %8s %8s %8s\n", "vector", "count", "min", "max", "avg");
+	bool ok = SimRxOverruns() == 0;
+	for(int i = 0; i < SimVectors::Count; ++i)
+	{
+		const SimIsrStats &stats = SimGetIsrStats(static_cast<SimVectors::Enum>(i));
+		if(stats.Count)
+		{
+			printf("%-14s %10lu %8llu %8llu %8llu\n", stats.Name, stats.Count, stats.Min, stats.Max, stats.Total / stats.Count);
+		}
+		for(size_t b = 0; b < options.Budgets.size(); ++b)
+		{
+			if(options.Budgets[b].first == stats.Name && stats.Max > options.Budgets[b].second)
+			{
+				fprintf(stderr, "%s worst case of %llu cycles is over the budget of %llu\n", stats.Name, stats.Max, options.Budgets[b].second);
+				ok = false;
+			}
+		}
+	}
+
+	for(size_t b = 0; b < options.Budgets.size(); ++b)
+	{
+		if(options.Budgets[b].first == "RX_WAIT" && SimRxWorstWait() > options.Budgets[b].second)
+		{
+			fprintf(stderr, "RX_WAIT worst case of %llu cycles is over the budget of %llu\n", SimRxWorstWait(), options.Budgets[b].second);
+			ok = false;
+		}
+	}
+
+	if(anim)
+	{
+		ok &= CheckAnimScenario(responses);
+	}
+	else if(container)
+	{
+		ok &= CheckContainerScenario(responses, containerSmall);
+	}
+	else if(upload)
+	{
+		ok &= CheckUploadScenario(responses);
+	}
+	else if(save)
+	{
+		ok &= CheckSaveScenario(responses);
+	}
+	else if(slots)
+	{
+		ok &= CheckSlotsScenario(responses);
+	}
+	else if(branch)
+	{
+		ok &= CheckBranchScenario(responses);
+	}
+	else if(restart)
+	{
+		ok &= CheckRestartScenario(responses);
+	}
+	else if(options.Scenario)
+	{
+		ok &= CheckSmokeScenario(responses);
+	}
+	return ok ? 0 : 1;
+}
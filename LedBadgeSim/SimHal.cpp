@@ -0,0 +1,833 @@
+#include "SimHal.h"
+
+#include <avr/io.h>
+#include <deque>
+#include <string.h>
+
+// Handlers the firmware may or may not provide
+extern "C" void TIMER2_COMPA_vect(void) __attribute__((weak));
+extern "C" void TIMER1_COMPA_vect(void) __attribute__((weak));
+extern "C" void TIMER1_OVF_vect(void) __attribute__((weak));
+extern "C" void USART_RX_vect(void) __attribute__((weak));
+extern "C" void USART_UDRE_vect(void) __attribute__((weak));
+extern "C" void USART_TX_vect(void) __attribute__((weak));
+extern "C" void EE_READY_vect(void) __attribute__((weak));
+extern "C" void TWI_vect(void) __attribute__((weak));
+
+enum
+{
+	InterruptResponseCycles = 4,	// push pc + jmp to the vector
+	InterruptReturnCycles = 4,		// reti
+	RxFifoDepth = 2,				// UDR0 is double buffered on the receive side
+	InternalEepromSize = 512,
+	ExternalEepromSize = 0x4000,
+	ExternalEepromPageSize = 64,
+	ExternalEepromAddress = 0xA0,
+	TwiIdle = 0,
+	TwiStarted,
+	TwiWriting,
+	TwiReading
+};
+
+struct PendingRxByte
+{
+	unsigned char Data;
+	SimCycles NotBefore;
+};
+
+struct PendingButton
+{
+	unsigned char Index;
+	bool Pressed;
+	SimCycles At;
+};
+
+struct SimState
+{
+	SimCycles Clock;
+	SimCycles StopAt;
+	SimCycles StopSettle;
+	bool Stopping;
+	bool InterruptFlag;
+	bool Updating;
+	unsigned char Io[256];
+
+	// timer 1 (normal mode only)
+	SimCycles Timer1Base;
+	SimCycles Timer1NextCompare;
+	SimCycles Timer1NextOverflow;
+
+	// timer 2 (normal and CTC modes)
+	SimCycles Timer2Base;
+	SimCycles Timer2NextCompare;
+
+	// usart
+	std::deque<PendingRxByte> RxWire;
+	SimCycles RxLineFreeAt;
+	unsigned char RxFifo[RxFifoDepth];
+	SimCycles RxFifoArrivedAt[RxFifoDepth];
+	unsigned char RxFifoCount;
+	SimCycles RxWorstWait;
+	bool RxOverrunFlag;
+	unsigned long RxOverruns;
+	SimCycles TxShiftDoneAt;
+	bool TxBufferFull;
+	unsigned char TxBuffer;
+	bool TxComplete;
+	std::vector<unsigned char> TxData;
+
+	// internal eeprom
+	unsigned char InternalEeprom[InternalEepromSize];
+	SimCycles EepromMasterWriteUntil;
+	SimCycles EepromBusyUntil;
+	unsigned long EepromWrites;
+
+	// external eeprom on the TWI bus
+	unsigned char ExternalEeprom[ExternalEepromSize];
+	SimCycles TwiDoneAt;
+	bool TwiPending;
+	unsigned char TwiStatus;
+	unsigned char TwiMode;
+	unsigned char TwiAddressBytes;
+	unsigned int ExternalPointer;
+	unsigned char PageBuffer[ExternalEepromPageSize];
+	bool PageDirty[ExternalEepromPageSize];
+	bool PageHasData;
+	SimCycles ExternalBusyUntil;
+	unsigned long TwiStarts;
+
+	// pins driven from outside
+	unsigned char ButtonsLow;
+	std::deque<PendingButton> ButtonChanges;
+
+	// accounting
+	SimIsrStats Stats[SimVectors::Count];
+	SimCycles NestedCycles;
+};
+
+static SimState s_Sim;
+
+static const char *const s_VectorNames[SimVectors::Count] =
+{
+	"TIMER2_COMPA",
+	"TIMER1_COMPA",
+	"TIMER1_OVF",
+	"USART_RX",
+	"USART_UDRE",
+	"USART_TX",
+	"EE_READY",
+	"TWI"
+};
+
+static void (*const s_VectorHandlers[SimVectors::Count])(void) =
+{
+	TIMER2_COMPA_vect,
+	TIMER1_COMPA_vect,
+	TIMER1_OVF_vect,
+	USART_RX_vect,
+	USART_UDRE_vect,
+	USART_TX_vect,
+	EE_READY_vect,
+	TWI_vect
+};
+
+static unsigned int Timer1Prescale()
+{
+	static const unsigned int Prescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+	return Prescale[s_Sim.Io[0x81] & 0x7];
+}
+
+static unsigned int Timer2Prescale()
+{
+	static const unsigned int Prescale[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+	return Prescale[s_Sim.Io[0xB1] & 0x7];
+}
+
+static unsigned int Timer2Period()
+{
+	return (s_Sim.Io[0xB0] & (1 << WGM21)) ? s_Sim.Io[0xB3] + 1 : 256;
+}
+
+static unsigned int UartByteCycles()
+{
+	unsigned int ubrr = ((s_Sim.Io[0xC5] & 0xF) << 8) | s_Sim.Io[0xC4];
+	unsigned int bitCycles = ((s_Sim.Io[0xC0] & (1 << U2X0)) ? 8 : 16) * (ubrr + 1);
+	return bitCycles * 10; // start + 8 data + stop
+}
+
+static unsigned int TwiBitCycles()
+{
+	static const unsigned int Prescale[4] = { 1, 4, 16, 64 };
+	return 16 + 2 * s_Sim.Io[0xB8] * Prescale[s_Sim.Io[0xB9] & 0x3];
+}
+
+static void ScheduleTimer1()
+{
+	unsigned int prescale = Timer1Prescale();
+	if(!prescale)
+	{
+		s_Sim.Timer1NextCompare = s_Sim.Timer1NextOverflow = ~0ULL;
+		return;
+	}
+
+	unsigned int count = ((s_Sim.Clock - s_Sim.Timer1Base) / prescale) & 0xFFFF;
+	unsigned int compare = (s_Sim.Io[0x89] << 8) | s_Sim.Io[0x88];
+	SimCycles now = s_Sim.Clock - (s_Sim.Clock - s_Sim.Timer1Base) % prescale;
+	s_Sim.Timer1NextCompare = now + (SimCycles)(((compare - count - 1) & 0xFFFF) + 1) * prescale;
+	s_Sim.Timer1NextOverflow = now + (SimCycles)(0x10000 - count) * prescale;
+}
+
+static void ScheduleTimer2()
+{
+	unsigned int prescale = Timer2Prescale();
+	if(!prescale)
+	{
+		s_Sim.Timer2NextCompare = ~0ULL;
+		return;
+	}
+
+	int period = Timer2Period();
+	int count = ((s_Sim.Clock - s_Sim.Timer2Base) / prescale) % period;
+	int compare = s_Sim.Io[0xB3];
+	SimCycles now = s_Sim.Clock - (s_Sim.Clock - s_Sim.Timer2Base) % prescale;
+	s_Sim.Timer2NextCompare = now + (SimCycles)(((compare - count + period - 1) % period) + 1) * prescale;
+}
+
+static bool ExternalEepromBusy()
+{
+	return s_Sim.Clock < s_Sim.ExternalBusyUntil;
+}
+
+// Finishes the write cycle the eeprom starts on a stop condition
+static void CommitExternalPage()
+{
+	if(!s_Sim.PageHasData)
+	{
+		return;
+	}
+
+	unsigned int page = s_Sim.ExternalPointer & ~(ExternalEepromPageSize - 1) & (ExternalEepromSize - 1);
+	for(unsigned int i = 0; i < ExternalEepromPageSize; ++i)
+	{
+		if(s_Sim.PageDirty[i])
+		{
+			s_Sim.ExternalEeprom[page + i] = s_Sim.PageBuffer[i];
+			s_Sim.PageDirty[i] = false;
+		}
+	}
+	s_Sim.PageHasData = false;
+	s_Sim.ExternalBusyUntil = s_Sim.Clock + F_CPU / 200; // 5ms write cycle
+}
+
+// Kicks off whatever the TWI unit was just asked to do, the result shows up in TWSR once TWINT comes back
+static void StartTwiOperation(unsigned char control)
+{
+	unsigned int bit = TwiBitCycles();
+	if(control & (1 << TWSTO))
+	{
+		if(s_Sim.TwiMode == TwiWriting)
+		{
+			CommitExternalPage();
+		}
+		s_Sim.TwiMode = TwiIdle;
+		s_Sim.TwiPending = false;
+		s_Sim.Io[0xBC] &= ~(1 << TWSTO);
+		if(!(control & (1 << TWSTA)))
+		{
+			return;
+		}
+		// with both set, the start goes out right after the stop
+	}
+
+	s_Sim.TwiPending = true;
+	if(control & (1 << TWSTA))
+	{
+		if(s_Sim.TwiMode == TwiWriting)
+		{
+			CommitExternalPage();
+		}
+		s_Sim.TwiStatus = s_Sim.TwiMode == TwiIdle ? 0x08 : 0x10;
+		++s_Sim.TwiStarts;
+		s_Sim.TwiMode = TwiStarted;
+		s_Sim.TwiDoneAt = s_Sim.Clock + bit;
+		return;
+	}
+
+	unsigned char data = s_Sim.Io[0xBB];
+	s_Sim.TwiDoneAt = s_Sim.Clock + bit * 9;
+	switch(s_Sim.TwiMode)
+	{
+		case TwiStarted:
+		{
+			bool present = (data & 0xFE) == ExternalEepromAddress && !ExternalEepromBusy();
+			if(data & 1)
+			{
+				s_Sim.TwiStatus = present ? 0x40 : 0x48;
+				s_Sim.TwiMode = present ? TwiReading : TwiIdle;
+			}
+			else
+			{
+				s_Sim.TwiStatus = present ? 0x18 : 0x20;
+				s_Sim.TwiMode = present ? TwiWriting : TwiIdle;
+				s_Sim.TwiAddressBytes = 0;
+			}
+			break;
+		}
+		case TwiWriting:
+		{
+			if(s_Sim.TwiAddressBytes < 2)
+			{
+				s_Sim.ExternalPointer = s_Sim.TwiAddressBytes == 0 ?
+					(data << 8) & (ExternalEepromSize - 1) :
+					(s_Sim.ExternalPointer & 0xFF00) | data;
+				++s_Sim.TwiAddressBytes;
+			}
+			else
+			{
+				// page writes roll over inside the page
+				unsigned int offset = s_Sim.ExternalPointer & (ExternalEepromPageSize - 1);
+				s_Sim.PageBuffer[offset] = data;
+				s_Sim.PageDirty[offset] = true;
+				s_Sim.PageHasData = true;
+				s_Sim.ExternalPointer = (s_Sim.ExternalPointer & ~(ExternalEepromPageSize - 1)) | ((offset + 1) & (ExternalEepromPageSize - 1));
+			}
+			s_Sim.TwiStatus = 0x28;
+			break;
+		}
+		case TwiReading:
+		{
+			s_Sim.Io[0xBB] = s_Sim.ExternalEeprom[s_Sim.ExternalPointer];
+			s_Sim.ExternalPointer = (s_Sim.ExternalPointer + 1) & (ExternalEepromSize - 1);
+			s_Sim.TwiStatus = (control & (1 << TWEA)) ? 0x50 : 0x58;
+			break;
+		}
+		default:
+		{
+			s_Sim.TwiStatus = 0x00; // bus error, nothing addressed
+			break;
+		}
+	}
+}
+
+// Moves a finished receive into the fifo
+static void DeliverRxByte(unsigned char data, SimCycles arrivedAt)
+{
+	if(!(s_Sim.Io[0xC1] & (1 << RXEN0)))
+	{
+		return;
+	}
+
+	if(s_Sim.RxFifoCount < RxFifoDepth)
+	{
+		s_Sim.RxFifo[s_Sim.RxFifoCount] = data;
+		s_Sim.RxFifoArrivedAt[s_Sim.RxFifoCount++] = arrivedAt;
+	}
+	else
+	{
+		s_Sim.RxOverrunFlag = true;
+		++s_Sim.RxOverruns;
+	}
+}
+
+// Brings every peripheral up to the current clock
+static void UpdatePeripherals()
+{
+	// timers
+	while(s_Sim.Clock >= s_Sim.Timer2NextCompare)
+	{
+		s_Sim.Io[0x37] |= (1 << OCF2A);
+		s_Sim.Timer2NextCompare += (SimCycles)Timer2Period() * Timer2Prescale();
+	}
+	while(s_Sim.Clock >= s_Sim.Timer1NextCompare)
+	{
+		s_Sim.Io[0x36] |= (1 << OCF1A);
+		s_Sim.Timer1NextCompare += 0x10000ULL * Timer1Prescale();
+	}
+	while(s_Sim.Clock >= s_Sim.Timer1NextOverflow)
+	{
+		s_Sim.Io[0x36] |= (1 << TOV1);
+		s_Sim.Timer1NextOverflow += 0x10000ULL * Timer1Prescale();
+	}
+
+	// buttons
+	while(!s_Sim.ButtonChanges.empty() && s_Sim.ButtonChanges.front().At <= s_Sim.Clock)
+	{
+		SimSetButton(s_Sim.ButtonChanges.front().Index, s_Sim.ButtonChanges.front().Pressed);
+		s_Sim.ButtonChanges.pop_front();
+	}
+
+	// receive line
+	unsigned int byteCycles = UartByteCycles();
+	while(!s_Sim.RxWire.empty())
+	{
+		const PendingRxByte &next = s_Sim.RxWire.front();
+		SimCycles start = next.NotBefore > s_Sim.RxLineFreeAt ? next.NotBefore : s_Sim.RxLineFreeAt;
+		if(start + byteCycles > s_Sim.Clock)
+		{
+			break;
+		}
+		s_Sim.RxLineFreeAt = start + byteCycles;
+		DeliverRxByte(next.Data, s_Sim.RxLineFreeAt);
+		s_Sim.RxWire.pop_front();
+	}
+
+	// transmit line
+	while(s_Sim.TxShiftDoneAt && s_Sim.Clock >= s_Sim.TxShiftDoneAt)
+	{
+		if(s_Sim.TxBufferFull)
+		{
+			s_Sim.TxBufferFull = false;
+			s_Sim.TxData.push_back(s_Sim.TxBuffer);
+			s_Sim.TxShiftDoneAt += byteCycles;
+		}
+		else
+		{
+			s_Sim.TxShiftDoneAt = 0;
+			s_Sim.TxComplete = true;
+		}
+	}
+
+	// TWI
+	if(s_Sim.TwiPending && s_Sim.Clock >= s_Sim.TwiDoneAt)
+	{
+		s_Sim.TwiPending = false;
+		s_Sim.Io[0xBC] |= (1 << TWINT);
+	}
+}
+
+static bool VectorPending(SimVectors::Enum vector)
+{
+	switch(vector)
+	{
+		case SimVectors::Timer2CompA:	return (s_Sim.Io[0x70] & (1 << OCIE2A)) && (s_Sim.Io[0x37] & (1 << OCF2A));
+		case SimVectors::Timer1CompA:	return (s_Sim.Io[0x6F] & (1 << OCIE1A)) && (s_Sim.Io[0x36] & (1 << OCF1A));
+		case SimVectors::Timer1Ovf:		return (s_Sim.Io[0x6F] & (1 << TOIE1)) && (s_Sim.Io[0x36] & (1 << TOV1));
+		case SimVectors::UsartRx:		return (s_Sim.Io[0xC1] & (1 << RXCIE0)) && s_Sim.RxFifoCount;
+		case SimVectors::UsartUdre:		return (s_Sim.Io[0xC1] & (1 << UDRIE0)) && !s_Sim.TxBufferFull;
+		case SimVectors::UsartTx:		return (s_Sim.Io[0xC1] & (1 << TXCIE0)) && s_Sim.TxComplete;
+		case SimVectors::EeReady:		return (s_Sim.Io[0x3F] & (1 << EERIE)) && s_Sim.Clock >= s_Sim.EepromBusyUntil;
+		case SimVectors::Twi:			return (s_Sim.Io[0xBC] & (1 << TWIE)) && (s_Sim.Io[0xBC] & (1 << TWINT));
+		case SimVectors::Count:			break;
+	}
+	return false;
+}
+
+// Flags that the hardware clears when the vector is taken
+static void AcknowledgeVector(SimVectors::Enum vector)
+{
+	switch(vector)
+	{
+		case SimVectors::Timer2CompA:	s_Sim.Io[0x37] &= ~(1 << OCF2A); break;
+		case SimVectors::Timer1CompA:	s_Sim.Io[0x36] &= ~(1 << OCF1A); break;
+		case SimVectors::Timer1Ovf:		s_Sim.Io[0x36] &= ~(1 << TOV1); break;
+		case SimVectors::UsartTx:		s_Sim.TxComplete = false; break;
+		default: break;
+	}
+}
+
+// Runs the highest priority pending handler, one at a time, while interrupts are enabled
+static void ServiceInterrupts()
+{
+	while(s_Sim.InterruptFlag)
+	{
+		int vector = 0;
+		while(vector < SimVectors::Count && !(s_VectorHandlers[vector] && VectorPending(static_cast<SimVectors::Enum>(vector))))
+		{
+			++vector;
+		}
+		if(vector == SimVectors::Count)
+		{
+			return;
+		}
+
+		SimIsrStats &stats = s_Sim.Stats[vector];
+		SimCycles start = s_Sim.Clock;
+		SimCycles outerNested = s_Sim.NestedCycles;
+		s_Sim.NestedCycles = 0;
+
+		s_Sim.InterruptFlag = false;
+		AcknowledgeVector(static_cast<SimVectors::Enum>(vector));
+		SimAdvance(InterruptResponseCycles);
+		s_VectorHandlers[vector]();
+		SimAdvance(InterruptReturnCycles);
+		s_Sim.InterruptFlag = true;
+
+		SimCycles inclusive = s_Sim.Clock - start;
+		SimCycles exclusive = inclusive - s_Sim.NestedCycles;
+		s_Sim.NestedCycles = outerNested + inclusive;
+
+		if(!stats.Count || exclusive < stats.Min) { stats.Min = exclusive; }
+		if(exclusive > stats.Max) { stats.Max = exclusive; }
+		stats.Total += exclusive;
+		++stats.Count;
+	}
+}
+
+SimCycles SimClock()
+{
+	return s_Sim.Clock;
+}
+
+void SimAdvance(unsigned long cycles)
+{
+	// once stopped, the firmware is only unwinding, so leave everything frozen
+	if(s_Sim.Stopping)
+	{
+		return;
+	}
+
+	s_Sim.Clock += cycles;
+	bool idle = s_Sim.RxWire.empty() && s_Sim.ButtonChanges.empty() && s_Sim.Clock >= s_Sim.RxLineFreeAt + s_Sim.StopSettle;
+	if(s_Sim.Clock >= s_Sim.StopAt || idle)
+	{
+		s_Sim.Stopping = true;
+		throw SimStop();
+	}
+
+	// handlers advance the clock too, so only the outermost call walks the peripherals
+	if(!s_Sim.Updating)
+	{
+		s_Sim.Updating = true;
+		UpdatePeripherals();
+		s_Sim.Updating = false;
+		ServiceInterrupts();
+	}
+}
+
+void SimStopAt(SimCycles cycles)
+{
+	s_Sim.StopAt = cycles;
+}
+
+void SimStopWhenIdle(SimCycles settleCycles)
+{
+	s_Sim.StopSettle = settleCycles;
+}
+
+unsigned char SimRead(unsigned char address)
+{
+	switch(address)
+	{
+		case 0x26: // PINC, buttons pull low against the pull-ups
+		{
+			return s_Sim.Io[0x28] & ~(~s_Sim.Io[0x27] & s_Sim.ButtonsLow);
+		}
+		case 0x3F: // EECR
+		{
+			unsigned char value = s_Sim.Io[address] & ~((1 << EEPE) | (1 << EEMPE));
+			if(s_Sim.Clock < s_Sim.EepromBusyUntil) { value |= (1 << EEPE); }
+			if(s_Sim.Clock < s_Sim.EepromMasterWriteUntil) { value |= (1 << EEMPE); }
+			return value;
+		}
+		case 0x5F: // SREG
+		{
+			return s_Sim.InterruptFlag ? 0x80 : 0;
+		}
+		case 0x84: // TCNT1L, latches the high byte
+		{
+			unsigned int prescale = Timer1Prescale();
+			unsigned int count = prescale ? ((s_Sim.Clock - s_Sim.Timer1Base) / prescale) & 0xFFFF : (s_Sim.Io[0x85] << 8) | s_Sim.Io[0x84];
+			s_Sim.Io[0x85] = (count >> 8) & 0xFF;
+			return count & 0xFF;
+		}
+		case 0xB2: // TCNT2
+		{
+			unsigned int prescale = Timer2Prescale();
+			return prescale ? ((s_Sim.Clock - s_Sim.Timer2Base) / prescale) % Timer2Period() : s_Sim.Io[address];
+		}
+		case 0xB9: // TWSR
+		{
+			return s_Sim.TwiStatus | (s_Sim.Io[address] & 0x3);
+		}
+		case 0xC0: // UCSR0A
+		{
+			unsigned char value = s_Sim.Io[address] & ((1 << U2X0) | (1 << MPCM0));
+			if(s_Sim.RxFifoCount) { value |= (1 << RXC0); }
+			if(s_Sim.TxComplete) { value |= (1 << TXC0); }
+			if(!s_Sim.TxBufferFull) { value |= (1 << UDRE0); }
+			if(s_Sim.RxOverrunFlag) { value |= (1 << DOR0); }
+			return value;
+		}
+		case 0xC6: // UDR0
+		{
+			if(!s_Sim.RxFifoCount)
+			{
+				return s_Sim.Io[address];
+			}
+			unsigned char data = s_Sim.RxFifo[0];
+			if(s_Sim.Clock - s_Sim.RxFifoArrivedAt[0] > s_Sim.RxWorstWait)
+			{
+				s_Sim.RxWorstWait = s_Sim.Clock - s_Sim.RxFifoArrivedAt[0];
+			}
+			s_Sim.RxFifo[0] = s_Sim.RxFifo[1];
+			s_Sim.RxFifoArrivedAt[0] = s_Sim.RxFifoArrivedAt[1];
+			--s_Sim.RxFifoCount;
+			s_Sim.RxOverrunFlag = false;
+			return s_Sim.Io[address] = data;
+		}
+	}
+	return s_Sim.Io[address];
+}
+
+void SimWrite(unsigned char address, unsigned char value)
+{
+	switch(address)
+	{
+		case 0x35: // TIFR0, write one to clear
+		case 0x36:
+		case 0x37:
+		{
+			s_Sim.Io[address] &= ~value;
+			return;
+		}
+		case 0x3F: // EECR
+		{
+			bool masterWrite = s_Sim.Clock < s_Sim.EepromMasterWriteUntil;
+			s_Sim.Io[address] = value & ((1 << EERIE) | (1 << EEPM0) | (1 << EEPM1));
+			if(value & (1 << EERE))
+			{
+				unsigned int eeAddress = ((s_Sim.Io[0x42] << 8) | s_Sim.Io[0x41]) & (InternalEepromSize - 1);
+				s_Sim.Io[0x40] = s_Sim.InternalEeprom[eeAddress];
+				SimAdvance(4); // cpu halts for the read
+			}
+			else if((value & (1 << EEPE)) && masterWrite && s_Sim.Clock >= s_Sim.EepromBusyUntil)
+			{
+				unsigned int eeAddress = ((s_Sim.Io[0x42] << 8) | s_Sim.Io[0x41]) & (InternalEepromSize - 1);
+				unsigned char &cell = s_Sim.InternalEeprom[eeAddress];
+				switch((value >> EEPM0) & 3)
+				{
+					case 0: cell = s_Sim.Io[0x40]; break;	// erase + write
+					case 1: cell = 0xFF; break;				// erase only
+					case 2: cell &= s_Sim.Io[0x40]; break;	// write only, can only clear bits
+				}
+				s_Sim.EepromMasterWriteUntil = 0;
+				s_Sim.EepromBusyUntil = s_Sim.Clock + (((value >> EEPM0) & 3) ? F_CPU * 18 / 10000 : F_CPU * 34 / 10000); // 1.8ms for half of the 3.4ms erase + write
+				++s_Sim.EepromWrites;
+				SimAdvance(2); // cpu halts for the write
+			}
+			else if(value & (1 << EEMPE))
+			{
+				s_Sim.EepromMasterWriteUntil = s_Sim.Clock + 4;
+			}
+			return;
+		}
+		case 0x5F: // SREG
+		{
+			s_Sim.InterruptFlag = (value & 0x80) != 0;
+			return;
+		}
+		case 0x81: // TCCR1B
+		{
+			s_Sim.Io[address] = value;
+			ScheduleTimer1();
+			return;
+		}
+		case 0x84: // TCNT1L, commits the high byte written before it
+		case 0x88: // OCR1AL
+		{
+			s_Sim.Io[address] = value;
+			if(address == 0x84)
+			{
+				unsigned int prescale = Timer1Prescale();
+				unsigned int count = (s_Sim.Io[0x85] << 8) | value;
+				s_Sim.Timer1Base = s_Sim.Clock - (SimCycles)count * (prescale ? prescale : 1);
+			}
+			ScheduleTimer1();
+			return;
+		}
+		case 0xB0: // TCCR2A
+		case 0xB1: // TCCR2B
+		case 0xB3: // OCR2A
+		{
+			s_Sim.Io[address] = value;
+			ScheduleTimer2();
+			return;
+		}
+		case 0xB2: // TCNT2
+		{
+			unsigned int prescale = Timer2Prescale();
+			s_Sim.Io[address] = value;
+			s_Sim.Timer2Base = s_Sim.Clock - (SimCycles)value * (prescale ? prescale : 1);
+			ScheduleTimer2();
+			return;
+		}
+		case 0xB9: // TWSR, only the prescaler is writable
+		{
+			s_Sim.Io[address] = value & 0x3;
+			return;
+		}
+		case 0xBC: // TWCR
+		{
+			bool start = (value & (1 << TWINT)) && (value & (1 << TWEN));
+			s_Sim.Io[address] = (s_Sim.Io[address] & (1 << TWINT)) | (value & ~(1 << TWINT));
+			if(start)
+			{
+				s_Sim.Io[address] &= ~(1 << TWINT);
+				StartTwiOperation(value);
+			}
+			return;
+		}
+		case 0xC0: // UCSR0A
+		{
+			if(value & (1 << TXC0)) { s_Sim.TxComplete = false; }
+			s_Sim.Io[address] = value & ((1 << U2X0) | (1 << MPCM0));
+			return;
+		}
+		case 0xC6: // UDR0
+		{
+			if(!(s_Sim.Io[0xC1] & (1 << TXEN0)))
+			{
+				return;
+			}
+			if(!s_Sim.TxShiftDoneAt)
+			{
+				s_Sim.TxData.push_back(value);
+				s_Sim.TxShiftDoneAt = s_Sim.Clock + UartByteCycles();
+				s_Sim.TxComplete = false;
+			}
+			else
+			{
+				// writing while UDRE is clear clobbers the pending byte, same as the hardware
+				s_Sim.TxBuffer = value;
+				s_Sim.TxBufferFull = true;
+			}
+			return;
+		}
+	}
+	s_Sim.Io[address] = value;
+}
+
+void SimSei()
+{
+	SimAdvance(1);
+	s_Sim.InterruptFlag = true;
+	ServiceInterrupts();
+}
+
+void SimCli()
+{
+	SimAdvance(1);
+	s_Sim.InterruptFlag = false;
+}
+
+bool SimInterruptsEnabled()
+{
+	return s_Sim.InterruptFlag;
+}
+
+void SimReset()
+{
+	s_Sim.Clock = 0;
+	s_Sim.StopAt = ~0ULL;
+	s_Sim.StopSettle = ~0ULL >> 1;
+	s_Sim.Stopping = false;
+	s_Sim.InterruptFlag = false;
+	s_Sim.Updating = false;
+	memset(s_Sim.Io, 0, sizeof(s_Sim.Io));
+	s_Sim.Io[0xB9] = 0xF8;
+	s_Sim.Timer1Base = s_Sim.Timer2Base = 0;
+	s_Sim.Timer1NextCompare = s_Sim.Timer1NextOverflow = s_Sim.Timer2NextCompare = ~0ULL;
+	s_Sim.RxWire.clear();
+	s_Sim.RxLineFreeAt = 0;
+	s_Sim.RxFifoCount = 0;
+	s_Sim.RxWorstWait = 0;
+	s_Sim.RxOverrunFlag = false;
+	s_Sim.RxOverruns = 0;
+	s_Sim.TxShiftDoneAt = 0;
+	s_Sim.TxBufferFull = false;
+	s_Sim.TxComplete = false;
+	s_Sim.TxData.clear();
+	memset(s_Sim.InternalEeprom, 0xFF, sizeof(s_Sim.InternalEeprom));
+	s_Sim.EepromMasterWriteUntil = s_Sim.EepromBusyUntil = 0;
+	s_Sim.EepromWrites = 0;
+	memset(s_Sim.ExternalEeprom, 0xFF, sizeof(s_Sim.ExternalEeprom));
+	s_Sim.TwiPending = false;
+	s_Sim.TwiStatus = 0xF8;
+	s_Sim.TwiMode = TwiIdle;
+	s_Sim.TwiAddressBytes = 0;
+	s_Sim.TwiStarts = 0;
+	s_Sim.ExternalPointer = 0;
+	memset(s_Sim.PageDirty, 0, sizeof(s_Sim.PageDirty));
+	s_Sim.PageHasData = false;
+	s_Sim.ExternalBusyUntil = 0;
+	s_Sim.ButtonsLow = 0;
+	s_Sim.ButtonChanges.clear();
+	for(int i = 0; i < SimVectors::Count; ++i)
+	{
+		s_Sim.Stats[i].Name = s_VectorNames[i];
+		s_Sim.Stats[i].Count = 0;
+		s_Sim.Stats[i].Min = s_Sim.Stats[i].Max = s_Sim.Stats[i].Total = 0;
+	}
+	s_Sim.NestedCycles = 0;
+}
+
+void SimQueueRx(const unsigned char *data, unsigned int length, SimCycles notBefore)
+{
+	for(unsigned int i = 0; i < length; ++i)
+	{
+		PendingRxByte pending = { data[i], notBefore };
+		s_Sim.RxWire.push_back(pending);
+	}
+}
+
+unsigned int SimPendingRx()
+{
+	return s_Sim.RxWire.size();
+}
+
+SimCycles SimRxDrainedAt()
+{
+	return s_Sim.RxLineFreeAt;
+}
+
+const std::vector<unsigned char> &SimTxData()
+{
+	return s_Sim.TxData;
+}
+
+unsigned long SimRxOverruns()
+{
+	return s_Sim.RxOverruns;
+}
+
+SimCycles SimRxWorstWait()
+{
+	return s_Sim.RxWorstWait;
+}
+
+unsigned long SimTwiStarts()
+{
+	return s_Sim.TwiStarts;
+}
+
+unsigned long SimEepromWrites()
+{
+	return s_Sim.EepromWrites;
+}
+
+void SimSetButton(unsigned char index, bool pressed)
+{
+	unsigned char pin = index == 0 ? (1 << PINC3) : (1 << PINC2);
+	s_Sim.ButtonsLow = pressed ? (s_Sim.ButtonsLow | pin) : (s_Sim.ButtonsLow & ~pin);
+}
+
+void SimQueueButton(unsigned char index, bool pressed, SimCycles at)
+{
+	PendingButton change = { index, pressed, at };
+	s_Sim.ButtonChanges.push_back(change);
+}
+
+unsigned char *SimInternalEeprom()
+{
+	return s_Sim.InternalEeprom;
+}
+
+unsigned char *SimExternalEeprom()
+{
+	return s_Sim.ExternalEeprom;
+}
+
+const SimIsrStats &SimGetIsrStats(SimVectors::Enum vector)
+{
+	return s_Sim.Stats[vector];
+}
@@ -0,0 +1,183 @@
+#ifndef SIMHAL_H_
+#define SIMHAL_H_
+
+// Host side stand-in for the ATmega88PA peripherals used by the firmware
+// Registers are proxies that route every access through the simulated peripherals and charge the virtual clock
+// Interrupts are delivered between register accesses, so the firmware only ever gets preempted at a HAL touch point
+
+#include <vector>
+
+#ifndef F_CPU
+#define F_CPU 12000000UL
+#endif
+
+typedef unsigned long long SimCycles;
+
+// Interrupt vectors the simulator knows how to raise, in priority order
+struct SimVectors
+{
+	enum Enum
+	{
+		Timer2CompA,
+		Timer1CompA,
+		Timer1Ovf,
+		UsartRx,
+		UsartUdre,
+		UsartTx,
+		EeReady,
+		Twi,
+
+		Count
+	};
+};
+
+// Cycle accounting for a single interrupt vector (exclusive of any nested interrupts)
+struct SimIsrStats
+{
+	const char *Name;
+	unsigned long Count;
+	SimCycles Min;
+	SimCycles Max;
+	SimCycles Total;
+};
+
+// Thrown out of the firmware once the virtual clock reaches the requested stop time
+struct SimStop
+{
+};
+
+// Virtual clock
+SimCycles SimClock();
+void SimAdvance(unsigned long cycles);
+void SimStopAt(SimCycles cycles);
+void SimStopWhenIdle(SimCycles settleCycles);
+
+// Raw data space access (addresses as they appear in the datasheet's register summary)
+unsigned char SimRead(unsigned char address);
+void SimWrite(unsigned char address, unsigned char value);
+
+// Global interrupt flag
+void SimSei();
+void SimCli();
+bool SimInterruptsEnabled();
+
+// Harness controls
+void SimReset();
+void SimQueueRx(const unsigned char *data, unsigned int length, SimCycles notBefore);
+unsigned int SimPendingRx();
+SimCycles SimRxDrainedAt();
+const std::vector<unsigned char> &SimTxData();
+unsigned long SimRxOverruns();
+SimCycles SimRxWorstWait();
+unsigned long SimTwiStarts();
+unsigned long SimEepromWrites();
+void SimSetButton(unsigned char index, bool pressed);
+void SimQueueButton(unsigned char index, bool pressed, SimCycles at);
+unsigned char *SimInternalEeprom();
+unsigned char *SimExternalEeprom();
+const SimIsrStats &SimGetIsrStats(SimVectors::Enum vector);
+
+// An I/O register, reads and writes go through the simulated peripherals
+class SimRegister
+{
+public:
+	explicit SimRegister(unsigned char address): m_address(address) {}
+
+	operator unsigned char() const
+	{
+		SimAdvance(m_address < 0x60 ? 1 : 2); // in/lds
+		return SimRead(m_address);
+	}
+
+	const SimRegister &operator=(unsigned char value) const
+	{
+		SimAdvance(m_address < 0x60 ? 1 : 2); // out/sts
+		SimWrite(m_address, value);
+		return *this;
+	}
+
+	const SimRegister &operator|=(int mask) const
+	{
+		if(m_address < 0x40 && IsSingleBit(mask))
+		{
+			SimAdvance(2); // sbi
+			SimWrite(m_address, SimRead(m_address) | mask);
+			return *this;
+		}
+		unsigned char value = *this;
+		SimAdvance(1);
+		return *this = value | mask;
+	}
+
+	const SimRegister &operator&=(int mask) const
+	{
+		if(m_address < 0x40 && IsSingleBit(~mask & 0xFF))
+		{
+			SimAdvance(2); // cbi
+			SimWrite(m_address, SimRead(m_address) & mask);
+			return *this;
+		}
+		unsigned char value = *this;
+		SimAdvance(1);
+		return *this = value & mask;
+	}
+
+	const SimRegister &operator^=(int mask) const
+	{
+		unsigned char value = *this;
+		SimAdvance(1);
+		return *this = value ^ mask;
+	}
+
+private:
+	static bool IsSingleBit(unsigned char mask) { return mask && !(mask & (mask - 1)); }
+
+	unsigned char m_address;
+};
+
+// A 16 bit register pair, low byte at the given address and high byte right after it
+class SimRegister16
+{
+public:
+	explicit SimRegister16(unsigned char address): m_address(address) {}
+
+	operator unsigned int() const
+	{
+		unsigned char low = SimRegister(m_address);
+		unsigned char high = SimRegister(m_address + 1);
+		return ((unsigned int)high << 8) | low;
+	}
+
+	const SimRegister16 &operator=(unsigned int value) const
+	{
+		SimRegister high(m_address + 1);
+		SimRegister low(m_address);
+		high = (value >> 8) & 0xFF;
+		low = value & 0xFF;
+		return *this;
+	}
+
+private:
+	unsigned char m_address;
+};
+
+// Backs ATOMIC_BLOCK, restores (or forces) the interrupt flag when the scope is left by any path
+class SimAtomicScope
+{
+public:
+	explicit SimAtomicScope(bool forceOn): m_restore(forceOn || SimInterruptsEnabled()), m_once(true) { SimCli(); }
+	~SimAtomicScope() noexcept(false) { if(m_restore) { SimSei(); } }
+
+	bool Once()
+	{
+		bool once = m_once;
+		m_once = false;
+		return once;
+	}
+
+private:
+	bool m_restore;
+	bool m_once;
+};
+
+#endif /* SIMHAL_H_ */
@@ -0,0 +1,9 @@
+#ifndef SIM_AVR_CPUFUNC_H_
+#define SIM_AVR_CPUFUNC_H_
+
+#include "SimHal.h"
+
+#define _NOP() SimAdvance(1)
+#define _MemoryBarrier() __asm__ __volatile__("" ::: "memory")
+
+#endif /* SIM_AVR_CPUFUNC_H_ */
@@ -0,0 +1,20 @@
+#ifndef SIM_AVR_INTERRUPT_H_
+#define SIM_AVR_INTERRUPT_H_
+
+// Handlers are plain functions the simulator calls between register accesses
+// The simulator clears the global interrupt flag on entry and sets it again on the way out, like the hardware does
+
+#include <avr/io.h>
+
+#define sei() SimSei()
+#define cli() SimCli()
+
+#define ISR_BLOCK
+#define ISR_NOBLOCK SimSei()
+
+#define ISR(vector, ...) \
+	static void vector##_Body(void); \
+	extern "C" void vector(void) { __VA_ARGS__; vector##_Body(); } \
+	static void vector##_Body(void)
+
+#endif /* SIM_AVR_INTERRUPT_H_ */
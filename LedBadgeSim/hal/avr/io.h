@@ -0,0 +1,239 @@
+#ifndef SIM_AVR_IO_H_
+#define SIM_AVR_IO_H_
+
+// ATmega88PA register file for the host simulator
+// Only the registers and bits the firmware touches are mapped, addresses follow the datasheet's register summary
+
+#include <avr/sfr_defs.h>
+#include "SimHal.h"
+
+#define PINB	SimRegister(0x23)
+#define DDRB	SimRegister(0x24)
+#define PORTB	SimRegister(0x25)
+#define PINC	SimRegister(0x26)
+#define DDRC	SimRegister(0x27)
+#define PORTC	SimRegister(0x28)
+#define PIND	SimRegister(0x29)
+#define DDRD	SimRegister(0x2A)
+#define PORTD	SimRegister(0x2B)
+#define TIFR0	SimRegister(0x35)
+#define TIFR1	SimRegister(0x36)
+#define TIFR2	SimRegister(0x37)
+#define GPIOR0	SimRegister(0x3E)
+#define EECR	SimRegister(0x3F)
+#define EEDR	SimRegister(0x40)
+#define EEARL	SimRegister(0x41)
+#define EEARH	SimRegister(0x42)
+#define EEAR	SimRegister16(0x41)
+#define TCCR0A	SimRegister(0x44)
+#define TCCR0B	SimRegister(0x45)
+#define TCNT0	SimRegister(0x46)
+#define OCR0A	SimRegister(0x47)
+#define OCR0B	SimRegister(0x48)
+#define GPIOR1	SimRegister(0x4A)
+#define GPIOR2	SimRegister(0x4B)
+#define SMCR	SimRegister(0x53)
+#define MCUSR	SimRegister(0x54)
+#define MCUCR	SimRegister(0x55)
+#define SREG	SimRegister(0x5F)
+#define PRR		SimRegister(0x64)
+#define TIMSK0	SimRegister(0x6E)
+#define TIMSK1	SimRegister(0x6F)
+#define TIMSK2	SimRegister(0x70)
+#define TCCR1A	SimRegister(0x80)
+#define TCCR1B	SimRegister(0x81)
+#define TCCR1C	SimRegister(0x82)
+#define TCNT1L	SimRegister(0x84)
+#define TCNT1H	SimRegister(0x85)
+#define TCNT1	SimRegister16(0x84)
+#define OCR1AL	SimRegister(0x88)
+#define OCR1AH	SimRegister(0x89)
+#define OCR1A	SimRegister16(0x88)
+#define TCCR2A	SimRegister(0xB0)
+#define TCCR2B	SimRegister(0xB1)
+#define TCNT2	SimRegister(0xB2)
+#define OCR2A	SimRegister(0xB3)
+#define OCR2B	SimRegister(0xB4)
+#define TWBR	SimRegister(0xB8)
+#define TWSR	SimRegister(0xB9)
+#define TWAR	SimRegister(0xBA)
+#define TWDR	SimRegister(0xBB)
+#define TWCR	SimRegister(0xBC)
+#define UCSR0A	SimRegister(0xC0)
+#define UCSR0B	SimRegister(0xC1)
+#define UCSR0C	SimRegister(0xC2)
+#define UBRR0L	SimRegister(0xC4)
+#define UBRR0H	SimRegister(0xC5)
+#define UBRR0	SimRegister16(0xC4)
+#define UDR0	SimRegister(0xC6)
+
+// port pins
+#define PINB0 0
+#define PINB1 1
+#define PINB2 2
+#define PINB3 3
+#define PINB4 4
+#define PINB5 5
+#define PINB6 6
+#define PINB7 7
+#define DDB0 0
+#define DDB1 1
+#define DDB2 2
+#define DDB3 3
+#define DDB4 4
+#define DDB5 5
+#define DDB6 6
+#define DDB7 7
+#define PORTB0 0
+#define PORTB1 1
+#define PORTB2 2
+#define PORTB3 3
+#define PORTB4 4
+#define PORTB5 5
+#define PORTB6 6
+#define PORTB7 7
+#define PINC0 0
+#define PINC1 1
+#define PINC2 2
+#define PINC3 3
+#define PINC4 4
+#define PINC5 5
+#define PINC6 6
+#define DDC0 0
+#define DDC1 1
+#define DDC2 2
+#define DDC3 3
+#define DDC4 4
+#define DDC5 5
+#define DDC6 6
+#define PORTC0 0
+#define PORTC1 1
+#define PORTC2 2
+#define PORTC3 3
+#define PORTC4 4
+#define PORTC5 5
+#define PORTC6 6
+#define PIND0 0
+#define PIND1 1
+#define PIND2 2
+#define PIND3 3
+#define PIND4 4
+#define PIND5 5
+#define PIND6 6
+#define PIND7 7
+#define DDD0 0
+#define DDD1 1
+#define DDD2 2
+#define DDD3 3
+#define DDD4 4
+#define DDD5 5
+#define DDD6 6
+#define DDD7 7
+#define PORTD0 0
+#define PORTD1 1
+#define PORTD2 2
+#define PORTD3 3
+#define PORTD4 4
+#define PORTD5 5
+#define PORTD6 6
+#define PORTD7 7
+
+// MCUCR
+#define PUD 4
+
+// EECR
+#define EERE 0
+#define EEPE 1
+#define EEMPE 2
+#define EERIE 3
+#define EEPM0 4
+#define EEPM1 5
+
+// timer 0
+#define WGM00 0
+#define WGM01 1
+#define COM0B0 4
+#define COM0B1 5
+#define COM0A0 6
+#define COM0A1 7
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM02 3
+
+// timer 1
+#define WGM10 0
+#define WGM11 1
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define WGM13 4
+#define TOIE1 0
+#define OCIE1A 1
+#define OCIE1B 2
+#define TOV1 0
+#define OCF1A 1
+#define OCF1B 2
+
+// timer 2
+#define WGM20 0
+#define WGM21 1
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM22 3
+#define TOIE2 0
+#define OCIE2A 1
+#define OCIE2B 2
+#define TOV2 0
+#define OCF2A 1
+#define OCF2B 2
+
+// TWI
+#define TWIE 0
+#define TWEN 2
+#define TWWC 3
+#define TWSTO 4
+#define TWSTA 5
+#define TWEA 6
+#define TWINT 7
+#define TWPS0 0
+#define TWPS1 1
+
+// USART
+#define MPCM0 0
+#define U2X0 1
+#define UPE0 2
+#define DOR0 3
+#define FE0 4
+#define UDRE0 5
+#define TXC0 6
+#define RXC0 7
+#define TXB80 0
+#define RXB80 1
+#define UCSZ02 2
+#define TXEN0 3
+#define RXEN0 4
+#define UDRIE0 5
+#define TXCIE0 6
+#define RXCIE0 7
+#define UCPOL0 0
+#define UCSZ00 1
+#define UCSZ01 2
+#define USBS0 3
+#define UPM00 4
+#define UPM01 5
+#define UMSEL00 6
+#define UMSEL01 7
+
+// PRR
+#define PRADC 0
+#define PRUSART0 1
+#define PRSPI 2
+#define PRTIM1 3
+#define PRTIM0 5
+#define PRTIM2 6
+#define PRTWI 7
+
+#endif /* SIM_AVR_IO_H_ */
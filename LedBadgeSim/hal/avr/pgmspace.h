@@ -0,0 +1,31 @@
+#ifndef SIM_AVR_PGMSPACE_H_
+#define SIM_AVR_PGMSPACE_H_
+
+// Flash and data space are the same thing on the host, lpm costs one more cycle than ld
+
+#include "SimHal.h"
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+inline unsigned char pgm_read_byte(const void *address)
+{
+	SimAdvance(3);
+	return *static_cast<const unsigned char *>(address);
+}
+
+inline unsigned short pgm_read_word(const void *address)
+{
+	SimAdvance(6);
+	const unsigned char *p = static_cast<const unsigned char *>(address);
+	return p[0] | (p[1] << 8);
+}
+
+// Pointers are wider than a word on the host, so this reads the whole thing
+inline const void *pgm_read_ptr(const void *address)
+{
+	SimAdvance(6);
+	return *static_cast<const void *const *>(address);
+}
+
+#endif /* SIM_AVR_PGMSPACE_H_ */
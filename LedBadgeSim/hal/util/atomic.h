@@ -0,0 +1,11 @@
+#ifndef SIM_UTIL_ATOMIC_H_
+#define SIM_UTIL_ATOMIC_H_
+
+#include "SimHal.h"
+
+#define ATOMIC_RESTORESTATE false
+#define ATOMIC_FORCEON true
+
+#define ATOMIC_BLOCK(type) for(SimAtomicScope simAtomicScope(type); simAtomicScope.Once(); )
+
+#endif /* SIM_UTIL_ATOMIC_H_ */
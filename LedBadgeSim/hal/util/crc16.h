@@ -0,0 +1,28 @@
+#ifndef SIM_UTIL_CRC16_H_
+#define SIM_UTIL_CRC16_H_
+
+// C equivalents of the avr-libc inline assembly, charged with the cycle counts of the originals
+
+#include <stdint.h>
+#include "SimHal.h"
+
+inline uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data)
+{
+	SimAdvance(19);
+	data ^= crc & 0xFF;
+	data ^= data << 4;
+	return ((((uint16_t)data << 8) | ((crc >> 8) & 0xFF)) ^ (uint8_t)(data >> 4) ^ ((uint16_t)data << 3));
+}
+
+inline uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data)
+{
+	SimAdvance(40);
+	crc ^= data;
+	for(uint8_t i = 0; i < 8; ++i)
+	{
+		crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+	}
+	return crc;
+}
+
+#endif /* SIM_UTIL_CRC16_H_ */
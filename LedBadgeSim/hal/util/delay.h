@@ -0,0 +1,16 @@
+#ifndef SIM_UTIL_DELAY_H_
+#define SIM_UTIL_DELAY_H_
+
+#include "SimHal.h"
+
+inline void _delay_ms(double ms)
+{
+	SimAdvance((unsigned long)(ms * (F_CPU / 1000.0)));
+}
+
+inline void _delay_us(double us)
+{
+	SimAdvance((unsigned long)(us * (F_CPU / 1000000.0)));
+}
+
+#endif /* SIM_UTIL_DELAY_H_ */
@@ -0,0 +1,17 @@
+#ifndef SIM_UTIL_DELAY_BASIC_H_
+#define SIM_UTIL_DELAY_BASIC_H_
+
+#include <stdint.h>
+#include "SimHal.h"
+
+inline void _delay_loop_1(uint8_t count)
+{
+	SimAdvance(3 * (count ? count : 256));
+}
+
+inline void _delay_loop_2(uint16_t count)
+{
+	SimAdvance(4 * (count ? count : 65536UL));
+}
+
+#endif /* SIM_UTIL_DELAY_BASIC_H_ */
@@ -40,10 +40,17 @@ public BadgeCommandEventArgs(BadgeCaps device, MemoryStream commands)
 
     public class BadgePump: IDisposable
     {
+        /// <summary>Number of buffers the badge swaps between, i.e. how many frames ago the back buffer was written.</summary>
+        const int SwapChainLength = 2;
+        /// <summary>Dirty updates in a row to a buffer before it gets a full frame again.</summary>
+        const int KeyframeInterval = 30;
+
         public BadgePump(IBadgeResponseDispatcher dispatcher)
         {
             Brightness = 255;
             UseFrameBuffer = true;
+            DirtyUpdates = true;
+            SlidingWindow = true;
             FrameRate = 60;
             m_responseDispatcher = dispatcher;
 
@@ -58,6 +65,10 @@ public BadgePump(IBadgeResponseDispatcher dispatcher)
         public BadgeCaps Device { get { return m_device; } }
         public bool Running { get; private set; }
         public bool UseFrameBuffer { get; set; }
+        /// <summary>Only send the blocks that changed since the target buffer was last written (with a periodic full frame to recover from dropped packets).</summary>
+        public bool DirtyUpdates { get; set; }
+        /// <summary>Keep a window of packets in flight sized by the badge's free input buffer, on badges that report it (see SupportedFeatures.CreditAcks).</summary>
+        public bool SlidingWindow { get; set; }
         public bool RotateFrame { get; set; }
         public int FrameRate { get; set; }
         public bool FrameSync { get; set; }
@@ -69,11 +80,15 @@ public BadgePump(IBadgeResponseDispatcher dispatcher)
         public event BadgeCommandEvenHandler ReadyToSend;
 
         int m_prevBrightness = -1;
+        bool m_slidingWindowTried;
         BadgeCaps m_device;
         IBadgeResponseDispatcher m_responseDispatcher;
         BadgeConnection m_connection;
         ConcurrentQueue<Tuple<MemoryStream, bool>> m_pendingCommands = new ConcurrentQueue<Tuple<MemoryStream, bool>>();
         BadgeRenderTarget m_renderTarget;
+        byte[][] m_sentFrames = new byte[SwapChainLength][];
+        int[] m_dirtyFramesSent = new int[SwapChainLength];
+        int m_sentFrameIndex;
         ManualResetEvent m_cancel = new ManualResetEvent(false);
         ManualResetEvent m_enable = new ManualResetEvent(false);
         Stopwatch m_timer = new Stopwatch();
@@ -114,6 +129,8 @@ public void Connect(string port, BadgeCaps device)
             {
                 m_device = device;
                 m_prevBrightness = -1;
+                m_slidingWindowTried = false;
+                ResetSentFrames();
                 m_responseDispatcher.ResponseHandler += ResponseHandler;
                 m_connection = new BadgeConnection(port, device.Baud, m_responseDispatcher);
             }
@@ -143,6 +160,7 @@ void RunFrame()
                 if(device != null && (m_renderTarget == null || !m_renderTarget.SameDimentions(device.Width, device.Height, device.BitsPerPixel == 1 ? PixelFormat.OneBit : PixelFormat.TwoBits)))
                 {
                     m_renderTarget = new BadgeRenderTarget(device.Width, device.Height, device.BitsPerPixel == 1 ? PixelFormat.OneBit : PixelFormat.TwoBits);
+                    ResetSentFrames();
                 }
 
                 if(m_renderTarget != null)
@@ -165,15 +183,15 @@ void RunFrame()
                         ready(this, new BadgeFrameEventArgs(Device, m_renderTarget));
                     }
 
-                    int writeBufferLength;
-                    BadgeCommands.CreateWriteRect(commands, Target.BackBuffer, m_renderTarget.PackedFormat,
-                        0, 0, (byte)m_renderTarget.WidthInBlocks, (byte)m_renderTarget.Height, out writeBufferLength);
-                    commands.Write(m_renderTarget.PackedBuffer, 0, m_renderTarget.PackedBuffer.Length);
+                    WriteFrame(commands);
                     BadgeCommands.CreateSwap(commands, false, 0);
                 }
             }
             else
             {
+                // whatever gets generated here can touch the buffers behind our back
+                ResetSentFrames();
+
                 var getCommands = GenerateCommands;
                 if(getCommands != null)
                 {
@@ -190,10 +208,89 @@ void RunFrame()
             SendFrame(commands);
         }
 
+        void WriteFrame(MemoryStream commands)
+        {
+            byte[] packed = m_renderTarget.PackedBuffer;
+            byte[] previous = m_sentFrames[m_sentFrameIndex];
+            byte width = (byte)m_renderTarget.WidthInBlocks;
+            byte height = (byte)m_renderTarget.Height;
+            bool twoBits = m_renderTarget.PackedFormat == PixelFormat.TwoBits;
+
+            // full frame, the fallback when nothing smaller comes along
+            var best = new MemoryStream();
+            int writeBufferLength;
+            BadgeCommands.CreateWriteRect(best, Target.BackBuffer, m_renderTarget.PackedFormat, 0, 0, width, height, out writeBufferLength);
+            best.Write(packed, 0, packed.Length);
+            bool keyframe = true;
+
+            if(twoBits)
+            {
+                var runLength = new MemoryStream();
+                BadgeCommands.CreateWriteRectRunLength(runLength, Target.BackBuffer, 0, 0, width, height, packed);
+                if(runLength.Length < best.Length)
+                {
+                    best = runLength;
+                }
+            }
+
+            // updates relative to what's in the buffer get a keyframe now and then to recover from dropped frames
+            if(DirtyUpdates && previous != null && m_dirtyFramesSent[m_sentFrameIndex] < KeyframeInterval)
+            {
+                var dirty = new MemoryStream();
+                BadgeCommands.CreateWriteDirtyRect(dirty, Target.BackBuffer, m_renderTarget.PackedFormat, 0, 0, width, height, packed, previous);
+                if(dirty.Length < best.Length)
+                {
+                    best = dirty;
+                    keyframe = false;
+                }
+
+                if(twoBits)
+                {
+                    var delta = new MemoryStream();
+                    BadgeCommands.CreateWriteRectXorDelta(delta, Target.BackBuffer, 0, 0, width, height, packed, previous);
+                    if(delta.Length < best.Length)
+                    {
+                        best = delta;
+                        keyframe = false;
+                    }
+                }
+            }
+
+            best.WriteTo(commands);
+            if(keyframe)
+            {
+                m_dirtyFramesSent[m_sentFrameIndex] = 0;
+            }
+            else
+            {
+                ++m_dirtyFramesSent[m_sentFrameIndex];
+            }
+
+            m_sentFrames[m_sentFrameIndex] = (byte[])packed.Clone();
+            m_sentFrameIndex = (m_sentFrameIndex + 1) % SwapChainLength;
+        }
+
+        void ResetSentFrames()
+        {
+            for(int i = 0; i < SwapChainLength; ++i)
+            {
+                m_sentFrames[i] = null;
+                m_dirtyFramesSent[i] = 0;
+            }
+        }
+
         void SendFrame(MemoryStream commands)
         {
             if(Connected)
             {
+                // only once the caps are in, and before anything else goes out this frame
+                var device = m_connection.Device;
+                if(SlidingWindow && !m_slidingWindowTried && device != null && (device.SupportedFeatures & SupportedFeatures.CreditAcks) != 0)
+                {
+                    m_slidingWindowTried = true;
+                    m_connection.EnableSlidingWindow();
+                }
+
                 Tuple<MemoryStream, bool> additionalCommands;
                 while(m_pendingCommands.TryDequeue(out additionalCommands))
                 {